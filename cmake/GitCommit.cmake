@@ -0,0 +1,14 @@
+# Run at build time by the jar_git_commit target, so the stamp follows the
+# checkout instead of the last configure. configure_file only touches the
+# header when the commit changed, so nothing rebuilds needlessly.
+execute_process(
+  COMMAND git rev-parse --short HEAD
+  WORKING_DIRECTORY ${SOURCE_DIR}
+  OUTPUT_VARIABLE JAR_GIT_COMMIT
+  OUTPUT_STRIP_TRAILING_WHITESPACE
+  ERROR_QUIET
+)
+if(NOT JAR_GIT_COMMIT)
+  set(JAR_GIT_COMMIT "unknown")
+endif()
+configure_file(${SOURCE_DIR}/cmake/GitCommit.hpp.in ${OUTPUT} @ONLY)
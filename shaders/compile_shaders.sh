@@ -1,4 +1,20 @@
 #!/bin/bash
+# Offline build of the SPIR-V the app starts with, edits to the GLSL are
+# picked up at runtime by jar::ShaderManager
+GLSLANG_VALIDATOR=${GLSLANG_VALIDATOR:-glslangValidator}
 
-~/App/vulkan/1.1.77.0/x86_64/bin/glslangValidator -V shader.frag
-~/App/vulkan/1.1.77.0/x86_64/bin/glslangValidator -V shader.vert
+$GLSLANG_VALIDATOR -V shader.frag
+$GLSLANG_VALIDATOR -V shader.vert
+$GLSLANG_VALIDATOR -V depth.vert -o depth.spv
+$GLSLANG_VALIDATOR -V particle.vert -o particle_vert.spv
+$GLSLANG_VALIDATOR -V particle.frag -o particle_frag.spv
+for pass in init simulate emit finish; do
+  $GLSLANG_VALIDATOR -V particle_$pass.comp -o particle_$pass.spv
+done
+$GLSLANG_VALIDATOR -V light_cull.comp -o light_cull.spv
+$GLSLANG_VALIDATOR -V shadow.vert -o shadow.spv
+
+python3 pack_shaders.py shaders.pack vert.spv frag.spv depth.spv \
+  particle_vert.spv particle_frag.spv \
+  particle_init.spv particle_simulate.spv particle_emit.spv particle_finish.spv \
+  light_cull.spv shadow.spv
@@ -0,0 +1,23 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Depth pre-pass: must produce bit-identical positions to shader.vert,
+// the main pass tests against this depth with EQUAL.
+out gl_PerVertex {
+  invariant vec4 gl_Position;
+};
+
+layout(binding = 0) uniform UniformBufferObject {
+  mat4 view_projection;
+} ubo;
+
+layout(binding = 1) readonly buffer Objects {
+  mat4 worlds[];
+};
+
+layout(location = 0) in vec3 inPosition;
+
+void main() {
+  vec4 world = worlds[gl_InstanceIndex] * vec4(inPosition, 1.0);
+  gl_Position = ubo.view_projection * world;
+}
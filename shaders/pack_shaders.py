@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+# Packs SPIR-V modules into one file for jar::ShaderModuleRegistry, so the
+# app maps a single file at startup instead of opening each module.
+# Usage: pack_shaders.py output.pack module.spv...
+import os
+import struct
+import sys
+
+MAGIC = 0x4b505346
+
+
+def align(offset):
+    return (offset + 3) & ~3
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit("usage: pack_shaders.py output.pack module.spv...")
+    output, modules = sys.argv[1], sys.argv[2:]
+    names = [os.path.basename(path).encode() for path in modules]
+    datas = [open(path, "rb").read() for path in modules]
+
+    offset = 8 + 16 * len(modules)
+    name_offsets = []
+    for name in names:
+        name_offsets.append(offset)
+        offset += len(name)
+    data_offsets = []
+    for data in datas:
+        offset = align(offset)
+        data_offsets.append(offset)
+        offset += len(data)
+
+    with open(output, "wb") as pack:
+        pack.write(struct.pack("<II", MAGIC, len(modules)))
+        for name, name_offset, data, data_offset in zip(names, name_offsets, datas, data_offsets):
+            pack.write(struct.pack("<IIII", name_offset, len(name), data_offset, len(data)))
+        for name in names:
+            pack.write(name)
+        for data, data_offset in zip(datas, data_offsets):
+            pack.write(b"\0" * (data_offset - pack.tell()))
+            pack.write(data)
+
+
+if __name__ == "__main__":
+    main()
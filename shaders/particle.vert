@@ -0,0 +1,66 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// No vertex buffers, everything is pulled from the simulation's storage
+// buffers through the alive list of the set this image's draw was built from
+
+struct DrawRecord {
+  uint vertex_count;
+  uint instance_count;
+  uint first_vertex;
+  uint first_instance;
+  uint set;
+  uint pad[3];
+};
+
+layout(binding = 0) uniform UniformBufferObject {
+  mat4 view_projection;
+  mat4 view;
+  mat4 model;
+} ubo;
+
+// Unused, declared so set 0 matches the scene pipelines'
+layout(binding = 1) readonly buffer Objects {
+  mat4 worlds[];
+};
+
+layout(set = 1, binding = 0) readonly buffer Positions {
+  vec4 positions[];
+};
+
+layout(set = 1, binding = 2) readonly buffer Alive {
+  uint alive[];
+};
+
+layout(set = 1, binding = 5) readonly buffer Draws {
+  DrawRecord draws[];
+};
+
+layout(push_constant) uniform Push {
+  uint draw_slot;
+  uint capacity;
+  float size;
+} push;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragCorner;
+
+const vec2 corners[6] = vec2[](
+  vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+  vec2(1.0, 1.0), vec2(-1.0, 1.0), vec2(-1.0, -1.0)
+);
+
+void main() {
+  uint set = draws[push.draw_slot].set;
+  uint index = alive[set * push.capacity + gl_InstanceIndex];
+  vec4 particle = positions[set * push.capacity + index];
+
+  vec2 corner = corners[gl_VertexIndex];
+  gl_Position = ubo.view_projection * (ubo.model * vec4(particle.xyz, 1.0));
+  // Offset in clip space, so the quad always faces the camera
+  gl_Position.xy += corner * push.size * gl_Position.w;
+  // Hot when young, fading out towards the end of the lifetime
+  float age = particle.w;
+  fragColor = mix(vec3(1.0, 0.8, 0.3), vec3(0.6, 0.1, 0.05), age) * (1.0 - age);
+  fragCorner = corner;
+}
@@ -1,10 +1,127 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// Clustered forward shading, see jar::ClusteredLighting. Only the lights
+// light_cull.comp listed for this fragment's cluster are looked at. The sun
+// and the first few lights are shadowed, see jar::ShadowMaps.
+
+struct Light {
+  // View space
+  vec4 position_radius;
+  vec4 color_intensity;
+};
+
+layout(set = 1, binding = 0) readonly buffer Lights {
+  mat4 inverse_projection;
+  // Clusters in x, y and z, then the light count
+  uvec4 grid;
+  // Framebuffer size, near and far plane
+  vec4 screen;
+  vec4 ambient;
+  // Lights per cluster
+  uvec4 limits;
+  Light lights[];
+};
+
+layout(set = 1, binding = 1) readonly buffer ClusterCounts {
+  uint cluster_counts[];
+};
+
+layout(set = 1, binding = 2) readonly buffer ClusterLights {
+  uint cluster_lights[];
+};
+
+layout(set = 2, binding = 0) uniform Shadows {
+  mat4 view_to_world;
+  // World space to the cascade's uv and depth
+  mat4 cascades[4];
+  // View depth each cascade ends at
+  vec4 cascade_splits;
+  // Towards the sun, then its intensity
+  vec4 sun_direction;
+  vec4 sun_color;
+  // Cascades, shadowed local lights
+  uvec4 counts;
+  // World position, then the far plane
+  vec4 local_lights[8];
+  // World space to the atlas uv and depth, six faces per light
+  mat4 local_faces[48];
+} shadows;
+
+layout(set = 2, binding = 1) uniform sampler2DArrayShadow cascade_map;
+layout(set = 2, binding = 2) uniform sampler2DShadow shadow_atlas;
+
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 fragViewPosition;
 
 layout(location = 0) out vec4 outColor;
 
+float sun_shadow(vec3 world_position, float depth) {
+  for(uint i = 0; i < shadows.counts.x; i++) {
+    if(depth < shadows.cascade_splits[i]) {
+      vec4 position = shadows.cascades[i] * vec4(world_position, 1.0);
+      return texture(cascade_map, vec4(position.xy, float(i), position.z));
+    }
+  }
+  // Past the last cascade
+  return 1.0;
+}
+
+// The cube face is picked by the largest component of the direction, the
+// same split the faces were rendered with
+float local_shadow(uint light, vec3 world_position) {
+  vec3 direction = world_position - shadows.local_lights[light].xyz;
+  vec3 size = abs(direction);
+  uint face;
+  if(size.x >= size.y && size.x >= size.z) {
+    face = direction.x > 0.0 ? 0u : 1u;
+  } else if(size.y >= size.z) {
+    face = direction.y > 0.0 ? 2u : 3u;
+  } else {
+    face = direction.z > 0.0 ? 4u : 5u;
+  }
+  vec4 position = shadows.local_faces[light * 6u + face] * vec4(world_position, 1.0);
+  return texture(shadow_atlas, position.xyz / position.w);
+}
+
 void main() {
-  outColor = vec4(fragColor, 1.0);
+  // The mesh has no normals, the triangle's own facing the camera will do
+  vec3 normal = normalize(cross(dFdx(fragViewPosition), dFdy(fragViewPosition)));
+  if(dot(normal, fragViewPosition) > 0.0) {
+    normal = -normal;
+  }
+
+  float near = screen.z;
+  float far = screen.w;
+  uvec2 tile = min(uvec2(gl_FragCoord.xy * vec2(grid.xy) / screen.xy), grid.xy - 1);
+  float depth = -fragViewPosition.z;
+  uint slice = uint(clamp(log(depth / near) / log(far / near) * float(grid.z), 0.0, float(grid.z - 1)));
+  uint cluster = tile.x + grid.x * (tile.y + grid.y * slice);
+
+  // Nudged off the surface along the normal, against acne at grazing angles
+  vec3 world_normal = mat3(shadows.view_to_world) * normal;
+  vec3 world_position = (shadows.view_to_world * vec4(fragViewPosition, 1.0)).xyz + world_normal * 0.01;
+
+  vec3 lighting = ambient.rgb;
+  float sun = max(dot(world_normal, shadows.sun_direction.xyz), 0.0);
+  if(sun > 0.0) {
+    lighting += shadows.sun_color.rgb * shadows.sun_direction.w * sun * sun_shadow(world_position, depth);
+  }
+  uint count = cluster_counts[cluster];
+  uint first = cluster * limits.x;
+  for(uint i = 0; i < count; i++) {
+    uint index = cluster_lights[first + i];
+    Light light = lights[index];
+    vec3 to_light = light.position_radius.xyz - fragViewPosition;
+    float distance = length(to_light);
+    // Smoothly down to nothing at the radius, so the cluster bounds cut nothing off
+    float falloff = clamp(1.0 - pow(distance / light.position_radius.w, 4.0), 0.0, 1.0);
+    falloff = falloff * falloff / (distance * distance + 1.0);
+    float diffuse = max(dot(normal, to_light / max(distance, 1e-4)), 0.0);
+    if(diffuse * falloff > 0.0 && index < shadows.counts.y) {
+      falloff *= local_shadow(index, world_position);
+    }
+    lighting += light.color_intensity.rgb * light.color_intensity.w * diffuse * falloff;
+  }
+  outColor = vec4(fragColor * lighting, 1.0);
 }
@@ -2,19 +2,29 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 out gl_PerVertex {
-  vec4 gl_Position;
+  invariant vec4 gl_Position;
 };
 
 layout(binding = 0) uniform UniformBufferObject {
-  mat4 mvp;
+  mat4 view_projection;
+  mat4 view;
 } ubo;
 
+// World matrices of the visible objects, the draw's first instance picks one
+layout(binding = 1) readonly buffer Objects {
+  mat4 worlds[];
+};
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 
 layout(location = 0) out vec3 fragColor;
+// Lighting is done in view space
+layout(location = 1) out vec3 fragViewPosition;
 
 void main() {
-  gl_Position = ubo.mvp * vec4(inPosition, 1.0);
+  vec4 world = worlds[gl_InstanceIndex] * vec4(inPosition, 1.0);
+  gl_Position = ubo.view_projection * world;
   fragColor = inColor;
+  fragViewPosition = (ubo.view * world).xyz;
 }
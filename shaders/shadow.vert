@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Shadow casters, see jar::ShadowMaps. Positions only, the matrix takes
+// them to the light's clip space.
+out gl_PerVertex {
+  vec4 gl_Position;
+};
+
+layout(push_constant) uniform Caster {
+  mat4 mvp;
+} caster;
+
+layout(location = 0) in vec3 inPosition;
+
+void main() {
+  gl_Position = caster.mvp * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,48 @@
+#include "Arguments.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+  [[noreturn]] void invalid(const std::string& option, const std::string& value, const std::string& expected) {
+    throw std::runtime_error("invalid value '" + value + "' for " + option + ", expected " + expected);
+  }
+}
+
+namespace jar::args {
+  uint32_t parse_uint(const std::string& option, const std::string& value, uint32_t min, uint32_t max) {
+    std::string expected = "a whole number from " + std::to_string(min) + " to " + std::to_string(max);
+    // stoull would take a sign or trailing garbage
+    if(value.empty() || value.size() > 10 || !std::all_of(value.begin(), value.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+      invalid(option, value, expected);
+    }
+    uint64_t number = std::stoull(value);
+    if(number < min || number > max) {
+      invalid(option, value, expected);
+    }
+    return static_cast<uint32_t>(number);
+  }
+
+  uint64_t parse_uint64(const std::string& option, const std::string& value) {
+    if(value.empty() || value.size() > 19 || !std::all_of(value.begin(), value.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+      invalid(option, value, "a whole number");
+    }
+    return std::stoull(value);
+  }
+
+  double parse_double(const std::string& option, const std::string& value, double min, double max) {
+    std::string expected = "a number from " + std::to_string(min) + " to " + std::to_string(max);
+    size_t end = 0;
+    double number = 0.0;
+    try {
+      number = std::stod(value, &end);
+    } catch(const std::exception&) {
+      invalid(option, value, expected);
+    }
+    if(end != value.size() || !std::isfinite(number) || number < min || number > max) {
+      invalid(option, value, expected);
+    }
+    return number;
+  }
+}
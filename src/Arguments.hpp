@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <string>
+
+// Number parsing for the command line tools. Bad input throws a
+// std::runtime_error that names the option, mains print it and exit
+// instead of letting std::stoul's exceptions terminate them.
+namespace jar::args {
+  uint32_t parse_uint(const std::string& option,
+      const std::string& value,
+      uint32_t min = 0,
+      uint32_t max = std::numeric_limits<uint32_t>::max());
+  uint64_t parse_uint64(const std::string& option, const std::string& value);
+  double parse_double(const std::string& option,
+      const std::string& value,
+      double min = std::numeric_limits<double>::lowest(),
+      double max = std::numeric_limits<double>::max());
+}
@@ -0,0 +1,229 @@
+#include "AsyncCompute.hpp"
+#include "FramePacing.hpp"
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace jar {
+  void AsyncCompute::create(vk::Device device,
+      vk::PhysicalDevice physical_device,
+      const vk::DispatchLoaderDynamic& dispatch,
+      uint32_t family,
+      uint32_t graphics_family,
+      uint32_t slot_count,
+      bool calibrated_timestamps) {
+    this->device = device;
+    this->dispatch = &dispatch;
+    this->family = family;
+    this->graphics_family = graphics_family;
+    device.getQueue(family, 0, &queue);
+    timeline.create(device, dispatch);
+
+    auto families = physical_device.getQueueFamilyProperties();
+    auto valid_mask = [](uint32_t valid_bits) {
+      return valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+    };
+    timestamps_supported = families[family].timestampValidBits > 0;
+    timestamp_mask = valid_mask(families[family].timestampValidBits);
+    graphics_timestamp_mask = valid_mask(families[graphics_family].timestampValidBits);
+    timestamp_period = physical_device.getProperties().limits.timestampPeriod;
+    if(calibrated_timestamps && timestamps_supported) {
+      auto domains = physical_device.getCalibrateableTimeDomainsEXT(dispatch);
+      calibrated = std::find(domains.begin(), domains.end(), vk::TimeDomainEXT::eDevice) != domains.end();
+    }
+
+    vk::CommandPoolCreateInfo pool_info{};
+    pool_info.setQueueFamilyIndex(family);
+    // Each slot's buffer is re-recorded every frame
+    pool_info.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+    if(device.createCommandPool(&pool_info, nullptr, &command_pool) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create compute command pool!");
+    }
+    set_slot_count(slot_count);
+  }
+
+  void AsyncCompute::set_slot_count(uint32_t slot_count) {
+    timeline.wait(timeline.last_value());
+    if(!slots.empty()) {
+      std::vector<vk::CommandBuffer> command_buffers;
+      for(const auto& slot: slots) {
+        command_buffers.push_back(slot.command_buffer);
+      }
+      device.freeCommandBuffers(command_pool, command_buffers.size(), command_buffers.data());
+    }
+    if(timestamp_pool) {
+      device.destroyQueryPool(timestamp_pool);
+      timestamp_pool = nullptr;
+    }
+
+    slots.assign(slot_count, {});
+    std::vector<vk::CommandBuffer> command_buffers(slot_count);
+    vk::CommandBufferAllocateInfo alloc_info{};
+    alloc_info.setCommandPool(command_pool);
+    alloc_info.setLevel(vk::CommandBufferLevel::ePrimary);
+    alloc_info.setCommandBufferCount(slot_count);
+    if(device.allocateCommandBuffers(&alloc_info, command_buffers.data()) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to allocate compute command buffers!");
+    }
+    for(uint32_t i = 0; i < slot_count; i++) {
+      slots[i].command_buffer = command_buffers[i];
+    }
+
+    if(timestamps_supported) {
+      // Begin and end of the batch per slot
+      vk::QueryPoolCreateInfo query_info{};
+      query_info.setQueryType(vk::QueryType::eTimestamp);
+      query_info.setQueryCount(slot_count * 2);
+      if(device.createQueryPool(&query_info, nullptr, &timestamp_pool) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to create compute timestamp query pool!");
+      }
+    }
+  }
+
+  void AsyncCompute::destroy() {
+    timeline.wait(timeline.last_value());
+    if(timestamp_pool) {
+      device.destroyQueryPool(timestamp_pool);
+      timestamp_pool = nullptr;
+    }
+    // Frees the command buffers with it
+    device.destroyCommandPool(command_pool);
+    slots.clear();
+    timeline.destroy();
+  }
+
+  void AsyncCompute::add_job(const std::string& name,
+      std::function<void(vk::CommandBuffer, uint32_t)> record,
+      vk::PipelineStageFlags consumer_stages) {
+    jobs.push_back({name, std::move(record), consumer_stages});
+  }
+
+  bool AsyncCompute::has_jobs() const {
+    return !jobs.empty();
+  }
+
+  vk::PipelineStageFlags AsyncCompute::get_consumer_stages() const {
+    vk::PipelineStageFlags stages;
+    for(const auto& job: jobs) {
+      stages |= job.consumer_stages;
+    }
+    return stages;
+  }
+
+  uint64_t AsyncCompute::submit(uint32_t slot_index, vk::Semaphore graphics_timeline, uint64_t graphics_wait_value) {
+    if(jobs.empty()) {
+      return 0;
+    }
+    Slot& slot = slots[slot_index];
+    // Normally long done, the graphics frame that waited on it used the same slot
+    timeline.wait(slot.value);
+
+    vk::CommandBuffer cmd = slot.command_buffer;
+    cmd.reset({});
+    vk::CommandBufferBeginInfo begin_info{};
+    begin_info.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    if(cmd.begin(&begin_info) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to begin recording compute command buffer!");
+    }
+    if(timestamps_supported) {
+      cmd.resetQueryPool(timestamp_pool, slot_index * 2, 2);
+      cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestamp_pool, slot_index * 2);
+    }
+    for(const auto& job: jobs) {
+      job.record(cmd, slot_index);
+    }
+    if(timestamps_supported) {
+      cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamp_pool, slot_index * 2 + 1);
+    }
+    cmd.end();
+
+    uint64_t value = timeline.next_value();
+    vk::Semaphore signal_semaphore = timeline.get_semaphore();
+    vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eComputeShader;
+    vk::TimelineSemaphoreSubmitInfoKHR timeline_info{};
+    timeline_info.setSignalSemaphoreValueCount(1);
+    timeline_info.setPSignalSemaphoreValues(&value);
+
+    vk::SubmitInfo submit_info{};
+    submit_info.setPNext(&timeline_info);
+    if(graphics_wait_value != 0) {
+      timeline_info.setWaitSemaphoreValueCount(1);
+      timeline_info.setPWaitSemaphoreValues(&graphics_wait_value);
+      submit_info.setWaitSemaphoreCount(1);
+      submit_info.setPWaitSemaphores(&graphics_timeline);
+      submit_info.setPWaitDstStageMask(&wait_stage);
+    }
+    submit_info.setCommandBufferCount(1);
+    submit_info.setPCommandBuffers(&cmd);
+    submit_info.setSignalSemaphoreCount(1);
+    submit_info.setPSignalSemaphores(&signal_semaphore);
+    if(queue.submit(1, &submit_info, nullptr) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to submit compute command buffer!");
+    }
+    slot.value = value;
+    slot.has_timestamps = timestamps_supported;
+    return value;
+  }
+
+  void AsyncCompute::record_overlap(uint32_t slot_index, uint64_t graphics_begin, uint64_t graphics_end) {
+    Slot& slot = slots[slot_index];
+    if(!slot.has_timestamps) {
+      return;
+    }
+    slot.has_timestamps = false;
+    std::array<uint64_t, 2> results{};
+    const auto& result = device.getQueryPoolResults(timestamp_pool, slot_index * 2, 2,
+        sizeof(results), results.data(), sizeof(uint64_t),
+        vk::QueryResultFlagBits::e64);
+    if(result != vk::Result::eSuccess) {
+      return;
+    }
+    // Each queue's own duration, the masked difference survives a wrap
+    double to_ms = timestamp_period / 1e6;
+    uint64_t compute_time = (results[1] - results[0]) & timestamp_mask;
+    uint64_t graphics_time = (graphics_end - graphics_begin) & graphics_timestamp_mask;
+    stats.compute_ms = LatencyStats::smooth(stats.compute_ms, compute_time * to_ms);
+    stats.graphics_ms = LatencyStats::smooth(stats.graphics_ms, graphics_time * to_ms);
+    if(!calibrated) {
+      return;
+    }
+
+    // The extension puts both queues' timestamps in the device domain,
+    // sampling it turns each one into an age on that one clock
+    vk::CalibratedTimestampInfoEXT timestamp_info{vk::TimeDomainEXT::eDevice};
+    uint64_t now = 0;
+    uint64_t deviation = 0;
+    if(device.getCalibratedTimestampsEXT(1, &timestamp_info, &now, &deviation, *dispatch) != vk::Result::eSuccess) {
+      return;
+    }
+    uint64_t compute_begin_age = (now - results[0]) & timestamp_mask;
+    uint64_t compute_end_age = (now - results[1]) & timestamp_mask;
+    uint64_t graphics_begin_age = (now - graphics_begin) & graphics_timestamp_mask;
+    uint64_t graphics_end_age = (now - graphics_end) & graphics_timestamp_mask;
+    // Older is further back, so the later begin is the smaller age
+    uint64_t overlap_begin_age = std::min(compute_begin_age, graphics_begin_age);
+    uint64_t overlap_end_age = std::max(compute_end_age, graphics_end_age);
+    uint64_t overlap = overlap_begin_age > overlap_end_age ? overlap_begin_age - overlap_end_age : 0;
+    stats.overlap_ms = LatencyStats::smooth(stats.overlap_ms, overlap * to_ms);
+    stats.has_overlap = true;
+  }
+
+  const OverlapStats& AsyncCompute::get_overlap_stats() const {
+    return stats;
+  }
+
+  const Timeline& AsyncCompute::get_timeline() const {
+    return timeline;
+  }
+
+  bool AsyncCompute::is_async() const {
+    return family != graphics_family;
+  }
+
+  std::vector<uint32_t> AsyncCompute::get_sharing_families() const {
+    if(family == graphics_family) {
+      return {family};
+    }
+    return {graphics_family, family};
+  }
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Timeline.hpp"
+
+namespace jar {
+  // Smoothed GPU time of the compute batch and the graphics frame, and how
+  // much of the compute time ran while graphics was busy. The overlap needs
+  // VK_EXT_calibrated_timestamps, without it has_overlap stays false.
+  struct OverlapStats {
+    double compute_ms = 0.0;
+    double graphics_ms = 0.0;
+    double overlap_ms = 0.0;
+    bool has_overlap = false;
+
+    double overlap_ratio() const {
+      return has_overlap && compute_ms > 0.0 ? overlap_ms / compute_ms : 0.0;
+    }
+  };
+
+  /*
+   * Compute work submitted on its own queue, ideally a dedicated compute
+   * family so it runs while the graphics queue rasterizes. Jobs are
+   * registered once and recorded in order into one command buffer per frame
+   * in flight. The batch signals its own timeline, the graphics submission
+   * waits on that value at the stages that consume the results.
+   *
+   * Buffers shared with the graphics queue should be created with
+   * get_sharing_families() and eConcurrent sharing when the families
+   * differ, there are no queue family ownership transfers.
+   */
+  class AsyncCompute {
+    struct Job {
+      std::string name;
+      std::function<void(vk::CommandBuffer, uint32_t)> record;
+      vk::PipelineStageFlags consumer_stages;
+    };
+
+    struct Slot {
+      vk::CommandBuffer command_buffer;
+      uint64_t value = 0;
+      bool has_timestamps = false;
+    };
+
+    vk::Device device;
+    const vk::DispatchLoaderDynamic* dispatch = nullptr;
+    vk::Queue queue;
+    uint32_t family = 0;
+    uint32_t graphics_family = 0;
+    vk::CommandPool command_pool;
+    vk::QueryPool timestamp_pool;
+    bool timestamps_supported = false;
+    uint64_t timestamp_mask = 0;
+    uint64_t graphics_timestamp_mask = 0;
+    float timestamp_period = 1.0f;
+    // The device time domain can be sampled, which puts both queues'
+    // timestamps on one clock
+    bool calibrated = false;
+    Timeline timeline;
+    std::vector<Job> jobs;
+    std::vector<Slot> slots;
+    OverlapStats stats{};
+
+    public:
+    void create(vk::Device device,
+        vk::PhysicalDevice physical_device,
+        const vk::DispatchLoaderDynamic& dispatch,
+        uint32_t family,
+        uint32_t graphics_family,
+        uint32_t slot_count,
+        bool calibrated_timestamps);
+    void destroy();
+    // Only while nothing is in flight
+    void set_slot_count(uint32_t slot_count);
+
+    // consumer_stages is where the graphics queue first uses the results
+    void add_job(const std::string& name,
+        std::function<void(vk::CommandBuffer, uint32_t slot)> record,
+        vk::PipelineStageFlags consumer_stages);
+    bool has_jobs() const;
+    // Every stage that has to wait for this frame's batch
+    vk::PipelineStageFlags get_consumer_stages() const;
+
+    // Records and submits this frame's jobs. If graphics_wait_value isn't 0
+    // the batch first waits for the graphics timeline to reach it, for work
+    // that reads what an earlier frame rendered. Returns the value the
+    // graphics submission waits on, 0 when there was nothing to do.
+    uint64_t submit(uint32_t slot, vk::Semaphore graphics_timeline = nullptr, uint64_t graphics_wait_value = 0);
+
+    // Call once the slot's batch is known to be done, with the graphics
+    // frame's begin and end timestamps from the graphics queue
+    void record_overlap(uint32_t slot, uint64_t graphics_begin, uint64_t graphics_end);
+    const OverlapStats& get_overlap_stats() const;
+
+    const Timeline& get_timeline() const;
+    bool is_async() const;
+    std::vector<uint32_t> get_sharing_families() const;
+  };
+}
@@ -0,0 +1,610 @@
+#include "Bvh.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <numeric>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define JAR_BVH_SSE
+#endif
+
+namespace {
+  // One lane per node slot
+#ifdef JAR_BVH_SSE
+  struct Float4 {
+    __m128 v;
+    static Float4 load(const float* values) { return {_mm_load_ps(values)}; }
+    static Float4 splat(float value) { return {_mm_set1_ps(value)}; }
+    void store(float* values) const { _mm_storeu_ps(values, v); }
+  };
+  inline Float4 operator+(Float4 a, Float4 b) { return {_mm_add_ps(a.v, b.v)}; }
+  inline Float4 operator-(Float4 a, Float4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+  inline Float4 operator*(Float4 a, Float4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+  inline Float4 min(Float4 a, Float4 b) { return {_mm_min_ps(a.v, b.v)}; }
+  inline Float4 max(Float4 a, Float4 b) { return {_mm_max_ps(a.v, b.v)}; }
+  // Bit per lane where the comparison holds
+  inline uint32_t less(Float4 a, Float4 b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+  inline uint32_t less_equal(Float4 a, Float4 b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+#else
+  struct Float4 {
+    float v[4];
+    static Float4 load(const float* values) { return {{values[0], values[1], values[2], values[3]}}; }
+    static Float4 splat(float value) { return {{value, value, value, value}}; }
+    void store(float* values) const { std::copy(v, v + 4, values); }
+  };
+  template<typename F>
+  inline Float4 lanes(Float4 a, Float4 b, F f) {
+    return {{f(a.v[0], b.v[0]), f(a.v[1], b.v[1]), f(a.v[2], b.v[2]), f(a.v[3], b.v[3])}};
+  }
+  inline Float4 operator+(Float4 a, Float4 b) { return lanes(a, b, [](float x, float y) { return x + y; }); }
+  inline Float4 operator-(Float4 a, Float4 b) { return lanes(a, b, [](float x, float y) { return x - y; }); }
+  inline Float4 operator*(Float4 a, Float4 b) { return lanes(a, b, [](float x, float y) { return x * y; }); }
+  inline Float4 min(Float4 a, Float4 b) { return lanes(a, b, [](float x, float y) { return x < y ? x : y; }); }
+  inline Float4 max(Float4 a, Float4 b) { return lanes(a, b, [](float x, float y) { return x > y ? x : y; }); }
+  inline uint32_t less(Float4 a, Float4 b) {
+    uint32_t mask = 0;
+    for(uint32_t i = 0; i < 4; i++) {
+      mask |= (a.v[i] < b.v[i]) << i;
+    }
+    return mask;
+  }
+  inline uint32_t less_equal(Float4 a, Float4 b) {
+    uint32_t mask = 0;
+    for(uint32_t i = 0; i < 4; i++) {
+      mask |= (a.v[i] <= b.v[i]) << i;
+    }
+    return mask;
+  }
+#endif
+
+  constexpr uint32_t bin_count = 16;
+  // Relative to testing one object's bounds
+  constexpr float traversal_cost = 1.0f;
+
+  bool outside(const jar::Frustum& frustum, const jar::Aabb& box) {
+    for(const auto& plane: frustum.planes) {
+      // Corner furthest along the normal
+      glm::vec3 corner(plane.x >= 0.0f ? box.max.x : box.min.x,
+        plane.y >= 0.0f ? box.max.y : box.min.y,
+        plane.z >= 0.0f ? box.max.z : box.min.z);
+      if(glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::optional<float> intersect(const glm::vec3& origin, const glm::vec3& inverse_direction, const jar::Aabb& box, float max_distance) {
+    glm::vec3 t1 = (box.min - origin) * inverse_direction;
+    glm::vec3 t2 = (box.max - origin) * inverse_direction;
+    glm::vec3 closest = glm::min(t1, t2);
+    glm::vec3 furthest = glm::max(t1, t2);
+    float enter = std::max(std::max(closest.x, closest.y), std::max(closest.z, 0.0f));
+    float exit = std::min(std::min(furthest.x, furthest.y), std::min(furthest.z, max_distance));
+    if(enter > exit) {
+      return std::nullopt;
+    }
+    return enter;
+  }
+
+  uint32_t bin_of(float center, float min, float scale) {
+    return std::min(static_cast<uint32_t>((center - min) * scale), bin_count - 1);
+  }
+}
+
+namespace jar {
+  void Aabb::expand(const glm::vec3& point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+
+  void Aabb::expand(const Aabb& other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+  }
+
+  glm::vec3 Aabb::center() const {
+    return (min + max) * 0.5f;
+  }
+
+  float Aabb::surface_area() const {
+    glm::vec3 size = max - min;
+    if(size.x < 0.0f || size.y < 0.0f || size.z < 0.0f) {
+      return 0.0f;
+    }
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+  }
+
+  Aabb Aabb::transformed(const glm::mat4& transform) const {
+    if(min.x > max.x) {
+      return *this;
+    }
+    // Center moves with the transform, the extent is spread over the absolute axes
+    glm::vec3 center = glm::vec3(transform * glm::vec4(this->center(), 1.0f));
+    glm::vec3 extent = (max - min) * 0.5f;
+    glm::vec3 new_extent(0.0f);
+    for(int axis = 0; axis < 3; axis++) {
+      new_extent += glm::abs(glm::vec3(transform[axis])) * extent[axis];
+    }
+    return {center - new_extent, center + new_extent};
+  }
+
+  Frustum Frustum::from_matrix(const glm::mat4& view_projection) {
+    auto row = [&](int i) {
+      return glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+    };
+    Frustum frustum;
+    frustum.planes[0] = row(3) + row(0);
+    frustum.planes[1] = row(3) - row(0);
+    frustum.planes[2] = row(3) + row(1);
+    frustum.planes[3] = row(3) - row(1);
+    frustum.planes[4] = row(2);
+    frustum.planes[5] = row(3) - row(2);
+    for(auto& plane: frustum.planes) {
+      plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+  }
+
+  void Bvh::build(const std::vector<Aabb>& bounds) {
+    nodes.clear();
+    dirty_nodes.clear();
+    object_nodes.assign(bounds.size(), 0);
+    object_positions.resize(bounds.size());
+    objects.resize(bounds.size());
+    object_bounds.resize(bounds.size());
+    if(bounds.empty()) {
+      node_dirty.clear();
+      return;
+    }
+
+    // Partitioned in place while building, so every pass reads in order
+    std::vector<BuildReference> references(bounds.size());
+    for(uint32_t i = 0; i < bounds.size(); i++) {
+      references[i] = {bounds[i], bounds[i].center(), i};
+    }
+    std::vector<BuildNode> build_nodes;
+    build_nodes.reserve(2 * bounds.size());
+    build_binary(build_nodes, references);
+    for(uint32_t i = 0; i < references.size(); i++) {
+      objects[i] = references[i].object;
+      object_bounds[i] = references[i].bounds;
+      object_positions[references[i].object] = i;
+    }
+    collapse(build_nodes);
+    node_dirty.assign(nodes.size(), 0);
+  }
+
+  // Top down with an explicit stack, a badly split input can't overflow it
+  void Bvh::build_binary(std::vector<BuildNode>& build_nodes, std::vector<BuildReference>& references) {
+    struct Task {
+      uint32_t index;
+      uint32_t first;
+      uint32_t count;
+    };
+    std::vector<Task> stack;
+    build_nodes.push_back({});
+    stack.push_back({0, 0, static_cast<uint32_t>(references.size())});
+
+    while(!stack.empty()) {
+      Task task = stack.back();
+      stack.pop_back();
+      Aabb bounds, center_bounds;
+      for(uint32_t i = task.first; i < task.first + task.count; i++) {
+        bounds.expand(references[i].bounds);
+        center_bounds.expand(references[i].center);
+      }
+      build_nodes[task.index] = {bounds, empty_slot, empty_slot, task.first, task.count};
+      if(task.count <= 1) {
+        continue;
+      }
+
+      // Binned SAH over all three axes, cost is area times object count per side
+      float best_cost = std::numeric_limits<float>::max();
+      int best_axis = -1;
+      uint32_t best_split = 0;
+      glm::vec3 extent = center_bounds.max - center_bounds.min;
+      for(int axis = 0; axis < 3; axis++) {
+        if(extent[axis] <= 0.0f) {
+          continue;
+        }
+        float scale = bin_count / extent[axis];
+        Aabb bins[bin_count];
+        uint32_t counts[bin_count] = {};
+        for(uint32_t i = task.first; i < task.first + task.count; i++) {
+          uint32_t bin = bin_of(references[i].center[axis], center_bounds.min[axis], scale);
+          bins[bin].expand(references[i].bounds);
+          counts[bin]++;
+        }
+        float right_costs[bin_count];
+        Aabb right;
+        uint32_t right_count = 0;
+        for(uint32_t bin = bin_count - 1; bin > 0; bin--) {
+          right.expand(bins[bin]);
+          right_count += counts[bin];
+          right_costs[bin] = right_count == 0 ? -1.0f : right.surface_area() * right_count;
+        }
+        Aabb left;
+        uint32_t left_count = 0;
+        for(uint32_t bin = 0; bin + 1 < bin_count; bin++) {
+          left.expand(bins[bin]);
+          left_count += counts[bin];
+          if(left_count == 0 || right_costs[bin + 1] < 0.0f) {
+            continue;
+          }
+          float cost = left.surface_area() * left_count + right_costs[bin + 1];
+          if(cost < best_cost) {
+            best_cost = cost;
+            best_axis = axis;
+            best_split = bin;
+          }
+        }
+      }
+
+      float area = bounds.surface_area();
+      if(task.count <= max_leaf_size && (best_axis < 0 || traversal_cost * area + best_cost >= area * task.count)) {
+        continue;
+      }
+      uint32_t left_count = task.count / 2;
+      if(best_axis >= 0) {
+        float min = center_bounds.min[best_axis];
+        float scale = bin_count / extent[best_axis];
+        auto first = references.begin() + task.first;
+        auto middle = std::partition(first, first + task.count, [&](const BuildReference& reference) {
+          return bin_of(reference.center[best_axis], min, scale) <= best_split;
+        });
+        left_count = static_cast<uint32_t>(middle - first);
+      }
+      // Every center in one spot, any split is as good as another
+      if(left_count == 0 || left_count == task.count) {
+        left_count = task.count / 2;
+      }
+
+      uint32_t left_index = static_cast<uint32_t>(build_nodes.size());
+      build_nodes.push_back({});
+      build_nodes.push_back({});
+      build_nodes[task.index].left = left_index;
+      build_nodes[task.index].right = left_index + 1;
+      stack.push_back({left_index, task.first, left_count});
+      stack.push_back({left_index + 1, task.first + left_count, task.count - left_count});
+    }
+  }
+
+  // Pulls the two or three levels below a binary node up into one 4-wide
+  // node, opening the largest child first. Parents always get a smaller
+  // index than their children.
+  void Bvh::collapse(const std::vector<BuildNode>& build_nodes) {
+    struct Task {
+      uint32_t build_index;
+      uint32_t parent;
+      uint32_t slot;
+    };
+    std::vector<Task> stack;
+    stack.push_back({0, empty_slot, 0});
+    nodes.reserve(build_nodes.size() / 3 + 1);
+
+    while(!stack.empty()) {
+      Task task = stack.back();
+      stack.pop_back();
+      uint32_t index = static_cast<uint32_t>(nodes.size());
+      if(task.parent != empty_slot) {
+        nodes[task.parent].child[task.slot] = index;
+      }
+      nodes.emplace_back();
+
+      uint32_t candidates[4] = {task.build_index};
+      uint32_t candidate_count = 1;
+      while(candidate_count < 4) {
+        int widest = -1;
+        float widest_area = -1.0f;
+        for(uint32_t i = 0; i < candidate_count; i++) {
+          const auto& candidate = build_nodes[candidates[i]];
+          if(candidate.left != empty_slot && candidate.bounds.surface_area() > widest_area) {
+            widest = static_cast<int>(i);
+            widest_area = candidate.bounds.surface_area();
+          }
+        }
+        if(widest < 0) {
+          break;
+        }
+        const auto& opened = build_nodes[candidates[widest]];
+        candidates[widest] = opened.left;
+        candidates[candidate_count++] = opened.right;
+      }
+
+      Node node = {};
+      node.parent = task.parent;
+      node.subtree_first = build_nodes[task.build_index].first;
+      node.subtree_count = build_nodes[task.build_index].count;
+      for(uint32_t slot = 0; slot < 4; slot++) {
+        if(slot >= candidate_count) {
+          node.child[slot] = empty_slot;
+          set_slot(node, slot, Aabb());
+          continue;
+        }
+        const auto& build = build_nodes[candidates[slot]];
+        node.slot_mask |= 1u << slot;
+        set_slot(node, slot, build.bounds);
+        if(build.left == empty_slot) {
+          node.child[slot] = build.first;
+          node.count[slot] = build.count;
+          for(uint32_t i = build.first; i < build.first + build.count; i++) {
+            object_nodes[objects[i]] = index;
+          }
+        } else {
+          stack.push_back({candidates[slot], index, slot});
+        }
+      }
+      // Children haven't been created yet, they fill in child[] when they are
+      nodes[index] = node;
+    }
+  }
+
+  void Bvh::set_slot(Node& node, uint32_t slot, const Aabb& bounds) const {
+    node.min_x[slot] = bounds.min.x;
+    node.min_y[slot] = bounds.min.y;
+    node.min_z[slot] = bounds.min.z;
+    node.max_x[slot] = bounds.max.x;
+    node.max_y[slot] = bounds.max.y;
+    node.max_z[slot] = bounds.max.z;
+  }
+
+  Aabb Bvh::slot_bounds(const Node& node, uint32_t slot) const {
+    return {{node.min_x[slot], node.min_y[slot], node.min_z[slot]}, {node.max_x[slot], node.max_y[slot], node.max_z[slot]}};
+  }
+
+  Aabb Bvh::node_bounds(const Node& node) const {
+    Aabb bounds;
+    for(uint32_t slot = 0; slot < 4; slot++) {
+      if(node.slot_mask & (1u << slot)) {
+        bounds.expand(slot_bounds(node, slot));
+      }
+    }
+    return bounds;
+  }
+
+  void Bvh::update(uint32_t object, const Aabb& bounds) {
+    object_bounds[object_positions[object]] = bounds;
+    uint32_t node = object_nodes[object];
+    if(!nodes.empty() && !node_dirty[node]) {
+      node_dirty[node] = 1;
+      dirty_nodes.push_back(node);
+    }
+  }
+
+  void Bvh::refit() {
+    if(dirty_nodes.empty()) {
+      return;
+    }
+    // Walk up until reaching a node some other object already marked
+    size_t leaf_count = dirty_nodes.size();
+    for(size_t i = 0; i < leaf_count; i++) {
+      uint32_t parent = nodes[dirty_nodes[i]].parent;
+      while(parent != empty_slot && !node_dirty[parent]) {
+        node_dirty[parent] = 1;
+        dirty_nodes.push_back(parent);
+        parent = nodes[parent].parent;
+      }
+    }
+
+    // Inner slots already hold their children's bounds, each refitted node
+    // writes its own into its parent. One random access per node instead of
+    // one per slot.
+    auto refit_node = [&](uint32_t index) {
+      Node& node = nodes[index];
+      for(uint32_t slot = 0; slot < 4; slot++) {
+        if(!(node.slot_mask & (1u << slot)) || node.count[slot] == 0) {
+          continue;
+        }
+        Aabb bounds;
+        for(uint32_t i = node.child[slot]; i < node.child[slot] + node.count[slot]; i++) {
+          bounds.expand(object_bounds[i]);
+        }
+        set_slot(node, slot, bounds);
+      }
+      node_dirty[index] = 0;
+      if(node.parent == empty_slot) {
+        return;
+      }
+      Node& parent = nodes[node.parent];
+      for(uint32_t slot = 0; slot < 4; slot++) {
+        if(parent.count[slot] == 0 && parent.child[slot] == index) {
+          set_slot(parent, slot, node_bounds(node));
+          break;
+        }
+      }
+    };
+    // Children come after their parents, so going backwards is bottom up.
+    // Past a point a scan over the flags is cheaper than sorting.
+    if(dirty_nodes.size() > nodes.size() / 8) {
+      for(size_t index = nodes.size(); index-- > 0;) {
+        if(node_dirty[index]) {
+          refit_node(static_cast<uint32_t>(index));
+        }
+      }
+    } else {
+      std::sort(dirty_nodes.begin(), dirty_nodes.end(), std::greater<uint32_t>());
+      for(uint32_t index: dirty_nodes) {
+        refit_node(index);
+      }
+    }
+    dirty_nodes.clear();
+  }
+
+  template<typename Allocator>
+  void Bvh::cull(const Frustum& frustum, std::vector<uint32_t, Allocator>& visible) const {
+    if(nodes.empty()) {
+      return;
+    }
+    struct PlaneTest {
+      Float4 x, y, z, w;
+      bool positive_x, positive_y, positive_z;
+    };
+    PlaneTest tests[6];
+    for(int i = 0; i < 6; i++) {
+      const auto& plane = frustum.planes[i];
+      tests[i] = {Float4::splat(plane.x), Float4::splat(plane.y), Float4::splat(plane.z), Float4::splat(plane.w),
+        plane.x >= 0.0f, plane.y >= 0.0f, plane.z >= 0.0f};
+    }
+    Float4 zero = Float4::splat(0.0f);
+
+    std::vector<uint32_t> stack;
+    stack.reserve(64);
+    stack.push_back(0);
+    while(!stack.empty()) {
+      const Node& node = nodes[stack.back()];
+      stack.pop_back();
+      Float4 min_x = Float4::load(node.min_x), min_y = Float4::load(node.min_y), min_z = Float4::load(node.min_z);
+      Float4 max_x = Float4::load(node.max_x), max_y = Float4::load(node.max_y), max_z = Float4::load(node.max_z);
+      // Outside if the furthest corner along a normal is behind its plane,
+      // partly outside if the nearest one is
+      uint32_t outside_mask = 0;
+      uint32_t straddling_mask = 0;
+      for(const auto& test: tests) {
+        Float4 furthest = test.x * (test.positive_x ? max_x : min_x) + test.y * (test.positive_y ? max_y : min_y)
+          + test.z * (test.positive_z ? max_z : min_z) + test.w;
+        Float4 closest = test.x * (test.positive_x ? min_x : max_x) + test.y * (test.positive_y ? min_y : max_y)
+          + test.z * (test.positive_z ? min_z : max_z) + test.w;
+        outside_mask |= less(furthest, zero);
+        straddling_mask |= less(closest, zero);
+      }
+
+      uint32_t hits = node.slot_mask & ~outside_mask;
+      for(uint32_t slot = 0; slot < 4; slot++) {
+        uint32_t bit = 1u << slot;
+        if(!(hits & bit)) {
+          continue;
+        }
+        bool inside = !(straddling_mask & bit);
+        if(node.count[slot] > 0) {
+          auto first = objects.begin() + node.child[slot];
+          if(inside) {
+            visible.insert(visible.end(), first, first + node.count[slot]);
+            continue;
+          }
+          for(uint32_t i = node.child[slot]; i < node.child[slot] + node.count[slot]; i++) {
+            if(!outside(frustum, object_bounds[i])) {
+              visible.push_back(objects[i]);
+            }
+          }
+        } else if(inside) {
+          const Node& child = nodes[node.child[slot]];
+          auto first = objects.begin() + child.subtree_first;
+          visible.insert(visible.end(), first, first + child.subtree_count);
+        } else {
+          stack.push_back(node.child[slot]);
+        }
+      }
+    }
+  }
+
+  template void Bvh::cull(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+  template void Bvh::cull(const Frustum& frustum, ArenaVector<uint32_t>& visible) const;
+
+  std::optional<RayHit> Bvh::raycast(const Ray& ray) const {
+    if(nodes.empty()) {
+      return std::nullopt;
+    }
+    // Keeps 0 * inf out of the slab tests for axis aligned rays
+    glm::vec3 inverse_direction;
+    for(int axis = 0; axis < 3; axis++) {
+      float direction = ray.direction[axis];
+      if(std::abs(direction) < 1e-30f) {
+        direction = std::copysign(1e-30f, direction);
+      }
+      inverse_direction[axis] = 1.0f / direction;
+    }
+    Float4 origin_x = Float4::splat(ray.origin.x), origin_y = Float4::splat(ray.origin.y), origin_z = Float4::splat(ray.origin.z);
+    Float4 inverse_x = Float4::splat(inverse_direction.x), inverse_y = Float4::splat(inverse_direction.y);
+    Float4 inverse_z = Float4::splat(inverse_direction.z);
+    Float4 zero = Float4::splat(0.0f);
+
+    float best = ray.max_distance;
+    uint32_t best_object = empty_slot;
+    struct Entry {
+      uint32_t node;
+      float distance;
+    };
+    std::vector<Entry> stack;
+    stack.reserve(64);
+    stack.push_back({0, 0.0f});
+    while(!stack.empty()) {
+      Entry entry = stack.back();
+      stack.pop_back();
+      if(entry.distance > best) {
+        continue;
+      }
+      const Node& node = nodes[entry.node];
+      Float4 t1_x = (Float4::load(node.min_x) - origin_x) * inverse_x;
+      Float4 t2_x = (Float4::load(node.max_x) - origin_x) * inverse_x;
+      Float4 t1_y = (Float4::load(node.min_y) - origin_y) * inverse_y;
+      Float4 t2_y = (Float4::load(node.max_y) - origin_y) * inverse_y;
+      Float4 t1_z = (Float4::load(node.min_z) - origin_z) * inverse_z;
+      Float4 t2_z = (Float4::load(node.max_z) - origin_z) * inverse_z;
+      Float4 enter = max(max(min(t1_x, t2_x), min(t1_y, t2_y)), max(min(t1_z, t2_z), zero));
+      Float4 exit = min(min(max(t1_x, t2_x), max(t1_y, t2_y)), min(max(t1_z, t2_z), Float4::splat(best)));
+      uint32_t hits = node.slot_mask & less_equal(enter, exit);
+      float distances[4];
+      enter.store(distances);
+
+      Entry children[4];
+      uint32_t child_count = 0;
+      for(uint32_t slot = 0; slot < 4; slot++) {
+        if(!(hits & (1u << slot))) {
+          continue;
+        }
+        if(node.count[slot] == 0) {
+          children[child_count++] = {node.child[slot], distances[slot]};
+          continue;
+        }
+        for(uint32_t i = node.child[slot]; i < node.child[slot] + node.count[slot]; i++) {
+          auto distance = intersect(ray.origin, inverse_direction, object_bounds[i], best);
+          if(distance && (*distance < best || best_object == empty_slot)) {
+            best = *distance;
+            best_object = objects[i];
+          }
+        }
+      }
+      // Furthest pushed first, so the nearest child is visited next
+      for(uint32_t i = 1; i < child_count; i++) {
+        for(uint32_t j = i; j > 0 && children[j - 1].distance < children[j].distance; j--) {
+          std::swap(children[j - 1], children[j]);
+        }
+      }
+      stack.insert(stack.end(), children, children + child_count);
+    }
+    if(best_object == empty_slot) {
+      return std::nullopt;
+    }
+    return RayHit{best_object, best};
+  }
+
+  float Bvh::sah_cost() const {
+    if(nodes.empty()) {
+      return 0.0f;
+    }
+    float root_area = node_bounds(nodes[0]).surface_area();
+    if(root_area <= 0.0f) {
+      return 0.0f;
+    }
+    float cost = 0.0f;
+    for(const auto& node: nodes) {
+      for(uint32_t slot = 0; slot < 4; slot++) {
+        if(node.slot_mask & (1u << slot)) {
+          // Visiting a slot costs one 4-wide test, a leaf adds its objects on top
+          float area = slot_bounds(node, slot).surface_area();
+          cost += area * (node.count[slot] > 0 ? node.count[slot] : traversal_cost);
+        }
+      }
+    }
+    return traversal_cost + cost / root_area;
+  }
+
+  size_t Bvh::node_count() const {
+    return nodes.size();
+  }
+
+  size_t Bvh::object_count() const {
+    return object_bounds.size();
+  }
+}
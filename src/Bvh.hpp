@@ -0,0 +1,129 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+#include "FrameArena.hpp"
+
+namespace jar {
+  struct Aabb {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    void expand(const glm::vec3& point);
+    void expand(const Aabb& other);
+    glm::vec3 center() const;
+    // 0 for an empty box
+    float surface_area() const;
+    // Bounds of the box after the transform, not the tightest fit of what's inside
+    Aabb transformed(const glm::mat4& transform) const;
+  };
+
+  struct Ray {
+    glm::vec3 origin;
+    // Doesn't need to be normalized, distances are in multiples of it
+    glm::vec3 direction;
+    float max_distance = std::numeric_limits<float>::max();
+  };
+
+  struct RayHit {
+    uint32_t object;
+    float distance;
+  };
+
+  // Planes point inwards, xyz normal and w distance
+  struct Frustum {
+    glm::vec4 planes[6];
+
+    // From a projection * view matrix with a 0..1 depth range
+    static Frustum from_matrix(const glm::mat4& view_projection);
+  };
+
+  /*
+   * Bounding volume hierarchy over object bounds, for culling and picking
+   * on the CPU. Built top down with binned SAH into a binary tree, which is
+   * then collapsed into 4-wide nodes. Each node keeps the bounds of its four
+   * children as SoA, so one SIMD test covers all of them (SSE when available,
+   * plain loops otherwise).
+   *
+   * Moving objects are handled with update() and refit(), which only
+   * recomputes the nodes above the moved objects. Refitting never changes
+   * the topology, so the tree gets looser as things move. Rebuild with
+   * build() once sah_cost() has grown too far past its value after the build.
+   */
+  class Bvh {
+    struct alignas(16) Node {
+      float min_x[4];
+      float min_y[4];
+      float min_z[4];
+      float max_x[4];
+      float max_y[4];
+      float max_z[4];
+      // Inner child: node index and count 0. Leaf: first entry in
+      // objects and the object count. Empty slot: empty_slot and 0.
+      uint32_t child[4];
+      uint32_t count[4];
+      uint32_t parent;
+      // Bit per slot in use
+      uint32_t slot_mask;
+      // A subtree's objects are contiguous in objects
+      uint32_t subtree_first;
+      uint32_t subtree_count;
+    };
+
+    struct BuildReference {
+      Aabb bounds;
+      glm::vec3 center;
+      uint32_t object;
+    };
+
+    // Binary tree before collapsing, left is empty_slot for leaves
+    struct BuildNode {
+      Aabb bounds;
+      uint32_t left;
+      uint32_t right;
+      uint32_t first;
+      uint32_t count;
+    };
+
+    std::vector<Node> nodes;
+    // Object ids in leaf order, with their bounds alongside so leaves read
+    // them in sequence
+    std::vector<uint32_t> objects;
+    std::vector<Aabb> object_bounds;
+    // By object id: position in objects and the node holding its leaf
+    std::vector<uint32_t> object_positions;
+    std::vector<uint32_t> object_nodes;
+    std::vector<uint32_t> dirty_nodes;
+    std::vector<uint8_t> node_dirty;
+
+    void build_binary(std::vector<BuildNode>& build_nodes, std::vector<BuildReference>& references);
+    void collapse(const std::vector<BuildNode>& build_nodes);
+    void set_slot(Node& node, uint32_t slot, const Aabb& bounds) const;
+    Aabb slot_bounds(const Node& node, uint32_t slot) const;
+    Aabb node_bounds(const Node& node) const;
+
+    public:
+    static constexpr uint32_t empty_slot = ~0u;
+    static constexpr uint32_t max_leaf_size = 4;
+
+    // Object ids are indices into bounds
+    void build(const std::vector<Aabb>& bounds);
+    void update(uint32_t object, const Aabb& bounds);
+    // Propagates every update() since the last refit up the tree
+    void refit();
+
+    // Appends the objects whose bounds intersect the frustum, into a plain
+    // vector or one from a frame arena
+    template<typename Allocator>
+    void cull(const Frustum& frustum, std::vector<uint32_t, Allocator>& visible) const;
+    // Nearest object whose bounds the ray hits
+    std::optional<RayHit> raycast(const Ray& ray) const;
+
+    // Expected cost of a query relative to the root, for deciding when to rebuild
+    float sah_cost() const;
+    size_t node_count() const;
+    size_t object_count() const;
+  };
+}
@@ -0,0 +1,148 @@
+#include "BvhBenchmark.hpp"
+#include "Bvh.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+
+  double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  // Same test as the tree's leaves, one box at a time
+  bool brute_force_visible(const jar::Frustum& frustum, const jar::Aabb& box) {
+    for(const auto& plane: frustum.planes) {
+      glm::vec3 corner(plane.x >= 0.0f ? box.max.x : box.min.x,
+        plane.y >= 0.0f ? box.max.y : box.min.y,
+        plane.z >= 0.0f ? box.max.z : box.min.z);
+      if(glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  float brute_force_raycast(const jar::Ray& ray, const std::vector<jar::Aabb>& boxes) {
+    float best = ray.max_distance;
+    for(const auto& box: boxes) {
+      float enter = 0.0f;
+      float exit = best;
+      for(int axis = 0; axis < 3; axis++) {
+        float t1 = (box.min[axis] - ray.origin[axis]) / ray.direction[axis];
+        float t2 = (box.max[axis] - ray.origin[axis]) / ray.direction[axis];
+        enter = std::max(enter, std::min(t1, t2));
+        exit = std::min(exit, std::max(t1, t2));
+      }
+      if(enter <= exit) {
+        best = enter;
+      }
+    }
+    return best;
+  }
+}
+
+namespace jar {
+  void run_bvh_benchmark(uint32_t object_count) {
+    constexpr float world_size = 1000.0f;
+    constexpr int cull_runs = 20;
+    constexpr int ray_count = 10000;
+    constexpr int checked_rays = 20;
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-world_size * 0.5f, world_size * 0.5f);
+    std::uniform_real_distribution<float> size(0.5f, 4.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<Aabb> bounds(object_count);
+    for(auto& box: bounds) {
+      glm::vec3 center(position(random), position(random), position(random));
+      glm::vec3 extent(size(random), size(random), size(random));
+      box = {center - extent * 0.5f, center + extent * 0.5f};
+    }
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "BVH benchmark: " << object_count << " objects\n";
+
+    Bvh bvh;
+    auto start = Clock::now();
+    bvh.build(bounds);
+    double build_ms = elapsed_ms(start);
+    float built_cost = bvh.sah_cost();
+    std::cout << "  build: " << build_ms << "ms, " << bvh.node_count() << " nodes, SAH cost " << built_cost << '\n';
+
+    // Camera in the middle of the cube, so the frustum cuts through a lot of objects
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, world_size * 0.5f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.2f, 0.5f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = Frustum::from_matrix(projection * view);
+    std::vector<uint32_t> visible;
+    visible.reserve(object_count);
+    start = Clock::now();
+    for(int run = 0; run < cull_runs; run++) {
+      visible.clear();
+      bvh.cull(frustum, visible);
+    }
+    double cull_ms = elapsed_ms(start) / cull_runs;
+    start = Clock::now();
+    size_t expected_visible = 0;
+    for(const auto& box: bounds) {
+      expected_visible += brute_force_visible(frustum, box);
+    }
+    double brute_cull_ms = elapsed_ms(start);
+    std::cout << "  cull: " << cull_ms << "ms, " << visible.size() << " visible (brute force "
+      << brute_cull_ms << "ms, " << expected_visible << " visible)\n";
+
+    std::vector<Ray> rays(ray_count);
+    for(auto& ray: rays) {
+      ray.origin = glm::vec3(position(random), position(random), position(random)) * 0.5f;
+      ray.direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(1e-3f));
+    }
+    size_t hits = 0;
+    start = Clock::now();
+    for(const auto& ray: rays) {
+      hits += bvh.raycast(ray).has_value();
+    }
+    double ray_us = elapsed_ms(start) * 1000.0 / ray_count;
+    int mismatches = 0;
+    start = Clock::now();
+    for(int i = 0; i < checked_rays; i++) {
+      float expected = brute_force_raycast(rays[i], bounds);
+      auto hit = bvh.raycast(rays[i]);
+      float distance = hit ? hit->distance : rays[i].max_distance;
+      mismatches += std::abs(expected - distance) > 1e-3f * std::max(1.0f, expected);
+    }
+    double brute_ray_us = elapsed_ms(start) * 1000.0 / checked_rays;
+    std::cout << "  raycast: " << ray_us << "us per ray, " << hits << "/" << ray_count << " hit (brute force "
+      << brute_ray_us << "us, " << mismatches << " mismatches in " << checked_rays << ")\n";
+
+    // Move some objects a little, as a frame of a mostly static scene would
+    for(uint32_t fraction: {100u, 10u, 1u}) {
+      uint32_t moved = object_count / fraction;
+      std::vector<uint32_t> moved_objects(moved);
+      for(auto& object: moved_objects) {
+        object = static_cast<uint32_t>(random() % object_count);
+      }
+      start = Clock::now();
+      for(uint32_t object: moved_objects) {
+        glm::vec3 offset(unit(random), unit(random), unit(random));
+        Aabb box = bounds[object];
+        box.min += offset;
+        box.max += offset;
+        bounds[object] = box;
+        bvh.update(object, box);
+      }
+      bvh.refit();
+      std::cout << "  refit " << moved << " moved: " << elapsed_ms(start) << "ms, SAH cost " << bvh.sah_cost() << '\n';
+    }
+
+    visible.clear();
+    bvh.cull(frustum, visible);
+    expected_visible = std::count_if(bounds.begin(), bounds.end(), [&](const Aabb& box) {
+      return brute_force_visible(frustum, box);
+    });
+    std::cout << "  after refits: " << visible.size() << " visible (brute force " << expected_visible << ")\n";
+  }
+}
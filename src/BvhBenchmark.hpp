@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdint>
+
+namespace jar {
+  /*
+   * CPU only, no window or device. Scatters object_count random boxes
+   * through a cube and times the build, frustum culling, ray picking and
+   * refitting after moving a few or all of them. Culling and picking are
+   * checked against a brute force loop over every box.
+   */
+  void run_bvh_benchmark(uint32_t object_count);
+}
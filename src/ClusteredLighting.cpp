@@ -0,0 +1,288 @@
+#include "ClusteredLighting.hpp"
+#include "Memory.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+namespace {
+  glm::vec3 hue_to_rgb(float hue) {
+    glm::vec3 rgb(
+        std::abs(hue * 6.0f - 3.0f) - 1.0f,
+        2.0f - std::abs(hue * 6.0f - 2.0f),
+        2.0f - std::abs(hue * 6.0f - 4.0f));
+    return glm::clamp(rgb, 0.0f, 1.0f);
+  }
+}
+
+namespace jar {
+  void ClusteredLighting::create(vk::Device device,
+      vk::PhysicalDevice physical_device,
+      DeletionQueue& deletion_queue,
+      MemoryBudget& memory_budget,
+      LayoutCache& layouts,
+      const ShaderReflection& fragment_reflection,
+      const std::vector<uint32_t>& sharing_families,
+      const LightSettings& settings) {
+    this->device = device;
+    this->physical_device = physical_device;
+    this->deletion_queue = &deletion_queue;
+    this->memory_budget = &memory_budget;
+    this->layouts = &layouts;
+    this->sharing_families = sharing_families;
+    this->settings = settings;
+    this->settings.capacity = std::max(1u, settings.capacity);
+    this->settings.count = std::min(settings.count, this->settings.capacity);
+    this->settings.max_lights_per_cluster = std::max(1u, settings.max_lights_per_cluster);
+    time = 0.0f;
+
+    // Same lights every run, so frame times compare
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    orbits.resize(this->settings.capacity);
+    for(auto& orbit: orbits) {
+      orbit.distance = 0.2f + 2.6f * std::sqrt(unit(random));
+      orbit.height = 0.05f + 0.4f * unit(random);
+      orbit.phase = 6.2831853f * unit(random);
+      orbit.speed = (unit(random) - 0.5f) * 1.5f;
+      orbit.color = hue_to_rgb(unit(random));
+    }
+
+    // Set 1 of the main pipeline, set 0 is the app's uniform buffer
+    auto render_description = merge_layouts({fragment_reflection});
+    if(render_description.sets.count(1) == 0) {
+      throw std::runtime_error("shader.frag has no light buffers in set 1!");
+    }
+    render_bindings = render_description.sets[1];
+    for(const auto& binding: render_bindings) {
+      if(binding.binding >= 3) {
+        throw std::runtime_error("shader.frag uses an unknown light buffer binding!");
+      }
+    }
+    render_set_layout = layouts.get_set_layout(render_bindings);
+    compute_set_layout = layouts.get_set_layout({
+      {0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+      {1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+      {2, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute}
+    });
+  }
+
+  void ClusteredLighting::set_slot_count(uint32_t count) {
+    current_slot = 0;
+    slots.clear();
+    slots.resize(count);
+    vk::DeviceSize lights_size = sizeof(Header) + vk::DeviceSize(settings.capacity) * sizeof(Light);
+    vk::DeviceSize counts_size = cluster_count * sizeof(uint32_t);
+    vk::DeviceSize indices_size = vk::DeviceSize(cluster_count) * settings.max_lights_per_cluster * sizeof(uint32_t);
+    for(auto& slot: slots) {
+      slot.lights = create_buffer(lights_size, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+      slot.mapped = device.mapMemory(slot.lights.memory, 0, VK_WHOLE_SIZE);
+      std::memset(slot.mapped, 0, sizeof(Header));
+      slot.cluster_counts = create_buffer(counts_size, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      slot.cluster_lights = create_buffer(indices_size, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    }
+    create_descriptor_sets();
+  }
+
+  BufferAllocation ClusteredLighting::create_buffer(vk::DeviceSize size, vk::MemoryPropertyFlags properties) {
+    vk::BufferCreateInfo buffer_info{};
+    buffer_info.setSize(size);
+    buffer_info.setUsage(vk::BufferUsageFlagBits::eStorageBuffer);
+    // Written on the compute queue, read on the graphics queue
+    if(sharing_families.size() > 1) {
+      buffer_info.setSharingMode(vk::SharingMode::eConcurrent);
+      buffer_info.setQueueFamilyIndexCount(static_cast<uint32_t>(sharing_families.size()));
+      buffer_info.setPQueueFamilyIndices(sharing_families.data());
+    } else {
+      buffer_info.setSharingMode(vk::SharingMode::eExclusive);
+    }
+
+    BufferAllocation allocation;
+    allocation.size = size;
+    vk::Buffer buffer;
+    if(device.createBuffer(&buffer_info, nullptr, &buffer) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create light buffer!");
+    }
+    allocation.buffer = UniqueBuffer(*deletion_queue, buffer);
+
+    vk::MemoryRequirements mem_requirements = device.getBufferMemoryRequirements(buffer);
+    uint32_t memory_type = memory::findMemoryType(physical_device, mem_requirements.memoryTypeBits, properties);
+    vk::MemoryAllocateInfo alloc_info{};
+    alloc_info.setAllocationSize(mem_requirements.size);
+    alloc_info.setMemoryTypeIndex(memory_type);
+    vk::DeviceMemory memory;
+    if(device.allocateMemory(&alloc_info, nullptr, &memory) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to allocate light buffer memory!");
+    }
+    allocation.memory = UniqueMemory(*deletion_queue, memory);
+    allocation.charge = MemoryCharge(*memory_budget, *deletion_queue, memory_type, MemoryCategory::lights, mem_requirements.size);
+    device.bindBufferMemory(buffer, memory, 0);
+    return allocation;
+  }
+
+  void ClusteredLighting::create_descriptor_sets() {
+    uint32_t slot_count = static_cast<uint32_t>(slots.size());
+    vk::DescriptorPoolSize pool_size{};
+    pool_size.setType(vk::DescriptorType::eStorageBuffer);
+    pool_size.setDescriptorCount(2 * 3 * slot_count);
+    vk::DescriptorPoolCreateInfo pool_info{};
+    pool_info.setPoolSizeCount(1);
+    pool_info.setPPoolSizes(&pool_size);
+    pool_info.setMaxSets(2 * slot_count);
+    vk::DescriptorPool pool;
+    if(device.createDescriptorPool(&pool_info, nullptr, &pool) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create light descriptor pool!");
+    }
+    // The sets of the old pool go with it
+    descriptor_pool = Unique<vk::DescriptorPool>(*deletion_queue, pool);
+
+    std::vector<vk::DescriptorSetLayout> set_layouts;
+    for(uint32_t i = 0; i < slot_count; i++) {
+      set_layouts.push_back(compute_set_layout);
+      set_layouts.push_back(render_set_layout);
+    }
+    std::vector<vk::DescriptorSet> sets(set_layouts.size());
+    vk::DescriptorSetAllocateInfo alloc_info{};
+    alloc_info.setDescriptorPool(descriptor_pool);
+    alloc_info.setDescriptorSetCount(static_cast<uint32_t>(set_layouts.size()));
+    alloc_info.setPSetLayouts(set_layouts.data());
+    if(device.allocateDescriptorSets(&alloc_info, sets.data()) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to allocate light descriptor sets!");
+    }
+
+    // Binding numbers are the same in both sets. Written in one go, the infos
+    // have to stay put until then.
+    std::vector<vk::DescriptorBufferInfo> buffer_infos;
+    buffer_infos.reserve(3 * slot_count);
+    std::vector<vk::WriteDescriptorSet> writes;
+    for(uint32_t i = 0; i < slot_count; i++) {
+      Slot& slot = slots[i];
+      slot.compute_set = sets[i * 2];
+      slot.render_set = sets[i * 2 + 1];
+      const BufferAllocation* buffers[] = {&slot.lights, &slot.cluster_counts, &slot.cluster_lights};
+      size_t first_info = buffer_infos.size();
+      for(const auto* buffer: buffers) {
+        buffer_infos.push_back({buffer->buffer, 0, VK_WHOLE_SIZE});
+      }
+      for(uint32_t binding = 0; binding < 3; binding++) {
+        vk::WriteDescriptorSet write{};
+        write.setDstSet(slot.compute_set);
+        write.setDstBinding(binding);
+        write.setDescriptorType(vk::DescriptorType::eStorageBuffer);
+        write.setDescriptorCount(1);
+        write.setPBufferInfo(&buffer_infos[first_info + binding]);
+        writes.push_back(write);
+      }
+      for(const auto& binding: render_bindings) {
+        vk::WriteDescriptorSet write{};
+        write.setDstSet(slot.render_set);
+        write.setDstBinding(binding.binding);
+        write.setDescriptorType(vk::DescriptorType::eStorageBuffer);
+        write.setDescriptorCount(1);
+        write.setPBufferInfo(&buffer_infos[first_info + binding.binding]);
+        writes.push_back(write);
+      }
+    }
+    device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+  }
+
+  void ClusteredLighting::create_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders) {
+    build_pipelines(modules, shaders)();
+  }
+
+  std::function<void()> ClusteredLighting::build_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders) {
+    Spirv spirv = shaders.get("light_cull.comp");
+    auto description = merge_layouts({reflect(spirv)});
+    auto set_layouts = layouts->get_set_layouts(description);
+    if(set_layouts.size() != 1 || set_layouts[0] != compute_set_layout) {
+      throw std::runtime_error("light_cull.comp doesn't match the light buffers!");
+    }
+    vk::PipelineLayout layout = layouts->get_pipeline_layout(description);
+
+    vk::ComputePipelineCreateInfo pipeline_info{};
+    pipeline_info.stage.setStage(vk::ShaderStageFlagBits::eCompute);
+    pipeline_info.stage.setModule(modules.get_module(spirv));
+    pipeline_info.stage.setPName("main");
+    pipeline_info.setLayout(layout);
+    vk::Pipeline pipeline;
+    if(device.createComputePipelines(nullptr, 1, &pipeline_info, nullptr, &pipeline) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create light culling pipeline!");
+    }
+    // Batches still in flight keep the old one until the deletion queue gets to it
+    auto built = std::make_shared<UniquePipeline>(*deletion_queue, pipeline);
+    return [this, layout, built]() {
+      cull_layout = layout;
+      cull_pipeline = std::move(*built);
+    };
+  }
+
+  void ClusteredLighting::destroy() {
+    cull_pipeline.reset();
+    descriptor_pool.reset();
+    slots.clear();
+  }
+
+  void ClusteredLighting::set_light_count(uint32_t count) {
+    settings.count = std::min(count, settings.capacity);
+  }
+
+  const LightSettings& ClusteredLighting::get_settings() const {
+    return settings;
+  }
+
+  void ClusteredLighting::set_still_lights(uint32_t count) {
+    still_lights = count;
+  }
+
+  glm::vec3 ClusteredLighting::get_position(uint32_t light) const {
+    return position_of(std::min(light, settings.capacity - 1));
+  }
+
+  glm::vec3 ClusteredLighting::position_of(uint32_t light) const {
+    const Orbit& orbit = orbits[light];
+    float angle = orbit.phase + (light < still_lights ? 0.0f : orbit.speed * time);
+    return glm::vec3(orbit.distance * std::cos(angle), orbit.distance * std::sin(angle), orbit.height);
+  }
+
+  void ClusteredLighting::prepare(float dt,
+      const glm::mat4& view,
+      const glm::mat4& projection,
+      float z_near,
+      float z_far,
+      vk::Extent2D extent,
+      uint32_t slot) {
+    current_slot = slot;
+    time += std::min(dt, 0.1f);
+
+    auto* header = static_cast<Header*>(slots[slot].mapped);
+    header->inverse_projection = glm::inverse(projection);
+    header->grid = glm::uvec4(grid_x, grid_y, grid_z, settings.count);
+    header->screen = glm::vec4(extent.width, extent.height, z_near, z_far);
+    header->ambient = glm::vec4(settings.ambient, 0.0f);
+    header->limits = glm::uvec4(settings.max_lights_per_cluster, 0, 0, 0);
+
+    // Straight into the mapped buffer, the compute batch reads it after this
+    // frame's submit
+    auto* lights = reinterpret_cast<Light*>(header + 1);
+    for(uint32_t i = 0; i < settings.count; i++) {
+      lights[i].position_radius = glm::vec4(glm::vec3(view * glm::vec4(position_of(i), 1.0f)), settings.radius);
+      lights[i].color_intensity = glm::vec4(orbits[i].color, settings.intensity);
+    }
+  }
+
+  void ClusteredLighting::record_culling(vk::CommandBuffer cmd) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, cull_pipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cull_layout, 0, 1, &slots[current_slot].compute_set, 0, nullptr);
+    // One invocation per cluster
+    cmd.dispatch((cluster_count + 63) / 64, 1, 1);
+  }
+
+  vk::DescriptorSet ClusteredLighting::get_render_set(uint32_t slot) const {
+    return slots[slot].render_set;
+  }
+
+  vk::DescriptorSetLayout ClusteredLighting::get_render_set_layout() const {
+    return render_set_layout;
+  }
+}
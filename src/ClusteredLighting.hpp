@@ -0,0 +1,157 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "MemoryBudget.hpp"
+#include "Resource.hpp"
+#include "Reflection.hpp"
+#include "ShaderManager.hpp"
+
+namespace jar {
+  struct LightSettings {
+    // Most lights at once, the buffers are sized for it
+    uint32_t capacity = 4096;
+    uint32_t count = 256;
+    // Lights past this many in one cluster are left out of it
+    uint32_t max_lights_per_cluster = 128;
+    // Distance at which a light's contribution reaches zero
+    float radius = 0.35f;
+    float intensity = 0.8f;
+    glm::vec3 ambient = {0.25f, 0.25f, 0.25f};
+  };
+
+  /*
+   * Clustered forward shading. The view frustum is cut into a grid of
+   * froxels, screen tiles split into slices that get exponentially deeper
+   * with distance. Each frame, on the async compute queue, light_cull.comp
+   * builds every cluster's bounds from the projection and lists the lights
+   * whose sphere touches it. shader.frag then finds its cluster from the
+   * fragment position and depth and only loops over that cluster's lights,
+   * so the shading cost follows the lights around a pixel rather than the
+   * total count.
+   *
+   * Lights orbit the scene, they are moved on the CPU and written in view
+   * space to a host visible buffer. Like the uniform buffers everything is
+   * per swapchain image, the fragment shader reads the set for the image the
+   * prerecorded command buffer draws to.
+   */
+  class ClusteredLighting {
+    // Matches the header of the Lights block in light_cull.comp and shader.frag
+    struct Header {
+      glm::mat4 inverse_projection;
+      // Clusters in x, y and z, then the light count
+      glm::uvec4 grid;
+      // Framebuffer size, near and far plane
+      glm::vec4 screen;
+      glm::vec4 ambient;
+      // Lights per cluster
+      glm::uvec4 limits;
+    };
+
+    struct Light {
+      // View space
+      glm::vec4 position_radius;
+      glm::vec4 color_intensity;
+    };
+
+    // Where a light goes, picked once at creation
+    struct Orbit {
+      float distance;
+      float height;
+      float phase;
+      float speed;
+      glm::vec3 color;
+    };
+
+    struct Slot {
+      BufferAllocation lights;
+      // Stays mapped, freeing the memory unmaps it
+      void* mapped = nullptr;
+      BufferAllocation cluster_counts;
+      BufferAllocation cluster_lights;
+      vk::DescriptorSet compute_set;
+      vk::DescriptorSet render_set;
+    };
+
+    vk::Device device;
+    vk::PhysicalDevice physical_device;
+    DeletionQueue* deletion_queue = nullptr;
+    MemoryBudget* memory_budget = nullptr;
+    LayoutCache* layouts = nullptr;
+    std::vector<uint32_t> sharing_families;
+    LightSettings settings{};
+    std::vector<Orbit> orbits;
+    float time = 0.0f;
+    uint32_t still_lights = 0;
+    uint32_t current_slot = 0;
+
+    // One per swapchain image, see set_slot_count
+    std::vector<Slot> slots;
+    Unique<vk::DescriptorPool> descriptor_pool;
+    vk::DescriptorSetLayout compute_set_layout;
+    vk::DescriptorSetLayout render_set_layout;
+    // Of set 1 in shader.frag
+    std::vector<vk::DescriptorSetLayoutBinding> render_bindings;
+    vk::PipelineLayout cull_layout;
+    UniquePipeline cull_pipeline;
+
+    BufferAllocation create_buffer(vk::DeviceSize size, vk::MemoryPropertyFlags properties);
+    glm::vec3 position_of(uint32_t light) const;
+    void create_descriptor_sets();
+
+    public:
+    static constexpr uint32_t grid_x = 16;
+    static constexpr uint32_t grid_y = 9;
+    static constexpr uint32_t grid_z = 24;
+    static constexpr uint32_t cluster_count = grid_x * grid_y * grid_z;
+
+    // sharing_families are the queues touching the buffers, see AsyncCompute.
+    // fragment_reflection is the shader reading the lights in set 1.
+    void create(vk::Device device,
+        vk::PhysicalDevice physical_device,
+        DeletionQueue& deletion_queue,
+        MemoryBudget& memory_budget,
+        LayoutCache& layouts,
+        const ShaderReflection& fragment_reflection,
+        const std::vector<uint32_t>& sharing_families,
+        const LightSettings& settings);
+    // Again on a shader reload, replaces the culling pipeline
+    void create_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders);
+    // Same from any thread, the returned call swaps them in between frames
+    std::function<void()> build_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders);
+    // Slots are indexed by swapchain image. Again when the image count
+    // changes, with nothing in flight, the old buffers and sets go through
+    // the deletion queue.
+    void set_slot_count(uint32_t count);
+    void destroy();
+
+    // Up to the capacity
+    void set_light_count(uint32_t count);
+    const LightSettings& get_settings() const;
+    // The first count lights stay where they start, shadow maps of lights
+    // that don't move can be kept, see jar::ShadowMaps
+    void set_still_lights(uint32_t count);
+    // World space, as of the last prepare()
+    glm::vec3 get_position(uint32_t light) const;
+
+    // Before the compute batch is recorded. Moves the lights on by dt and
+    // writes them for the swapchain image the frame renders to, with the
+    // frame's camera.
+    void prepare(float dt,
+        const glm::mat4& view,
+        const glm::mat4& projection,
+        float z_near,
+        float z_far,
+        vk::Extent2D extent,
+        uint32_t slot);
+    // The async compute job
+    void record_culling(vk::CommandBuffer cmd);
+
+    // Set 1 of the main pipeline for a swapchain image
+    vk::DescriptorSet get_render_set(uint32_t slot) const;
+    vk::DescriptorSetLayout get_render_set_layout() const;
+  };
+}
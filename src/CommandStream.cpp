@@ -0,0 +1,254 @@
+#include "CommandStream.hpp"
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+  const char magic[8] = {'J', 'A', 'R', 'C', 'M', 'D', '\r', '\n'};
+  // 3 added MSAA and the shadow settings to the setup, 2 is still read
+  const uint32_t version = 3;
+  const uint32_t oldest_version = 2;
+
+  enum ChunkType: uint32_t {
+    setup_chunk = 1,
+    mesh_chunk = 2,
+    frame_chunk = 3,
+  };
+
+  template<typename T>
+  void put(std::vector<uint8_t>& out, const T& value) {
+    size_t offset = out.size();
+    out.resize(offset + sizeof(T));
+    std::memcpy(out.data() + offset, &value, sizeof(T));
+  }
+
+  template<typename T>
+  void put_array(std::vector<uint8_t>& out, const std::vector<T>& values) {
+    put(out, static_cast<uint32_t>(values.size()));
+    size_t offset = out.size();
+    out.resize(offset + values.size() * sizeof(T));
+    std::memcpy(out.data() + offset, values.data(), values.size() * sizeof(T));
+  }
+
+  // Reads out of one chunk, running past its end means the file is broken
+  class Cursor {
+    const uint8_t* data;
+    size_t size;
+    size_t offset = 0;
+
+    void need(size_t count) const {
+      if(count > size - offset) {
+        throw std::runtime_error("failed to read command stream, a chunk is cut short!");
+      }
+    }
+
+    public:
+    Cursor(const uint8_t* data, size_t size): data(data), size(size) {}
+
+    template<typename T>
+    T get() {
+      need(sizeof(T));
+      T value;
+      std::memcpy(&value, data + offset, sizeof(T));
+      offset += sizeof(T);
+      return value;
+    }
+
+    template<typename T>
+    void get_array(std::vector<T>& values) {
+      uint32_t count = get<uint32_t>();
+      need(size_t(count) * sizeof(T));
+      values.resize(count);
+      std::memcpy(values.data(), data + offset, size_t(count) * sizeof(T));
+      offset += size_t(count) * sizeof(T);
+    }
+  };
+}
+
+namespace jar {
+  uint32_t FramePacket::visible_count() const {
+    uint32_t count = 0;
+    for(size_t i = 1; i < visible_runs.size(); i += 2) {
+      count += visible_runs[i];
+    }
+    return count;
+  }
+
+  void CommandStreamWriter::open(const std::string& path, const StreamSetup& setup) {
+    file.open(path, std::ios::binary);
+    if(!file) {
+      throw std::runtime_error("failed to open " + path + " for writing!");
+    }
+    file.write(magic, sizeof(magic));
+    file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    frames = 0;
+    bytes = sizeof(magic) + sizeof(version);
+
+    chunk.clear();
+    put(chunk, setup.object_count);
+    put(chunk, setup.width);
+    put(chunk, setup.height);
+    put(chunk, setup.particles.capacity);
+    put(chunk, setup.particles.emit_rate);
+    put(chunk, setup.particles.size);
+    put(chunk, setup.particles.emitter);
+    put(chunk, setup.particles.spread);
+    put(chunk, setup.lights.capacity);
+    put(chunk, setup.lights.count);
+    put(chunk, setup.lights.max_lights_per_cluster);
+    put(chunk, setup.lights.radius);
+    put(chunk, setup.lights.intensity);
+    put(chunk, setup.lights.ambient);
+    put(chunk, setup.msaa_samples);
+    put(chunk, setup.shadows.cascade_count);
+    put(chunk, setup.shadows.cascade_resolution);
+    put(chunk, setup.shadows.max_distance);
+    put(chunk, setup.shadows.split_lambda);
+    put(chunk, setup.shadows.caster_margin);
+    put(chunk, setup.shadows.local_lights);
+    put(chunk, setup.shadows.atlas_resolution);
+    put(chunk, setup.shadows.tile_resolution);
+    put(chunk, setup.shadows.sun_direction);
+    put(chunk, setup.shadows.sun_color);
+    put(chunk, setup.shadows.sun_intensity);
+    write_chunk(setup_chunk);
+  }
+
+  void CommandStreamWriter::write_mesh(const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indices) {
+    chunk.clear();
+    put_array(chunk, vertices);
+    put_array(chunk, indices);
+    write_chunk(mesh_chunk);
+  }
+
+  void CommandStreamWriter::write_frame(const FramePacket& frame) {
+    chunk.clear();
+    put(chunk, frame.index);
+    put(chunk, frame.dt);
+    put(chunk, frame.width);
+    put(chunk, frame.height);
+    put(chunk, frame.particle_emit_rate);
+    put(chunk, frame.light_count);
+    put(chunk, frame.model);
+    put(chunk, frame.view);
+    put(chunk, frame.projection);
+    put_array(chunk, frame.visible_runs);
+    write_chunk(frame_chunk);
+    frames++;
+  }
+
+  void CommandStreamWriter::write_chunk(uint32_t type) {
+    if(!file.is_open()) {
+      return;
+    }
+    uint32_t size = static_cast<uint32_t>(chunk.size());
+    file.write(reinterpret_cast<const char*>(&type), sizeof(type));
+    file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+    bytes += sizeof(type) + sizeof(size) + chunk.size();
+  }
+
+  void CommandStreamWriter::close() {
+    file.close();
+  }
+
+  bool CommandStreamWriter::is_open() const {
+    return file.is_open();
+  }
+
+  uint64_t CommandStreamWriter::get_frame_count() const {
+    return frames;
+  }
+
+  uint64_t CommandStreamWriter::get_byte_count() const {
+    return bytes;
+  }
+
+  CommandStream read_command_stream(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file) {
+      throw std::runtime_error("failed to open " + path + "!");
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    uint32_t file_version = 0;
+    if(data.size() < sizeof(magic) + sizeof(file_version) || std::memcmp(data.data(), magic, sizeof(magic)) != 0) {
+      throw std::runtime_error("failed to read command stream, " + path + " isn't one!");
+    }
+    std::memcpy(&file_version, data.data() + sizeof(magic), sizeof(file_version));
+    if(file_version < oldest_version || file_version > version) {
+      throw std::runtime_error("failed to read command stream, version " + std::to_string(file_version) + " isn't supported!");
+    }
+
+    CommandStream stream;
+    bool has_setup = false;
+    size_t offset = sizeof(magic) + sizeof(file_version);
+    // A capture that was killed can end in a partial chunk, keep what came before
+    while(data.size() - offset >= 2 * sizeof(uint32_t)) {
+      uint32_t type, size;
+      std::memcpy(&type, data.data() + offset, sizeof(type));
+      std::memcpy(&size, data.data() + offset + sizeof(type), sizeof(size));
+      offset += 2 * sizeof(uint32_t);
+      if(size > data.size() - offset) {
+        break;
+      }
+      Cursor cursor(data.data() + offset, size);
+      offset += size;
+
+      if(type == setup_chunk) {
+        stream.setup.object_count = cursor.get<uint32_t>();
+        stream.setup.width = cursor.get<uint32_t>();
+        stream.setup.height = cursor.get<uint32_t>();
+        stream.setup.particles.capacity = cursor.get<uint32_t>();
+        stream.setup.particles.emit_rate = cursor.get<float>();
+        stream.setup.particles.size = cursor.get<float>();
+        stream.setup.particles.emitter = cursor.get<glm::vec3>();
+        stream.setup.particles.spread = cursor.get<float>();
+        stream.setup.lights.capacity = cursor.get<uint32_t>();
+        stream.setup.lights.count = cursor.get<uint32_t>();
+        stream.setup.lights.max_lights_per_cluster = cursor.get<uint32_t>();
+        stream.setup.lights.radius = cursor.get<float>();
+        stream.setup.lights.intensity = cursor.get<float>();
+        stream.setup.lights.ambient = cursor.get<glm::vec3>();
+        // Older streams were drawn with the defaults
+        if(file_version >= 3) {
+          stream.setup.msaa_samples = cursor.get<uint32_t>();
+          stream.setup.shadows.cascade_count = cursor.get<uint32_t>();
+          stream.setup.shadows.cascade_resolution = cursor.get<uint32_t>();
+          stream.setup.shadows.max_distance = cursor.get<float>();
+          stream.setup.shadows.split_lambda = cursor.get<float>();
+          stream.setup.shadows.caster_margin = cursor.get<float>();
+          stream.setup.shadows.local_lights = cursor.get<uint32_t>();
+          stream.setup.shadows.atlas_resolution = cursor.get<uint32_t>();
+          stream.setup.shadows.tile_resolution = cursor.get<uint32_t>();
+          stream.setup.shadows.sun_direction = cursor.get<glm::vec3>();
+          stream.setup.shadows.sun_color = cursor.get<glm::vec3>();
+          stream.setup.shadows.sun_intensity = cursor.get<float>();
+        }
+        has_setup = true;
+      } else if(type == mesh_chunk) {
+        MeshPacket mesh;
+        cursor.get_array(mesh.vertices);
+        cursor.get_array(mesh.indices);
+        stream.packets.push_back(std::move(mesh));
+      } else if(type == frame_chunk) {
+        FramePacket frame;
+        frame.index = cursor.get<uint64_t>();
+        frame.dt = cursor.get<float>();
+        frame.width = cursor.get<uint32_t>();
+        frame.height = cursor.get<uint32_t>();
+        frame.particle_emit_rate = cursor.get<float>();
+        frame.light_count = cursor.get<uint32_t>();
+        frame.model = cursor.get<glm::mat4>();
+        frame.view = cursor.get<glm::mat4>();
+        frame.projection = cursor.get<glm::mat4>();
+        cursor.get_array(frame.visible_runs);
+        stream.packets.push_back(std::move(frame));
+        stream.frame_count++;
+      }
+    }
+    if(!has_setup) {
+      throw std::runtime_error("failed to read command stream, " + path + " has no setup!");
+    }
+    return stream;
+  }
+}
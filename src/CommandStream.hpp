@@ -0,0 +1,121 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <variant>
+#include <vector>
+#include "ClusteredLighting.hpp"
+#include "ParticleSystem.hpp"
+#include "ShadowMaps.hpp"
+#include "Vertex.hpp"
+
+namespace jar {
+  /*
+   * A capture of what the renderer was asked to draw, one packet per frame,
+   * for replaying a workload without the app around it. The file is a small
+   * header followed by chunks of (type, size, payload), readers skip types
+   * they don't know. Everything is written in host byte order.
+   *
+   * Packets hold what the renderer consumed, not Vulkan calls: the camera
+   * and model transform, which objects survived culling, the light count
+   * and the timestep. The command buffers are prerecorded from the scene
+   * setup, so replaying those inputs into a renderer set up the same way
+   * submits the same work.
+   */
+
+  // How the renderer was set up, the first chunk of every stream
+  struct StreamSetup {
+    uint32_t object_count = 1;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    ParticleSettings particles{};
+    LightSettings lights{};
+    // Samples per pixel the device gave, 1 for none
+    uint32_t msaa_samples = 1;
+    ShadowSettings shadows{};
+  };
+
+  // A mesh upload, the scene's mesh from then on
+  struct MeshPacket {
+    std::vector<Vertex> vertices;
+    std::vector<uint16_t> indices;
+  };
+
+  struct FramePacket {
+    uint64_t index = 0;
+    float dt = 0.0f;
+    // Framebuffer size the frame was drawn at
+    uint32_t width = 0;
+    uint32_t height = 0;
+    float particle_emit_rate = 0.0f;
+    uint32_t light_count = 0;
+    glm::mat4 model{1.0f};
+    glm::mat4 view{1.0f};
+    glm::mat4 projection{1.0f};
+    // Objects that passed culling as sorted (first, count) runs, neighbours
+    // in the scene tend to be visible together
+    std::vector<uint32_t> visible_runs;
+
+    // Any order, sorts it in place
+    template<typename Vector>
+    void set_visible(Vector& visible_objects);
+    uint32_t visible_count() const;
+    // Calls f(object) for each visible object
+    template<typename F>
+    void for_each_visible(F&& f) const;
+  };
+
+  using StreamPacket = std::variant<MeshPacket, FramePacket>;
+
+  class CommandStreamWriter {
+    std::ofstream file;
+    std::vector<uint8_t> chunk;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+
+    void write_chunk(uint32_t type);
+
+    public:
+    void open(const std::string& path, const StreamSetup& setup);
+    void write_mesh(const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indices);
+    void write_frame(const FramePacket& frame);
+    void close();
+    bool is_open() const;
+    uint64_t get_frame_count() const;
+    uint64_t get_byte_count() const;
+  };
+
+  struct CommandStream {
+    StreamSetup setup;
+    std::vector<StreamPacket> packets;
+    uint64_t frame_count = 0;
+  };
+
+  // Loads all of it, throws if it isn't a command stream or is cut short
+  CommandStream read_command_stream(const std::string& path);
+
+  template<typename Vector>
+  void FramePacket::set_visible(Vector& visible_objects) {
+    std::sort(visible_objects.begin(), visible_objects.end());
+    visible_runs.clear();
+    for(uint32_t object: visible_objects) {
+      if(!visible_runs.empty() && visible_runs[visible_runs.size() - 2] + visible_runs.back() == object) {
+        visible_runs.back()++;
+      } else {
+        visible_runs.push_back(object);
+        visible_runs.push_back(1);
+      }
+    }
+  }
+
+  template<typename F>
+  void FramePacket::for_each_visible(F&& f) const {
+    for(size_t i = 0; i + 1 < visible_runs.size(); i += 2) {
+      for(uint32_t object = visible_runs[i]; object < visible_runs[i] + visible_runs[i + 1]; object++) {
+        f(object);
+      }
+    }
+  }
+}
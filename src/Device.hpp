@@ -2,9 +2,15 @@
 #include <vulkan/vulkan.hpp>
 #include <vector>
 #include <set>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <string>
 #include "QueueFamilyIndices.hpp"
 #include "SwapChainSupportDetails.hpp"
 #include "SwapChain.hpp"
+#include "DeviceSelection.hpp"
+#include "Json.hpp"
 
 namespace jar::device {
 
@@ -36,22 +42,41 @@ namespace jar::device {
       vk::Bool32 presentSupport = false;
       physicalDevice.getSurfaceSupportKHR(i, surface, &presentSupport);
       if(queueFamily.queueCount > 0) {
-        if(presentSupport) {
+        if(presentSupport && indices.present_family < 0) {
           indices.present_family = i;
         }
 
-        if(queueFamily.queueFlags & vk::QueueFlagBits::eGraphics) {
+        if((queueFamily.queueFlags & vk::QueueFlagBits::eGraphics) && indices.graphics_family < 0) {
           indices.graphics_family = i;
         }
-      }
-      if(indices.is_complete()) {
-        break;
+
+        // Dedicated compute families are what the hardware runs concurrently with graphics
+        if((queueFamily.queueFlags & vk::QueueFlagBits::eCompute) && !(queueFamily.queueFlags & vk::QueueFlagBits::eGraphics) && indices.compute_family < 0) {
+          indices.compute_family = i;
+        }
       }
       i++;
     }
+    if(indices.compute_family < 0) {
+      indices.compute_family = indices.graphics_family;
+    }
     return indices;
   }
 
+  // For optional extensions, unlike check_device_extension_support this doesn't complain
+  bool has_device_extension(const vk::PhysicalDevice& device, const std::string& name) {
+    uint32_t extension_count;
+    device.enumerateDeviceExtensionProperties(nullptr, &extension_count, nullptr);
+    std::vector<vk::ExtensionProperties> available_extensions(extension_count);
+    device.enumerateDeviceExtensionProperties(nullptr, &extension_count, available_extensions.data());
+    for(const auto& extension: available_extensions) {
+      if(name == extension.extensionName) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   bool check_device_extension_support(const vk::PhysicalDevice& device, const std::vector<const char*> device_extensions) {
     uint32_t extension_count;
     device.enumerateDeviceExtensionProperties(nullptr, &extension_count, nullptr);
@@ -90,32 +115,206 @@ namespace jar::device {
   }
 
 
-  vk::PhysicalDevice pickPhysicalDevice(vk::Instance& instance,
+  // Everything the score is based on, also what ends up in the report
+  struct DeviceInfo {
+    uint32_t index;
+    vk::PhysicalDevice device;
+    vk::PhysicalDeviceProperties properties;
+    vk::PhysicalDeviceFeatures features;
+    vk::PhysicalDeviceMemoryProperties memory;
+    std::vector<vk::QueueFamilyProperties> queue_families;
+    bool suitable;
+    vk::DeviceSize device_local_memory;
+    bool dedicated_compute;
+    bool dedicated_transfer;
+    int score;
+  };
+
+  // Largest device local heap, integrated GPUs report a share of system memory here
+  vk::DeviceSize get_device_local_memory(const vk::PhysicalDeviceMemoryProperties& memory) {
+    vk::DeviceSize largest = 0;
+    for(uint32_t i = 0; i < memory.memoryHeapCount; i++) {
+      if(memory.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+        largest = std::max(largest, memory.memoryHeaps[i].size);
+      }
+    }
+    return largest;
+  }
+
+  /*
+   * Device type dominates so a discrete GPU always beats an integrated one,
+   * the rest only orders devices of the same type: VRAM, async compute and
+   * transfer queues, texture size limit and the optional features we use.
+   */
+  int score_device(const DeviceInfo& info) {
+    if(!info.suitable) {
+      return -1;
+    }
+    int score = 0;
+    switch(info.properties.deviceType) {
+      case vk::PhysicalDeviceType::eDiscreteGpu: score += 100000; break;
+      case vk::PhysicalDeviceType::eIntegratedGpu: score += 50000; break;
+      case vk::PhysicalDeviceType::eVirtualGpu: score += 20000; break;
+      case vk::PhysicalDeviceType::eCpu: score += 1000; break;
+      default: break;
+    }
+    // 1 point per 16MiB, 8GiB is worth 512
+    score += static_cast<int>(std::min<vk::DeviceSize>(info.device_local_memory >> 24, 4096));
+    score += info.dedicated_compute ? 500 : 0;
+    score += info.dedicated_transfer ? 300 : 0;
+    score += static_cast<int>(info.properties.limits.maxImageDimension2D / 64);
+    score += info.features.pipelineStatisticsQuery ? 100 : 0;
+    score += info.features.samplerAnisotropy ? 100 : 0;
+    score += info.features.multiDrawIndirect ? 100 : 0;
+    return score;
+  }
+
+  DeviceInfo get_device_info(uint32_t index,
+      const vk::PhysicalDevice& device,
       const vk::SurfaceKHR& surface,
-      const std::vector<const char*> required_device_extensions) {
-    vk::PhysicalDevice physicalDevice{};
+      const std::vector<const char*>& required_device_extensions) {
+    DeviceInfo info{};
+    info.index = index;
+    info.device = device;
+    device.getProperties(&info.properties);
+    device.getFeatures(&info.features);
+    device.getMemoryProperties(&info.memory);
+    info.queue_families = getQueueFamilies(device);
+    info.suitable = isDeviceSuitable(device, surface, required_device_extensions);
+    info.device_local_memory = get_device_local_memory(info.memory);
+    for(const auto& family: info.queue_families) {
+      bool graphics = static_cast<bool>(family.queueFlags & vk::QueueFlagBits::eGraphics);
+      bool compute = static_cast<bool>(family.queueFlags & vk::QueueFlagBits::eCompute);
+      info.dedicated_compute |= compute && !graphics;
+      info.dedicated_transfer |= (family.queueFlags & vk::QueueFlagBits::eTransfer) && !graphics && !compute;
+    }
+    info.score = score_device(info);
+    return info;
+  }
 
-    bool found = false;
+  std::string to_lower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+    return text;
+  }
+
+  // One object per device, meant for scripts choosing benchmark baselines
+  void write_device_report(const std::string& path, const std::vector<DeviceInfo>& infos, int selected) {
+    std::ofstream out(path);
+    if(!out.is_open()) {
+      throw std::runtime_error("failed to open " + path + "!");
+    }
+    out << "{\n  \"selected\": " << selected << ",\n  \"devices\": [";
+    for(size_t d = 0; d < infos.size(); d++) {
+      const auto& info = infos[d];
+      const auto& limits = info.properties.limits;
+      out << (d ? "," : "") << "\n    {\n"
+        << "      \"index\": " << info.index << ",\n"
+        << "      \"name\": " << json::quote(info.properties.deviceName) << ",\n"
+        << "      \"type\": " << json::quote(vk::to_string(info.properties.deviceType)) << ",\n"
+        << "      \"vendor_id\": " << info.properties.vendorID << ",\n"
+        << "      \"device_id\": " << info.properties.deviceID << ",\n"
+        << "      \"driver_version\": " << info.properties.driverVersion << ",\n"
+        << "      \"api_version\": " << json::quote(std::to_string(VK_VERSION_MAJOR(info.properties.apiVersion)) + "."
+            + std::to_string(VK_VERSION_MINOR(info.properties.apiVersion)) + "."
+            + std::to_string(VK_VERSION_PATCH(info.properties.apiVersion))) << ",\n"
+        << "      \"suitable\": " << (info.suitable ? "true" : "false") << ",\n"
+        << "      \"score\": " << info.score << ",\n"
+        << "      \"device_local_memory\": " << info.device_local_memory << ",\n"
+        << "      \"memory_heaps\": [";
+      for(uint32_t i = 0; i < info.memory.memoryHeapCount; i++) {
+        const auto& heap = info.memory.memoryHeaps[i];
+        out << (i ? ", " : "") << "{\"size\": " << heap.size
+          << ", \"device_local\": " << ((heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) ? "true" : "false") << "}";
+      }
+      out << "],\n      \"queue_families\": [";
+      for(size_t i = 0; i < info.queue_families.size(); i++) {
+        const auto& family = info.queue_families[i];
+        out << (i ? ", " : "") << "{\"flags\": " << json::quote(vk::to_string(family.queueFlags))
+          << ", \"count\": " << family.queueCount
+          << ", \"timestamp_valid_bits\": " << family.timestampValidBits << "}";
+      }
+      out << "],\n"
+        << "      \"dedicated_compute\": " << (info.dedicated_compute ? "true" : "false") << ",\n"
+        << "      \"dedicated_transfer\": " << (info.dedicated_transfer ? "true" : "false") << ",\n"
+        << "      \"limits\": {"
+        << "\"max_image_dimension_2d\": " << limits.maxImageDimension2D
+        << ", \"max_bound_descriptor_sets\": " << limits.maxBoundDescriptorSets
+        << ", \"max_push_constants_size\": " << limits.maxPushConstantsSize
+        << ", \"max_memory_allocation_count\": " << limits.maxMemoryAllocationCount
+        << ", \"max_compute_work_group_invocations\": " << limits.maxComputeWorkGroupInvocations
+        << ", \"max_sampler_anisotropy\": " << limits.maxSamplerAnisotropy
+        << ", \"timestamp_period\": " << limits.timestampPeriod
+        << "},\n"
+        << "      \"features\": {"
+        << "\"pipeline_statistics_query\": " << (info.features.pipelineStatisticsQuery ? "true" : "false")
+        << ", \"sampler_anisotropy\": " << (info.features.samplerAnisotropy ? "true" : "false")
+        << ", \"multi_draw_indirect\": " << (info.features.multiDrawIndirect ? "true" : "false")
+        << ", \"geometry_shader\": " << (info.features.geometryShader ? "true" : "false")
+        << ", \"shader_int64\": " << (info.features.shaderInt64 ? "true" : "false")
+        << "}\n    }";
+    }
+    out << "\n  ]\n}\n";
+    std::cout << "Device report written to " << path << '\n';
+  }
+
+  vk::PhysicalDevice pickPhysicalDevice(vk::Instance& instance,
+      const vk::SurfaceKHR& surface,
+      const std::vector<const char*> required_device_extensions,
+      const DeviceSelection& selection = {}) {
     const auto devices = get_devices(instance);
     std::cout << "Found " << devices.size() << " device(s)\n";
-    for(const auto& device: devices) {
-      vk::PhysicalDeviceFeatures deviceFeatures{};
-      device.getFeatures(&deviceFeatures);
-      vk::PhysicalDeviceProperties deviceProperties{};
-      device.getProperties(&deviceProperties);
+    std::vector<DeviceInfo> infos;
+    for(uint32_t i = 0; i < devices.size(); i++) {
+      infos.push_back(get_device_info(i, devices[i], surface, required_device_extensions));
+    }
+
+    const DeviceInfo* chosen = nullptr;
+    std::vector<std::string> matches;
+    for(const auto& info: infos) {
+      std::cout << "\t[" << info.index << "] " << info.properties.deviceName
+        << " (" << vk::to_string(info.properties.deviceType) << ", "
+        << (info.device_local_memory >> 20) << "MiB"
+        << (info.dedicated_compute ? ", async compute" : "")
+        << (info.dedicated_transfer ? ", transfer queue" : "") << ") "
+        << (info.suitable ? "score " + std::to_string(info.score) : std::string("unsuitable")) << '\n';
 
-      if (isDeviceSuitable(device, surface, required_device_extensions)) {
-        std::cout << "Using " << deviceProperties.deviceName << '\n';
-        found = true;
-        physicalDevice = device;
-        break;
+      bool forced = selection.index >= 0 ? static_cast<int>(info.index) == selection.index :
+        !selection.name.empty() && to_lower(info.properties.deviceName).find(to_lower(selection.name)) != std::string::npos;
+      if(forced) {
+        if(!info.suitable) {
+          throw std::runtime_error("requested GPU " + std::string(info.properties.deviceName) + " is not suitable!");
+        }
+        chosen = &info;
+        matches.push_back("[" + std::to_string(info.index) + "] " + info.properties.deviceName);
+      }
+    }
+    bool overridden = selection.index >= 0 || !selection.name.empty();
+    if(overridden && !chosen) {
+      throw std::runtime_error("requested GPU not found!");
+    }
+    // Two of the same card have the same name too, only the index tells them apart
+    if(matches.size() > 1) {
+      std::string names;
+      for(const auto& match: matches) {
+        names += (names.empty() ? "" : ", ") + match;
+      }
+      throw std::runtime_error("GPU name " + selection.name + " matches " + names + ", pick one by index!");
+    }
+    if(!overridden) {
+      for(const auto& info: infos) {
+        if(info.suitable && (!chosen || info.score > chosen->score)) {
+          chosen = &info;
+        }
       }
     }
 
-    if (!found) {
+    if(!selection.report_path.empty()) {
+      write_device_report(selection.report_path, infos, chosen ? static_cast<int>(chosen->index) : -1);
+    }
+    if(!chosen) {
       throw std::runtime_error("failed to find a suitable GPU!");
     }
-
-    return physicalDevice;
+    std::cout << "Using " << chosen->properties.deviceName << (overridden ? " (requested)" : "") << '\n';
+    return chosen->device;
   }
 }
@@ -0,0 +1,28 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include "Arguments.hpp"
+
+namespace jar::device {
+  // How to pick the GPU, by default the highest scoring suitable one
+  struct DeviceSelection {
+    // Case insensitive substring of the device name, has to match only one
+    std::string name;
+    // Index in enumeration order, -1 to not force one
+    int index = -1;
+    // Writes every device's capabilities and score as JSON, empty for none
+    std::string report_path;
+
+    // The value of --gpu: an index if it's all digits, a name otherwise
+    void parse(const std::string& option, const std::string& gpu) {
+      if(!gpu.empty() && std::all_of(gpu.begin(), gpu.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+        index = static_cast<int>(args::parse_uint(option, gpu, 0, 1024));
+        name.clear();
+      } else {
+        name = gpu;
+        index = -1;
+      }
+    }
+  };
+}
@@ -0,0 +1,150 @@
+#include "FrameArena.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <unordered_set>
+
+namespace {
+  std::atomic<uint64_t> next_frame_arena_id{1};
+
+  struct LocalArena {
+    uint64_t owner;
+    jar::Arena* arena;
+  };
+  // A handful of entries, one per live FrameArena this thread has used.
+  // Dead ones are pruned the next time the thread looks one up after a
+  // FrameArena went away, so apps rebuilding their arenas don't grow it.
+  struct LocalArenas {
+    std::vector<LocalArena> entries;
+    uint64_t destroyed_seen = 0;
+  };
+  thread_local LocalArenas local_arenas;
+
+  std::mutex live_mutex;
+  std::unordered_set<uint64_t> live_frame_arenas;
+  std::atomic<uint64_t> destroyed_frame_arenas{0};
+
+  void prune_local_arenas() {
+    std::lock_guard<std::mutex> lock(live_mutex);
+    auto& entries = local_arenas.entries;
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [](const LocalArena& local) {
+        return live_frame_arenas.count(local.owner) == 0;
+      }), entries.end());
+  }
+
+  size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+  }
+}
+
+namespace jar {
+  Arena::Arena(size_t block_size, bool poison): block_size(block_size), poison(poison) {
+  }
+
+  void* Arena::allocate(size_t size, size_t alignment) {
+    while(current < blocks.size()) {
+      Block& block = blocks[current];
+      // Aligned as an address, the blocks are only aligned for max_align_t
+      uintptr_t base = reinterpret_cast<uintptr_t>(block.memory.get());
+      size_t start = align_up(base + offset, alignment) - base;
+      if(start + size <= block.size) {
+        offset = start + size;
+        high_water_mark = std::max(high_water_mark, used());
+        return block.memory.get() + start;
+      }
+      // Kept from an earlier round but too small, skipped until the reset
+      used_before += block.size;
+      current++;
+      offset = 0;
+    }
+    size_t new_size = std::max(block_size, size + alignment);
+    blocks.push_back({std::make_unique<std::byte[]>(new_size), new_size});
+    return allocate(size, alignment);
+  }
+
+  void Arena::reset() {
+    if(poison) {
+      for(size_t i = 0; i < current && i < blocks.size(); i++) {
+        std::memset(blocks[i].memory.get(), poison_byte, blocks[i].size);
+      }
+      if(current < blocks.size()) {
+        std::memset(blocks[current].memory.get(), poison_byte, offset);
+      }
+    }
+    current = 0;
+    offset = 0;
+    used_before = 0;
+  }
+
+  size_t Arena::used() const {
+    return used_before + offset;
+  }
+
+  ArenaStats Arena::get_stats() const {
+    ArenaStats stats;
+    stats.used = used();
+    stats.high_water_mark = high_water_mark;
+    stats.block_count = blocks.size();
+    for(const auto& block: blocks) {
+      stats.capacity += block.size;
+    }
+    return stats;
+  }
+
+  FrameArena::FrameArena(size_t block_size, bool poison):
+    id(next_frame_arena_id++), block_size(block_size), poison(poison) {
+    std::lock_guard<std::mutex> lock(live_mutex);
+    live_frame_arenas.insert(id);
+  }
+
+  FrameArena::~FrameArena() {
+    {
+      std::lock_guard<std::mutex> lock(live_mutex);
+      live_frame_arenas.erase(id);
+    }
+    destroyed_frame_arenas++;
+  }
+
+  Arena& FrameArena::local() {
+    uint64_t destroyed = destroyed_frame_arenas.load();
+    if(local_arenas.destroyed_seen != destroyed) {
+      prune_local_arenas();
+      local_arenas.destroyed_seen = destroyed;
+    }
+    for(const auto& local: local_arenas.entries) {
+      if(local.owner == id) {
+        return *local.arena;
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    arenas.push_back(std::make_unique<Arena>(block_size, poison));
+    local_arenas.entries.push_back({id, arenas.back().get()});
+    return *arenas.back();
+  }
+
+  void FrameArena::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& arena: arenas) {
+      arena->reset();
+    }
+  }
+
+  ArenaStats FrameArena::get_stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    ArenaStats total;
+    for(const auto& arena: arenas) {
+      ArenaStats stats = arena->get_stats();
+      total.used += stats.used;
+      total.high_water_mark += stats.high_water_mark;
+      total.capacity += stats.capacity;
+      total.block_count += stats.block_count;
+    }
+    return total;
+  }
+
+  size_t FrameArena::thread_count() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return arenas.size();
+  }
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace jar {
+#ifdef JAR_ARENA_POISON
+  constexpr bool poison_arenas_by_default = true;
+#else
+  constexpr bool poison_arenas_by_default = false;
+#endif
+
+  struct ArenaStats {
+    size_t used = 0;
+    // Most used at once since the arena was created
+    size_t high_water_mark = 0;
+    // Reserved in blocks, kept across resets
+    size_t capacity = 0;
+    size_t block_count = 0;
+  };
+
+  /*
+   * Bump allocator over a list of blocks. Nothing is freed on its own,
+   * reset() drops everything at once by rewinding to the first block and
+   * keeps the blocks for the next round. Not thread safe, see FrameArena
+   * for one per thread.
+   *
+   * With poisoning on, reset() fills everything handed out since the last
+   * reset with poison_byte, so reads through stale pointers show up.
+   */
+  class Arena {
+    struct Block {
+      std::unique_ptr<std::byte[]> memory;
+      size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t block_size;
+    bool poison;
+    size_t current = 0;
+    size_t offset = 0;
+    // Bytes in the blocks before current, including what alignment skipped
+    size_t used_before = 0;
+    size_t high_water_mark = 0;
+
+    public:
+    static constexpr size_t default_block_size = 64 * 1024;
+    static constexpr uint8_t poison_byte = 0xcd;
+
+    explicit Arena(size_t block_size = default_block_size, bool poison = poison_arenas_by_default);
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    template<typename T>
+    T* allocate(size_t count) {
+      return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+    void reset();
+    size_t used() const;
+    ArenaStats get_stats() const;
+  };
+
+  // Lets standard containers allocate from an arena. Deallocation does
+  // nothing, a growing vector leaves its old storage behind until the
+  // reset, so reserve up front.
+  template<typename T>
+  class ArenaAllocator {
+    template<typename U>
+    friend class ArenaAllocator;
+    Arena* arena;
+
+    public:
+    using value_type = T;
+
+    ArenaAllocator(Arena& arena): arena(&arena) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other): arena(other.arena) {}
+
+    T* allocate(size_t count) {
+      return arena->allocate<T>(count);
+    }
+    void deallocate(T*, size_t) {}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+      return arena == other.arena;
+    }
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+      return arena != other.arena;
+    }
+  };
+
+  template<typename T>
+  using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+  /*
+   * Transient memory for one frame in flight, reset once the GPU is done
+   * with that frame. Every thread allocating from it gets its own Arena on
+   * first use, so allocations never lock. reset() and get_stats() need all
+   * of those threads to be done with it.
+   */
+  class FrameArena {
+    // Unique per instance so thread local lookups can't hit a dead one at the same address
+    uint64_t id;
+    size_t block_size;
+    bool poison;
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Arena>> arenas;
+
+    public:
+    explicit FrameArena(size_t block_size = Arena::default_block_size, bool poison = poison_arenas_by_default);
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+    // Threads drop their cached entry for it on their next local()
+    ~FrameArena();
+
+    // The calling thread's arena
+    Arena& local();
+    template<typename T>
+    ArenaAllocator<T> allocator() {
+      return ArenaAllocator<T>(local());
+    }
+    template<typename T>
+    ArenaVector<T> vector(size_t reserve = 0) {
+      ArenaVector<T> values(allocator<T>());
+      values.reserve(reserve);
+      return values;
+    }
+    void reset();
+    // Summed over the threads, the high water mark is the sum of theirs
+    ArenaStats get_stats() const;
+    size_t thread_count() const;
+  };
+}
@@ -0,0 +1,287 @@
+#include "FrameCapture.hpp"
+#include "Memory.hpp"
+#include <chrono>
+#include <iostream>
+
+namespace jar {
+  void FrameCapture::create(vk::Device device,
+      vk::PhysicalDevice physical_device,
+      uint32_t queue_family,
+      DeletionQueue& deletion_queue,
+      MemoryBudget& memory_budget,
+      uint32_t slot_count) {
+    this->device = device;
+    this->physical_device = physical_device;
+    this->deletion_queue = &deletion_queue;
+    this->memory_budget = &memory_budget;
+
+    vk::CommandPoolCreateInfo pool_info{};
+    pool_info.setQueueFamilyIndex(queue_family);
+    pool_info.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+    if(device.createCommandPool(&pool_info, nullptr, &command_pool) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create capture command pool!");
+    }
+    std::vector<vk::CommandBuffer> command_buffers(slot_count);
+    vk::CommandBufferAllocateInfo alloc_info{};
+    alloc_info.setCommandPool(command_pool);
+    alloc_info.setLevel(vk::CommandBufferLevel::ePrimary);
+    alloc_info.setCommandBufferCount(slot_count);
+    if(device.allocateCommandBuffers(&alloc_info, command_buffers.data()) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to allocate capture command buffers!");
+    }
+    for(auto cmd: command_buffers) {
+      slots.push_back(std::make_unique<Slot>());
+      slots.back()->cmd = cmd;
+    }
+    worker = std::make_unique<ThreadPool>(1);
+  }
+
+  void FrameCapture::destroy() {
+    if(!worker) {
+      return;
+    }
+    for(auto& slot: slots) {
+      if(slot->pending) {
+        slot->pending = false;
+        Slot* finished = slot.get();
+        worker->submit([this, finished]() { encode(*finished); });
+      }
+    }
+    if(recording) {
+      stop_recording();
+    }
+    // Finishes what is queued first
+    worker.reset();
+    for(auto& slot: slots) {
+      slot->buffer.reset();
+    }
+    slots.clear();
+    last_recorded = nullptr;
+    requests.clear();
+    device.destroyCommandPool(command_pool);
+  }
+
+  void FrameCapture::capture_next(Callback callback) {
+    requests.push_back(std::move(callback));
+  }
+
+  void FrameCapture::start_recording(const std::string& path, uint32_t width, uint32_t height, uint32_t fps) {
+    if(recording) {
+      stop_recording();
+    }
+    recording = true;
+    worker->submit([this, path, width, height, fps]() {
+      try {
+        video.open(path, width, height, fps);
+        std::cout << "Recording " << width << "x" << height << " to " << path << '\n';
+      } catch(const std::exception& e) {
+        std::cout << "Can't record: " << e.what() << '\n';
+      }
+    });
+  }
+
+  void FrameCapture::stop_recording() {
+    recording = false;
+    worker->submit([this]() {
+      video.close();
+      std::cout << "Recording stopped, " << captured << " frame(s) captured and " << dropped
+        << " dropped so far, " << encode_ms << "ms to convert one\n";
+    });
+  }
+
+  bool FrameCapture::is_recording() const {
+    return recording;
+  }
+
+  void FrameCapture::allocate(Slot& slot, vk::DeviceSize size) {
+    slot.buffer.reset();
+    vk::BufferCreateInfo buffer_info{};
+    buffer_info.setSize(size);
+    buffer_info.setUsage(vk::BufferUsageFlagBits::eTransferDst);
+    buffer_info.setSharingMode(vk::SharingMode::eExclusive);
+    vk::Buffer buffer;
+    if(device.createBuffer(&buffer_info, nullptr, &buffer) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create readback buffer!");
+    }
+    slot.buffer.buffer = UniqueBuffer(*deletion_queue, buffer);
+    slot.buffer.size = size;
+
+    // Cached memory makes the CPU side reads a lot faster, it just needs
+    // invalidating if it isn't coherent as well
+    vk::MemoryRequirements requirements = device.getBufferMemoryRequirements(buffer);
+    uint32_t memory_type;
+    try {
+      memory_type = memory::findMemoryType(physical_device, requirements.memoryTypeBits,
+          vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCached);
+    } catch(const std::runtime_error&) {
+      memory_type = memory::findMemoryType(physical_device, requirements.memoryTypeBits,
+          vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    }
+    vk::PhysicalDeviceMemoryProperties properties;
+    physical_device.getMemoryProperties(&properties);
+    slot.coherent = static_cast<bool>(properties.memoryTypes[memory_type].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent);
+
+    vk::MemoryAllocateInfo alloc_info{};
+    alloc_info.setAllocationSize(requirements.size);
+    alloc_info.setMemoryTypeIndex(memory_type);
+    vk::DeviceMemory memory;
+    if(device.allocateMemory(&alloc_info, nullptr, &memory) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to allocate readback memory!");
+    }
+    slot.buffer.memory = UniqueMemory(*deletion_queue, memory);
+    slot.buffer.charge = MemoryCharge(*memory_budget, *deletion_queue, memory_type, MemoryCategory::readback, requirements.size);
+    device.bindBufferMemory(buffer, memory, 0);
+    // Stays mapped, freeing the memory unmaps it
+    slot.mapped = device.mapMemory(memory, 0, VK_WHOLE_SIZE);
+    slot.capacity = size;
+  }
+
+  vk::CommandBuffer FrameCapture::record(vk::Image image, vk::Format format, vk::Extent2D extent) {
+    last_recorded = nullptr;
+    if(requests.empty() && !recording) {
+      return nullptr;
+    }
+    bool bgra = format == vk::Format::eB8G8R8A8Unorm || format == vk::Format::eB8G8R8A8Srgb;
+    bool rgba = format == vk::Format::eR8G8B8A8Unorm || format == vk::Format::eR8G8B8A8Srgb;
+    if(!bgra && !rgba) {
+      if(!warned_format) {
+        warned_format = true;
+        std::cout << "Can't capture " << vk::to_string(format) << " swapchain images\n";
+      }
+      return nullptr;
+    }
+    Slot* slot = nullptr;
+    for(auto& candidate: slots) {
+      if(!candidate->busy.load(std::memory_order_acquire)) {
+        slot = candidate.get();
+        break;
+      }
+    }
+    if(!slot) {
+      // Screenshots wait for the next frame, video just loses this one
+      dropped++;
+      return nullptr;
+    }
+
+    vk::DeviceSize size = vk::DeviceSize(extent.width) * extent.height * 4;
+    if(slot->capacity < size) {
+      allocate(*slot, size);
+    }
+    slot->width = extent.width;
+    slot->height = extent.height;
+    slot->bgra = bgra;
+    slot->video = recording;
+    slot->callbacks.swap(requests);
+    requests.clear();
+
+    vk::CommandBuffer cmd = slot->cmd;
+    vk::CommandBufferBeginInfo begin_info{};
+    begin_info.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    cmd.begin(&begin_info);
+
+    vk::ImageMemoryBarrier to_transfer{};
+    to_transfer.setImage(image);
+    to_transfer.setOldLayout(vk::ImageLayout::ePresentSrcKHR);
+    to_transfer.setNewLayout(vk::ImageLayout::eTransferSrcOptimal);
+    to_transfer.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    to_transfer.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    to_transfer.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite);
+    to_transfer.setDstAccessMask(vk::AccessFlagBits::eTransferRead);
+    to_transfer.subresourceRange.setAspectMask(vk::ImageAspectFlagBits::eColor);
+    to_transfer.subresourceRange.setLevelCount(1);
+    to_transfer.subresourceRange.setLayerCount(1);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer,
+        {}, 0, nullptr, 0, nullptr, 1, &to_transfer);
+
+    vk::BufferImageCopy region{};
+    region.imageSubresource.setAspectMask(vk::ImageAspectFlagBits::eColor);
+    region.imageSubresource.setLayerCount(1);
+    region.setImageExtent({extent.width, extent.height, 1});
+    cmd.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, slot->buffer.buffer, 1, &region);
+
+    // Present waits on the semaphore signaled after this, nothing to wait for on the GPU side
+    vk::ImageMemoryBarrier to_present = to_transfer;
+    to_present.setOldLayout(vk::ImageLayout::eTransferSrcOptimal);
+    to_present.setNewLayout(vk::ImageLayout::ePresentSrcKHR);
+    to_present.setSrcAccessMask({});
+    to_present.setDstAccessMask({});
+    vk::BufferMemoryBarrier to_host{};
+    to_host.setBuffer(slot->buffer.buffer);
+    to_host.setSize(size);
+    to_host.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    to_host.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    to_host.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+    to_host.setDstAccessMask(vk::AccessFlagBits::eHostRead);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eBottomOfPipe | vk::PipelineStageFlagBits::eHost,
+        {}, 0, nullptr, 1, &to_host, 1, &to_present);
+    cmd.end();
+
+    slot->busy.store(true, std::memory_order_relaxed);
+    last_recorded = slot;
+    return cmd;
+  }
+
+  void FrameCapture::submitted(uint64_t value) {
+    if(last_recorded) {
+      last_recorded->value = value;
+      last_recorded->pending = true;
+      last_recorded = nullptr;
+    }
+  }
+
+  void FrameCapture::poll(const Timeline& timeline) {
+    for(auto& slot: slots) {
+      if(slot->pending && timeline.is_complete(slot->value)) {
+        slot->pending = false;
+        Slot* finished = slot.get();
+        worker->submit([this, finished]() { encode(*finished); });
+      }
+    }
+  }
+
+  void FrameCapture::encode(Slot& slot) {
+    auto start = std::chrono::steady_clock::now();
+    if(!slot.coherent) {
+      vk::MappedMemoryRange range{};
+      range.setMemory(slot.buffer.memory);
+      range.setSize(VK_WHOLE_SIZE);
+      device.invalidateMappedMemoryRanges(1, &range);
+    }
+    RgbImage image;
+    image.width = slot.width;
+    image.height = slot.height;
+    size_t pixel_count = size_t(slot.width) * slot.height;
+    image.pixels.resize(pixel_count * 3);
+    const uint8_t* source = static_cast<const uint8_t*>(slot.mapped);
+    int red = slot.bgra ? 2 : 0, blue = slot.bgra ? 0 : 2;
+    for(size_t i = 0; i < pixel_count; i++) {
+      image.pixels[i * 3] = source[i * 4 + red];
+      image.pixels[i * 3 + 1] = source[i * 4 + 1];
+      image.pixels[i * 3 + 2] = source[i * 4 + blue];
+    }
+    auto callbacks = std::move(slot.callbacks);
+    slot.callbacks.clear();
+    bool video_frame = slot.video;
+    // Everything needed is copied out, the render thread can reuse it
+    slot.busy.store(false, std::memory_order_release);
+
+    if(video_frame) {
+      video.write_frame(image);
+    }
+    for(const auto& callback: callbacks) {
+      callback(image);
+    }
+    captured++;
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    encode_ms = encode_ms * 0.9 + elapsed.count() * 0.1;
+  }
+
+  CaptureStats FrameCapture::get_stats() const {
+    CaptureStats stats;
+    stats.captured = captured;
+    stats.dropped = dropped;
+    stats.encode_ms = encode_ms;
+    return stats;
+  }
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ImageIO.hpp"
+#include "MemoryBudget.hpp"
+#include "Resource.hpp"
+#include "ThreadPool.hpp"
+#include "Timeline.hpp"
+
+namespace jar {
+  struct CaptureStats {
+    uint64_t captured = 0;
+    // Wanted but every readback buffer was still busy
+    uint64_t dropped = 0;
+    double encode_ms = 0.0;
+  };
+
+  /*
+   * Reads presented frames back without stalling. A capture appends a copy
+   * of the swapchain image into one of a ring of host visible buffers to the
+   * frame's own submission, the graphics timeline value of that submission
+   * says when the data is there. poll() hands finished copies to a worker
+   * thread that converts them and runs the callbacks or appends them to the
+   * video, and the buffer is free again once converted. If every buffer is
+   * still in flight or being encoded the frame is dropped, not waited for.
+   *
+   * Everything but the callbacks runs on the thread calling draw_frame.
+   */
+  class FrameCapture {
+    public:
+    // On the worker thread
+    using Callback = std::function<void(const RgbImage& image)>;
+    static constexpr uint32_t default_slot_count = 3;
+
+    private:
+    struct Slot {
+      BufferAllocation buffer;
+      void* mapped = nullptr;
+      vk::DeviceSize capacity = 0;
+      bool coherent = true;
+      vk::CommandBuffer cmd;
+      uint32_t width = 0;
+      uint32_t height = 0;
+      bool bgra = false;
+      uint64_t value = 0;
+      bool pending = false;
+      bool video = false;
+      std::vector<Callback> callbacks;
+      // Set from record() until the worker is done reading it
+      std::atomic<bool> busy{false};
+    };
+
+    vk::Device device;
+    vk::PhysicalDevice physical_device;
+    DeletionQueue* deletion_queue = nullptr;
+    MemoryBudget* memory_budget = nullptr;
+    vk::CommandPool command_pool;
+    std::vector<std::unique_ptr<Slot>> slots;
+    Slot* last_recorded = nullptr;
+    std::vector<Callback> requests;
+    bool recording = false;
+    bool warned_format = false;
+
+    std::atomic<uint64_t> captured{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<double> encode_ms{0.0};
+    // Also the only one touching the video writer
+    std::unique_ptr<ThreadPool> worker;
+    Y4mWriter video;
+
+    void allocate(Slot& slot, vk::DeviceSize size);
+    void encode(Slot& slot);
+
+    public:
+    void create(vk::Device device,
+        vk::PhysicalDevice physical_device,
+        uint32_t queue_family,
+        DeletionQueue& deletion_queue,
+        MemoryBudget& memory_budget,
+        uint32_t slot_count = default_slot_count);
+    // Device idle, finishes the captures that were submitted
+    void destroy();
+
+    // Grabs the next frame that gets presented
+    void capture_next(Callback callback);
+    // Every frame from now on goes to a Y4M file, dropped ones are missing
+    void start_recording(const std::string& path, uint32_t width, uint32_t height, uint32_t fps = 60);
+    void stop_recording();
+    bool is_recording() const;
+
+    // With the frame about to be submitted, the image is in present layout
+    // once the frame's commands are done. Returns a command buffer to submit
+    // right after them, or nothing if no capture is wanted or possible.
+    vk::CommandBuffer record(vk::Image image, vk::Format format, vk::Extent2D extent);
+    // Timeline value of the submission record() went into
+    void submitted(uint64_t value);
+    // Once per frame, passes completed copies on to the worker
+    void poll(const Timeline& timeline);
+
+    CaptureStats get_stats() const;
+  };
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+struct FramePacing {
+  // Past this there is only latency to gain
+  static constexpr uint32_t max_frames_in_flight = 4;
+  // More frames in flight keeps the GPU busier at the cost of latency
+  uint32_t frames_in_flight = 2;
+  // Falls back to something supported, see jar::swapchain::choose_swap_present_mode
+  vk::PresentModeKHR present_mode = vk::PresentModeKHR::eMailbox;
+  // CPU side frame cap, 0 means uncapped
+  double max_fps = 0.0;
+
+  // Interactive use: one frame queued, newest image wins
+  static FramePacing low_latency() {
+    return {1, vk::PresentModeKHR::eMailbox, 0.0};
+  }
+
+  // Batch use: keep the queue full, never wait for vblank
+  static FramePacing throughput() {
+    return {3, vk::PresentModeKHR::eImmediate, 0.0};
+  }
+
+  // Plain vsync
+  static FramePacing vsync() {
+    return {2, vk::PresentModeKHR::eFifo, 0.0};
+  }
+};
+
+// Smoothed time from polling input until the frame using it was presented
+// and until the GPU was seen to be done with it
+struct LatencyStats {
+  double input_to_present_ms = 0.0;
+  double input_to_gpu_done_ms = 0.0;
+
+  static double smooth(double average, double sample) {
+    return average == 0.0 ? sample : average * 0.9 + sample * 0.1;
+  }
+};
+
+/*
+ * Caps the frame rate by sleeping most of the remaining frame time and
+ * spinning the last bit, sleep alone overshoots by up to a scheduler tick.
+ * Call wait() right before polling input so the frame starts as late as
+ * possible, that keeps the input fresh.
+ */
+class FrameLimiter {
+  using Clock = std::chrono::steady_clock;
+  static constexpr std::chrono::microseconds spin_threshold{2000};
+  Clock::duration frame_time{0};
+  Clock::time_point next_frame = Clock::now();
+
+  public:
+  void set_max_fps(double fps) {
+    frame_time = fps > 0.0 ?
+      std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps)) :
+      Clock::duration{0};
+    next_frame = Clock::now();
+  }
+
+  void wait() {
+    if(frame_time == Clock::duration{0}) {
+      return;
+    }
+    if(next_frame - Clock::now() > spin_threshold) {
+      std::this_thread::sleep_until(next_frame - spin_threshold);
+    }
+    while(Clock::now() < next_frame) {
+    }
+    // Don't try to catch up on frames that ran long, just start over
+    next_frame = std::max(next_frame + frame_time, Clock::now());
+  }
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vector>
+
+namespace jar::image {
+  vk::Format find_supported_format(const vk::PhysicalDevice& physical_device,
+      const std::vector<vk::Format>& candidates,
+      vk::ImageTiling tiling,
+      vk::FormatFeatureFlags features) {
+    for (const auto& format: candidates) {
+      vk::FormatProperties props = physical_device.getFormatProperties(format);
+      if (tiling == vk::ImageTiling::eLinear && (props.linearTilingFeatures & features) == features) {
+        return format;
+      }
+      if (tiling == vk::ImageTiling::eOptimal && (props.optimalTilingFeatures & features) == features) {
+        return format;
+      }
+    }
+    throw std::runtime_error("failed to find supported format!");
+  }
+
+  vk::Format find_depth_format(const vk::PhysicalDevice& physical_device) {
+    return find_supported_format(physical_device,
+        {vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint, vk::Format::eD24UnormS8Uint},
+        vk::ImageTiling::eOptimal,
+        vk::FormatFeatureFlagBits::eDepthStencilAttachment);
+  }
+
+  // Most samples up to requested that color and depth framebuffers both support
+  vk::SampleCountFlagBits find_sample_count(const vk::PhysicalDevice& physical_device, uint32_t requested) {
+    vk::PhysicalDeviceProperties properties;
+    physical_device.getProperties(&properties);
+    vk::SampleCountFlags supported = properties.limits.framebufferColorSampleCounts & properties.limits.framebufferDepthSampleCounts;
+    for(uint32_t samples = 64; samples > 1; samples /= 2) {
+      if(samples <= requested && (supported & static_cast<vk::SampleCountFlagBits>(samples))) {
+        return static_cast<vk::SampleCountFlagBits>(samples);
+      }
+    }
+    return vk::SampleCountFlagBits::e1;
+  }
+
+  bool has_stencil_component(vk::Format format) {
+    return format == vk::Format::eD32SfloatS8Uint || format == vk::Format::eD24UnormS8Uint;
+  }
+}
@@ -0,0 +1,279 @@
+#include "ImageIO.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+  const uint8_t png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+  const std::array<uint32_t, 256>& crc_table() {
+    static const std::array<uint32_t, 256> table = []() {
+      std::array<uint32_t, 256> table{};
+      for(uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for(int k = 0; k < 8; k++) {
+          c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+      }
+      return table;
+    }();
+    return table;
+  }
+
+  uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    const auto& table = crc_table();
+    crc = ~crc;
+    for(size_t i = 0; i < size; i++) {
+      crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+  }
+
+  void put_u32(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+  }
+
+  uint32_t get_u32(const uint8_t* data) {
+    return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+  }
+
+  void write_chunk(std::ofstream& file, const char* type, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> chunk;
+    chunk.reserve(data.size() + 12);
+    put_u32(chunk, static_cast<uint32_t>(data.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    // Over the type and the data, not the length
+    put_u32(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+    file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+  }
+
+  uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+    int p = int(a) + int(b) - int(c);
+    int pa = std::abs(p - int(a)), pb = std::abs(p - int(b)), pc = std::abs(p - int(c));
+    if(pa <= pb && pa <= pc) {
+      return a;
+    }
+    return pb <= pc ? b : c;
+  }
+
+  uint8_t to_byte(float value) {
+    return static_cast<uint8_t>(std::clamp(value + 0.5f, 0.0f, 255.0f));
+  }
+}
+
+namespace jar {
+  void write_png(const std::string& path, const RgbImage& image) {
+    std::ofstream file(path, std::ios::binary);
+    if(!file) {
+      throw std::runtime_error("failed to open " + path + " for writing!");
+    }
+    file.write(reinterpret_cast<const char*>(png_signature), sizeof(png_signature));
+
+    std::vector<uint8_t> header;
+    put_u32(header, image.width);
+    put_u32(header, image.height);
+    // 8 bit RGB, deflate, no filtering beyond the per row byte, not interlaced
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    write_chunk(file, "IHDR", header);
+
+    // Every row starts with filter type 0
+    size_t row_size = size_t(image.width) * 3;
+    std::vector<uint8_t> raw;
+    raw.reserve((row_size + 1) * image.height);
+    for(uint32_t y = 0; y < image.height; y++) {
+      raw.push_back(0);
+      auto row = image.pixels.begin() + y * row_size;
+      raw.insert(raw.end(), row, row + row_size);
+    }
+
+    // zlib stream of stored blocks, at most 65535 bytes each
+    std::vector<uint8_t> zlib;
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    size_t offset = 0;
+    do {
+      size_t size = std::min<size_t>(raw.size() - offset, 65535);
+      bool last = offset + size == raw.size();
+      zlib.push_back(last ? 1 : 0);
+      zlib.push_back(size & 0xff);
+      zlib.push_back(size >> 8);
+      zlib.push_back(~size & 0xff);
+      zlib.push_back((~size >> 8) & 0xff);
+      zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+      offset += size;
+    } while(offset < raw.size());
+    uint32_t a = 1, b = 0;
+    for(uint8_t byte: raw) {
+      a = (a + byte) % 65521;
+      b = (b + a) % 65521;
+    }
+    put_u32(zlib, (b << 16) | a);
+    write_chunk(file, "IDAT", zlib);
+    write_chunk(file, "IEND", {});
+    if(!file) {
+      throw std::runtime_error("failed to write " + path + "!");
+    }
+  }
+
+  RgbImage read_png(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file) {
+      throw std::runtime_error("failed to open " + path + "!");
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if(data.size() < 8 || !std::equal(png_signature, png_signature + 8, data.begin())) {
+      throw std::runtime_error(path + " is not a PNG!");
+    }
+
+    RgbImage image;
+    uint32_t channels = 0;
+    std::vector<uint8_t> zlib;
+    size_t offset = 8;
+    while(offset + 12 <= data.size()) {
+      uint32_t length = get_u32(&data[offset]);
+      std::string type(data.begin() + offset + 4, data.begin() + offset + 8);
+      const uint8_t* body = &data[offset + 8];
+      if(offset + 12 + length > data.size()) {
+        throw std::runtime_error(path + " is truncated!");
+      }
+      if(type == "IHDR") {
+        image.width = get_u32(body);
+        image.height = get_u32(body + 4);
+        uint8_t depth = body[8], color_type = body[9], interlace = body[12];
+        if(depth != 8 || (color_type != 2 && color_type != 6) || interlace != 0) {
+          throw std::runtime_error(path + " isn't 8 bit RGB or RGBA without interlacing!");
+        }
+        channels = color_type == 6 ? 4 : 3;
+      } else if(type == "IDAT") {
+        zlib.insert(zlib.end(), body, body + length);
+      } else if(type == "IEND") {
+        break;
+      }
+      offset += 12 + length;
+    }
+    if(channels == 0) {
+      throw std::runtime_error(path + " has no header!");
+    }
+
+    std::vector<uint8_t> raw;
+    size_t position = 2;
+    bool last = false;
+    while(!last) {
+      if(position + 5 > zlib.size()) {
+        throw std::runtime_error(path + " has a truncated image stream!");
+      }
+      uint8_t block_header = zlib[position];
+      last = block_header & 1;
+      if((block_header >> 1) & 3) {
+        throw std::runtime_error(path + " is compressed, only uncompressed PNGs can be read!");
+      }
+      size_t size = zlib[position + 1] | (zlib[position + 2] << 8);
+      position += 5;
+      if(position + size > zlib.size()) {
+        throw std::runtime_error(path + " has a truncated image stream!");
+      }
+      raw.insert(raw.end(), zlib.begin() + position, zlib.begin() + position + size);
+      position += size;
+    }
+
+    size_t stride = size_t(image.width) * channels;
+    if(raw.size() < (stride + 1) * image.height) {
+      throw std::runtime_error(path + " has fewer rows than its size says!");
+    }
+    std::vector<uint8_t> previous(stride, 0), row(stride);
+    image.pixels.resize(size_t(image.width) * image.height * 3);
+    for(uint32_t y = 0; y < image.height; y++) {
+      const uint8_t* line = &raw[y * (stride + 1)];
+      uint8_t filter = line[0];
+      for(size_t x = 0; x < stride; x++) {
+        uint8_t left = x >= channels ? row[x - channels] : 0;
+        uint8_t up = previous[x];
+        uint8_t up_left = x >= channels ? previous[x - channels] : 0;
+        uint8_t value = line[1 + x];
+        switch(filter) {
+          case 0: break;
+          case 1: value += left; break;
+          case 2: value += up; break;
+          case 3: value += (int(left) + int(up)) / 2; break;
+          case 4: value += paeth(left, up, up_left); break;
+          default: throw std::runtime_error(path + " has an unknown row filter!");
+        }
+        row[x] = value;
+      }
+      for(uint32_t x = 0; x < image.width; x++) {
+        std::copy_n(&row[x * channels], 3, &image.pixels[(size_t(y) * image.width + x) * 3]);
+      }
+      std::swap(previous, row);
+    }
+    return image;
+  }
+
+  void Y4mWriter::open(const std::string& path, uint32_t width, uint32_t height, uint32_t fps) {
+    file.open(path, std::ios::binary);
+    if(!file) {
+      throw std::runtime_error("failed to open " + path + " for writing!");
+    }
+    this->width = width;
+    this->height = height;
+    file << "YUV4MPEG2 W" << width << " H" << height << " F" << fps << ":1 Ip A1:1 C444\n";
+    planes.resize(size_t(width) * height * 3);
+  }
+
+  bool Y4mWriter::write_frame(const RgbImage& image) {
+    if(!file.is_open() || image.width != width || image.height != height) {
+      return false;
+    }
+    // BT.601 limited range, what players assume without a colour tag
+    size_t pixel_count = size_t(width) * height;
+    uint8_t* y_plane = planes.data();
+    uint8_t* u_plane = y_plane + pixel_count;
+    uint8_t* v_plane = u_plane + pixel_count;
+    for(size_t i = 0; i < pixel_count; i++) {
+      float r = image.pixels[i * 3], g = image.pixels[i * 3 + 1], b = image.pixels[i * 3 + 2];
+      y_plane[i] = to_byte(16.0f + 0.257f * r + 0.504f * g + 0.098f * b);
+      u_plane[i] = to_byte(128.0f - 0.148f * r - 0.291f * g + 0.439f * b);
+      v_plane[i] = to_byte(128.0f + 0.439f * r - 0.368f * g - 0.071f * b);
+    }
+    file << "FRAME\n";
+    file.write(reinterpret_cast<const char*>(planes.data()), planes.size());
+    return static_cast<bool>(file);
+  }
+
+  void Y4mWriter::close() {
+    file.close();
+  }
+
+  bool Y4mWriter::is_open() const {
+    return file.is_open();
+  }
+
+  ImageDifference compare_images(const RgbImage& a, const RgbImage& b, uint32_t tolerance) {
+    ImageDifference difference;
+    if(a.width != b.width || a.height != b.height) {
+      difference.same_size = false;
+      return difference;
+    }
+    double squared = 0.0;
+    size_t pixel_count = size_t(a.width) * a.height;
+    for(size_t i = 0; i < pixel_count; i++) {
+      uint32_t pixel_difference = 0;
+      for(size_t c = 0; c < 3; c++) {
+        int delta = int(a.pixels[i * 3 + c]) - int(b.pixels[i * 3 + c]);
+        pixel_difference = std::max<uint32_t>(pixel_difference, std::abs(delta));
+        squared += double(delta) * delta;
+      }
+      difference.max_difference = std::max(difference.max_difference, pixel_difference);
+      difference.differing_pixels += pixel_difference > tolerance;
+    }
+    difference.rmse = pixel_count > 0 ? std::sqrt(squared / (pixel_count * 3)) : 0.0;
+    return difference;
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace jar {
+  // 8 bit RGB, rows top to bottom, no padding
+  struct RgbImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> pixels;
+  };
+
+  // Uncompressed deflate, there is no zlib to lean on. Captures are for
+  // comparing and converting, not for keeping around.
+  void write_png(const std::string& path, const RgbImage& image);
+  // 8 bit RGB or RGBA, not interlaced. Only stored deflate blocks are
+  // understood, which is what write_png produces, so baselines have to come
+  // from a capture.
+  RgbImage read_png(const std::string& path);
+
+  // Raw 4:4:4 YUV4MPEG2 stream, ffmpeg and most players take it as is
+  class Y4mWriter {
+    std::ofstream file;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> planes;
+
+    public:
+    void open(const std::string& path, uint32_t width, uint32_t height, uint32_t fps);
+    // Frames of another size are skipped, returns whether it was written
+    bool write_frame(const RgbImage& image);
+    void close();
+    bool is_open() const;
+  };
+
+  struct ImageDifference {
+    bool same_size = true;
+    // Largest difference of any channel
+    uint32_t max_difference = 0;
+    // Pixels with a channel off by more than the tolerance
+    size_t differing_pixels = 0;
+    double rmse = 0.0;
+
+    bool matches() const {
+      return same_size && differing_pixels == 0;
+    }
+  };
+
+  ImageDifference compare_images(const RgbImage& a, const RgbImage& b, uint32_t tolerance = 0);
+}
@@ -0,0 +1,256 @@
+#include "Json.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+  using jar::json::Value;
+
+  struct Parser {
+    const std::string& text;
+    size_t position = 0;
+    uint32_t depth = 0;
+
+    [[noreturn]] void fail(const std::string& what) const {
+      throw std::runtime_error("failed to parse JSON at offset " + std::to_string(position) + ", " + what + "!");
+    }
+
+    void skip_space() {
+      while(position < text.size() && (text[position] == ' ' || text[position] == '\t' || text[position] == '\r' || text[position] == '\n')) {
+        position++;
+      }
+    }
+
+    void expect(char c) {
+      skip_space();
+      if(position >= text.size() || text[position] != c) {
+        fail(std::string("expected '") + c + "'");
+      }
+      position++;
+    }
+
+    bool next_is(char c) {
+      skip_space();
+      return position < text.size() && text[position] == c;
+    }
+
+    bool consume(const char* word) {
+      size_t length = std::char_traits<char>::length(word);
+      if(text.compare(position, length, word) != 0) {
+        return false;
+      }
+      position += length;
+      return true;
+    }
+
+    uint32_t hex4() {
+      if(position + 4 > text.size()) {
+        fail("truncated escape");
+      }
+      uint32_t code = 0;
+      for(int i = 0; i < 4; i++) {
+        char c = text[position++];
+        code <<= 4;
+        if(c >= '0' && c <= '9') {
+          code |= c - '0';
+        } else if(c >= 'a' && c <= 'f') {
+          code |= c - 'a' + 10;
+        } else if(c >= 'A' && c <= 'F') {
+          code |= c - 'A' + 10;
+        } else {
+          fail("bad escape");
+        }
+      }
+      return code;
+    }
+
+    void append_utf8(std::string& out, uint32_t code) {
+      if(code < 0x80) {
+        out += static_cast<char>(code);
+      } else if(code < 0x800) {
+        out += static_cast<char>(0xc0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+      } else if(code < 0x10000) {
+        out += static_cast<char>(0xe0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+      } else {
+        out += static_cast<char>(0xf0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+      }
+    }
+
+    std::string parse_string() {
+      expect('"');
+      std::string out;
+      while(true) {
+        if(position >= text.size()) {
+          fail("unterminated string");
+        }
+        char c = text[position++];
+        if(c == '"') {
+          return out;
+        }
+        if(static_cast<unsigned char>(c) < 0x20) {
+          fail("control character in string");
+        }
+        if(c != '\\') {
+          out += c;
+          continue;
+        }
+        if(position >= text.size()) {
+          fail("unterminated string");
+        }
+        char escape = text[position++];
+        switch(escape) {
+          case '"': out += '"'; break;
+          case '\\': out += '\\'; break;
+          case '/': out += '/'; break;
+          case 'b': out += '\b'; break;
+          case 'f': out += '\f'; break;
+          case 'n': out += '\n'; break;
+          case 'r': out += '\r'; break;
+          case 't': out += '\t'; break;
+          case 'u': {
+            uint32_t code = hex4();
+            // Surrogate pairs
+            if(code >= 0xd800 && code < 0xdc00 && consume("\\u")) {
+              uint32_t low = hex4();
+              if(low < 0xdc00 || low >= 0xe000) {
+                fail("bad surrogate pair");
+              }
+              code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            }
+            append_utf8(out, code);
+            break;
+          }
+          default: fail("bad escape");
+        }
+      }
+    }
+
+    double parse_number() {
+      // Stricter than strtod, which would take hex, inf and nan
+      size_t start = position;
+      if(position < text.size() && text[position] == '-') {
+        position++;
+      }
+      size_t digits = position;
+      auto skip_digits = [this]() {
+        while(position < text.size() && text[position] >= '0' && text[position] <= '9') {
+          position++;
+        }
+      };
+      skip_digits();
+      if(position == digits) {
+        fail("expected a value");
+      }
+      if(position < text.size() && text[position] == '.') {
+        position++;
+        skip_digits();
+      }
+      if(position < text.size() && (text[position] == 'e' || text[position] == 'E')) {
+        position++;
+        if(position < text.size() && (text[position] == '+' || text[position] == '-')) {
+          position++;
+        }
+        skip_digits();
+      }
+      return std::strtod(text.substr(start, position - start).c_str(), nullptr);
+    }
+
+    Value parse_value() {
+      // Deep enough for anything the tools write, shallow enough for the stack
+      if(++depth > 64) {
+        fail("nested too deep");
+      }
+      skip_space();
+      if(position >= text.size()) {
+        fail("unexpected end");
+      }
+      Value value;
+      char c = text[position];
+      if(c == '{') {
+        value.type = Value::Type::object;
+        position++;
+        if(!next_is('}')) {
+          do {
+            skip_space();
+            value.keys.push_back(parse_string());
+            expect(':');
+            value.items.push_back(parse_value());
+          } while(next_is(',') && ++position);
+        }
+        expect('}');
+      } else if(c == '[') {
+        value.type = Value::Type::array;
+        position++;
+        if(!next_is(']')) {
+          do {
+            value.items.push_back(parse_value());
+          } while(next_is(',') && ++position);
+        }
+        expect(']');
+      } else if(c == '"') {
+        value.type = Value::Type::string;
+        value.string = parse_string();
+      } else if(consume("true")) {
+        value.type = Value::Type::boolean;
+        value.boolean = true;
+      } else if(consume("false")) {
+        value.type = Value::Type::boolean;
+      } else if(consume("null")) {
+        value.type = Value::Type::null;
+      } else {
+        value.type = Value::Type::number;
+        value.number = parse_number();
+      }
+      depth--;
+      return value;
+    }
+  };
+}
+
+namespace jar::json {
+  const Value* Value::find(const std::string& key) const {
+    if(type != Type::object) {
+      return nullptr;
+    }
+    for(size_t i = 0; i < keys.size(); i++) {
+      if(keys[i] == key) {
+        return &items[i];
+      }
+    }
+    return nullptr;
+  }
+
+  Value parse(const std::string& text) {
+    Parser parser{text};
+    Value value = parser.parse_value();
+    parser.skip_space();
+    if(parser.position != text.size()) {
+      parser.fail("trailing characters");
+    }
+    return value;
+  }
+
+  std::string quote(const std::string& text) {
+    std::string escaped = "\"";
+    for(char c: text) {
+      if(c == '"' || c == '\\') {
+        escaped += '\\';
+        escaped += c;
+      } else if(static_cast<unsigned char>(c) < 0x20) {
+        char code[8];
+        std::snprintf(code, sizeof(code), "\\u%04x", c);
+        escaped += code;
+      } else {
+        escaped += c;
+      }
+    }
+    return escaped + "\"";
+  }
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Just enough JSON for the tools' reports and reading them back. Parse
+// errors throw a std::runtime_error with the offset.
+namespace jar::json {
+  struct Value {
+    enum class Type {null, boolean, number, string, array, object};
+    Type type = Type::null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    // Array elements, or object members in file order next to their keys
+    std::vector<Value> items;
+    std::vector<std::string> keys;
+
+    // Object member, nullptr if there is none or this isn't an object
+    const Value* find(const std::string& key) const;
+  };
+
+  Value parse(const std::string& text);
+  // Quoted and escaped
+  std::string quote(const std::string& text);
+}
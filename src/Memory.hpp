@@ -1,7 +1,7 @@
 #pragma once
 #include <vulkan/vulkan.hpp>
 namespace jar::memory {
-  uint32_t findMemoryType(const vk::PhysicalDevice& physical_device, uint32_t typeFilter, vk::MemoryPropertyFlags properties) {
+  inline uint32_t findMemoryType(const vk::PhysicalDevice& physical_device, uint32_t typeFilter, vk::MemoryPropertyFlags properties) {
     vk::PhysicalDeviceMemoryProperties mem_properties;
     physical_device.getMemoryProperties(&mem_properties);
 
@@ -0,0 +1,191 @@
+#include "MemoryBudget.hpp"
+#include "Resource.hpp"
+#include <algorithm>
+
+namespace jar {
+  const char* to_string(MemoryCategory category) {
+    switch(category) {
+      case MemoryCategory::mesh: return "mesh";
+      case MemoryCategory::texture: return "texture";
+      case MemoryCategory::uniform: return "uniform";
+      case MemoryCategory::staging: return "staging";
+      case MemoryCategory::indirect: return "indirect";
+      case MemoryCategory::particles: return "particles";
+      case MemoryCategory::render_target: return "render target";
+      case MemoryCategory::readback: return "readback";
+      case MemoryCategory::lights: return "lights";
+      case MemoryCategory::shadows: return "shadows";
+      default: return "unknown";
+    }
+  }
+
+  void MemoryBudget::init(vk::PhysicalDevice physical_device, const vk::DispatchLoaderDynamic& dispatch, bool driver_budget) {
+    this->physical_device = physical_device;
+    this->dispatch = &dispatch;
+    this->driver_budget = driver_budget;
+
+    vk::PhysicalDeviceMemoryProperties properties;
+    physical_device.getMemoryProperties(&properties);
+    type_heaps.resize(properties.memoryTypeCount);
+    for(uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+      type_heaps[i] = properties.memoryTypes[i].heapIndex;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    heaps.assign(properties.memoryHeapCount, {});
+    warned.assign(properties.memoryHeapCount, false);
+    driver_usage_tracked.assign(properties.memoryHeapCount, 0);
+    for(uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+      auto& heap = heaps[i];
+      heap.size = properties.memoryHeaps[i].size;
+      heap.device_local = static_cast<bool>(properties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+      heap.budget = static_cast<vk::DeviceSize>(heap.size * fallback_budget_fraction);
+    }
+    refresh_locked();
+  }
+
+  void MemoryBudget::refresh_locked() {
+    last_refresh = std::chrono::steady_clock::now();
+    if(!driver_budget) {
+      return;
+    }
+    vk::PhysicalDeviceMemoryBudgetPropertiesEXT budget_properties{};
+    vk::PhysicalDeviceMemoryProperties2 properties{};
+    properties.setPNext(&budget_properties);
+    physical_device.getMemoryProperties2KHR(&properties, *dispatch);
+    for(size_t i = 0; i < heaps.size(); i++) {
+      auto& heap = heaps[i];
+      heap.budget = budget_properties.heapBudget[i];
+      // Our allocations since this refresh are added on top in usage_locked
+      heap.usage = budget_properties.heapUsage[i];
+      driver_usage_tracked[i] = heap.tracked;
+    }
+  }
+
+  vk::DeviceSize MemoryBudget::usage_locked(uint32_t heap) const {
+    const auto& budget = heaps[heap];
+    if(!driver_budget) {
+      return budget.tracked;
+    }
+    // The driver only knows about allocations up to the last refresh
+    int64_t since_refresh = static_cast<int64_t>(budget.tracked) - static_cast<int64_t>(driver_usage_tracked[heap]);
+    return static_cast<vk::DeviceSize>(std::max<int64_t>(0, static_cast<int64_t>(budget.usage) + since_refresh));
+  }
+
+  void MemoryBudget::allocated(uint32_t memory_type, MemoryCategory category, vk::DeviceSize size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    heaps[type_heaps[memory_type]].tracked += size;
+    categories[static_cast<size_t>(category)] += size;
+    allocation_count++;
+  }
+
+  void MemoryBudget::freed(uint32_t memory_type, MemoryCategory category, vk::DeviceSize size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    heaps[type_heaps[memory_type]].tracked -= size;
+    categories[static_cast<size_t>(category)] -= size;
+    allocation_count--;
+  }
+
+  bool MemoryBudget::fits(uint32_t memory_type, vk::DeviceSize size) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t heap = type_heaps[memory_type];
+    return usage_locked(heap) + size <= heaps[heap].budget;
+  }
+
+  void MemoryBudget::update() {
+    std::vector<std::pair<uint32_t, HeapBudget>> warnings;
+    std::vector<WarningCallback> to_call;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(std::chrono::steady_clock::now() - last_refresh >= refresh_interval) {
+        refresh_locked();
+      }
+      for(uint32_t i = 0; i < heaps.size(); i++) {
+        HeapBudget heap = heaps[i];
+        heap.usage = usage_locked(i);
+        bool over = heap.fraction_used() >= warning_fraction;
+        if(over && !warned[i]) {
+          warnings.push_back({i, heap});
+        }
+        warned[i] = over;
+      }
+      if(!warnings.empty()) {
+        to_call = callbacks;
+      }
+    }
+    // Outside the lock, a callback may well free something
+    for(const auto& [heap, budget]: warnings) {
+      for(const auto& callback: to_call) {
+        callback(heap, budget);
+      }
+    }
+  }
+
+  void MemoryBudget::add_warning_callback(WarningCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    callbacks.push_back(std::move(callback));
+  }
+
+  void MemoryBudget::set_warning_fraction(float fraction) {
+    std::lock_guard<std::mutex> lock(mutex);
+    warning_fraction = fraction;
+  }
+
+  MemoryReport MemoryBudget::get_report() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    MemoryReport report;
+    report.heaps = heaps;
+    for(uint32_t i = 0; i < heaps.size(); i++) {
+      report.heaps[i].usage = usage_locked(i);
+    }
+    report.categories = categories;
+    report.allocation_count = allocation_count;
+    report.driver_budget = driver_budget;
+    return report;
+  }
+
+  bool MemoryBudget::has_driver_budget() const {
+    return driver_budget;
+  }
+
+  MemoryCharge::MemoryCharge(MemoryBudget& budget, DeletionQueue& queue, uint32_t memory_type, MemoryCategory category, vk::DeviceSize size):
+    budget(&budget), queue(&queue), memory_type(memory_type), category(category), size(size) {
+    budget.allocated(memory_type, category, size);
+  }
+
+  MemoryCharge::MemoryCharge(MemoryCharge&& other) noexcept:
+    budget(other.budget), queue(other.queue), memory_type(other.memory_type), category(other.category), size(other.size) {
+    other.budget = nullptr;
+  }
+
+  MemoryCharge& MemoryCharge::operator=(MemoryCharge&& other) noexcept {
+    if(this != &other) {
+      reset();
+      budget = other.budget;
+      queue = other.queue;
+      memory_type = other.memory_type;
+      category = other.category;
+      size = other.size;
+      other.budget = nullptr;
+    }
+    return *this;
+  }
+
+  MemoryCharge::~MemoryCharge() {
+    reset();
+  }
+
+  void MemoryCharge::reset() {
+    if(!budget) {
+      return;
+    }
+    MemoryBudget* budget = this->budget;
+    uint32_t memory_type = this->memory_type;
+    MemoryCategory category = this->category;
+    vk::DeviceSize size = this->size;
+    queue->defer([budget, memory_type, category, size]() {
+      budget->freed(memory_type, category, size);
+    });
+    this->budget = nullptr;
+  }
+}
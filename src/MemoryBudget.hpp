@@ -0,0 +1,130 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace jar {
+  class DeletionQueue;
+
+  enum class MemoryCategory : uint32_t {
+    mesh,
+    texture,
+    uniform,
+    staging,
+    indirect,
+    particles,
+    render_target,
+    readback,
+    lights,
+    shadows,
+    count
+  };
+  constexpr size_t memory_category_count = static_cast<size_t>(MemoryCategory::count);
+  const char* to_string(MemoryCategory category);
+
+  struct HeapBudget {
+    vk::DeviceSize size = 0;
+    // What the driver says this process may use, with VK_EXT_memory_budget.
+    // Without it a fixed share of the heap, the rest is left to everyone else.
+    vk::DeviceSize budget = 0;
+    // Driver reported usage if there is one, otherwise what we allocated
+    vk::DeviceSize usage = 0;
+    // Only what went through a MemoryBudget
+    vk::DeviceSize tracked = 0;
+    bool device_local = false;
+
+    float fraction_used() const {
+      return budget > 0 ? static_cast<float>(usage) / static_cast<float>(budget) : 0.0f;
+    }
+  };
+
+  struct MemoryReport {
+    std::vector<HeapBudget> heaps;
+    std::array<vk::DeviceSize, memory_category_count> categories{};
+    uint32_t allocation_count = 0;
+    bool driver_budget = false;
+  };
+
+  /*
+   * Accounts device memory per heap and per category. Allocations are
+   * reported as they happen, the driver's view through VK_EXT_memory_budget
+   * is refreshed from update() at most every refresh_interval since asking
+   * isn't free. Warning callbacks fire from update() when a heap goes over
+   * warning_fraction of its budget, and again only after it dropped back
+   * under it. fits() is for anything that can evict before allocating.
+   *
+   * Recording and querying are thread safe, startup allocates on several
+   * threads. Callbacks run on whichever thread calls update().
+   */
+  class MemoryBudget {
+    public:
+    using WarningCallback = std::function<void(uint32_t heap, const HeapBudget& budget)>;
+    static constexpr float default_warning_fraction = 0.9f;
+    // Of a heap's size, when the driver can't tell us
+    static constexpr float fallback_budget_fraction = 0.8f;
+    static constexpr std::chrono::milliseconds refresh_interval{500};
+
+    private:
+    vk::PhysicalDevice physical_device;
+    const vk::DispatchLoaderDynamic* dispatch = nullptr;
+    bool driver_budget = false;
+    std::vector<uint32_t> type_heaps;
+
+    mutable std::mutex mutex;
+    std::vector<HeapBudget> heaps;
+    std::vector<bool> warned;
+    // Each heap's tracked bytes when the driver was last asked
+    std::vector<vk::DeviceSize> driver_usage_tracked;
+    std::array<vk::DeviceSize, memory_category_count> categories{};
+    uint32_t allocation_count = 0;
+    float warning_fraction = default_warning_fraction;
+    std::vector<WarningCallback> callbacks;
+    std::chrono::steady_clock::time_point last_refresh{};
+
+    void refresh_locked();
+    vk::DeviceSize usage_locked(uint32_t heap) const;
+
+    public:
+    // driver_budget if VK_EXT_memory_budget was enabled on the device, the
+    // dispatch needs VK_KHR_get_physical_device_properties2 loaded
+    void init(vk::PhysicalDevice physical_device, const vk::DispatchLoaderDynamic& dispatch, bool driver_budget);
+
+    void allocated(uint32_t memory_type, MemoryCategory category, vk::DeviceSize size);
+    void freed(uint32_t memory_type, MemoryCategory category, vk::DeviceSize size);
+    // Whether size more bytes of memory_type stay within its heap's budget
+    bool fits(uint32_t memory_type, vk::DeviceSize size) const;
+
+    // Once per frame
+    void update();
+    void add_warning_callback(WarningCallback callback);
+    void set_warning_fraction(float fraction);
+    MemoryReport get_report() const;
+    bool has_driver_budget() const;
+  };
+
+  // An allocation counted against a MemoryBudget until it is reset. The
+  // release goes through the deletion queue, so it is uncounted when the
+  // memory is actually freed.
+  class MemoryCharge {
+    MemoryBudget* budget = nullptr;
+    DeletionQueue* queue = nullptr;
+    uint32_t memory_type = 0;
+    MemoryCategory category = MemoryCategory::mesh;
+    vk::DeviceSize size = 0;
+
+    public:
+    MemoryCharge() = default;
+    MemoryCharge(MemoryBudget& budget, DeletionQueue& queue, uint32_t memory_type, MemoryCategory category, vk::DeviceSize size);
+    MemoryCharge(const MemoryCharge&) = delete;
+    MemoryCharge& operator=(const MemoryCharge&) = delete;
+    MemoryCharge(MemoryCharge&& other) noexcept;
+    MemoryCharge& operator=(MemoryCharge&& other) noexcept;
+    ~MemoryCharge();
+
+    void reset();
+  };
+}
@@ -0,0 +1,309 @@
+#include "ParticleSystem.hpp"
+#include "Memory.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+  // Everything the previous dispatch wrote, visible to the next one and to
+  // the indirect dispatch reading its arguments
+  void compute_barrier(vk::CommandBuffer cmd) {
+    vk::MemoryBarrier barrier{};
+    barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
+    barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eIndirectCommandRead);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect,
+        {}, 1, &barrier, 0, nullptr, 0, nullptr);
+  }
+
+  vk::PipelineShaderStageCreateInfo compute_stage(vk::ShaderModule module) {
+    vk::PipelineShaderStageCreateInfo stage{};
+    stage.setStage(vk::ShaderStageFlagBits::eCompute);
+    stage.setModule(module);
+    stage.setPName("main");
+    return stage;
+  }
+}
+
+namespace jar {
+  void ParticleSystem::create(vk::Device device,
+      vk::PhysicalDevice physical_device,
+      DeletionQueue& deletion_queue,
+      MemoryBudget& memory_budget,
+      LayoutCache& layouts,
+      const ShaderManager& shaders,
+      const std::vector<uint32_t>& sharing_families,
+      const ParticleSettings& settings) {
+    this->device = device;
+    this->physical_device = physical_device;
+    this->deletion_queue = &deletion_queue;
+    this->memory_budget = &memory_budget;
+    this->layouts = &layouts;
+    this->sharing_families = sharing_families;
+    this->settings = settings;
+    initialized = false;
+
+    vk::DeviceSize capacity = settings.capacity;
+    // Positions and alive lists have a set being drawn and a set being built
+    positions = create_buffer(2 * capacity * sizeof(glm::vec4), vk::BufferUsageFlagBits::eStorageBuffer);
+    velocities = create_buffer(capacity * sizeof(glm::vec4), vk::BufferUsageFlagBits::eStorageBuffer);
+    alive = create_buffer(2 * capacity * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer);
+    dead = create_buffer(capacity * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer);
+    // dead_count, current, alive_count[2], then the simulate dispatch arguments
+    counters = create_buffer(8 * sizeof(uint32_t),
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer);
+
+    // Set 1 of the particle pipeline, set 0 is the app's uniform buffer
+    auto render_description = merge_layouts({reflect(shaders.get("particle.vert"))});
+    if(render_description.sets.count(1) == 0) {
+      throw std::runtime_error("particle.vert has no particle buffers in set 1!");
+    }
+    render_bindings = render_description.sets[1];
+    for(const auto& binding: render_bindings) {
+      if(binding.binding > 5) {
+        throw std::runtime_error("particle.vert uses an unknown particle buffer binding!");
+      }
+    }
+    render_set_layout = layouts.get_set_layout(render_bindings);
+
+    // Every simulation shader binds this one set, each uses part of it
+    compute_set_layout = layouts.get_set_layout({
+      {0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+      {1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+      {2, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+      {3, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+      {4, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+      {5, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute}
+    });
+  }
+
+  void ParticleSystem::set_slot_count(uint32_t count) {
+    draws = create_buffer(count * sizeof(DrawRecord),
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst);
+    clear_draws = true;
+    create_descriptor_sets();
+  }
+
+  BufferAllocation ParticleSystem::create_buffer(vk::DeviceSize size, vk::BufferUsageFlags usage) {
+    vk::BufferCreateInfo buffer_info{};
+    buffer_info.setSize(size);
+    buffer_info.setUsage(usage);
+    // Written on the compute queue, read on the graphics queue
+    if(sharing_families.size() > 1) {
+      buffer_info.setSharingMode(vk::SharingMode::eConcurrent);
+      buffer_info.setQueueFamilyIndexCount(static_cast<uint32_t>(sharing_families.size()));
+      buffer_info.setPQueueFamilyIndices(sharing_families.data());
+    } else {
+      buffer_info.setSharingMode(vk::SharingMode::eExclusive);
+    }
+
+    BufferAllocation allocation;
+    allocation.size = size;
+    vk::Buffer buffer;
+    if(device.createBuffer(&buffer_info, nullptr, &buffer) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create particle buffer!");
+    }
+    allocation.buffer = UniqueBuffer(*deletion_queue, buffer);
+
+    vk::MemoryRequirements mem_requirements = device.getBufferMemoryRequirements(buffer);
+    uint32_t memory_type = memory::findMemoryType(physical_device,
+        mem_requirements.memoryTypeBits,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    vk::MemoryAllocateInfo alloc_info{};
+    alloc_info.setAllocationSize(mem_requirements.size);
+    alloc_info.setMemoryTypeIndex(memory_type);
+    vk::DeviceMemory memory;
+    if(device.allocateMemory(&alloc_info, nullptr, &memory) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to allocate particle buffer memory!");
+    }
+    allocation.memory = UniqueMemory(*deletion_queue, memory);
+    allocation.charge = MemoryCharge(*memory_budget, *deletion_queue, memory_type, MemoryCategory::particles, mem_requirements.size);
+    device.bindBufferMemory(buffer, memory, 0);
+    return allocation;
+  }
+
+  void ParticleSystem::create_descriptor_sets() {
+    vk::DescriptorPoolSize pool_size{};
+    pool_size.setType(vk::DescriptorType::eStorageBuffer);
+    pool_size.setDescriptorCount(12);
+    vk::DescriptorPoolCreateInfo pool_info{};
+    pool_info.setPoolSizeCount(1);
+    pool_info.setPPoolSizes(&pool_size);
+    pool_info.setMaxSets(2);
+    vk::DescriptorPool pool;
+    if(device.createDescriptorPool(&pool_info, nullptr, &pool) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create particle descriptor pool!");
+    }
+    // The sets of the old pool go with it
+    descriptor_pool = Unique<vk::DescriptorPool>(*deletion_queue, pool);
+
+    vk::DescriptorSetLayout set_layouts[] = {compute_set_layout, render_set_layout};
+    vk::DescriptorSet sets[2];
+    vk::DescriptorSetAllocateInfo alloc_info{};
+    alloc_info.setDescriptorPool(descriptor_pool);
+    alloc_info.setDescriptorSetCount(2);
+    alloc_info.setPSetLayouts(set_layouts);
+    if(device.allocateDescriptorSets(&alloc_info, sets) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to allocate particle descriptor sets!");
+    }
+    compute_set = sets[0];
+    render_set = sets[1];
+
+    // Binding numbers are the same in both sets
+    const BufferAllocation* buffers[] = {&positions, &velocities, &alive, &dead, &counters, &draws};
+    std::vector<vk::DescriptorBufferInfo> buffer_infos;
+    for(const auto* buffer: buffers) {
+      buffer_infos.push_back({buffer->buffer, 0, VK_WHOLE_SIZE});
+    }
+    std::vector<vk::WriteDescriptorSet> writes;
+    for(uint32_t binding = 0; binding < buffer_infos.size(); binding++) {
+      vk::WriteDescriptorSet write{};
+      write.setDstSet(compute_set);
+      write.setDstBinding(binding);
+      write.setDescriptorType(vk::DescriptorType::eStorageBuffer);
+      write.setDescriptorCount(1);
+      write.setPBufferInfo(&buffer_infos[binding]);
+      writes.push_back(write);
+    }
+    for(const auto& binding: render_bindings) {
+      vk::WriteDescriptorSet write{};
+      write.setDstSet(render_set);
+      write.setDstBinding(binding.binding);
+      write.setDescriptorType(vk::DescriptorType::eStorageBuffer);
+      write.setDescriptorCount(1);
+      write.setPBufferInfo(&buffer_infos[binding.binding]);
+      writes.push_back(write);
+    }
+    device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+  }
+
+  void ParticleSystem::create_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders) {
+    build_pipelines(modules, shaders)();
+  }
+
+  std::function<void()> ParticleSystem::build_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders) {
+    const char* sources[] = {"particle_init.comp", "particle_simulate.comp", "particle_emit.comp", "particle_finish.comp"};
+    std::vector<ShaderReflection> reflections;
+    std::vector<vk::ComputePipelineCreateInfo> pipeline_infos;
+    for(const char* source: sources) {
+      Spirv spirv = shaders.get(source);
+      reflections.push_back(reflect(spirv));
+      vk::ComputePipelineCreateInfo pipeline_info{};
+      pipeline_info.setStage(compute_stage(modules.get_module(spirv)));
+      pipeline_infos.push_back(pipeline_info);
+    }
+
+    auto description = merge_layouts(reflections);
+    if(description.push_constants.size() != 1 || description.push_constants[0].size != sizeof(PushConstants)) {
+      throw std::runtime_error("particle shaders don't match ParticleSystem::PushConstants!");
+    }
+    auto set_layouts = layouts->get_set_layouts(description);
+    if(set_layouts.size() != 1 || set_layouts[0] != compute_set_layout) {
+      throw std::runtime_error("particle shaders don't match the particle buffers!");
+    }
+    vk::PipelineLayout layout = layouts->get_pipeline_layout(description);
+    for(auto& pipeline_info: pipeline_infos) {
+      pipeline_info.setLayout(layout);
+    }
+
+    std::vector<vk::Pipeline> pipelines(pipeline_infos.size());
+    if(device.createComputePipelines(nullptr, static_cast<uint32_t>(pipeline_infos.size()), pipeline_infos.data(), nullptr, pipelines.data()) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create particle pipelines!");
+    }
+    // Batches still in flight keep the old ones until the deletion queue gets to them
+    auto built = std::make_shared<std::array<UniquePipeline, 4>>();
+    for(size_t i = 0; i < built->size(); i++) {
+      (*built)[i] = UniquePipeline(*deletion_queue, pipelines[i]);
+    }
+    return [this, layout, built]() {
+      compute_layout = layout;
+      init_pipeline = std::move((*built)[0]);
+      simulate_pipeline = std::move((*built)[1]);
+      emit_pipeline = std::move((*built)[2]);
+      finish_pipeline = std::move((*built)[3]);
+    };
+  }
+
+  void ParticleSystem::destroy() {
+    init_pipeline.reset();
+    simulate_pipeline.reset();
+    emit_pipeline.reset();
+    finish_pipeline.reset();
+    descriptor_pool.reset();
+    positions.reset();
+    velocities.reset();
+    alive.reset();
+    dead.reset();
+    counters.reset();
+    draws.reset();
+  }
+
+  void ParticleSystem::set_emit_rate(float rate) {
+    settings.emit_rate = std::max(0.0f, rate);
+  }
+
+  const ParticleSettings& ParticleSystem::get_settings() const {
+    return settings;
+  }
+
+  void ParticleSystem::prepare(float dt, uint32_t draw_slot) {
+    // A hitch shouldn't fire a burst of particles or tunnel them through the floor
+    dt = std::min(dt, 0.1f);
+    time += dt;
+    float emit = settings.emit_rate * dt + emit_remainder;
+    float emit_count = std::floor(emit);
+    emit_remainder = emit - emit_count;
+
+    push.emitter = glm::vec4(settings.emitter, settings.spread);
+    push.dt = dt;
+    push.time = time;
+    push.emit_count = static_cast<uint32_t>(std::min(emit_count, static_cast<float>(settings.capacity)));
+    push.capacity = settings.capacity;
+    push.draw_slot = draw_slot;
+  }
+
+  void ParticleSystem::record_simulation(vk::CommandBuffer cmd) {
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, compute_layout, 0, 1, &compute_set, 0, nullptr);
+    cmd.pushConstants(compute_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(push), &push);
+    if(clear_draws) {
+      // Images that haven't been drawn to yet draw nothing
+      cmd.fillBuffer(draws.buffer, 0, VK_WHOLE_SIZE, 0);
+      clear_draws = false;
+    }
+    if(!initialized) {
+      cmd.bindPipeline(vk::PipelineBindPoint::eCompute, init_pipeline);
+      cmd.dispatch((settings.capacity + 255) / 256, 1, 1);
+      initialized = true;
+    }
+    // Also orders this batch after the previous one on the queue
+    vk::MemoryBarrier barrier{};
+    barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite);
+    barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eIndirectCommandRead);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect,
+        {}, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, simulate_pipeline);
+    // Sized by last frame's finish pass
+    cmd.dispatchIndirect(counters.buffer, 4 * sizeof(uint32_t));
+    compute_barrier(cmd);
+    if(push.emit_count > 0) {
+      cmd.bindPipeline(vk::PipelineBindPoint::eCompute, emit_pipeline);
+      cmd.dispatch((push.emit_count + 63) / 64, 1, 1);
+      compute_barrier(cmd);
+    }
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, finish_pipeline);
+    cmd.dispatch(1, 1, 1);
+  }
+
+  void ParticleSystem::record_draw(vk::CommandBuffer cmd, vk::PipelineLayout layout, uint32_t draw_slot) const {
+    RenderPushConstants render_push{draw_slot, settings.capacity, settings.size};
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 1, 1, &render_set, 0, nullptr);
+    cmd.pushConstants(layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(render_push), &render_push);
+    cmd.drawIndirect(draws.buffer, draw_slot * sizeof(DrawRecord), 1, sizeof(DrawRecord));
+  }
+
+  vk::DescriptorSetLayout ParticleSystem::get_render_set_layout() const {
+    return render_set_layout;
+  }
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Resource.hpp"
+#include "Reflection.hpp"
+#include "ShaderManager.hpp"
+
+namespace jar {
+  struct ParticleSettings {
+    // Most particles alive at once, the storage is allocated up front. 0 turns
+    // the particles off.
+    uint32_t capacity = 1 << 20;
+    // Spawned per second, the live count settles at about rate * mean_lifetime
+    float emit_rate = 250000.0f;
+    // Half the quad size in clip space units
+    float size = 0.004f;
+    glm::vec3 emitter = {0.0f, 0.0f, 0.0f};
+    float spread = 0.6f;
+
+    // Lifetimes are picked uniformly from 1-3s in particle_emit.comp
+    static constexpr float mean_lifetime = 2.0f;
+  };
+
+  /*
+   * Particles that live entirely on the GPU. State is kept as structure of
+   * arrays in storage buffers: positions (xyz + normalized age) and
+   * velocities (xyz + lifetime), an alive index list and a dead list of free
+   * slots. Each frame, on the async compute queue:
+   *
+   *  simulate  integrates the live particles, appending survivors to the
+   *            other set's alive list (so it stays compact) and freeing
+   *            the rest
+   *  emit      pops free slots and appends the new particles to that list
+   *  finish    writes the indirect draw for this frame's swapchain image and
+   *            the simulate dispatch for the next frame, then flips sets
+   *
+   * Positions and alive lists are double buffered: the graphics queue draws
+   * the set built for its frame while the next frame's compute builds the
+   * other one. The CPU only ever pushes constants, the live count never
+   * leaves the GPU.
+   */
+  class ParticleSystem {
+    // Matches the push constant block of the particle_*.comp shaders
+    struct PushConstants {
+      glm::vec4 emitter;
+      float dt;
+      float time;
+      uint32_t emit_count;
+      uint32_t capacity;
+      uint32_t draw_slot;
+    };
+
+    // Matches particle.vert
+    struct RenderPushConstants {
+      uint32_t draw_slot;
+      uint32_t capacity;
+      float size;
+    };
+
+    // A VkDrawIndirectCommand and the set it draws, see particle_finish.comp
+    struct DrawRecord {
+      vk::DrawIndirectCommand command;
+      uint32_t set;
+      uint32_t pad[3];
+    };
+
+    vk::Device device;
+    vk::PhysicalDevice physical_device;
+    DeletionQueue* deletion_queue = nullptr;
+    MemoryBudget* memory_budget = nullptr;
+    LayoutCache* layouts = nullptr;
+    std::vector<uint32_t> sharing_families;
+    ParticleSettings settings{};
+
+    BufferAllocation positions;
+    BufferAllocation velocities;
+    BufferAllocation alive;
+    BufferAllocation dead;
+    BufferAllocation counters;
+    BufferAllocation draws;
+    Unique<vk::DescriptorPool> descriptor_pool;
+    vk::DescriptorSet compute_set;
+    vk::DescriptorSet render_set;
+    vk::DescriptorSetLayout compute_set_layout;
+    vk::DescriptorSetLayout render_set_layout;
+    // Of set 1 in particle.vert
+    std::vector<vk::DescriptorSetLayoutBinding> render_bindings;
+
+    vk::PipelineLayout compute_layout;
+    UniquePipeline init_pipeline;
+    UniquePipeline simulate_pipeline;
+    UniquePipeline emit_pipeline;
+    UniquePipeline finish_pipeline;
+
+    bool initialized = false;
+    // The draw records are new, see set_slot_count
+    bool clear_draws = false;
+    float time = 0.0f;
+    float emit_remainder = 0.0f;
+    PushConstants push{};
+
+    BufferAllocation create_buffer(vk::DeviceSize size, vk::BufferUsageFlags usage);
+    void create_descriptor_sets();
+
+    public:
+    // sharing_families are the queues touching the buffers, see AsyncCompute
+    void create(vk::Device device,
+        vk::PhysicalDevice physical_device,
+        DeletionQueue& deletion_queue,
+        MemoryBudget& memory_budget,
+        LayoutCache& layouts,
+        const ShaderManager& shaders,
+        const std::vector<uint32_t>& sharing_families,
+        const ParticleSettings& settings);
+    // Again on a shader reload, replaces the compute pipelines
+    void create_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders);
+    // Same from any thread, the returned call swaps them in between frames
+    std::function<void()> build_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders);
+    // Draw records are indexed by swapchain image. Again when the image
+    // count changes, with nothing in flight.
+    void set_slot_count(uint32_t count);
+    void destroy();
+
+    void set_emit_rate(float rate);
+    const ParticleSettings& get_settings() const;
+
+    // Before the compute batch is recorded, draw_slot is the swapchain image
+    // the frame renders to
+    void prepare(float dt, uint32_t draw_slot);
+    // The async compute job
+    void record_simulation(vk::CommandBuffer cmd);
+    // Inside the main pass, with the particle pipeline and set 0 bound
+    void record_draw(vk::CommandBuffer cmd, vk::PipelineLayout layout, uint32_t draw_slot) const;
+
+    vk::DescriptorSetLayout get_render_set_layout() const;
+  };
+}
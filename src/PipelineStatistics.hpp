@@ -0,0 +1,24 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+
+// Counters read back from the pipeline statistics query around the main (color) subpass
+struct PipelineStatistics {
+  static const uint32_t COUNTER_COUNT = 3;
+  static vk::QueryPipelineStatisticFlags flags() {
+    return vk::QueryPipelineStatisticFlagBits::eInputAssemblyPrimitives |
+      vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+      vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+  }
+
+  // Same order as the bits in flags(), which is the order vulkan writes them in
+  uint64_t input_primitives = 0;
+  uint64_t clipped_primitives = 0;
+  uint64_t fragment_invocations = 0;
+  uint64_t pixel_count = 0;
+
+  // Fragments shaded per pixel on screen, 1.0 means no wasted shading
+  double overdraw() const {
+    return pixel_count > 0 ? (double) fragment_invocations / pixel_count : 0.0;
+  }
+};
@@ -2,9 +2,16 @@
 struct QueueFamilyIndices {
   int graphics_family = -1;
   int present_family = -1;
+  // A compute-only family if there is one, otherwise the graphics family
+  int compute_family = -1;
 
   bool is_complete() const {
     return graphics_family >= 0 && present_family >= 0;
   }
+
+  // Compute work can run alongside graphics on its own queue
+  bool has_async_compute() const {
+    return compute_family >= 0 && compute_family != graphics_family;
+  }
 };
 
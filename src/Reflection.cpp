@@ -0,0 +1,500 @@
+#include "Reflection.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+  // The handful of SPIR-V opcodes and enums the reflection needs, see the
+  // SPIR-V specification for the full lists
+  enum Op : uint32_t {
+    OpEntryPoint = 15,
+    OpTypeInt = 21,
+    OpTypeFloat = 22,
+    OpTypeVector = 23,
+    OpTypeMatrix = 24,
+    OpTypeImage = 25,
+    OpTypeSampler = 26,
+    OpTypeSampledImage = 27,
+    OpTypeArray = 28,
+    OpTypeRuntimeArray = 29,
+    OpTypeStruct = 30,
+    OpTypePointer = 32,
+    OpConstant = 43,
+    OpVariable = 59,
+    OpDecorate = 71,
+    OpMemberDecorate = 72
+  };
+
+  enum Decoration : uint32_t {
+    DecorationBlock = 2,
+    DecorationBufferBlock = 3,
+    DecorationArrayStride = 6,
+    DecorationMatrixStride = 7,
+    DecorationBuiltIn = 11,
+    DecorationLocation = 30,
+    DecorationBinding = 33,
+    DecorationDescriptorSet = 34,
+    DecorationOffset = 35
+  };
+
+  enum StorageClass : uint32_t {
+    StorageClassUniformConstant = 0,
+    StorageClassInput = 1,
+    StorageClassUniform = 2,
+    StorageClassPushConstant = 9,
+    StorageClassStorageBuffer = 12
+  };
+
+  constexpr uint32_t spirv_magic = 0x07230203;
+  constexpr uint32_t dim_buffer = 5;
+  constexpr uint32_t no_value = ~0u;
+
+  struct Type {
+    uint32_t opcode = 0;
+    // Component/element/column/pointee type
+    uint32_t element = 0;
+    // Component/column count, array length id, int/float width
+    uint32_t count = 0;
+    bool is_signed = false;
+    // Images: 1 sampled, 2 storage
+    uint32_t sampled = 0;
+    uint32_t dim = 0;
+    uint32_t storage_class = 0;
+    std::vector<uint32_t> members;
+  };
+
+  struct Decorations {
+    uint32_t set = no_value;
+    uint32_t binding = no_value;
+    uint32_t location = no_value;
+    uint32_t array_stride = 0;
+    bool block = false;
+    bool buffer_block = false;
+    bool builtin = false;
+    std::vector<uint32_t> member_offsets;
+    uint32_t matrix_stride = 0;
+  };
+
+  struct Variable {
+    uint32_t type;
+    uint32_t storage_class;
+  };
+
+  class Parser {
+    jar::Spirv words;
+    std::unordered_map<uint32_t, Type> types;
+    std::unordered_map<uint32_t, Decorations> decorations;
+    std::unordered_map<uint32_t, uint32_t> constants;
+    std::vector<std::pair<uint32_t, Variable>> variables;
+    uint32_t execution_model = 0;
+
+    const Type& type(uint32_t id) const {
+      auto found = types.find(id);
+      if(found == types.end()) {
+        throw std::runtime_error("SPIR-V references unknown type!");
+      }
+      return found->second;
+    }
+
+    uint32_t array_length(const Type& array) const {
+      auto found = constants.find(array.count);
+      return found == constants.end() ? 1 : found->second;
+    }
+
+    uint32_t size_of(uint32_t id) const {
+      const Type& t = type(id);
+      switch(t.opcode) {
+        case OpTypeInt:
+        case OpTypeFloat:
+          return t.count / 8;
+        case OpTypeVector:
+          return size_of(t.element) * t.count;
+        case OpTypeMatrix:
+          return size_of(t.element) * t.count;
+        case OpTypeArray: {
+          auto found = decorations.find(id);
+          uint32_t stride = found != decorations.end() && found->second.array_stride ?
+            found->second.array_stride : size_of(t.element);
+          return stride * array_length(t);
+        }
+        case OpTypeStruct: {
+          uint32_t size = 0;
+          auto found = decorations.find(id);
+          for(size_t i = 0; i < t.members.size(); i++) {
+            uint32_t offset = found != decorations.end() && i < found->second.member_offsets.size() ?
+              found->second.member_offsets[i] : size;
+            size = std::max(size, offset + size_of(t.members[i]));
+          }
+          return size;
+        }
+        default:
+          return 0;
+      }
+    }
+
+    vk::Format format_of(uint32_t id) const {
+      const Type& t = type(id);
+      uint32_t components = 1;
+      const Type* scalar = &t;
+      if(t.opcode == OpTypeVector) {
+        components = t.count;
+        scalar = &type(t.element);
+      }
+      if(scalar->count != 32) {
+        throw std::runtime_error("only 32 bit vertex inputs are supported!");
+      }
+      static const vk::Format floats[] = {vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat};
+      static const vk::Format sints[] = {vk::Format::eR32Sint, vk::Format::eR32G32Sint, vk::Format::eR32G32B32Sint, vk::Format::eR32G32B32A32Sint};
+      static const vk::Format uints[] = {vk::Format::eR32Uint, vk::Format::eR32G32Uint, vk::Format::eR32G32B32Uint, vk::Format::eR32G32B32A32Uint};
+      if(scalar->opcode == OpTypeFloat) {
+        return floats[components - 1];
+      }
+      return scalar->is_signed ? sints[components - 1] : uints[components - 1];
+    }
+
+    vk::DescriptorType descriptor_type(const Type& t, uint32_t storage_class, const Decorations& decoration) const {
+      if(storage_class == StorageClassStorageBuffer || decoration.buffer_block) {
+        return vk::DescriptorType::eStorageBuffer;
+      }
+      if(storage_class == StorageClassUniform) {
+        return vk::DescriptorType::eUniformBuffer;
+      }
+      switch(t.opcode) {
+        case OpTypeSampler:
+          return vk::DescriptorType::eSampler;
+        case OpTypeSampledImage:
+          return vk::DescriptorType::eCombinedImageSampler;
+        case OpTypeImage:
+          if(t.dim == dim_buffer) {
+            return t.sampled == 2 ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+          }
+          return t.sampled == 2 ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+        default:
+          throw std::runtime_error("unsupported descriptor type in SPIR-V!");
+      }
+    }
+
+    vk::ShaderStageFlagBits stage() const {
+      switch(execution_model) {
+        case 0: return vk::ShaderStageFlagBits::eVertex;
+        case 1: return vk::ShaderStageFlagBits::eTessellationControl;
+        case 2: return vk::ShaderStageFlagBits::eTessellationEvaluation;
+        case 3: return vk::ShaderStageFlagBits::eGeometry;
+        case 4: return vk::ShaderStageFlagBits::eFragment;
+        case 5: return vk::ShaderStageFlagBits::eCompute;
+        default: throw std::runtime_error("unsupported SPIR-V execution model!");
+      }
+    }
+
+    public:
+    explicit Parser(jar::Spirv words): words(words) {}
+
+    jar::ShaderReflection parse() {
+      if(words.size() < 5 || words[0] != spirv_magic) {
+        throw std::runtime_error("not a SPIR-V module!");
+      }
+      for(size_t i = 5; i < words.size(); ) {
+        uint32_t opcode = words[i] & 0xffff;
+        uint32_t length = words[i] >> 16;
+        if(length == 0 || i + length > words.size()) {
+          throw std::runtime_error("malformed SPIR-V module!");
+        }
+        const uint32_t* op = &words[i];
+        switch(opcode) {
+          case OpEntryPoint:
+            execution_model = op[1];
+            break;
+          case OpDecorate: {
+            auto& decoration = decorations[op[1]];
+            switch(op[2]) {
+              case DecorationBlock: decoration.block = true; break;
+              case DecorationBufferBlock: decoration.buffer_block = true; break;
+              case DecorationArrayStride: decoration.array_stride = op[3]; break;
+              case DecorationBuiltIn: decoration.builtin = true; break;
+              case DecorationLocation: decoration.location = op[3]; break;
+              case DecorationBinding: decoration.binding = op[3]; break;
+              case DecorationDescriptorSet: decoration.set = op[3]; break;
+            }
+            break;
+          }
+          case OpMemberDecorate: {
+            auto& decoration = decorations[op[1]];
+            if(op[3] == DecorationOffset) {
+              if(decoration.member_offsets.size() <= op[2]) {
+                decoration.member_offsets.resize(op[2] + 1, 0);
+              }
+              decoration.member_offsets[op[2]] = op[4];
+            } else if(op[3] == DecorationBuiltIn) {
+              decoration.builtin = true;
+            }
+            break;
+          }
+          case OpTypeInt:
+            types[op[1]] = {opcode, 0, op[2], op[3] != 0};
+            break;
+          case OpTypeFloat:
+            types[op[1]] = {opcode, 0, op[2]};
+            break;
+          case OpTypeVector:
+          case OpTypeMatrix:
+          case OpTypeArray:
+            types[op[1]] = {opcode, op[2], op[3]};
+            break;
+          case OpTypeRuntimeArray:
+          case OpTypeSampledImage:
+            types[op[1]] = {opcode, op[2]};
+            break;
+          case OpTypeSampler:
+            types[op[1]] = {opcode};
+            break;
+          case OpTypeImage: {
+            Type image{opcode, op[2]};
+            image.dim = op[3];
+            image.sampled = op[7];
+            types[op[1]] = image;
+            break;
+          }
+          case OpTypeStruct: {
+            Type structure{opcode};
+            structure.members.assign(op + 2, op + length);
+            types[op[1]] = structure;
+            break;
+          }
+          case OpTypePointer: {
+            Type pointer{opcode, op[3]};
+            pointer.storage_class = op[2];
+            types[op[1]] = pointer;
+            break;
+          }
+          case OpConstant:
+            constants[op[2]] = op[3];
+            break;
+          case OpVariable:
+            variables.push_back({op[2], {op[1], op[3]}});
+            break;
+        }
+        i += length;
+      }
+      return build();
+    }
+
+    jar::ShaderReflection build() const {
+      jar::ShaderReflection reflection{};
+      reflection.stage = stage();
+      static const Decorations none{};
+      for(const auto& [id, variable]: variables) {
+        auto found = decorations.find(id);
+        const Decorations& decoration = found == decorations.end() ? none : found->second;
+        const Type& pointee = type(type(variable.type).element);
+        auto type_decoration = decorations.find(type(variable.type).element);
+        const Decorations& pointee_decoration = type_decoration == decorations.end() ? none : type_decoration->second;
+
+        switch(variable.storage_class) {
+          case StorageClassInput:
+            // Only vertex inputs end up in a vertex layout
+            if(reflection.stage != vk::ShaderStageFlagBits::eVertex || decoration.builtin || pointee_decoration.builtin) {
+              break;
+            }
+            reflection.inputs.push_back({decoration.location, format_of(type(variable.type).element), size_of(type(variable.type).element)});
+            break;
+          case StorageClassPushConstant:
+            reflection.push_constant_size = size_of(type(variable.type).element);
+            break;
+          case StorageClassUniformConstant:
+          case StorageClassUniform:
+          case StorageClassStorageBuffer: {
+            uint32_t count = 1;
+            const Type* resource = &pointee;
+            uint32_t resource_id = type(variable.type).element;
+            if(pointee.opcode == OpTypeArray) {
+              count = array_length(pointee);
+              resource_id = pointee.element;
+              resource = &type(resource_id);
+            } else if(pointee.opcode == OpTypeRuntimeArray) {
+              resource_id = pointee.element;
+              resource = &type(resource_id);
+            }
+            auto resource_decoration = decorations.find(resource_id);
+            const Decorations& block = resource_decoration == decorations.end() ? none : resource_decoration->second;
+            reflection.bindings.push_back({
+              decoration.set == no_value ? 0 : decoration.set,
+              decoration.binding == no_value ? 0 : decoration.binding,
+              descriptor_type(*resource, variable.storage_class, block),
+              count
+            });
+            break;
+          }
+        }
+      }
+      std::sort(reflection.inputs.begin(), reflection.inputs.end(), [](const auto& a, const auto& b) {
+        return a.location < b.location;
+      });
+      return reflection;
+    }
+  };
+
+  // Words of every field that makes a layout binding distinct
+  void append_key(std::vector<uint32_t>& key, const vk::DescriptorSetLayoutBinding& binding) {
+    key.push_back(binding.binding);
+    key.push_back(static_cast<uint32_t>(binding.descriptorType));
+    key.push_back(binding.descriptorCount);
+    key.push_back(static_cast<uint32_t>(binding.stageFlags));
+  }
+}
+
+namespace jar {
+  ShaderReflection reflect(Spirv spirv) {
+    return Parser(spirv).parse();
+  }
+
+  PipelineLayoutDescription merge_layouts(const std::vector<ShaderReflection>& stages) {
+    PipelineLayoutDescription description{};
+    uint32_t push_constant_size = 0;
+    vk::ShaderStageFlags push_constant_stages;
+    for(const auto& stage: stages) {
+      for(const auto& binding: stage.bindings) {
+        auto& set = description.sets[binding.set];
+        auto existing = std::find_if(set.begin(), set.end(), [&](const auto& b) {
+          return b.binding == binding.binding;
+        });
+        if(existing == set.end()) {
+          vk::DescriptorSetLayoutBinding layout_binding{};
+          layout_binding.setBinding(binding.binding);
+          layout_binding.setDescriptorType(binding.type);
+          layout_binding.setDescriptorCount(binding.count);
+          layout_binding.setStageFlags(stage.stage);
+          set.push_back(layout_binding);
+        } else if(existing->descriptorType != binding.type) {
+          throw std::runtime_error("stages disagree on the type of a descriptor binding!");
+        } else {
+          existing->stageFlags |= stage.stage;
+        }
+      }
+      if(stage.push_constant_size > 0) {
+        push_constant_size = std::max(push_constant_size, stage.push_constant_size);
+        push_constant_stages |= stage.stage;
+      }
+    }
+    for(auto& [set, bindings]: description.sets) {
+      std::sort(bindings.begin(), bindings.end(), [](const auto& a, const auto& b) {
+        return a.binding < b.binding;
+      });
+    }
+    // One range covering every stage keeps it simple, blocks share offsets anyway
+    if(push_constant_size > 0) {
+      description.push_constants.push_back({push_constant_stages, 0, push_constant_size});
+    }
+    return description;
+  }
+
+  VertexLayout make_vertex_layout(const ShaderReflection& vertex_shader, uint32_t binding) {
+    VertexLayout layout{};
+    uint32_t offset = 0;
+    for(const auto& input: vertex_shader.inputs) {
+      vk::VertexInputAttributeDescription attribute{};
+      attribute.setBinding(binding);
+      attribute.setLocation(input.location);
+      attribute.setFormat(input.format);
+      attribute.setOffset(offset);
+      layout.attributes.push_back(attribute);
+      offset += input.size;
+    }
+    layout.binding.setBinding(binding);
+    layout.binding.setStride(offset);
+    layout.binding.setInputRate(vk::VertexInputRate::eVertex);
+    return layout;
+  }
+
+  size_t LayoutCache::KeyHash::operator()(const std::vector<uint32_t>& key) const {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(uint32_t word: key) {
+      hash = (hash ^ word) * 1099511628211ull;
+    }
+    return static_cast<size_t>(hash);
+  }
+
+  void LayoutCache::init(vk::Device device) {
+    this->device = device;
+  }
+
+  void LayoutCache::destroy() {
+    for(auto& [key, layout]: pipeline_layouts) {
+      device.destroyPipelineLayout(layout);
+    }
+    for(auto& [key, layout]: set_layouts) {
+      device.destroyDescriptorSetLayout(layout);
+    }
+    pipeline_layouts.clear();
+    set_layouts.clear();
+  }
+
+  vk::DescriptorSetLayout LayoutCache::get_set_layout(const std::vector<vk::DescriptorSetLayoutBinding>& bindings) {
+    std::vector<uint32_t> key;
+    for(const auto& binding: bindings) {
+      append_key(key, binding);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = set_layouts.find(key);
+    if(found != set_layouts.end()) {
+      return found->second;
+    }
+
+    vk::DescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.setBindingCount(static_cast<uint32_t>(bindings.size()));
+    layout_info.setPBindings(bindings.data());
+    vk::DescriptorSetLayout layout;
+    if(device.createDescriptorSetLayout(&layout_info, nullptr, &layout) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create descriptor set layout!");
+    }
+    set_layouts.emplace(std::move(key), layout);
+    return layout;
+  }
+
+  std::vector<vk::DescriptorSetLayout> LayoutCache::get_set_layouts(const PipelineLayoutDescription& description) {
+    std::vector<vk::DescriptorSetLayout> layouts;
+    if(description.sets.empty()) {
+      return layouts;
+    }
+    uint32_t set_count = description.sets.rbegin()->first + 1;
+    for(uint32_t set = 0; set < set_count; set++) {
+      auto found = description.sets.find(set);
+      layouts.push_back(get_set_layout(found == description.sets.end() ? std::vector<vk::DescriptorSetLayoutBinding>{} : found->second));
+    }
+    return layouts;
+  }
+
+  vk::PipelineLayout LayoutCache::get_pipeline_layout(const PipelineLayoutDescription& description) {
+    std::vector<vk::DescriptorSetLayout> layouts = get_set_layouts(description);
+
+    // Set layouts are already deduplicated, so their handles identify them
+    std::vector<uint32_t> key;
+    for(auto layout: layouts) {
+      uint64_t handle = reinterpret_cast<uint64_t>(static_cast<VkDescriptorSetLayout>(layout));
+      key.push_back(static_cast<uint32_t>(handle));
+      key.push_back(static_cast<uint32_t>(handle >> 32));
+    }
+    key.push_back(~0u);
+    for(const auto& range: description.push_constants) {
+      key.push_back(static_cast<uint32_t>(range.stageFlags));
+      key.push_back(range.offset);
+      key.push_back(range.size);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = pipeline_layouts.find(key);
+    if(found != pipeline_layouts.end()) {
+      return found->second;
+    }
+
+    vk::PipelineLayoutCreateInfo pipeline_layout_info{};
+    pipeline_layout_info.setSetLayoutCount(static_cast<uint32_t>(layouts.size()));
+    pipeline_layout_info.setPSetLayouts(layouts.data());
+    pipeline_layout_info.setPushConstantRangeCount(static_cast<uint32_t>(description.push_constants.size()));
+    pipeline_layout_info.setPPushConstantRanges(description.push_constants.data());
+    vk::PipelineLayout layout;
+    if(device.createPipelineLayout(&pipeline_layout_info, nullptr, &layout) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create pipeline layout!");
+    }
+    pipeline_layouts.emplace(std::move(key), layout);
+    return layout;
+  }
+}
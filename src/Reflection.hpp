@@ -0,0 +1,77 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "ShaderModules.hpp"
+
+namespace jar {
+  struct DescriptorBinding {
+    uint32_t set;
+    uint32_t binding;
+    vk::DescriptorType type;
+    uint32_t count;
+  };
+
+  struct VertexInput {
+    uint32_t location;
+    vk::Format format;
+    uint32_t size;
+  };
+
+  // What a single SPIR-V module declares, as far as layouts are concerned
+  struct ShaderReflection {
+    vk::ShaderStageFlagBits stage = vk::ShaderStageFlagBits::eVertex;
+    std::vector<DescriptorBinding> bindings;
+    // Size of the push constant block, 0 if there is none
+    uint32_t push_constant_size = 0;
+    // Sorted by location, built-ins left out
+    std::vector<VertexInput> inputs;
+  };
+
+  ShaderReflection reflect(Spirv spirv);
+
+  // Everything a pipeline layout needs, merged over the stages of a pipeline
+  struct PipelineLayoutDescription {
+    std::map<uint32_t, std::vector<vk::DescriptorSetLayoutBinding>> sets;
+    std::vector<vk::PushConstantRange> push_constants;
+  };
+
+  PipelineLayoutDescription merge_layouts(const std::vector<ShaderReflection>& stages);
+
+  // Vertex inputs of a shader as a single interleaved, tightly packed binding
+  struct VertexLayout {
+    vk::VertexInputBindingDescription binding;
+    std::vector<vk::VertexInputAttributeDescription> attributes;
+  };
+
+  VertexLayout make_vertex_layout(const ShaderReflection& vertex_shader, uint32_t binding = 0);
+
+  /*
+   * Descriptor set and pipeline layouts keyed on their contents, so every
+   * pipeline with the same interface shares the same objects. Layouts are
+   * tiny and few, they live until destroy() at shutdown.
+   */
+  class LayoutCache {
+    struct KeyHash {
+      size_t operator()(const std::vector<uint32_t>& key) const;
+    };
+
+    vk::Device device;
+    std::unordered_map<std::vector<uint32_t>, vk::DescriptorSetLayout, KeyHash> set_layouts;
+    std::unordered_map<std::vector<uint32_t>, vk::PipelineLayout, KeyHash> pipeline_layouts;
+    // Shader reloads build pipelines on a worker
+    std::mutex mutex;
+
+    public:
+    void init(vk::Device device);
+    void destroy();
+
+    vk::DescriptorSetLayout get_set_layout(const std::vector<vk::DescriptorSetLayoutBinding>& bindings);
+    // Sets missing between used set numbers get an empty layout
+    vk::PipelineLayout get_pipeline_layout(const PipelineLayoutDescription& description);
+    std::vector<vk::DescriptorSetLayout> get_set_layouts(const PipelineLayoutDescription& description);
+  };
+}
@@ -0,0 +1,871 @@
+#include "RenderGraph.hpp"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include "Memory.hpp"
+
+namespace jar {
+  AccessInfo get_access_info(Access access) {
+    switch(access) {
+      case Access::ColorAttachmentWrite:
+        return {
+          vk::PipelineStageFlagBits::eColorAttachmentOutput,
+          vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite,
+          vk::AccessFlagBits::eColorAttachmentWrite,
+          vk::ImageLayout::eColorAttachmentOptimal,
+          vk::ImageUsageFlagBits::eColorAttachment,
+          true
+        };
+      case Access::ColorAttachmentResolve:
+        return {
+          vk::PipelineStageFlagBits::eColorAttachmentOutput,
+          vk::AccessFlagBits::eColorAttachmentWrite,
+          vk::AccessFlagBits::eColorAttachmentWrite,
+          vk::ImageLayout::eColorAttachmentOptimal,
+          vk::ImageUsageFlagBits::eColorAttachment,
+          true
+        };
+      case Access::DepthAttachmentWrite:
+        return {
+          vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+          vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+          vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+          vk::ImageLayout::eDepthStencilAttachmentOptimal,
+          vk::ImageUsageFlagBits::eDepthStencilAttachment,
+          true
+        };
+      case Access::DepthAttachmentRead:
+        return {
+          vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+          vk::AccessFlagBits::eDepthStencilAttachmentRead,
+          {},
+          vk::ImageLayout::eDepthStencilReadOnlyOptimal,
+          vk::ImageUsageFlagBits::eDepthStencilAttachment,
+          true
+        };
+      case Access::ShaderRead:
+        return {
+          vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,
+          vk::AccessFlagBits::eShaderRead,
+          {},
+          vk::ImageLayout::eShaderReadOnlyOptimal,
+          vk::ImageUsageFlagBits::eSampled,
+          false
+        };
+      case Access::StorageReadWrite:
+        return {
+          vk::PipelineStageFlagBits::eComputeShader,
+          vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+          vk::AccessFlagBits::eShaderWrite,
+          vk::ImageLayout::eGeneral,
+          vk::ImageUsageFlagBits::eStorage,
+          false
+        };
+      case Access::TransferRead:
+        return {
+          vk::PipelineStageFlagBits::eTransfer,
+          vk::AccessFlagBits::eTransferRead,
+          {},
+          vk::ImageLayout::eTransferSrcOptimal,
+          vk::ImageUsageFlagBits::eTransferSrc,
+          false
+        };
+      case Access::TransferWrite:
+        return {
+          vk::PipelineStageFlagBits::eTransfer,
+          vk::AccessFlagBits::eTransferWrite,
+          vk::AccessFlagBits::eTransferWrite,
+          vk::ImageLayout::eTransferDstOptimal,
+          vk::ImageUsageFlagBits::eTransferDst,
+          false
+        };
+    }
+    throw std::runtime_error("unknown render graph access!");
+  }
+
+  PassBuilder& PassBuilder::write_color(ResourceHandle resource, std::optional<std::array<float, 4>> clear) {
+    std::optional<vk::ClearValue> clear_value;
+    if(clear) {
+      clear_value = vk::ClearValue{vk::ClearColorValue{*clear}};
+    }
+    graph.passes[pass].resources.push_back({resource, Access::ColorAttachmentWrite, clear_value});
+    return *this;
+  }
+
+  PassBuilder& PassBuilder::write_depth(ResourceHandle resource, std::optional<float> clear) {
+    std::optional<vk::ClearValue> clear_value;
+    if(clear) {
+      clear_value = vk::ClearValue{};
+      clear_value->setDepthStencil({*clear, 0});
+    }
+    graph.passes[pass].resources.push_back({resource, Access::DepthAttachmentWrite, clear_value});
+    return *this;
+  }
+
+  PassBuilder& PassBuilder::read_depth(ResourceHandle resource) {
+    graph.passes[pass].resources.push_back({resource, Access::DepthAttachmentRead, std::nullopt});
+    return *this;
+  }
+
+  PassBuilder& PassBuilder::resolve(ResourceHandle source, ResourceHandle target) {
+    graph.passes[pass].resources.push_back({target, Access::ColorAttachmentResolve, std::nullopt, source});
+    return *this;
+  }
+
+  PassBuilder& PassBuilder::read(ResourceHandle resource, Access access) {
+    graph.passes[pass].resources.push_back({resource, access, std::nullopt});
+    return *this;
+  }
+
+  PassBuilder& PassBuilder::write(ResourceHandle resource, Access access) {
+    graph.passes[pass].resources.push_back({resource, access, std::nullopt});
+    return *this;
+  }
+
+  PassBuilder& PassBuilder::side_effect() {
+    graph.passes[pass].side_effect = true;
+    return *this;
+  }
+
+  PassBuilder& PassBuilder::on_record(std::function<void(vk::CommandBuffer, uint32_t)> record) {
+    graph.passes[pass].record = record;
+    return *this;
+  }
+
+  RenderGraph::RenderGraph(vk::Device device, vk::PhysicalDevice physical_device, MemoryBudget* memory_budget):
+    device(device),
+    physical_device(physical_device),
+    memory_budget(memory_budget) {
+  }
+
+  ResourceHandle RenderGraph::create_image(const std::string& name,
+      vk::Format format,
+      vk::Extent2D extent,
+      vk::ImageAspectFlags aspect,
+      vk::SampleCountFlagBits samples) {
+    Resource resource{};
+    resource.name = name;
+    resource.format = format;
+    resource.extent = extent;
+    resource.aspect = aspect;
+    resource.samples = samples;
+    resources.push_back(resource);
+    return resources.size() - 1;
+  }
+
+  ResourceHandle RenderGraph::import_image(const std::string& name,
+      vk::Format format,
+      vk::Extent2D extent,
+      vk::ImageAspectFlags aspect,
+      const std::vector<vk::Image>& images,
+      const std::vector<vk::ImageView>& views,
+      vk::ImageLayout initial_layout,
+      vk::PipelineStageFlags initial_stages,
+      vk::ImageLayout final_layout) {
+    if(images.empty() || images.size() != views.size()) {
+      throw std::runtime_error("imported image " + name + " needs one view per image!");
+    }
+    if(version_count > 1 && images.size() > 1 && images.size() != version_count) {
+      throw std::runtime_error("imported image " + name + " has a different number of versions!");
+    }
+    version_count = std::max<uint32_t>(version_count, images.size());
+
+    Resource resource{};
+    resource.name = name;
+    resource.format = format;
+    resource.extent = extent;
+    resource.aspect = aspect;
+    resource.imported = true;
+    resource.images = images;
+    resource.views = views;
+    resource.initial_layout = initial_layout;
+    resource.initial_stages = initial_stages;
+    resource.final_layout = final_layout;
+    resources.push_back(resource);
+    return resources.size() - 1;
+  }
+
+  void RenderGraph::set_output(ResourceHandle resource) {
+    resources[resource].output = true;
+  }
+
+  PassBuilder RenderGraph::add_pass(const std::string& name) {
+    Pass pass{};
+    pass.name = name;
+    passes.push_back(pass);
+    return PassBuilder(*this, passes.size() - 1);
+  }
+
+  void RenderGraph::cull_passes() {
+    // Walk backwards from the outputs. A resource stays needed until we pass
+    // the pass that overwrites it completely (cleared attachment or transfer
+    // destination), everything a live pass reads becomes needed.
+    std::vector<bool> needed(resources.size(), false);
+    for(size_t i = 0; i < resources.size(); i++) {
+      needed[i] = resources[i].output;
+    }
+
+    for(auto pass = passes.rbegin(); pass != passes.rend(); ++pass) {
+      pass->live = pass->side_effect;
+      for(const auto& r: pass->resources) {
+        if(get_access_info(r.access).write_access && needed[r.resource]) {
+          pass->live = true;
+        }
+      }
+      if(!pass->live) {
+        continue;
+      }
+      for(const auto& r: pass->resources) {
+        bool overwrites = r.clear || r.access == Access::TransferWrite || r.access == Access::ColorAttachmentResolve;
+        needed[r.resource] = !overwrites;
+      }
+    }
+  }
+
+  void RenderGraph::compute_lifetimes() {
+    for(size_t p = 0; p < passes.size(); p++) {
+      const auto& pass = passes[p];
+      if(!pass.live) {
+        continue;
+      }
+      for(const auto& r: pass.resources) {
+        auto& resource = resources[r.resource];
+        const auto& info = get_access_info(r.access);
+        if(resource.first_pass < 0) {
+          resource.first_pass = p;
+        }
+        resource.last_pass = p;
+        resource.usage |= info.usage;
+        resource.all_stages |= info.stages;
+        resource.all_write_access |= info.write_access;
+      }
+    }
+  }
+
+  void RenderGraph::merge_passes() {
+    // A raster pass joins the render pass before it if it touches nothing
+    // but attachments of the same size, none of which the render pass used
+    // as anything else so far. Barriers between them become subpass
+    // dependencies.
+    enum Use { unused, attachment, other };
+    std::vector<Use> uses(resources.size(), unused);
+    int group = -1;
+    vk::Extent2D group_extent;
+    for(size_t p = 0; p < passes.size(); p++) {
+      auto& pass = passes[p];
+      if(!pass.live) {
+        continue;
+      }
+      bool has_attachments = false;
+      bool fits = group >= 0;
+      for(const auto& r: pass.resources) {
+        const auto& resource = resources[r.resource];
+        if(get_access_info(r.access).is_attachment) {
+          has_attachments = true;
+          fits = fits && resource.extent == group_extent && uses[r.resource] != other;
+        } else {
+          fits = false;
+        }
+      }
+
+      if(has_attachments && fits) {
+        pass.group = group;
+        pass.subpass = passes[group].subpass_count++;
+      } else {
+        pass.group = static_cast<int>(p);
+        pass.subpass = 0;
+        group = has_attachments ? static_cast<int>(p) : -1;
+        pass.subpass_count = has_attachments ? 1 : 0;
+        std::fill(uses.begin(), uses.end(), unused);
+      }
+      for(const auto& r: pass.resources) {
+        const auto& info = get_access_info(r.access);
+        if(!info.is_attachment) {
+          uses[r.resource] = other;
+        } else if(uses[r.resource] == unused) {
+          uses[r.resource] = attachment;
+          group_extent = resources[r.resource].extent;
+        }
+      }
+    }
+
+    const vk::ImageUsageFlags attachment_usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment;
+    for(auto& resource: resources) {
+      if(resource.first_pass < 0) {
+        continue;
+      }
+      resource.alias_first_pass = passes[resource.first_pass].group;
+      // Cleared or undefined at the start of its render pass and dropped at
+      // the end, nothing ever has to be written out
+      if(!resource.imported && !resource.output && !(resource.usage & ~attachment_usage) &&
+          passes[resource.first_pass].group == passes[resource.last_pass].group) {
+        resource.transient_attachment = true;
+        resource.usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+      }
+    }
+  }
+
+  void RenderGraph::allocate_transient_images() {
+    std::vector<ResourceHandle> transients;
+    for(size_t i = 0; i < resources.size(); i++) {
+      auto& resource = resources[i];
+      if(resource.imported || resource.first_pass < 0) {
+        continue;
+      }
+      vk::ImageCreateInfo image_info{};
+      image_info.setImageType(vk::ImageType::e2D);
+      image_info.setExtent({resource.extent.width, resource.extent.height, 1});
+      image_info.setMipLevels(1);
+      image_info.setArrayLayers(1);
+      image_info.setFormat(resource.format);
+      image_info.setTiling(vk::ImageTiling::eOptimal);
+      image_info.setInitialLayout(vk::ImageLayout::eUndefined);
+      image_info.setUsage(resource.usage);
+      image_info.setSamples(resource.samples);
+      image_info.setSharingMode(vk::SharingMode::eExclusive);
+
+      vk::Image image;
+      if(device.createImage(&image_info, nullptr, &image) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to create transient image " + resource.name + "!");
+      }
+      resource.images = {image};
+      transients.push_back(i);
+    }
+
+    // Biggest first, each image goes at the lowest offset that doesn't
+    // collide with an already placed image whose lifetime overlaps its own
+    std::vector<vk::MemoryRequirements> requirements(resources.size());
+    for(auto handle: transients) {
+      auto& resource = resources[handle];
+      requirements[handle] = device.getImageMemoryRequirements(resource.images[0]);
+      resource.memory_size = requirements[handle].size;
+      if(resource.transient_attachment) {
+        // Tiled GPUs only back this if a tile actually spills
+        try {
+          resource.memory_type = jar::memory::findMemoryType(physical_device,
+              requirements[handle].memoryTypeBits,
+              vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated);
+          continue;
+        } catch(const std::runtime_error&) {
+        }
+      }
+      resource.memory_type = jar::memory::findMemoryType(physical_device,
+          requirements[handle].memoryTypeBits,
+          vk::MemoryPropertyFlagBits::eDeviceLocal);
+    }
+    std::sort(transients.begin(), transients.end(), [this](ResourceHandle a, ResourceHandle b) {
+      return resources[a].memory_size > resources[b].memory_size;
+    });
+
+    auto lifetimes_overlap = [this](const Resource& a, const Resource& b) {
+      return a.alias_first_pass <= b.last_pass && b.alias_first_pass <= a.last_pass;
+    };
+    auto memory_overlaps = [](const Resource& a, const Resource& b) {
+      return a.memory_offset < b.memory_offset + b.memory_size && b.memory_offset < a.memory_offset + a.memory_size;
+    };
+
+    std::vector<ResourceHandle> placed;
+    std::vector<vk::DeviceSize> heap_sizes(VK_MAX_MEMORY_TYPES, 0);
+    for(auto handle: transients) {
+      auto& resource = resources[handle];
+      vk::DeviceSize alignment = requirements[handle].alignment;
+      resource.memory_offset = 0;
+      bool moved = true;
+      while(moved) {
+        moved = false;
+        for(auto other_handle: placed) {
+          const auto& other = resources[other_handle];
+          if(other.memory_type == resource.memory_type && lifetimes_overlap(resource, other) && memory_overlaps(resource, other)) {
+            vk::DeviceSize end = other.memory_offset + other.memory_size;
+            resource.memory_offset = (end + alignment - 1) / alignment * alignment;
+            moved = true;
+          }
+        }
+      }
+      placed.push_back(handle);
+      heap_sizes[resource.memory_type] = std::max(heap_sizes[resource.memory_type], resource.memory_offset + resource.memory_size);
+    }
+
+    vk::PhysicalDeviceMemoryProperties memory_properties;
+    physical_device.getMemoryProperties(&memory_properties);
+    std::vector<vk::DeviceMemory> memory_by_type(VK_MAX_MEMORY_TYPES);
+    for(uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; type++) {
+      if(heap_sizes[type] == 0) {
+        continue;
+      }
+      vk::MemoryAllocateInfo alloc_info{};
+      alloc_info.setAllocationSize(heap_sizes[type]);
+      alloc_info.setMemoryTypeIndex(type);
+      if(device.allocateMemory(&alloc_info, nullptr, &memory_by_type[type]) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to allocate transient image memory!");
+      }
+      transient_memory.push_back(memory_by_type[type]);
+      transient_memory_types.push_back({type, heap_sizes[type]});
+      // Counted in full even though it may never be committed
+      if(memory_properties.memoryTypes[type].propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated) {
+        lazy_memory_size += heap_sizes[type];
+      }
+      if(memory_budget) {
+        memory_budget->allocated(type, MemoryCategory::render_target, heap_sizes[type]);
+      }
+      transient_memory_size += heap_sizes[type];
+    }
+
+    for(auto handle: placed) {
+      auto& resource = resources[handle];
+      device.bindImageMemory(resource.images[0], memory_by_type[resource.memory_type], resource.memory_offset);
+
+      vk::ImageViewCreateInfo view_info{};
+      view_info.setImage(resource.images[0]);
+      view_info.setViewType(vk::ImageViewType::e2D);
+      view_info.setFormat(resource.format);
+      view_info.subresourceRange.setAspectMask(resource.aspect);
+      view_info.subresourceRange.setBaseMipLevel(0);
+      view_info.subresourceRange.setLevelCount(1);
+      view_info.subresourceRange.setBaseArrayLayer(0);
+      view_info.subresourceRange.setLayerCount(1);
+      vk::ImageView view;
+      if(device.createImageView(&view_info, nullptr, &view) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to create transient image view " + resource.name + "!");
+      }
+      resource.views = {view};
+
+      for(auto other_handle: placed) {
+        const auto& other = resources[other_handle];
+        if(other.memory_type == resource.memory_type && memory_overlaps(resource, other)) {
+          resource.aliases.push_back(other_handle);
+        }
+      }
+    }
+  }
+
+  void RenderGraph::compute_barriers() {
+    struct State {
+      vk::ImageLayout layout;
+      vk::PipelineStageFlags write_stages;
+      vk::AccessFlags write_access;
+      vk::PipelineStageFlags read_stages;
+      // Stages the last write has already been made visible to
+      vk::PipelineStageFlags visible_stages;
+    };
+
+    std::vector<State> states(resources.size());
+    for(size_t i = 0; i < resources.size(); i++) {
+      const auto& resource = resources[i];
+      auto& state = states[i];
+      state.layout = resource.initial_layout;
+      state.read_stages = resource.initial_stages;
+      // Transient memory was last touched by whichever alias used it last,
+      // possibly in the previous frame, so wait for all of them
+      for(auto alias: resource.aliases) {
+        state.write_stages |= resources[alias].all_stages;
+        state.write_access |= resources[alias].all_write_access;
+      }
+    }
+
+    for(auto& pass: passes) {
+      pass.barriers = {};
+      if(!pass.live) {
+        continue;
+      }
+      for(const auto& r: pass.resources) {
+        const auto& info = get_access_info(r.access);
+        auto& state = states[r.resource];
+        bool layout_change = state.layout != info.layout;
+
+        vk::PipelineStageFlags src_stages;
+        vk::AccessFlags src_access;
+        bool needed = false;
+        if(info.write_access || layout_change) {
+          // Writes and transitions have to wait for earlier readers as well (WAR)
+          src_stages = state.write_stages | state.read_stages;
+          src_access = state.write_access;
+          needed = layout_change || src_stages;
+        } else if(state.write_stages && (state.visible_stages & info.stages) != info.stages) {
+          src_stages = state.write_stages;
+          src_access = state.write_access;
+          needed = true;
+        }
+
+        if(needed) {
+          pass.barriers.src_stages |= src_stages ? src_stages : vk::PipelineStageFlagBits::eTopOfPipe;
+          pass.barriers.dst_stages |= info.stages;
+          pass.barriers.barriers.push_back({
+            r.resource,
+            layout_change ? state.layout : info.layout,
+            info.layout,
+            src_access,
+            info.access,
+            src_stages ? src_stages : vk::PipelineStageFlagBits::eTopOfPipe,
+            info.stages
+          });
+        }
+
+        if(info.write_access) {
+          state.write_stages = info.stages;
+          state.write_access = info.write_access;
+          state.read_stages = {};
+          state.visible_stages = {};
+        } else if(layout_change) {
+          state.read_stages = info.stages;
+          state.visible_stages = info.stages;
+        } else {
+          state.read_stages |= info.stages;
+          state.visible_stages |= info.stages;
+        }
+        state.layout = info.layout;
+      }
+    }
+
+    final_barriers = {};
+    for(size_t i = 0; i < resources.size(); i++) {
+      const auto& resource = resources[i];
+      const auto& state = states[i];
+      if(!resource.imported || resource.final_layout == vk::ImageLayout::eUndefined || resource.final_layout == state.layout) {
+        continue;
+      }
+      vk::PipelineStageFlags src_stages = state.write_stages | state.read_stages;
+      final_barriers.src_stages |= src_stages ? src_stages : vk::PipelineStageFlagBits::eTopOfPipe;
+      final_barriers.dst_stages |= vk::PipelineStageFlagBits::eBottomOfPipe;
+      final_barriers.barriers.push_back({
+        static_cast<ResourceHandle>(i),
+        state.layout,
+        resource.final_layout,
+        state.write_access,
+        {},
+        src_stages ? src_stages : vk::PipelineStageFlagBits::eTopOfPipe,
+        vk::PipelineStageFlagBits::eBottomOfPipe
+      });
+    }
+  }
+
+  void RenderGraph::create_render_passes() {
+    struct Subpass {
+      std::vector<vk::AttachmentReference> color_refs;
+      std::vector<ResourceHandle> color_resources;
+      std::vector<vk::AttachmentReference> resolve_refs;
+      std::optional<vk::AttachmentReference> depth_ref;
+    };
+
+    for(size_t first = 0; first < passes.size(); first++) {
+      auto& render_pass = passes[first];
+      if(!render_pass.live || render_pass.group != static_cast<int>(first) || render_pass.subpass_count == 0) {
+        continue;
+      }
+
+      std::vector<vk::AttachmentDescription> attachments;
+      std::vector<ResourceHandle> attachment_resources;
+      std::vector<int> attachment_index(resources.size(), -1);
+      std::vector<uint32_t> last_subpass(resources.size(), 0);
+      std::vector<Subpass> subpasses(render_pass.subpass_count);
+      std::vector<vk::SubpassDependency> dependencies;
+      for(size_t p = first; p < passes.size(); p++) {
+        auto& pass = passes[p];
+        if(!pass.live) {
+          continue;
+        }
+        if(pass.group != static_cast<int>(first)) {
+          break;
+        }
+        auto& subpass = subpasses[pass.subpass];
+
+        // Later subpasses wait through the render pass instead of barriers,
+        // on an earlier subpass or on whatever came before the render pass
+        std::vector<vk::ImageLayout> old_layouts(resources.size(), vk::ImageLayout::eUndefined);
+        if(pass.subpass > 0) {
+          for(const auto& b: pass.barriers.barriers) {
+            bool earlier = attachment_index[b.resource] >= 0;
+            vk::SubpassDependency dependency{};
+            dependency.setSrcSubpass(earlier ? last_subpass[b.resource] : VK_SUBPASS_EXTERNAL);
+            dependency.setDstSubpass(pass.subpass);
+            dependency.setSrcStageMask(b.src_stages);
+            dependency.setDstStageMask(b.dst_stages);
+            dependency.setSrcAccessMask(b.src_access);
+            dependency.setDstAccessMask(b.dst_access);
+            if(earlier) {
+              dependency.setDependencyFlags(vk::DependencyFlagBits::eByRegion);
+            }
+            dependencies.push_back(dependency);
+            old_layouts[b.resource] = b.old_layout;
+          }
+          pass.barriers = {};
+        }
+
+        for(const auto& r: pass.resources) {
+          const auto& info = get_access_info(r.access);
+          if(!info.is_attachment) {
+            continue;
+          }
+          const auto& resource = resources[r.resource];
+
+          if(attachment_index[r.resource] < 0) {
+            // Load what an earlier pass (or frame, for imported images) left
+            // behind, a resolve overwrites it anyway
+            bool has_contents = resource.first_pass < static_cast<int>(p) ||
+              (resource.imported && resource.initial_layout != vk::ImageLayout::eUndefined);
+            bool load = has_contents && r.access != Access::ColorAttachmentResolve;
+
+            vk::AttachmentDescription attachment{};
+            attachment.setFormat(resource.format);
+            attachment.setSamples(resource.samples);
+            attachment.setLoadOp(r.clear ? vk::AttachmentLoadOp::eClear :
+                load ? vk::AttachmentLoadOp::eLoad : vk::AttachmentLoadOp::eDontCare);
+            attachment.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare);
+            attachment.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare);
+            // The graph's barriers transition everything the first subpass
+            // uses, the render pass does it for the ones after
+            bool transitioned = pass.subpass > 0 && old_layouts[r.resource] != vk::ImageLayout::eUndefined;
+            attachment.setInitialLayout(pass.subpass == 0 ? info.layout : transitioned ? old_layouts[r.resource] :
+                load ? info.layout : vk::ImageLayout::eUndefined);
+            attachment_index[r.resource] = attachments.size();
+            attachments.push_back(attachment);
+            attachment_resources.push_back(r.resource);
+            render_pass.clear_values.push_back(r.clear ? *r.clear : vk::ClearValue{});
+            render_pass.extent = resource.extent;
+          }
+
+          // Left in the layout of its last use, stored only if someone is
+          // going to look at it again
+          auto& attachment = attachments[attachment_index[r.resource]];
+          bool read_later = resource.last_pass > static_cast<int>(p) || resource.imported || resource.output;
+          attachment.setFinalLayout(info.layout);
+          attachment.setStoreOp(read_later ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare);
+          last_subpass[r.resource] = pass.subpass;
+
+          vk::AttachmentReference ref{static_cast<uint32_t>(attachment_index[r.resource]), info.layout};
+          if(r.access == Access::ColorAttachmentWrite) {
+            subpass.color_refs.push_back(ref);
+            subpass.color_resources.push_back(r.resource);
+          } else if(r.access != Access::ColorAttachmentResolve) {
+            subpass.depth_ref = ref;
+          }
+        }
+
+        // Resolve attachments pair up with the color attachments
+        subpass.resolve_refs.assign(subpass.color_refs.size(), {VK_ATTACHMENT_UNUSED, vk::ImageLayout::eUndefined});
+        bool has_resolves = false;
+        for(const auto& r: pass.resources) {
+          if(r.access != Access::ColorAttachmentResolve) {
+            continue;
+          }
+          auto source = std::find(subpass.color_resources.begin(), subpass.color_resources.end(), *r.resolve_source);
+          if(source == subpass.color_resources.end()) {
+            throw std::runtime_error("resolve source in " + pass.name + " isn't one of its color attachments!");
+          }
+          if(resources[*r.resolve_source].samples == vk::SampleCountFlagBits::e1 ||
+              resources[r.resource].samples != vk::SampleCountFlagBits::e1) {
+            throw std::runtime_error("resolve in " + pass.name + " has to go from multisampled to single sampled!");
+          }
+          subpass.resolve_refs[source - subpass.color_resources.begin()] = {
+            static_cast<uint32_t>(attachment_index[r.resource]),
+            vk::ImageLayout::eColorAttachmentOptimal
+          };
+          has_resolves = true;
+        }
+        if(!has_resolves) {
+          subpass.resolve_refs.clear();
+        }
+      }
+
+      std::vector<vk::SubpassDescription> descriptions;
+      for(const auto& subpass: subpasses) {
+        vk::SubpassDescription description{};
+        description.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics);
+        description.setColorAttachmentCount(subpass.color_refs.size());
+        description.setPColorAttachments(subpass.color_refs.data());
+        description.setPResolveAttachments(subpass.resolve_refs.empty() ? nullptr : subpass.resolve_refs.data());
+        description.setPDepthStencilAttachment(subpass.depth_ref ? &*subpass.depth_ref : nullptr);
+        descriptions.push_back(description);
+      }
+
+      vk::RenderPassCreateInfo render_pass_info{};
+      render_pass_info.setAttachmentCount(attachments.size());
+      render_pass_info.setPAttachments(attachments.data());
+      render_pass_info.setSubpassCount(descriptions.size());
+      render_pass_info.setPSubpasses(descriptions.data());
+      render_pass_info.setDependencyCount(dependencies.size());
+      render_pass_info.setPDependencies(dependencies.data());
+
+      if(device.createRenderPass(&render_pass_info, nullptr, &render_pass.render_pass) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to create render pass for " + render_pass.name + "!");
+      }
+
+      render_pass.framebuffers.resize(version_count);
+      for(uint32_t version = 0; version < version_count; version++) {
+        std::vector<vk::ImageView> views;
+        for(auto handle: attachment_resources) {
+          const auto& resource_views = resources[handle].views;
+          views.push_back(resource_views[std::min<size_t>(version, resource_views.size() - 1)]);
+        }
+        vk::FramebufferCreateInfo framebuffer_info{};
+        framebuffer_info.setRenderPass(render_pass.render_pass);
+        framebuffer_info.setAttachmentCount(views.size());
+        framebuffer_info.setPAttachments(views.data());
+        framebuffer_info.setWidth(render_pass.extent.width);
+        framebuffer_info.setHeight(render_pass.extent.height);
+        framebuffer_info.setLayers(1);
+        if(device.createFramebuffer(&framebuffer_info, nullptr, &render_pass.framebuffers[version]) != vk::Result::eSuccess) {
+          throw std::runtime_error("failed to create framebuffer for " + render_pass.name + "!");
+        }
+      }
+    }
+  }
+
+  void RenderGraph::compile() {
+    if(compiled) {
+      throw std::runtime_error("render graph compiled twice!");
+    }
+    cull_passes();
+    compute_lifetimes();
+    merge_passes();
+    allocate_transient_images();
+    compute_barriers();
+    create_render_passes();
+    compiled = true;
+    print_summary();
+  }
+
+  void RenderGraph::emit(vk::CommandBuffer cmd, const BarrierBatch& batch, uint32_t version) const {
+    if(batch.barriers.empty()) {
+      return;
+    }
+    std::vector<vk::ImageMemoryBarrier> image_barriers;
+    image_barriers.reserve(batch.barriers.size());
+    for(const auto& b: batch.barriers) {
+      const auto& resource = resources[b.resource];
+      vk::ImageMemoryBarrier barrier{};
+      barrier.setOldLayout(b.old_layout);
+      barrier.setNewLayout(b.new_layout);
+      barrier.setSrcAccessMask(b.src_access);
+      barrier.setDstAccessMask(b.dst_access);
+      barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+      barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+      barrier.setImage(resource.images[std::min<size_t>(version, resource.images.size() - 1)]);
+      barrier.subresourceRange.setAspectMask(resource.aspect);
+      barrier.subresourceRange.setBaseMipLevel(0);
+      barrier.subresourceRange.setLevelCount(1);
+      barrier.subresourceRange.setBaseArrayLayer(0);
+      barrier.subresourceRange.setLayerCount(1);
+      image_barriers.push_back(barrier);
+    }
+    cmd.pipelineBarrier(batch.src_stages, batch.dst_stages, {},
+        0, nullptr,
+        0, nullptr,
+        image_barriers.size(), image_barriers.data());
+  }
+
+  void RenderGraph::execute(vk::CommandBuffer cmd, uint32_t version) const {
+    if(!compiled) {
+      throw std::runtime_error("render graph executed before compile()!");
+    }
+    for(const auto& pass: passes) {
+      if(!pass.live) {
+        continue;
+      }
+      const auto& render_pass = passes[pass.group];
+      if(pass.subpass > 0) {
+        cmd.nextSubpass(vk::SubpassContents::eInline);
+      } else {
+        emit(cmd, pass.barriers, version);
+        if(pass.render_pass) {
+          vk::RenderPassBeginInfo render_pass_info{};
+          render_pass_info.setRenderPass(pass.render_pass);
+          render_pass_info.setFramebuffer(pass.framebuffers[version]);
+          render_pass_info.renderArea.setOffset({0, 0});
+          render_pass_info.renderArea.setExtent(pass.extent);
+          render_pass_info.setClearValueCount(pass.clear_values.size());
+          render_pass_info.setPClearValues(pass.clear_values.data());
+          cmd.beginRenderPass(&render_pass_info, vk::SubpassContents::eInline);
+        }
+      }
+      if(pass.record) {
+        pass.record(cmd, version);
+      }
+      if(render_pass.render_pass && pass.subpass + 1 == render_pass.subpass_count) {
+        cmd.endRenderPass();
+      }
+    }
+    emit(cmd, final_barriers, version);
+  }
+
+  void RenderGraph::destroy() {
+    for(auto& pass: passes) {
+      for(const auto& framebuffer: pass.framebuffers) {
+        device.destroyFramebuffer(framebuffer);
+      }
+      if(pass.render_pass) {
+        device.destroyRenderPass(pass.render_pass);
+      }
+    }
+    for(auto& resource: resources) {
+      if(resource.imported) {
+        continue;
+      }
+      for(const auto& view: resource.views) {
+        device.destroyImageView(view);
+      }
+      for(const auto& image: resource.images) {
+        device.destroyImage(image);
+      }
+    }
+    for(const auto& memory: transient_memory) {
+      device.freeMemory(memory);
+    }
+    transient_memory.clear();
+    if(memory_budget) {
+      for(const auto& [type, size]: transient_memory_types) {
+        memory_budget->freed(type, MemoryCategory::render_target, size);
+      }
+    }
+    transient_memory_types.clear();
+    transient_memory_size = 0;
+    lazy_memory_size = 0;
+    passes.clear();
+    resources.clear();
+    final_barriers = {};
+    version_count = 1;
+    compiled = false;
+  }
+
+  vk::RenderPass RenderGraph::get_render_pass(PassHandle pass) const {
+    if(passes[pass].group < 0) {
+      return nullptr;
+    }
+    return passes[passes[pass].group].render_pass;
+  }
+
+  uint32_t RenderGraph::get_subpass(PassHandle pass) const {
+    return passes[pass].subpass;
+  }
+
+  bool RenderGraph::is_live(PassHandle pass) const {
+    return passes[pass].live;
+  }
+
+  void RenderGraph::print_summary() const {
+    size_t live_passes = 0;
+    size_t render_passes = 0;
+    size_t barrier_count = final_barriers.barriers.size();
+    for(const auto& pass: passes) {
+      if(pass.live) {
+        live_passes++;
+        barrier_count += pass.barriers.barriers.size();
+        if(pass.render_pass) {
+          render_passes++;
+        }
+      } else {
+        std::cout << "Render graph: culled pass " << pass.name << '\n';
+      }
+    }
+    vk::DeviceSize unaliased = 0;
+    for(const auto& resource: resources) {
+      if(!resource.imported) {
+        unaliased += resource.memory_size;
+      }
+    }
+    std::cout << "Render graph: " << live_passes << "/" << passes.size() << " passes in "
+      << render_passes << " render pass(es), " << barrier_count << " image barriers, transient memory "
+      << transient_memory_size / 1024 << " KiB (" << unaliased / 1024 << " KiB without aliasing, "
+      << lazy_memory_size / 1024 << " KiB lazily allocated)\n";
+  }
+}
@@ -0,0 +1,214 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <array>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+#include "MemoryBudget.hpp"
+
+namespace jar {
+  using ResourceHandle = uint32_t;
+  using PassHandle = uint32_t;
+
+  // How a pass touches an image, this is all the graph needs to work out
+  // layouts, barriers, load/store ops and image usage
+  enum class Access {
+    ColorAttachmentWrite,
+    ColorAttachmentResolve,
+    DepthAttachmentWrite,
+    DepthAttachmentRead,
+    ShaderRead,
+    StorageReadWrite,
+    TransferRead,
+    TransferWrite
+  };
+
+  struct AccessInfo {
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags access;
+    vk::AccessFlags write_access;
+    vk::ImageLayout layout;
+    vk::ImageUsageFlags usage;
+    bool is_attachment;
+  };
+  AccessInfo get_access_info(Access access);
+
+  class RenderGraph;
+
+  class PassBuilder {
+    friend class RenderGraph;
+    RenderGraph& graph;
+    PassHandle pass;
+    PassBuilder(RenderGraph& graph, PassHandle pass): graph(graph), pass(pass) {}
+
+    public:
+    PassBuilder& write_color(ResourceHandle resource, std::optional<std::array<float, 4>> clear = std::nullopt);
+    PassBuilder& write_depth(ResourceHandle resource, std::optional<float> clear = std::nullopt);
+    PassBuilder& read_depth(ResourceHandle resource);
+    // At the end of the pass, source has to be one of its multisampled
+    // color attachments and target single sampled
+    PassBuilder& resolve(ResourceHandle source, ResourceHandle target);
+    PassBuilder& read(ResourceHandle resource, Access access = Access::ShaderRead);
+    PassBuilder& write(ResourceHandle resource, Access access);
+    // Never culled, for passes whose output leaves the graph some other way
+    PassBuilder& side_effect();
+    // Called with the version being executed, between begin/endRenderPass
+    // for passes with attachments
+    PassBuilder& on_record(std::function<void(vk::CommandBuffer, uint32_t)> record);
+    PassHandle handle() const { return pass; }
+  };
+
+  /*
+   * Frame graph: passes declare what they read and write, compile() then
+   * culls passes that nothing depends on, creates the render passes,
+   * batches the barriers and layout transitions each pass needs and aliases
+   * transient images with disjoint lifetimes onto the same memory.
+   *
+   * Raster passes that follow each other and only touch attachments become
+   * subpasses of one render pass. Images that then live and die within a
+   * render pass are never stored, they are created as transient attachments
+   * in lazily allocated memory where there is some, so on tiled GPUs they
+   * may never leave tile memory.
+   *
+   * Imported images (the swapchain) can have several versions, execute()
+   * picks which one is used, so one compiled graph serves every image.
+   */
+  class RenderGraph {
+    friend class PassBuilder;
+
+    struct PassResource {
+      ResourceHandle resource;
+      Access access;
+      std::optional<vk::ClearValue> clear;
+      // Color attachment a resolve reads from
+      std::optional<ResourceHandle> resolve_source;
+    };
+
+    struct ImageBarrier {
+      ResourceHandle resource;
+      vk::ImageLayout old_layout;
+      vk::ImageLayout new_layout;
+      vk::AccessFlags src_access;
+      vk::AccessFlags dst_access;
+      vk::PipelineStageFlags src_stages;
+      vk::PipelineStageFlags dst_stages;
+    };
+
+    struct BarrierBatch {
+      vk::PipelineStageFlags src_stages;
+      vk::PipelineStageFlags dst_stages;
+      std::vector<ImageBarrier> barriers;
+    };
+
+    struct Pass {
+      std::string name;
+      std::vector<PassResource> resources;
+      std::function<void(vk::CommandBuffer, uint32_t)> record;
+      bool side_effect = false;
+      bool live = false;
+      // First pass of the render pass this one is a subpass of
+      int group = -1;
+      uint32_t subpass = 0;
+
+      BarrierBatch barriers;
+      // Only set on the first pass of a render pass
+      uint32_t subpass_count = 0;
+      vk::RenderPass render_pass;
+      std::vector<vk::Framebuffer> framebuffers;
+      std::vector<vk::ClearValue> clear_values;
+      vk::Extent2D extent;
+    };
+
+    struct Resource {
+      std::string name;
+      vk::Format format;
+      vk::Extent2D extent;
+      vk::ImageAspectFlags aspect;
+      vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+      bool imported = false;
+      bool output = false;
+      // One entry per version for imported images, a single owned image otherwise
+      std::vector<vk::Image> images;
+      std::vector<vk::ImageView> views;
+      vk::ImageLayout initial_layout = vk::ImageLayout::eUndefined;
+      vk::PipelineStageFlags initial_stages;
+      vk::ImageLayout final_layout = vk::ImageLayout::eUndefined;
+
+      vk::ImageUsageFlags usage;
+      int first_pass = -1;
+      int last_pass = -1;
+      // Start of the render pass it's first used in, the earliest its memory
+      // can't be shared any more
+      int alias_first_pass = -1;
+      // Never leaves the render pass it's used in
+      bool transient_attachment = false;
+      vk::PipelineStageFlags all_stages;
+      vk::AccessFlags all_write_access;
+      uint32_t memory_type = 0;
+      vk::DeviceSize memory_offset = 0;
+      vk::DeviceSize memory_size = 0;
+      // Transient images sharing memory with this one (itself included)
+      std::vector<ResourceHandle> aliases;
+    };
+
+    vk::Device device;
+    vk::PhysicalDevice physical_device;
+    MemoryBudget* memory_budget;
+    std::vector<Pass> passes;
+    std::vector<Resource> resources;
+    std::vector<vk::DeviceMemory> transient_memory;
+    std::vector<std::pair<uint32_t, vk::DeviceSize>> transient_memory_types;
+    vk::DeviceSize transient_memory_size = 0;
+    vk::DeviceSize lazy_memory_size = 0;
+    BarrierBatch final_barriers;
+    uint32_t version_count = 1;
+    bool compiled = false;
+
+    void cull_passes();
+    void compute_lifetimes();
+    void merge_passes();
+    void allocate_transient_images();
+    void compute_barriers();
+    void create_render_passes();
+    void emit(vk::CommandBuffer cmd, const BarrierBatch& batch, uint32_t version) const;
+
+    public:
+    // Transient memory is counted as render targets if there is a budget
+    RenderGraph(vk::Device device, vk::PhysicalDevice physical_device, MemoryBudget* memory_budget = nullptr);
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    // Image owned by the graph that only lives within a frame
+    ResourceHandle create_image(const std::string& name,
+        vk::Format format,
+        vk::Extent2D extent,
+        vk::ImageAspectFlags aspect,
+        vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1);
+    // External image, initial_stages is what has to finish before the first
+    // use (e.g. the stage the acquire semaphore is waited on)
+    ResourceHandle import_image(const std::string& name,
+        vk::Format format,
+        vk::Extent2D extent,
+        vk::ImageAspectFlags aspect,
+        const std::vector<vk::Image>& images,
+        const std::vector<vk::ImageView>& views,
+        vk::ImageLayout initial_layout,
+        vk::PipelineStageFlags initial_stages,
+        vk::ImageLayout final_layout);
+    // Marks a resource as a result of the frame, passes contributing to it are kept
+    void set_output(ResourceHandle resource);
+    PassBuilder add_pass(const std::string& name);
+
+    void compile();
+    void execute(vk::CommandBuffer cmd, uint32_t version) const;
+    // Frees everything compile() created, the graph can then be rebuilt
+    void destroy();
+
+    // Pipelines for a pass are created against its render pass and subpass
+    vk::RenderPass get_render_pass(PassHandle pass) const;
+    uint32_t get_subpass(PassHandle pass) const;
+    bool is_live(PassHandle pass) const;
+    void print_summary() const;
+  };
+}
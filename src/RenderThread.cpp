@@ -0,0 +1,87 @@
+#include "RenderThread.hpp"
+#include "VulkanTestApp.hpp"
+#include <algorithm>
+
+namespace jar {
+  RenderThread::~RenderThread() {
+    running = false;
+    if(thread.joinable()) {
+      thread.join();
+    }
+  }
+
+  void RenderThread::start(VulkanTestApp& app, GLFWwindow* window, FrameLimiter& limiter, AfterFrame after_frame) {
+    running = true;
+    thread = std::thread([this, &app, window, &limiter, after_frame = std::move(after_frame)]() {
+      try {
+        loop(app, limiter, after_frame);
+      } catch(...) {
+        error = std::current_exception();
+      }
+      running = false;
+      // Both are fine from any thread, the empty event wakes glfwWaitEvents
+      glfwSetWindowShouldClose(window, GLFW_TRUE);
+      glfwPostEmptyEvent();
+    });
+  }
+
+  void RenderThread::loop(VulkanTestApp& app, FrameLimiter& limiter, const AfterFrame& after_frame) {
+    FrameState state;
+    while(running) {
+      // Before taking the state, so the frame starts with the newest input
+      limiter.wait();
+      {
+        std::lock_guard<std::mutex> lock(command_mutex);
+        running_commands.swap(commands);
+      }
+      for(auto& command: running_commands) {
+        command(app);
+      }
+      running_commands.clear();
+
+      if(states.consume(state)) {
+        consumed_sequence.store(state.sequence, std::memory_order_release);
+      } else {
+        // Same state as last frame, nothing new to react to
+        state.input_time.reset();
+      }
+      // No point spinning while there is nothing to present to
+      if(state.minimized) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        continue;
+      }
+      app.set_framebuffer_size(state.framebuffer_width, state.framebuffer_height);
+      app.draw_frame(state.input_time.value_or(std::chrono::steady_clock::now()));
+      after_frame(state);
+    }
+  }
+
+  void RenderThread::publish(FrameState state) {
+    // A state the render thread never took is overwritten, so its input time
+    // moves on to this one. If it was taken right after the check a frame
+    // reports an event the previous one handled, but none are missed.
+    if(consumed_sequence.load(std::memory_order_acquire) < published_sequence && unconsumed_input_time) {
+      state.input_time = state.input_time ? std::min(*state.input_time, *unconsumed_input_time) : unconsumed_input_time;
+    }
+    state.sequence = ++published_sequence;
+    unconsumed_input_time = state.input_time;
+    states.publish(state);
+  }
+
+  void RenderThread::post(Command command) {
+    std::lock_guard<std::mutex> lock(command_mutex);
+    commands.push_back(std::move(command));
+  }
+
+  void RenderThread::stop() {
+    running = false;
+    if(thread.joinable()) {
+      thread.join();
+    }
+    if(error) {
+      std::exception_ptr stopped_by = error;
+      error = nullptr;
+      std::rethrow_exception(stopped_by);
+    }
+  }
+}
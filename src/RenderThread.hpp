@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "TripleBuffer.hpp"
+#include "FramePacing.hpp"
+
+class VulkanTestApp;
+struct GLFWwindow;
+
+namespace jar {
+  // What the window thread knows that a frame needs, published after every
+  // round of events
+  struct FrameState {
+    uint64_t sequence = 0;
+    // Oldest event no frame has reacted to yet, if there is one
+    std::optional<std::chrono::steady_clock::time_point> input_time;
+    int framebuffer_width = 0;
+    int framebuffer_height = 0;
+    bool minimized = false;
+  };
+
+  /*
+   * Runs frames on their own thread so a long acquire or a wait on the GPU
+   * doesn't hold up event handling. GLFW wants windowing on the main thread,
+   * so that thread only polls events and publishes a FrameState through a
+   * triple buffer; the render thread picks up the newest one at the start
+   * of each frame. Anything else that touches the app from the main thread
+   * goes through post() and runs between frames.
+   */
+  class RenderThread {
+    public:
+    using Command = std::function<void(VulkanTestApp&)>;
+    // Runs on the render thread after every draw_frame
+    using AfterFrame = std::function<void(const FrameState&)>;
+
+    private:
+    TripleBuffer<FrameState> states;
+    // Written by the render thread, the newest sequence it has taken
+    std::atomic<uint64_t> consumed_sequence{0};
+    uint64_t published_sequence = 0;
+    std::optional<std::chrono::steady_clock::time_point> unconsumed_input_time;
+
+    std::mutex command_mutex;
+    std::vector<Command> commands;
+    std::vector<Command> running_commands;
+
+    std::atomic<bool> running{false};
+    std::thread thread;
+    std::exception_ptr error;
+
+    void loop(VulkanTestApp& app, FrameLimiter& limiter, const AfterFrame& after_frame);
+
+    public:
+    ~RenderThread();
+
+    // Main thread, after init_vulkan. The app and limiter belong to the
+    // render thread until stop(). The window is told to close when the
+    // render thread stops, whatever the reason.
+    void start(VulkanTestApp& app, GLFWwindow* window, FrameLimiter& limiter, AfterFrame after_frame);
+    void publish(FrameState state);
+    void post(Command command);
+    // Joins, and rethrows whatever stopped the render thread
+    void stop();
+  };
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include "Timeline.hpp"
+#include "MemoryBudget.hpp"
+
+namespace jar {
+  inline void destroy_handle(vk::Device device, vk::Buffer handle) { device.destroyBuffer(handle); }
+  inline void destroy_handle(vk::Device device, vk::DeviceMemory handle) { device.freeMemory(handle); }
+  inline void destroy_handle(vk::Device device, vk::Image handle) { device.destroyImage(handle); }
+  inline void destroy_handle(vk::Device device, vk::ImageView handle) { device.destroyImageView(handle); }
+  inline void destroy_handle(vk::Device device, vk::Pipeline handle) { device.destroyPipeline(handle); }
+  inline void destroy_handle(vk::Device device, vk::PipelineLayout handle) { device.destroyPipelineLayout(handle); }
+  inline void destroy_handle(vk::Device device, vk::DescriptorSetLayout handle) { device.destroyDescriptorSetLayout(handle); }
+  inline void destroy_handle(vk::Device device, vk::ShaderModule handle) { device.destroyShaderModule(handle); }
+  inline void destroy_handle(vk::Device device, vk::DescriptorPool handle) { device.destroyDescriptorPool(handle); }
+  inline void destroy_handle(vk::Device device, vk::RenderPass handle) { device.destroyRenderPass(handle); }
+  inline void destroy_handle(vk::Device device, vk::Framebuffer handle) { device.destroyFramebuffer(handle); }
+  inline void destroy_handle(vk::Device device, vk::Sampler handle) { device.destroySampler(handle); }
+  inline void destroy_handle(vk::Device device, vk::Semaphore handle) { device.destroySemaphore(handle); }
+
+  /*
+   * Destruction that waits for the GPU instead of the GPU waiting for us.
+   * Anything queued is destroyed once the graphics timeline passes the
+   * value of the next submission, so it is safe to release a resource
+   * while the frame that uses it is being recorded or is still in flight.
+   * Releasing is thread safe, startup creates resources on several threads.
+   */
+  class DeletionQueue {
+    struct Entry {
+      uint64_t value;
+      std::function<void()> destroy;
+    };
+    vk::Device device;
+    const Timeline* timeline = nullptr;
+    std::deque<Entry> entries;
+    mutable std::mutex mutex;
+
+    public:
+    void init(vk::Device device, const Timeline& timeline) {
+      this->device = device;
+      this->timeline = &timeline;
+    }
+
+    void defer(std::function<void()> destroy) {
+      std::lock_guard<std::mutex> lock(mutex);
+      entries.push_back({timeline->last_value() + 1, std::move(destroy)});
+    }
+
+    template<typename T>
+    void destroy_later(T handle) {
+      vk::Device device = this->device;
+      defer([device, handle]() {
+        destroy_handle(device, handle);
+      });
+    }
+
+    // Once per frame, values only grow so the queue is in completion order
+    void collect() {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(entries.empty()) {
+        return;
+      }
+      uint64_t completed = timeline->completed_value();
+      while(!entries.empty() && entries.front().value <= completed) {
+        entries.front().destroy();
+        entries.pop_front();
+      }
+    }
+
+    // Destroys everything right away, only after the device is idle
+    void flush() {
+      std::lock_guard<std::mutex> lock(mutex);
+      for(auto& entry: entries) {
+        entry.destroy();
+      }
+      entries.clear();
+    }
+
+    size_t size() const {
+      std::lock_guard<std::mutex> lock(mutex);
+      return entries.size();
+    }
+  };
+
+  // Owns a vulkan handle and hands it to the deletion queue when released
+  template<typename T>
+  class Unique {
+    T handle{};
+    DeletionQueue* queue = nullptr;
+
+    public:
+    Unique() = default;
+    Unique(DeletionQueue& queue, T handle): handle(handle), queue(&queue) {}
+    Unique(const Unique&) = delete;
+    Unique& operator=(const Unique&) = delete;
+    Unique(Unique&& other) noexcept: handle(other.handle), queue(other.queue) {
+      other.handle = T{};
+    }
+    Unique& operator=(Unique&& other) noexcept {
+      if(this != &other) {
+        reset();
+        handle = other.handle;
+        queue = other.queue;
+        other.handle = T{};
+      }
+      return *this;
+    }
+    ~Unique() {
+      reset();
+    }
+
+    void reset() {
+      if(handle) {
+        queue->destroy_later(handle);
+        handle = T{};
+      }
+    }
+
+    T get() const {
+      return handle;
+    }
+    // For the calls that take arrays of handles
+    const T* address() const {
+      return &handle;
+    }
+    operator T() const {
+      return handle;
+    }
+    explicit operator bool() const {
+      return static_cast<bool>(handle);
+    }
+  };
+
+  using UniqueBuffer = Unique<vk::Buffer>;
+  using UniqueMemory = Unique<vk::DeviceMemory>;
+  using UniqueImage = Unique<vk::Image>;
+  using UniqueImageView = Unique<vk::ImageView>;
+  using UniquePipeline = Unique<vk::Pipeline>;
+
+  // A buffer and the memory bound to it, released together
+  struct BufferAllocation {
+    UniqueBuffer buffer;
+    UniqueMemory memory;
+    MemoryCharge charge;
+    vk::DeviceSize size = 0;
+
+    void reset() {
+      buffer.reset();
+      memory.reset();
+      charge.reset();
+      size = 0;
+    }
+  };
+}
@@ -0,0 +1,256 @@
+#include "Scene.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+
+namespace {
+  // translate * rotate * scale without the full matrix products
+  glm::mat4 compose(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+    glm::mat4 local = glm::mat4_cast(rotation);
+    local[0] *= scale.x;
+    local[1] *= scale.y;
+    local[2] *= scale.z;
+    local[3] = glm::vec4(translation, 1.0f);
+    return local;
+  }
+
+  template<typename T>
+  void permute(std::vector<T>& values, const std::vector<uint32_t>& new_positions) {
+    std::vector<T> sorted(values.size());
+    for(size_t i = 0; i < values.size(); i++) {
+      sorted[new_positions[i]] = values[i];
+    }
+    values.swap(sorted);
+  }
+}
+
+namespace jar {
+  NodeHandle Scene::add_node(NodeHandle parent, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+    if(parent != no_parent && parent >= indices.size()) {
+      throw std::runtime_error("parent node doesn't exist!");
+    }
+    uint32_t index = static_cast<uint32_t>(handles.size());
+    NodeHandle handle = static_cast<NodeHandle>(indices.size());
+    uint32_t parent_index = parent == no_parent ? no_parent : indices[parent];
+    uint32_t depth = parent == no_parent ? 0 : depths[parent_index] + 1;
+
+    translations.push_back(translation);
+    rotations.push_back(rotation);
+    scales.push_back(scale);
+    world.emplace_back(1.0f);
+    parents.push_back(parent_index);
+    depths.push_back(depth);
+    dirty.push_back(0);
+    changed.push_back(0);
+    handles.push_back(handle);
+    indices.push_back(index);
+
+    // Appending in depth order keeps the levels valid, anything else waits for a sort
+    uint32_t level_count = static_cast<uint32_t>(level_starts.empty() ? 0 : level_starts.size() - 1);
+    if(needs_sort || (level_count > 0 && depth < level_count - 1)) {
+      needs_sort = true;
+    } else if(depth == level_count) {
+      if(level_starts.empty()) {
+        level_starts.push_back(0);
+      }
+      level_starts.push_back(index + 1);
+    } else {
+      level_starts.back() = index + 1;
+    }
+    mark_dirty(index);
+    return handle;
+  }
+
+  void Scene::reserve(size_t count) {
+    translations.reserve(count);
+    rotations.reserve(count);
+    scales.reserve(count);
+    world.reserve(count);
+    parents.reserve(count);
+    depths.reserve(count);
+    dirty.reserve(count);
+    changed.reserve(count);
+    handles.reserve(count);
+    indices.reserve(count);
+  }
+
+  void Scene::mark_dirty(uint32_t index) {
+    dirty[index] = 1;
+    first_dirty = std::min(first_dirty, index);
+  }
+
+  void Scene::set_translation(NodeHandle node, const glm::vec3& translation) {
+    uint32_t index = indices[node];
+    translations[index] = translation;
+    mark_dirty(index);
+  }
+
+  void Scene::set_rotation(NodeHandle node, const glm::quat& rotation) {
+    uint32_t index = indices[node];
+    rotations[index] = rotation;
+    mark_dirty(index);
+  }
+
+  void Scene::set_scale(NodeHandle node, const glm::vec3& scale) {
+    uint32_t index = indices[node];
+    scales[index] = scale;
+    mark_dirty(index);
+  }
+
+  const glm::vec3& Scene::get_translation(NodeHandle node) const {
+    return translations[indices[node]];
+  }
+
+  const glm::quat& Scene::get_rotation(NodeHandle node) const {
+    return rotations[indices[node]];
+  }
+
+  const glm::vec3& Scene::get_scale(NodeHandle node) const {
+    return scales[indices[node]];
+  }
+
+  NodeHandle Scene::get_parent(NodeHandle node) const {
+    uint32_t parent = parents[indices[node]];
+    return parent == no_parent ? no_parent : handles[parent];
+  }
+
+  // Stable counting sort on depth, parents already come before their
+  // children within the append order
+  void Scene::sort_by_depth() {
+    needs_sort = false;
+    uint32_t level_count = 0;
+    for(uint32_t depth: depths) {
+      level_count = std::max(level_count, depth + 1);
+    }
+    level_starts.assign(level_count + 1, 0);
+    for(uint32_t depth: depths) {
+      level_starts[depth + 1]++;
+    }
+    for(uint32_t level = 0; level < level_count; level++) {
+      level_starts[level + 1] += level_starts[level];
+    }
+
+    std::vector<uint32_t> new_positions(depths.size());
+    std::vector<uint32_t> next(level_starts.begin(), level_starts.end() - 1);
+    for(size_t i = 0; i < depths.size(); i++) {
+      new_positions[i] = next[depths[i]]++;
+    }
+    for(auto& parent: parents) {
+      if(parent != no_parent) {
+        parent = new_positions[parent];
+      }
+    }
+    permute(translations, new_positions);
+    permute(rotations, new_positions);
+    permute(scales, new_positions);
+    permute(world, new_positions);
+    permute(parents, new_positions);
+    permute(depths, new_positions);
+    permute(dirty, new_positions);
+    permute(handles, new_positions);
+    for(uint32_t i = 0; i < handles.size(); i++) {
+      indices[handles[i]] = i;
+    }
+    // Everything moved, so the previous results no longer line up
+    std::fill(changed.begin(), changed.end(), 0);
+    first_dirty = static_cast<uint32_t>(std::find(dirty.begin(), dirty.end(), 1) - dirty.begin());
+  }
+
+  uint32_t Scene::update_range(uint32_t begin, uint32_t end) {
+    uint32_t recomputed = 0;
+    for(uint32_t i = begin; i < end; i++) {
+      uint32_t parent = parents[i];
+      // The parent is earlier in the pass, its flag is already final
+      bool recompute = dirty[i] || (parent != no_parent && changed[parent]);
+      changed[i] = recompute;
+      if(!recompute) {
+        continue;
+      }
+      dirty[i] = 0;
+      glm::mat4 local = compose(translations[i], rotations[i], scales[i]);
+      world[i] = parent == no_parent ? local : world[parent] * local;
+      recomputed++;
+    }
+    return recomputed;
+  }
+
+  uint32_t Scene::begin_update() {
+    if(needs_sort) {
+      sort_by_depth();
+      pass_start = 0;
+    }
+    uint32_t count = static_cast<uint32_t>(handles.size());
+    uint32_t start = std::min(first_dirty, count);
+    // Flags before the start aren't touched by the pass, clear the last ones there
+    if(start > pass_start) {
+      std::fill(changed.begin() + pass_start, changed.begin() + start, 0);
+    }
+    pass_start = start;
+    first_dirty = count;
+    return start;
+  }
+
+  void Scene::update() {
+    uint32_t start = begin_update();
+    recomputed_count = update_range(start, static_cast<uint32_t>(handles.size()));
+  }
+
+  void Scene::update(ThreadPool& pool) {
+    uint32_t start = begin_update();
+    recomputed_count = 0;
+    std::mutex mutex;
+    std::condition_variable chunks_done;
+    for(size_t level = 0; level + 1 < level_starts.size(); level++) {
+      uint32_t begin = std::max(level_starts[level], start);
+      uint32_t end = level_starts[level + 1];
+      if(begin >= end) {
+        continue;
+      }
+      uint32_t size = end - begin;
+      uint32_t chunk_count = std::min<uint32_t>(static_cast<uint32_t>(pool.size()) + 1, size / min_chunk_size);
+      if(chunk_count <= 1) {
+        recomputed_count += update_range(begin, end);
+        continue;
+      }
+      // Nodes of one level only read the previous levels, the chunks are independent
+      uint32_t chunk_size = (size + chunk_count - 1) / chunk_count;
+      uint32_t remaining = chunk_count - 1;
+      uint32_t level_recomputed = 0;
+      for(uint32_t chunk = 1; chunk < chunk_count; chunk++) {
+        uint32_t chunk_begin = begin + chunk * chunk_size;
+        uint32_t chunk_end = std::min(end, chunk_begin + chunk_size);
+        pool.submit([&, chunk_begin, chunk_end]() {
+          uint32_t recomputed = update_range(chunk_begin, chunk_end);
+          std::lock_guard<std::mutex> lock(mutex);
+          level_recomputed += recomputed;
+          // Under the lock, the waiter may return and destroy these right after
+          if(--remaining == 0) {
+            chunks_done.notify_one();
+          }
+        });
+      }
+      // This thread takes the first chunk instead of just waiting
+      uint32_t recomputed = update_range(begin, std::min(end, begin + chunk_size));
+      std::unique_lock<std::mutex> lock(mutex);
+      chunks_done.wait(lock, [&]() { return remaining == 0; });
+      recomputed_count += level_recomputed + recomputed;
+    }
+  }
+
+  const glm::mat4& Scene::get_world(NodeHandle node) const {
+    return world[indices[node]];
+  }
+
+  bool Scene::world_changed(NodeHandle node) const {
+    return changed[indices[node]] != 0;
+  }
+
+  uint32_t Scene::get_recomputed_count() const {
+    return recomputed_count;
+  }
+
+  size_t Scene::size() const {
+    return handles.size();
+  }
+}
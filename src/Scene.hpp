@@ -0,0 +1,88 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <cstdint>
+#include <vector>
+#include "ThreadPool.hpp"
+
+namespace jar {
+  // Stable name for a node, its position in the arrays changes when the
+  // hierarchy is re-sorted
+  using NodeHandle = uint32_t;
+
+  /*
+   * Transform hierarchy stored as structure of arrays: local translation,
+   * rotation and scale, world matrix, parent index and dirty flags, each in
+   * its own array. Nodes are sorted by depth, so every parent comes before
+   * its children and all nodes of one depth are contiguous.
+   *
+   * update() recomputes world matrices in one linear pass. It starts at the
+   * first dirty node and only recomputes nodes that were changed or whose
+   * parent was recomputed this pass, so the cost is a byte test per node
+   * plus a matrix multiply per moved node. With a pool each depth level is
+   * split into chunks across threads, levels in order.
+   *
+   * Adding nodes appends them; the depth sort runs once at the next update.
+   */
+  class Scene {
+    // SoA, all indexed by position
+    std::vector<glm::vec3> translations;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+    std::vector<glm::mat4> world;
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> depths;
+    // Local transform was set since the last update
+    std::vector<uint8_t> dirty;
+    // World matrix was recomputed by the last update
+    std::vector<uint8_t> changed;
+    std::vector<NodeHandle> handles;
+
+    // Handle to position
+    std::vector<uint32_t> indices;
+    // First position of each depth, plus the end
+    std::vector<uint32_t> level_starts;
+    bool needs_sort = false;
+    uint32_t first_dirty = 0;
+    // Where the last pass started, changed flags before it are all clear
+    uint32_t pass_start = 0;
+    uint32_t recomputed_count = 0;
+
+    void sort_by_depth();
+    void mark_dirty(uint32_t index);
+    // Returns where the pass starts
+    uint32_t begin_update();
+    // Returns how many world matrices were recomputed
+    uint32_t update_range(uint32_t begin, uint32_t end);
+
+    public:
+    static constexpr uint32_t no_parent = ~0u;
+    // Smaller levels aren't worth handing to other threads
+    static constexpr uint32_t min_chunk_size = 4096;
+
+    NodeHandle add_node(NodeHandle parent = no_parent,
+        const glm::vec3& translation = glm::vec3(0.0f),
+        const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+        const glm::vec3& scale = glm::vec3(1.0f));
+    void reserve(size_t count);
+
+    void set_translation(NodeHandle node, const glm::vec3& translation);
+    void set_rotation(NodeHandle node, const glm::quat& rotation);
+    void set_scale(NodeHandle node, const glm::vec3& scale);
+    const glm::vec3& get_translation(NodeHandle node) const;
+    const glm::quat& get_rotation(NodeHandle node) const;
+    const glm::vec3& get_scale(NodeHandle node) const;
+    NodeHandle get_parent(NodeHandle node) const;
+
+    void update();
+    void update(ThreadPool& pool);
+
+    // Valid after update()
+    const glm::mat4& get_world(NodeHandle node) const;
+    // Whether the last update() changed the node's world matrix
+    bool world_changed(NodeHandle node) const;
+    // World matrices recomputed by the last update()
+    uint32_t get_recomputed_count() const;
+    size_t size() const;
+  };
+}
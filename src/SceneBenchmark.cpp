@@ -0,0 +1,113 @@
+#include "SceneBenchmark.hpp"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+
+  double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  // Walks up to the root for every node, the obvious way with full matrix products
+  uint32_t count_mismatches(const jar::Scene& scene) {
+    std::vector<glm::mat4> world(scene.size());
+    std::vector<uint8_t> done(scene.size(), 0);
+    std::function<const glm::mat4&(jar::NodeHandle)> reference = [&](jar::NodeHandle node) -> const glm::mat4& {
+      if(!done[node]) {
+        glm::mat4 local = glm::translate(glm::mat4(1.0f), scene.get_translation(node)) *
+          glm::mat4_cast(scene.get_rotation(node)) * glm::scale(glm::mat4(1.0f), scene.get_scale(node));
+        jar::NodeHandle parent = scene.get_parent(node);
+        world[node] = parent == jar::Scene::no_parent ? local : reference(parent) * local;
+        done[node] = 1;
+      }
+      return world[node];
+    };
+    uint32_t mismatches = 0;
+    for(jar::NodeHandle node = 0; node < scene.size(); node++) {
+      const glm::mat4& expected = reference(node);
+      const glm::mat4& actual = scene.get_world(node);
+      bool equal = true;
+      for(int column = 0; column < 4; column++) {
+        for(int row = 0; row < 4; row++) {
+          float tolerance = 1e-3f * std::max(1.0f, std::abs(expected[column][row]));
+          equal = equal && std::abs(expected[column][row] - actual[column][row]) <= tolerance;
+        }
+      }
+      mismatches += !equal;
+    }
+    return mismatches;
+  }
+}
+
+namespace jar {
+  bool run_scene_benchmark(uint32_t node_count) {
+    constexpr float root_fraction = 0.1f;
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> scale(0.9f, 1.1f);
+    auto random_rotation = [&]() {
+      return glm::angleAxis(unit(random) * 3.14159f, glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(1e-3f)));
+    };
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Scene benchmark: " << node_count << " nodes\n";
+
+    // Parents are picked from everything added so far, so depths come out
+    // of order and the first update has to sort
+    Scene scene;
+    scene.reserve(node_count);
+    std::uniform_real_distribution<float> fraction(0.0f, 1.0f);
+    for(uint32_t i = 0; i < node_count; i++) {
+      NodeHandle parent = i == 0 || fraction(random) < root_fraction ? Scene::no_parent : static_cast<NodeHandle>(random() % i);
+      scene.add_node(parent, glm::vec3(unit(random), unit(random), unit(random)), random_rotation(), glm::vec3(scale(random)));
+    }
+
+    ThreadPool pool;
+    uint32_t total_mismatches = 0;
+    auto check = [&](const char* name, double ms) {
+      uint32_t mismatches = count_mismatches(scene);
+      total_mismatches += mismatches;
+      std::cout << "  " << name << ": " << ms << "ms, " << scene.get_recomputed_count() << " recomputed, "
+        << mismatches << " mismatches\n";
+    };
+    auto move = [&](uint32_t count) {
+      for(uint32_t i = 0; i < count; i++) {
+        NodeHandle node = static_cast<NodeHandle>(random() % node_count);
+        scene.set_translation(node, scene.get_translation(node) + glm::vec3(unit(random), unit(random), unit(random)) * 0.1f);
+      }
+    };
+
+    auto start = Clock::now();
+    scene.update();
+    check("sort and full update", elapsed_ms(start));
+
+    for(bool parallel: {false, true}) {
+      std::string how = parallel ? " (" + std::to_string(pool.size()) + " threads)" : std::string(" (serial)");
+      for(uint32_t moved: {10u, node_count / 100}) {
+        move(moved);
+        start = Clock::now();
+        parallel ? scene.update(pool) : scene.update();
+        check((std::to_string(moved) + " moved" + how).c_str(), elapsed_ms(start));
+      }
+      // Every root moves, so the whole forest is recomputed
+      for(NodeHandle node = 0; node < node_count; node++) {
+        if(scene.get_parent(node) == Scene::no_parent) {
+          scene.set_rotation(node, random_rotation());
+        }
+      }
+      start = Clock::now();
+      parallel ? scene.update(pool) : scene.update();
+      check(("all moved" + how).c_str(), elapsed_ms(start));
+    }
+    return total_mismatches == 0;
+  }
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdint>
+
+namespace jar {
+  /*
+   * CPU only, no window or device. Builds a random forest of node_count
+   * nodes and times Scene::update, serial and on a thread pool, after
+   * moving everything, a few nodes and a percent of them. Every result is
+   * checked against a recursive reference, returns false on a mismatch.
+   */
+  bool run_scene_benchmark(uint32_t node_count);
+}
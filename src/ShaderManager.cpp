@@ -0,0 +1,204 @@
+#include "ShaderManager.hpp"
+#include <glslang/Public/ShaderLang.h>
+#include <glslang/Public/ResourceLimits.h>
+#include <SPIRV/GlslangToSpv.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+  std::optional<EShLanguage> get_stage(const std::string& source) {
+    static const std::map<std::string, EShLanguage> stages = {
+      {".vert", EShLangVertex},
+      {".frag", EShLangFragment},
+      {".comp", EShLangCompute},
+      {".geom", EShLangGeometry},
+      {".tesc", EShLangTessControl},
+      {".tese", EShLangTessEvaluation}
+    };
+    auto dot = source.rfind('.');
+    if(dot == std::string::npos) {
+      return std::nullopt;
+    }
+    auto stage = stages.find(source.substr(dot));
+    if(stage == stages.end()) {
+      return std::nullopt;
+    }
+    return stage->second;
+  }
+
+  std::optional<std::string> read_text(const std::string& path) {
+    std::ifstream file(path);
+    if(!file.is_open()) {
+      return std::nullopt;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+  }
+}
+
+namespace jar {
+  ShaderManager::ShaderManager(std::string directory, ShaderModuleRegistry& modules): directory(std::move(directory)), modules(modules) {
+  }
+
+  ShaderManager::~ShaderManager() {
+    stop();
+  }
+
+  void ShaderManager::add(const std::string& source, const std::string& spirv) {
+    if(!get_stage(source)) {
+      throw std::runtime_error("unknown shader stage for " + source + "!");
+    }
+    auto& shader = shaders[source];
+    try {
+      shader.spirv = modules.load(directory + "/" + spirv);
+    } catch(const std::runtime_error&) {
+      // Not built offline yet, compile it now so a fresh checkout still runs
+      glslang::InitializeProcess();
+      auto compiled = compile_spirv(source);
+      glslang::FinalizeProcess();
+      if(!compiled) {
+        throw std::runtime_error("failed to compile " + source + "!");
+      }
+      shader.compiled = std::move(*compiled);
+      shader.spirv = Spirv(shader.compiled);
+    }
+  }
+
+  void ShaderManager::start() {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd < 0) {
+      std::cout << "inotify unavailable, shader hot reload disabled\n";
+      return;
+    }
+    // Editors tend to write a temporary file and rename it over the original,
+    // so watch the directory rather than the files
+    if(inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+      std::cout << "Can't watch " << directory << ", shader hot reload disabled\n";
+      close(inotify_fd);
+      inotify_fd = -1;
+      return;
+    }
+    running = true;
+    worker = std::thread(&ShaderManager::watch, this);
+  }
+
+  void ShaderManager::stop() {
+    running = false;
+    if(worker.joinable()) {
+      worker.join();
+    }
+    if(inotify_fd >= 0) {
+      close(inotify_fd);
+      inotify_fd = -1;
+    }
+  }
+
+  void ShaderManager::watch() {
+    glslang::InitializeProcess();
+    // Big enough for a batch of events with names
+    alignas(inotify_event) char buffer[4096];
+    while(running) {
+      pollfd fd{inotify_fd, POLLIN, 0};
+      // Short timeout so stop() doesn't have to wait long
+      if(::poll(&fd, 1, 100) <= 0) {
+        continue;
+      }
+      std::vector<std::string> changed;
+      ssize_t length;
+      while((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for(char* ptr = buffer; ptr < buffer + length; ) {
+          auto* event = reinterpret_cast<inotify_event*>(ptr);
+          ptr += sizeof(inotify_event) + event->len;
+          if(event->len == 0) {
+            continue;
+          }
+          std::string name = event->name;
+          // shaders is only written before start(), reading it here is fine
+          if(shaders.count(name) && std::find(changed.begin(), changed.end(), name) == changed.end()) {
+            changed.push_back(name);
+          }
+        }
+      }
+      for(const auto& name: changed) {
+        compile(name);
+      }
+    }
+    glslang::FinalizeProcess();
+  }
+
+  std::optional<std::vector<uint32_t>> ShaderManager::compile_spirv(const std::string& source) const {
+    auto text = read_text(directory + "/" + source);
+    if(!text) {
+      std::cout << "Failed to read " << source << '\n';
+      return std::nullopt;
+    }
+    EShLanguage stage = *get_stage(source);
+    const char* strings[] = {text->c_str()};
+    const char* names[] = {source.c_str()};
+    glslang::TShader shader(stage);
+    shader.setStringsWithLengthsAndNames(strings, nullptr, names, 1);
+    shader.setEnvInput(glslang::EShSourceGlsl, stage, glslang::EShClientVulkan, 100);
+    shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_0);
+    shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_0);
+    auto messages = static_cast<EShMessages>(EShMsgSpvRules | EShMsgVulkanRules);
+    if(!shader.parse(GetDefaultResources(), 100, false, messages)) {
+      std::cout << "Failed to compile " << source << ":\n" << shader.getInfoLog();
+      return std::nullopt;
+    }
+    glslang::TProgram program;
+    program.addShader(&shader);
+    if(!program.link(messages)) {
+      std::cout << "Failed to link " << source << ":\n" << program.getInfoLog();
+      return std::nullopt;
+    }
+    std::vector<uint32_t> spirv;
+    glslang::GlslangToSpv(*program.getIntermediate(stage), spirv);
+    return spirv;
+  }
+
+  void ShaderManager::compile(const std::string& source) {
+    auto start = std::chrono::high_resolution_clock::now();
+    auto spirv = compile_spirv(source);
+    if(!spirv) {
+      return;
+    }
+    Compiled compiled{source, std::move(*spirv)};
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Recompiled " << source << " in "
+      << std::chrono::duration<float, std::milli>(end - start).count() << "ms\n";
+
+    std::lock_guard<std::mutex> lock(finished_mutex);
+    finished.push_back(std::move(compiled));
+  }
+
+  Spirv ShaderManager::get(const std::string& source) const {
+    return shaders.at(source).spirv;
+  }
+
+  std::vector<std::string> ShaderManager::poll() {
+    std::vector<Compiled> compiled;
+    {
+      std::lock_guard<std::mutex> lock(finished_mutex);
+      compiled.swap(finished);
+    }
+    std::vector<std::string> changed;
+    for(auto& result: compiled) {
+      auto& shader = shaders.at(result.source);
+      // Before the old words go away, the registry compares against them
+      modules.retire(shader.spirv);
+      shader.compiled = std::move(result.spirv);
+      shader.spirv = Spirv(shader.compiled);
+      changed.push_back(result.source);
+    }
+    return changed;
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ShaderModules.hpp"
+
+namespace jar {
+  /*
+   * Keeps the current SPIR-V of every registered shader and recompiles the
+   * GLSL on a worker thread whenever the file changes on disk (inotify on
+   * the shader directory). The render loop calls poll() at a frame boundary
+   * to pick up finished compiles, nothing in here ever blocks it.
+   *
+   * A shader that fails to compile keeps its previous SPIR-V, the error is
+   * printed and the next save is tried again.
+   */
+  class ShaderManager {
+    struct Shader {
+      // Points into the registry's mapping until the first recompile
+      Spirv spirv;
+      std::vector<uint32_t> compiled;
+    };
+
+    struct Compiled {
+      std::string source;
+      std::vector<uint32_t> spirv;
+    };
+
+    std::string directory;
+    ShaderModuleRegistry& modules;
+    std::map<std::string, Shader> shaders;
+
+    std::thread worker;
+    std::atomic<bool> running{false};
+    int inotify_fd = -1;
+    std::mutex finished_mutex;
+    std::vector<Compiled> finished;
+
+    void watch();
+    std::optional<std::vector<uint32_t>> compile_spirv(const std::string& source) const;
+    void compile(const std::string& source);
+
+    public:
+    ShaderManager(std::string directory, ShaderModuleRegistry& modules);
+    ShaderManager(const ShaderManager&) = delete;
+    ShaderManager& operator=(const ShaderManager&) = delete;
+    ~ShaderManager();
+
+    // source is the GLSL file name within the directory, the stage comes from
+    // its extension. spirv is the offline compiled version, loaded through
+    // the registry up front, the source is compiled right away if it's missing.
+    void add(const std::string& source, const std::string& spirv);
+    // Starts watching, call after every shader has been added
+    void start();
+    void stop();
+
+    // Valid until the next poll()
+    Spirv get(const std::string& source) const;
+    // Installs the compiles that finished since the last call and returns
+    // the shaders that changed
+    std::vector<std::string> poll();
+  };
+}
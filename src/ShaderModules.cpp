@@ -0,0 +1,150 @@
+#include "ShaderModules.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+  uint64_t hash_words(jar::Spirv spirv) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < spirv.size(); i++) {
+      hash = (hash ^ spirv[i]) * 1099511628211ull;
+    }
+    return hash;
+  }
+
+  std::string file_name(const std::string& path) {
+    auto slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+  }
+}
+
+namespace jar {
+  void ShaderModuleRegistry::init(vk::Device device, DeletionQueue& deletion_queue) {
+    this->device = device;
+    this->deletion_queue = &deletion_queue;
+  }
+
+  bool ShaderModuleRegistry::Module::matches(Spirv spirv) const {
+    return words.size() == spirv.size() && std::memcmp(words.data(), spirv.code, spirv.bytes()) == 0;
+  }
+
+  void ShaderModuleRegistry::destroy() {
+    for(auto& [hash, module]: modules) {
+      device.destroyShaderModule(module.module);
+    }
+    modules.clear();
+    for(auto module: uncached) {
+      device.destroyShaderModule(module);
+    }
+    uncached.clear();
+    pack_entries.clear();
+    for(auto& mapping: mappings) {
+      munmap(mapping.data, mapping.size);
+    }
+    mappings.clear();
+  }
+
+  // Page aligned, which is plenty for SPIR-V words, and no copy
+  const ShaderModuleRegistry::Mapping* ShaderModuleRegistry::map_file(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+      return nullptr;
+    }
+    struct stat info{};
+    if(fstat(fd, &info) != 0 || info.st_size == 0) {
+      close(fd);
+      return nullptr;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive on its own
+    close(fd);
+    if(data == MAP_FAILED) {
+      return nullptr;
+    }
+    mappings.push_back({data, size});
+    return &mappings.back();
+  }
+
+  bool ShaderModuleRegistry::open_pack(const std::string& path) {
+    const Mapping* pack = map_file(path);
+    if(!pack) {
+      return false;
+    }
+    const auto* words = static_cast<const uint32_t*>(pack->data);
+    // The header is untrusted, so do the bounds arithmetic in 64 bit where it can't wrap
+    uint64_t word_count = pack->size / sizeof(uint32_t);
+    if(word_count < 2 || words[0] != pack_magic || 2 + uint64_t(words[1]) * 4 > word_count) {
+      throw std::runtime_error("invalid shader pack " + path + "!");
+    }
+    const char* bytes = static_cast<const char*>(pack->data);
+    for(uint32_t i = 0; i < words[1]; i++) {
+      const uint32_t* entry = words + 2 + i * 4;
+      uint64_t name_offset = entry[0], name_length = entry[1], data_offset = entry[2], data_size = entry[3];
+      if(name_offset + name_length > pack->size || data_offset + data_size > pack->size || data_offset % sizeof(uint32_t) != 0) {
+        throw std::runtime_error("invalid shader pack " + path + "!");
+      }
+      pack_entries[std::string(bytes + name_offset, name_length)] = Spirv(words + data_offset / sizeof(uint32_t), data_size / sizeof(uint32_t));
+    }
+    std::cout << "Shader pack " << path << ": " << pack_entries.size() << " modules\n";
+    return true;
+  }
+
+  Spirv ShaderModuleRegistry::load(const std::string& path) {
+    auto packed = pack_entries.find(file_name(path));
+    if(packed != pack_entries.end()) {
+      return packed->second;
+    }
+    const Mapping* mapping = map_file(path);
+    if(!mapping) {
+      throw std::runtime_error("failed to open file " + path + "!");
+    }
+    return Spirv(static_cast<const uint32_t*>(mapping->data), mapping->size / sizeof(uint32_t));
+  }
+
+  vk::ShaderModule ShaderModuleRegistry::get_module(Spirv spirv) {
+    uint64_t hash = hash_words(spirv);
+    std::lock_guard<std::mutex> lock(modules_mutex);
+    module_requests++;
+    auto found = modules.find(hash);
+    if(found != modules.end() && found->second.matches(spirv)) {
+      return found->second.module;
+    }
+
+    vk::ShaderModuleCreateInfo create_info{};
+    create_info.setCodeSize(spirv.bytes());
+    create_info.setPCode(spirv.code);
+    vk::ShaderModule shader_module;
+    if(device.createShaderModule(&create_info, nullptr, &shader_module) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create shader module!");
+    }
+    if(found != modules.end()) {
+      // Hash collision, the first module keeps the slot
+      uncached.push_back(shader_module);
+      return shader_module;
+    }
+    modules[hash] = {std::vector<uint32_t>(spirv.code, spirv.code + spirv.size()), shader_module};
+    return shader_module;
+  }
+
+  void ShaderModuleRegistry::retire(Spirv spirv) {
+    uint64_t hash = hash_words(spirv);
+    std::lock_guard<std::mutex> lock(modules_mutex);
+    auto found = modules.find(hash);
+    if(found == modules.end() || !found->second.matches(spirv)) {
+      return;
+    }
+    deletion_queue->destroy_later(found->second.module);
+    modules.erase(found);
+  }
+
+  void ShaderModuleRegistry::print_summary() const {
+    std::cout << "Shader modules: " << modules.size() << " created for " << module_requests << " requests, "
+      << mappings.size() << " files mapped\n";
+  }
+}
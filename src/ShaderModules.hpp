@@ -0,0 +1,81 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Resource.hpp"
+
+namespace jar {
+  // Non-owning view of SPIR-V words, always 4 byte aligned
+  struct Spirv {
+    const uint32_t* code = nullptr;
+    // In words
+    size_t count = 0;
+
+    Spirv() = default;
+    Spirv(const uint32_t* code, size_t count): code(code), count(count) {}
+    Spirv(const std::vector<uint32_t>& words): code(words.data()), count(words.size()) {}
+
+    size_t size() const { return count; }
+    size_t bytes() const { return count * sizeof(uint32_t); }
+    const uint32_t& operator[](size_t i) const { return code[i]; }
+  };
+
+  /*
+   * Loads SPIR-V by mapping it straight from disk, either loose .spv files
+   * or a single pack built by shaders/pack_shaders.py, and hands out one
+   * vk::ShaderModule per distinct module content. Mappings and modules stay
+   * alive until destroy(), so pipelines can share modules freely, except
+   * for modules retired by a hot reload which go through the deletion queue.
+   *
+   * Pack layout, all little endian uint32: magic, entry count, then per
+   * entry name offset, name length, data offset, data size, followed by the
+   * names and the 4 byte aligned SPIR-V.
+   */
+  class ShaderModuleRegistry {
+    struct Mapping {
+      void* data;
+      size_t size;
+    };
+
+    vk::Device device;
+    DeletionQueue* deletion_queue = nullptr;
+    std::vector<Mapping> mappings;
+    std::unordered_map<std::string, Spirv> pack_entries;
+    // Keyed on a hash of the words, collisions are checked against a copy of
+    // them since recompiled SPIR-V doesn't outlive the next reload
+    struct Module {
+      std::vector<uint32_t> words;
+      vk::ShaderModule module;
+
+      bool matches(Spirv spirv) const;
+    };
+    std::unordered_map<uint64_t, Module> modules;
+    std::vector<vk::ShaderModule> uncached;
+    uint32_t module_requests = 0;
+    // Pipelines are rebuilt on a worker while the render loop retires modules
+    std::mutex modules_mutex;
+
+    const Mapping* map_file(const std::string& path);
+
+    public:
+    static constexpr uint32_t pack_magic = 0x4b505346; // "FSPK"
+
+    void init(vk::Device device, DeletionQueue& deletion_queue);
+    void destroy();
+
+    // Returns false if there is no pack, loose files are used then
+    bool open_pack(const std::string& path);
+    // Looks the file name up in the pack first
+    Spirv load(const std::string& path);
+    vk::ShaderModule get_module(Spirv spirv);
+    // The shader was replaced, its module goes once the frames and pipeline
+    // builds that may still use it are done. Asking for it again recreates it.
+    void retire(Spirv spirv);
+
+    void print_summary() const;
+  };
+}
@@ -0,0 +1,866 @@
+#include "ShadowMaps.hpp"
+#include "Memory.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+  // GLM's projections are -1..1 in depth, vulkan's clip space is 0..1
+  const glm::mat4 depth_zero_to_one = {
+    1.0f, 0.0f, 0.0f, 0.0f,
+    0.0f, 1.0f, 0.0f, 0.0f,
+    0.0f, 0.0f, 0.5f, 0.0f,
+    0.0f, 0.0f, 0.5f, 1.0f
+  };
+
+  // Clip space to uv in a rectangle of the texture, depth left alone
+  glm::mat4 clip_to_uv(glm::vec2 scale, glm::vec2 offset) {
+    glm::mat4 matrix(1.0f);
+    matrix[0][0] = 0.5f * scale.x;
+    matrix[1][1] = 0.5f * scale.y;
+    matrix[3][0] = 0.5f * scale.x + offset.x;
+    matrix[3][1] = 0.5f * scale.y + offset.y;
+    return matrix;
+  }
+
+  bool intersects(const jar::Frustum& frustum, const jar::Aabb& bounds) {
+    if(bounds.min.x > bounds.max.x) {
+      return false;
+    }
+    for(const auto& plane: frustum.planes) {
+      // The corner furthest along the plane normal
+      glm::vec3 corner(
+          plane.x >= 0.0f ? bounds.max.x : bounds.min.x,
+          plane.y >= 0.0f ? bounds.max.y : bounds.min.y,
+          plane.z >= 0.0f ? bounds.max.z : bounds.min.z);
+      if(glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void transition(vk::CommandBuffer cmd,
+      vk::Image image,
+      uint32_t layers,
+      vk::ImageLayout old_layout,
+      vk::ImageLayout new_layout,
+      vk::PipelineStageFlags src_stages,
+      vk::AccessFlags src_access,
+      vk::PipelineStageFlags dst_stages,
+      vk::AccessFlags dst_access) {
+    vk::ImageMemoryBarrier barrier{};
+    barrier.setImage(image);
+    barrier.setOldLayout(old_layout);
+    barrier.setNewLayout(new_layout);
+    barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    barrier.setSrcAccessMask(src_access);
+    barrier.setDstAccessMask(dst_access);
+    barrier.subresourceRange.setAspectMask(vk::ImageAspectFlagBits::eDepth);
+    barrier.subresourceRange.setLevelCount(1);
+    barrier.subresourceRange.setLayerCount(layers);
+    cmd.pipelineBarrier(src_stages, dst_stages, {}, 0, nullptr, 0, nullptr, 1, &barrier);
+  }
+
+  const vk::PipelineStageFlags depth_stages = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+  const vk::AccessFlags depth_access = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+}
+
+namespace jar {
+  void ShadowMaps::create(vk::Device device,
+      vk::PhysicalDevice physical_device,
+      uint32_t queue_family,
+      DeletionQueue& deletion_queue,
+      MemoryBudget& memory_budget,
+      LayoutCache& layouts,
+      const ShaderReflection& fragment_reflection,
+      const ShadowSettings& settings) {
+    this->device = device;
+    this->physical_device = physical_device;
+    this->deletion_queue = &deletion_queue;
+    this->memory_budget = &memory_budget;
+    this->layouts = &layouts;
+    this->settings = settings;
+    this->settings.cascade_count = std::clamp(settings.cascade_count, 1u, max_cascades);
+    this->settings.atlas_resolution = std::max(settings.atlas_resolution, settings.tile_resolution);
+    uint32_t tiles_per_row = this->settings.atlas_resolution / std::max(1u, settings.tile_resolution);
+    this->settings.local_lights = std::min({settings.local_lights, max_local_lights, tiles_per_row * tiles_per_row / 6});
+    this->settings.sun_direction = glm::normalize(settings.sun_direction);
+    initialized = false;
+    stats = {};
+
+    // D16 is always there for sampling and rendering, filtering it isn't
+    format = vk::Format::eD16Unorm;
+    auto wanted = vk::FormatFeatureFlagBits::eDepthStencilAttachment | vk::FormatFeatureFlagBits::eSampledImage;
+    auto d32 = physical_device.getFormatProperties(vk::Format::eD32Sfloat).optimalTilingFeatures;
+    if((d32 & wanted) == wanted) {
+      format = vk::Format::eD32Sfloat;
+    }
+    linear_filtering = static_cast<bool>(physical_device.getFormatProperties(format).optimalTilingFeatures &
+        vk::FormatFeatureFlagBits::eSampledImageFilterLinear);
+
+    create_render_passes();
+    create_target(cascades, {this->settings.cascade_resolution, this->settings.cascade_resolution}, this->settings.cascade_count);
+    create_target(atlas, {this->settings.atlas_resolution, this->settings.atlas_resolution}, 1);
+
+    views.assign(this->settings.cascade_count + this->settings.local_lights * 6, View{});
+    for(uint32_t i = 0; i < this->settings.cascade_count; i++) {
+      views[i].layer = i;
+      views[i].area = vk::Rect2D({0, 0}, cascades.extent);
+    }
+    uint32_t tile = this->settings.tile_resolution;
+    for(uint32_t i = 0; i < this->settings.local_lights * 6; i++) {
+      View& view = views[this->settings.cascade_count + i];
+      view.area = vk::Rect2D({int32_t(i % tiles_per_row * tile), int32_t(i / tiles_per_row * tile)}, {tile, tile});
+    }
+
+    // Linear filtering with a compare sampler is a free 2x2 PCF
+    vk::SamplerCreateInfo sampler_info{};
+    vk::Filter filter = linear_filtering ? vk::Filter::eLinear : vk::Filter::eNearest;
+    sampler_info.setMagFilter(filter);
+    sampler_info.setMinFilter(filter);
+    sampler_info.setAddressModeU(vk::SamplerAddressMode::eClampToEdge);
+    sampler_info.setAddressModeV(vk::SamplerAddressMode::eClampToEdge);
+    sampler_info.setAddressModeW(vk::SamplerAddressMode::eClampToEdge);
+    sampler_info.setCompareEnable(true);
+    sampler_info.setCompareOp(vk::CompareOp::eLessOrEqual);
+    sampler_info.setMaxLod(0.0f);
+    vk::Sampler new_sampler;
+    if(device.createSampler(&sampler_info, nullptr, &new_sampler) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create shadow sampler!");
+    }
+    sampler = Unique<vk::Sampler>(deletion_queue, new_sampler);
+
+    auto render_description = merge_layouts({fragment_reflection});
+    if(render_description.sets.count(2) == 0) {
+      throw std::runtime_error("shader.frag has no shadow maps in set 2!");
+    }
+    render_bindings = render_description.sets[2];
+    for(const auto& binding: render_bindings) {
+      if(binding.binding > 2) {
+        throw std::runtime_error("shader.frag uses an unknown shadow binding!");
+      }
+    }
+    render_set_layout = layouts.get_set_layout(render_bindings);
+
+    vk::CommandPoolCreateInfo pool_info{};
+    pool_info.setQueueFamilyIndex(queue_family);
+    pool_info.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+    if(device.createCommandPool(&pool_info, nullptr, &command_pool) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create shadow command pool!");
+    }
+  }
+
+  void ShadowMaps::set_slot_count(uint32_t count) {
+    slots.clear();
+    slots.resize(count);
+    for(auto& slot: slots) {
+      vk::BufferCreateInfo buffer_info{};
+      buffer_info.setSize(sizeof(Uniforms));
+      buffer_info.setUsage(vk::BufferUsageFlagBits::eUniformBuffer);
+      buffer_info.setSharingMode(vk::SharingMode::eExclusive);
+      vk::Buffer buffer;
+      if(device.createBuffer(&buffer_info, nullptr, &buffer) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to create shadow uniform buffer!");
+      }
+      slot.uniforms.buffer = UniqueBuffer(*deletion_queue, buffer);
+      slot.uniforms.size = sizeof(Uniforms);
+      vk::MemoryRequirements mem_requirements = device.getBufferMemoryRequirements(buffer);
+      uint32_t memory_type = memory::findMemoryType(physical_device, mem_requirements.memoryTypeBits,
+          vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+      vk::MemoryAllocateInfo alloc_info{};
+      alloc_info.setAllocationSize(mem_requirements.size);
+      alloc_info.setMemoryTypeIndex(memory_type);
+      vk::DeviceMemory memory;
+      if(device.allocateMemory(&alloc_info, nullptr, &memory) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to allocate shadow uniform buffer memory!");
+      }
+      slot.uniforms.memory = UniqueMemory(*deletion_queue, memory);
+      slot.uniforms.charge = MemoryCharge(*memory_budget, *deletion_queue, memory_type, MemoryCategory::uniform, mem_requirements.size);
+      device.bindBufferMemory(buffer, memory, 0);
+      slot.mapped = device.mapMemory(memory, 0, VK_WHOLE_SIZE);
+      std::memset(slot.mapped, 0, sizeof(Uniforms));
+    }
+    create_descriptor_sets();
+  }
+
+  void ShadowMaps::create_image(Image& image, const Target& target, vk::ImageUsageFlags usage) {
+    vk::ImageCreateInfo image_info{};
+    image_info.setImageType(vk::ImageType::e2D);
+    image_info.setFormat(format);
+    image_info.setExtent({target.extent.width, target.extent.height, 1});
+    image_info.setMipLevels(1);
+    image_info.setArrayLayers(target.layers);
+    image_info.setSamples(vk::SampleCountFlagBits::e1);
+    image_info.setTiling(vk::ImageTiling::eOptimal);
+    image_info.setUsage(usage | vk::ImageUsageFlagBits::eDepthStencilAttachment);
+    image_info.setSharingMode(vk::SharingMode::eExclusive);
+    image_info.setInitialLayout(vk::ImageLayout::eUndefined);
+    vk::Image handle;
+    if(device.createImage(&image_info, nullptr, &handle) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create shadow map!");
+    }
+    image.image = UniqueImage(*deletion_queue, handle);
+
+    vk::MemoryRequirements mem_requirements = device.getImageMemoryRequirements(handle);
+    uint32_t memory_type = memory::findMemoryType(physical_device, mem_requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    vk::MemoryAllocateInfo alloc_info{};
+    alloc_info.setAllocationSize(mem_requirements.size);
+    alloc_info.setMemoryTypeIndex(memory_type);
+    vk::DeviceMemory memory;
+    if(device.allocateMemory(&alloc_info, nullptr, &memory) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to allocate shadow map memory!");
+    }
+    image.memory = UniqueMemory(*deletion_queue, memory);
+    image.charge = MemoryCharge(*memory_budget, *deletion_queue, memory_type, MemoryCategory::shadows, mem_requirements.size);
+    device.bindImageMemory(handle, memory, 0);
+  }
+
+  void ShadowMaps::create_target(Target& target, vk::Extent2D extent, uint32_t layers) {
+    target.extent = extent;
+    target.layers = layers;
+    create_image(target.cache, target, vk::ImageUsageFlagBits::eTransferSrc);
+    create_image(target.live, target, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled);
+
+    auto create_view = [&](vk::Image image, vk::ImageViewType type, uint32_t first_layer, uint32_t layer_count) {
+      vk::ImageViewCreateInfo view_info{};
+      view_info.setImage(image);
+      view_info.setViewType(type);
+      view_info.setFormat(format);
+      view_info.subresourceRange.setAspectMask(vk::ImageAspectFlagBits::eDepth);
+      view_info.subresourceRange.setLevelCount(1);
+      view_info.subresourceRange.setBaseArrayLayer(first_layer);
+      view_info.subresourceRange.setLayerCount(layer_count);
+      vk::ImageView view;
+      if(device.createImageView(&view_info, nullptr, &view) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to create shadow map view!");
+      }
+      return UniqueImageView(*deletion_queue, view);
+    };
+    auto create_framebuffer = [&](vk::RenderPass render_pass, vk::ImageView view) {
+      vk::FramebufferCreateInfo framebuffer_info{};
+      framebuffer_info.setRenderPass(render_pass);
+      framebuffer_info.setAttachmentCount(1);
+      framebuffer_info.setPAttachments(&view);
+      framebuffer_info.setWidth(extent.width);
+      framebuffer_info.setHeight(extent.height);
+      framebuffer_info.setLayers(1);
+      vk::Framebuffer framebuffer;
+      if(device.createFramebuffer(&framebuffer_info, nullptr, &framebuffer) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to create shadow map framebuffer!");
+      }
+      return Unique<vk::Framebuffer>(*deletion_queue, framebuffer);
+    };
+
+    target.cache_views.clear();
+    target.live_views.clear();
+    target.cache_framebuffers.clear();
+    target.live_framebuffers.clear();
+    for(uint32_t layer = 0; layer < layers; layer++) {
+      target.cache_views.push_back(create_view(target.cache.image, vk::ImageViewType::e2D, layer, 1));
+      target.live_views.push_back(create_view(target.live.image, vk::ImageViewType::e2D, layer, 1));
+      target.cache_framebuffers.push_back(create_framebuffer(static_pass, target.cache_views.back()));
+      target.live_framebuffers.push_back(create_framebuffer(dynamic_pass, target.live_views.back()));
+    }
+    target.sampled_view = create_view(target.live.image, layers > 1 ? vk::ImageViewType::e2DArray : vk::ImageViewType::e2D, 0, layers);
+  }
+
+  // Only the load op differs, so the passes are compatible and share a pipeline.
+  // Layouts around them are done with explicit barriers.
+  void ShadowMaps::create_render_passes() {
+    auto create_pass = [&](vk::AttachmentLoadOp load_op) {
+      vk::AttachmentDescription attachment{};
+      attachment.setFormat(format);
+      attachment.setSamples(vk::SampleCountFlagBits::e1);
+      attachment.setLoadOp(load_op);
+      attachment.setStoreOp(vk::AttachmentStoreOp::eStore);
+      attachment.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare);
+      attachment.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare);
+      attachment.setInitialLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+      attachment.setFinalLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+      vk::AttachmentReference reference(0, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+      vk::SubpassDescription subpass{};
+      subpass.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics);
+      subpass.setPDepthStencilAttachment(&reference);
+      vk::RenderPassCreateInfo render_pass_info{};
+      render_pass_info.setAttachmentCount(1);
+      render_pass_info.setPAttachments(&attachment);
+      render_pass_info.setSubpassCount(1);
+      render_pass_info.setPSubpasses(&subpass);
+      vk::RenderPass render_pass;
+      if(device.createRenderPass(&render_pass_info, nullptr, &render_pass) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to create shadow render pass!");
+      }
+      return Unique<vk::RenderPass>(*deletion_queue, render_pass);
+    };
+    static_pass = create_pass(vk::AttachmentLoadOp::eClear);
+    dynamic_pass = create_pass(vk::AttachmentLoadOp::eLoad);
+  }
+
+  void ShadowMaps::create_descriptor_sets() {
+    uint32_t slot_count = static_cast<uint32_t>(slots.size());
+    vk::DescriptorPoolSize pool_sizes[] = {
+      {vk::DescriptorType::eUniformBuffer, slot_count},
+      {vk::DescriptorType::eCombinedImageSampler, 2 * slot_count}
+    };
+    vk::DescriptorPoolCreateInfo pool_info{};
+    pool_info.setPoolSizeCount(2);
+    pool_info.setPPoolSizes(pool_sizes);
+    pool_info.setMaxSets(slot_count);
+    vk::DescriptorPool pool;
+    if(device.createDescriptorPool(&pool_info, nullptr, &pool) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create shadow descriptor pool!");
+    }
+    // The sets of the old pool go with it
+    descriptor_pool = Unique<vk::DescriptorPool>(*deletion_queue, pool);
+
+    std::vector<vk::DescriptorSetLayout> set_layouts(slot_count, render_set_layout);
+    std::vector<vk::DescriptorSet> sets(slot_count);
+    vk::DescriptorSetAllocateInfo alloc_info{};
+    alloc_info.setDescriptorPool(descriptor_pool);
+    alloc_info.setDescriptorSetCount(slot_count);
+    alloc_info.setPSetLayouts(set_layouts.data());
+    if(device.allocateDescriptorSets(&alloc_info, sets.data()) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to allocate shadow descriptor sets!");
+    }
+
+    // The maps are the same for every slot, only the uniforms differ
+    vk::DescriptorImageInfo image_infos[] = {
+      {sampler, cascades.sampled_view, vk::ImageLayout::eShaderReadOnlyOptimal},
+      {sampler, atlas.sampled_view, vk::ImageLayout::eShaderReadOnlyOptimal}
+    };
+    std::vector<vk::DescriptorBufferInfo> buffer_infos;
+    buffer_infos.reserve(slot_count);
+    std::vector<vk::WriteDescriptorSet> writes;
+    for(uint32_t i = 0; i < slot_count; i++) {
+      Slot& slot = slots[i];
+      slot.render_set = sets[i];
+      buffer_infos.push_back({slot.uniforms.buffer, 0, sizeof(Uniforms)});
+      for(const auto& binding: render_bindings) {
+        vk::WriteDescriptorSet write{};
+        write.setDstSet(slot.render_set);
+        write.setDstBinding(binding.binding);
+        write.setDescriptorCount(1);
+        if(binding.binding == 0) {
+          write.setDescriptorType(vk::DescriptorType::eUniformBuffer);
+          write.setPBufferInfo(&buffer_infos.back());
+        } else {
+          write.setDescriptorType(vk::DescriptorType::eCombinedImageSampler);
+          write.setPImageInfo(&image_infos[binding.binding - 1]);
+        }
+        writes.push_back(write);
+      }
+    }
+    device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+  }
+
+  void ShadowMaps::create_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders) {
+    build_pipelines(modules, shaders)();
+  }
+
+  std::function<void()> ShadowMaps::build_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders) {
+    Spirv spirv = shaders.get("shadow.vert");
+    ShaderReflection reflection = reflect(spirv);
+    VertexLayout position_layout = make_vertex_layout(reflection);
+    if(position_layout.binding.stride != sizeof(glm::vec3)) {
+      throw std::runtime_error("shadow.vert inputs don't match the position stream!");
+    }
+    if(reflection.push_constant_size != sizeof(glm::mat4)) {
+      throw std::runtime_error("shadow.vert is expected to take its matrix as a push constant!");
+    }
+    auto description = merge_layouts({reflection});
+    vk::PipelineLayout layout = layouts->get_pipeline_layout(description);
+
+    vk::PipelineShaderStageCreateInfo stage{};
+    stage.setStage(vk::ShaderStageFlagBits::eVertex);
+    stage.setModule(modules.get_module(spirv));
+    stage.setPName("main");
+
+    vk::PipelineVertexInputStateCreateInfo vertex_info{};
+    vertex_info.setVertexBindingDescriptionCount(1);
+    vertex_info.setPVertexBindingDescriptions(&position_layout.binding);
+    vertex_info.setVertexAttributeDescriptionCount(static_cast<uint32_t>(position_layout.attributes.size()));
+    vertex_info.setPVertexAttributeDescriptions(position_layout.attributes.data());
+
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly{};
+    input_assembly.setTopology(vk::PrimitiveTopology::eTriangleList);
+
+    vk::PipelineViewportStateCreateInfo viewport_state{};
+    viewport_state.setViewportCount(1);
+    viewport_state.setScissorCount(1);
+
+    // Both faces, the scene is open meshes. The bias keeps lit surfaces
+    // from shadowing themselves.
+    vk::PipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.setPolygonMode(vk::PolygonMode::eFill);
+    rasterizer.setLineWidth(1.0f);
+    rasterizer.setCullMode(vk::CullModeFlagBits::eNone);
+    rasterizer.setFrontFace(vk::FrontFace::eCounterClockwise);
+    rasterizer.setDepthBiasEnable(true);
+    rasterizer.setDepthBiasConstantFactor(1.25f);
+    rasterizer.setDepthBiasClamp(0.0f);
+    rasterizer.setDepthBiasSlopeFactor(1.75f);
+
+    vk::PipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.setRasterizationSamples(vk::SampleCountFlagBits::e1);
+    multisampling.setMinSampleShading(1.0f);
+
+    vk::PipelineDepthStencilStateCreateInfo depth_stencil{};
+    depth_stencil.setDepthTestEnable(true);
+    depth_stencil.setDepthWriteEnable(true);
+    depth_stencil.setDepthCompareOp(vk::CompareOp::eLess);
+
+    vk::PipelineColorBlendStateCreateInfo no_blending{};
+
+    vk::DynamicState dynamic_states[] = {vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+    vk::PipelineDynamicStateCreateInfo dynamic_state{};
+    dynamic_state.setDynamicStateCount(2);
+    dynamic_state.setPDynamicStates(dynamic_states);
+
+    vk::GraphicsPipelineCreateInfo pipeline_info{};
+    pipeline_info.setStageCount(1);
+    pipeline_info.setPStages(&stage);
+    pipeline_info.setPVertexInputState(&vertex_info);
+    pipeline_info.setPInputAssemblyState(&input_assembly);
+    pipeline_info.setPViewportState(&viewport_state);
+    pipeline_info.setPRasterizationState(&rasterizer);
+    pipeline_info.setPMultisampleState(&multisampling);
+    pipeline_info.setPDepthStencilState(&depth_stencil);
+    pipeline_info.setPColorBlendState(&no_blending);
+    pipeline_info.setPDynamicState(&dynamic_state);
+    pipeline_info.setLayout(layout);
+    pipeline_info.setRenderPass(static_pass);
+    pipeline_info.setSubpass(0);
+    vk::Pipeline handle;
+    if(device.createGraphicsPipelines(nullptr, 1, &pipeline_info, nullptr, &handle) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create shadow pipeline!");
+    }
+    auto built = std::make_shared<UniquePipeline>(*deletion_queue, handle);
+    return [this, layout, built]() {
+      pipeline_layout = layout;
+      pipeline = std::move(*built);
+    };
+  }
+
+  void ShadowMaps::destroy() {
+    pipeline.reset();
+    descriptor_pool.reset();
+    sampler.reset();
+    for(Target* target: {&cascades, &atlas}) {
+      target->cache_framebuffers.clear();
+      target->live_framebuffers.clear();
+      target->cache_views.clear();
+      target->live_views.clear();
+      target->sampled_view.reset();
+      for(Image* image: {&target->cache, &target->live}) {
+        image->image.reset();
+        image->memory.reset();
+        image->charge.reset();
+      }
+    }
+    static_pass.reset();
+    dynamic_pass.reset();
+    slots.clear();
+    if(command_pool) {
+      device.destroyCommandPool(command_pool);
+      command_pool = nullptr;
+    }
+    recordings.clear();
+    pending = -1;
+    views.clear();
+    casters.clear();
+    dynamic_casters.clear();
+  }
+
+  uint32_t ShadowMaps::add_caster(const ShadowCaster& caster) {
+    uint32_t index = static_cast<uint32_t>(casters.size());
+    casters.push_back(caster);
+    if(caster.is_static) {
+      invalidate(caster.bounds);
+    } else {
+      dynamic_casters.push_back(index);
+    }
+    return index;
+  }
+
+  void ShadowMaps::update_caster(uint32_t index, const ShadowCaster& caster) {
+    ShadowCaster& old = casters.at(index);
+    bool moved = old.model != caster.model || old.is_static != caster.is_static ||
+      old.vertex_buffer != caster.vertex_buffer || old.position_offset != caster.position_offset ||
+      old.index_buffer != caster.index_buffer || old.index_offset != caster.index_offset ||
+      old.index_count != caster.index_count || old.bounds.min != caster.bounds.min || old.bounds.max != caster.bounds.max;
+    if(moved && (old.is_static || caster.is_static)) {
+      invalidate(old.bounds);
+      invalidate(caster.bounds);
+    }
+    if(old.is_static && !caster.is_static) {
+      dynamic_casters.push_back(index);
+    } else if(!old.is_static && caster.is_static) {
+      dynamic_casters.erase(std::find(dynamic_casters.begin(), dynamic_casters.end(), index));
+    }
+    old = caster;
+  }
+
+  void ShadowMaps::invalidate(const Aabb& bounds) {
+    for(auto& view: views) {
+      if(view.static_valid && intersects(view.frustum, bounds)) {
+        view.static_valid = false;
+      }
+    }
+  }
+
+  void ShadowMaps::set_sun(const glm::vec3& direction, const glm::vec3& color, float intensity) {
+    settings.sun_direction = glm::normalize(direction);
+    settings.sun_color = color;
+    settings.sun_intensity = intensity;
+  }
+
+  const ShadowSettings& ShadowMaps::get_settings() const {
+    return settings;
+  }
+
+  void ShadowMaps::prepare(const glm::mat4& view,
+      const glm::mat4& projection,
+      float z_near,
+      float z_far,
+      const ClusteredLighting& lighting,
+      uint32_t slot) {
+    auto* uniforms = static_cast<Uniforms*>(slots[slot].mapped);
+    uniforms->view_to_world = glm::inverse(view);
+    uniforms->sun_direction = glm::vec4(settings.sun_direction, settings.sun_intensity);
+    uniforms->sun_color = glm::vec4(settings.sun_color, 0.0f);
+    fit_cascades(view, projection, z_near, z_far, *uniforms);
+    place_local_lights(lighting, *uniforms);
+    uniforms->counts = glm::uvec4(settings.cascade_count, local_count, 0, 0);
+
+    for(auto& shadow_view: views) {
+      shadow_view.has_dynamic = false;
+      if(!shadow_view.active) {
+        continue;
+      }
+      for(uint32_t index: dynamic_casters) {
+        const ShadowCaster& caster = casters[index];
+        if(caster.index_count > 0 && intersects(shadow_view.frustum, caster.bounds)) {
+          shadow_view.has_dynamic = true;
+          break;
+        }
+      }
+    }
+  }
+
+  // Each cascade is fitted to a sphere around its slice of the view, so its
+  // size doesn't change as the camera turns, and snapped to whole texels so
+  // moving the camera doesn't make the static casters shimmer. The matrix
+  // then only changes when the slice moves by a texel or more.
+  void ShadowMaps::fit_cascades(const glm::mat4& view, const glm::mat4& projection, float z_near, float z_far, Uniforms& uniforms) {
+    glm::mat4 view_to_world = glm::inverse(view);
+    glm::mat4 inverse_projection = glm::inverse(projection);
+    // Rays through the corners of the screen, scaled to a view depth of 1
+    glm::vec3 rays[4];
+    for(int i = 0; i < 4; i++) {
+      glm::vec4 point = inverse_projection * glm::vec4(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, 0.5f, 1.0f);
+      glm::vec3 position = glm::vec3(point) / point.w;
+      rays[i] = position / -position.z;
+    }
+
+    glm::vec3 up = std::abs(settings.sun_direction.z) > 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+    glm::mat4 light_rotation = glm::lookAt(glm::vec3(0.0f), -settings.sun_direction, up);
+    float near = z_near;
+    float far = std::max(std::min(z_far, settings.max_distance), near * 1.01f);
+    float slice_start = near;
+    uniforms.cascade_splits = glm::vec4(0.0f);
+    for(uint32_t i = 0; i < settings.cascade_count; i++) {
+      float fraction = float(i + 1) / settings.cascade_count;
+      float even = near + (far - near) * fraction;
+      float logarithmic = near * std::pow(far / near, fraction);
+      float slice_end = even + (logarithmic - even) * settings.split_lambda;
+
+      glm::vec3 corners[8];
+      glm::vec3 center(0.0f);
+      for(int c = 0; c < 8; c++) {
+        float depth = c < 4 ? slice_start : slice_end;
+        corners[c] = glm::vec3(view_to_world * glm::vec4(rays[c % 4] * depth, 1.0f));
+        center += corners[c] / 8.0f;
+      }
+      float radius = 0.0f;
+      for(const auto& corner: corners) {
+        radius = std::max(radius, glm::length(corner - center));
+      }
+      radius = std::ceil(radius * 16.0f) / 16.0f;
+
+      float texel = 2.0f * radius / settings.cascade_resolution;
+      glm::vec3 light_center = glm::vec3(light_rotation * glm::vec4(center, 1.0f));
+      light_center = glm::floor(light_center / texel) * texel;
+      glm::mat4 ortho = glm::ortho(light_center.x - radius, light_center.x + radius,
+          light_center.y - radius, light_center.y + radius,
+          -(light_center.z + radius + settings.caster_margin), -(light_center.z - radius));
+
+      View& cascade = views[i];
+      glm::mat4 render = depth_zero_to_one * ortho * light_rotation;
+      cascade.active = true;
+      if(render != cascade.render) {
+        cascade.render = render;
+        cascade.frustum = Frustum::from_matrix(render);
+        cascade.static_valid = false;
+      }
+      uniforms.cascades[i] = clip_to_uv(glm::vec2(1.0f), glm::vec2(0.0f)) * render;
+      uniforms.cascade_splits[i] = slice_end;
+      slice_start = slice_end;
+    }
+  }
+
+  // Six 90 degree faces around each light, each a tile of the atlas
+  void ShadowMaps::place_local_lights(const ClusteredLighting& lighting, Uniforms& uniforms) {
+    static const glm::vec3 directions[6] = {
+      {1.0f, 0.0f, 0.0f}, {-1.0f, 0.0f, 0.0f},
+      {0.0f, 1.0f, 0.0f}, {0.0f, -1.0f, 0.0f},
+      {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f}
+    };
+    // Square edges along the other two axes, so the faces split space the
+    // way shader.frag picks them, by the largest component
+    static const glm::vec3 ups[6] = {
+      {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, 1.0f},
+      {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, 1.0f},
+      {0.0f, 1.0f, 0.0f}, {0.0f, 1.0f, 0.0f}
+    };
+    local_count = std::min(settings.local_lights, lighting.get_settings().count);
+    float far = lighting.get_settings().radius;
+    bool far_changed = far != local_far;
+    local_far = far;
+    glm::mat4 face_projection = depth_zero_to_one * glm::perspective(glm::radians(90.0f), 1.0f, far * 0.02f, far);
+    glm::vec2 atlas_size(atlas.extent.width, atlas.extent.height);
+
+    for(uint32_t light = 0; light < settings.local_lights; light++) {
+      bool active = light < local_count;
+      glm::vec3 position = lighting.get_position(light);
+      bool moved = position != local_positions[light] || far_changed;
+      local_positions[light] = position;
+      if(active) {
+        uniforms.local_lights[light] = glm::vec4(position, far);
+      }
+      for(uint32_t face = 0; face < 6; face++) {
+        View& view = views[settings.cascade_count + light * 6 + face];
+        view.active = active;
+        if(moved || view.render == glm::mat4(1.0f)) {
+          view.render = face_projection * glm::lookAt(position, position + directions[face], ups[face]);
+          view.frustum = Frustum::from_matrix(view.render);
+          view.static_valid = false;
+        }
+        if(active) {
+          glm::vec2 offset(view.area.offset.x, view.area.offset.y);
+          glm::vec2 size(view.area.extent.width, view.area.extent.height);
+          uniforms.local_faces[light * 6 + face] = clip_to_uv(size / atlas_size, offset / atlas_size) * view.render;
+        }
+      }
+    }
+  }
+
+  void ShadowMaps::draw_casters(vk::CommandBuffer cmd, const View& view, bool static_casters) {
+    vk::Viewport viewport(view.area.offset.x, view.area.offset.y, view.area.extent.width, view.area.extent.height, 0.0f, 1.0f);
+    cmd.setViewport(0, 1, &viewport);
+    cmd.setScissor(0, 1, &view.area);
+    auto draw = [&](const ShadowCaster& caster) {
+      if(caster.index_count == 0 || !intersects(view.frustum, caster.bounds)) {
+        return;
+      }
+      glm::mat4 mvp = view.render * caster.model;
+      cmd.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(mvp), &mvp);
+      cmd.bindVertexBuffers(0, 1, &caster.vertex_buffer, &caster.position_offset);
+      cmd.bindIndexBuffer(caster.index_buffer, caster.index_offset, vk::IndexType::eUint16);
+      cmd.drawIndexed(caster.index_count, 1, 0, 0, 0);
+      stats.draws++;
+    };
+    if(!static_casters) {
+      for(uint32_t index: dynamic_casters) {
+        draw(casters[index]);
+      }
+      return;
+    }
+    for(const auto& caster: casters) {
+      if(caster.is_static) {
+        draw(caster);
+      }
+    }
+  }
+
+  // Cache first, copied into the live map, dynamic casters on top. Each
+  // step only for the views that need it.
+  void ShadowMaps::record_target(vk::CommandBuffer cmd, Target& target, uint32_t first_view, uint32_t view_count) {
+    bool any_static = false, any_copy = false, any_dynamic = false;
+    for(uint32_t i = first_view; i < first_view + view_count; i++) {
+      View& view = views[i];
+      view.copy = view.active && (!view.static_valid || view.has_dynamic || view.had_dynamic);
+      any_static |= view.active && !view.static_valid;
+      any_copy |= view.copy;
+      any_dynamic |= view.active && view.has_dynamic;
+    }
+    if(!any_copy) {
+      return;
+    }
+    vk::ClearValue clear;
+    clear.depthStencil = vk::ClearDepthStencilValue(1.0f, 0);
+
+    if(any_static) {
+      transition(cmd, target.cache.image, target.layers,
+          vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eDepthStencilAttachmentOptimal,
+          vk::PipelineStageFlagBits::eTransfer, {}, depth_stages, depth_access);
+      for(uint32_t i = first_view; i < first_view + view_count; i++) {
+        View& view = views[i];
+        if(!view.active || view.static_valid) {
+          continue;
+        }
+        // The clear only covers the render area, the other tiles keep their cache
+        vk::RenderPassBeginInfo begin_info{};
+        begin_info.setRenderPass(static_pass);
+        begin_info.setFramebuffer(target.cache_framebuffers[view.layer]);
+        begin_info.setRenderArea(view.area);
+        begin_info.setClearValueCount(1);
+        begin_info.setPClearValues(&clear);
+        cmd.beginRenderPass(&begin_info, vk::SubpassContents::eInline);
+        draw_casters(cmd, view, true);
+        cmd.endRenderPass();
+        view.static_valid = true;
+        stats.static_views++;
+      }
+      transition(cmd, target.cache.image, target.layers,
+          vk::ImageLayout::eDepthStencilAttachmentOptimal, vk::ImageLayout::eTransferSrcOptimal,
+          depth_stages, vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+          vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead);
+    }
+
+    // Earlier frames on the queue may still be sampling it
+    transition(cmd, target.live.image, target.layers,
+        vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageLayout::eTransferDstOptimal,
+        vk::PipelineStageFlagBits::eFragmentShader, {}, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
+    std::vector<vk::ImageCopy> regions;
+    for(uint32_t i = first_view; i < first_view + view_count; i++) {
+      const View& view = views[i];
+      if(!view.copy) {
+        continue;
+      }
+      vk::ImageCopy region{};
+      region.srcSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eDepth, 0, view.layer, 1);
+      region.dstSubresource = region.srcSubresource;
+      region.srcOffset = vk::Offset3D(view.area.offset.x, view.area.offset.y, 0);
+      region.dstOffset = region.srcOffset;
+      region.extent = vk::Extent3D(view.area.extent.width, view.area.extent.height, 1);
+      regions.push_back(region);
+    }
+    cmd.copyImage(target.cache.image, vk::ImageLayout::eTransferSrcOptimal, target.live.image, vk::ImageLayout::eTransferDstOptimal,
+        static_cast<uint32_t>(regions.size()), regions.data());
+    stats.copied_views += static_cast<uint32_t>(regions.size());
+
+    if(!any_dynamic) {
+      transition(cmd, target.live.image, target.layers,
+          vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+          vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite,
+          vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead);
+    } else {
+      transition(cmd, target.live.image, target.layers,
+          vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eDepthStencilAttachmentOptimal,
+          vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite, depth_stages, depth_access);
+      for(uint32_t i = first_view; i < first_view + view_count; i++) {
+        const View& view = views[i];
+        if(!view.active || !view.has_dynamic) {
+          continue;
+        }
+        vk::RenderPassBeginInfo begin_info{};
+        begin_info.setRenderPass(dynamic_pass);
+        begin_info.setFramebuffer(target.live_framebuffers[view.layer]);
+        begin_info.setRenderArea(view.area);
+        cmd.beginRenderPass(&begin_info, vk::SubpassContents::eInline);
+        draw_casters(cmd, view, false);
+        cmd.endRenderPass();
+        stats.dynamic_views++;
+      }
+      transition(cmd, target.live.image, target.layers,
+          vk::ImageLayout::eDepthStencilAttachmentOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+          depth_stages, vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+          vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead);
+    }
+    for(uint32_t i = first_view; i < first_view + view_count; i++) {
+      views[i].had_dynamic = views[i].active && views[i].has_dynamic;
+    }
+  }
+
+  vk::CommandBuffer ShadowMaps::record(const Timeline& timeline) {
+    pending = -1;
+    bool any_work = !initialized;
+    for(const auto& view: views) {
+      any_work |= view.active && (!view.static_valid || view.has_dynamic || view.had_dynamic);
+    }
+    stats.static_views = 0;
+    stats.dynamic_views = 0;
+    stats.copied_views = 0;
+    stats.draws = 0;
+    if(!any_work) {
+      return nullptr;
+    }
+
+    // Any recording whose submission is done can be reused
+    uint64_t completed = timeline.completed_value();
+    for(size_t i = 0; i < recordings.size(); i++) {
+      if(recordings[i].value <= completed) {
+        pending = static_cast<int>(i);
+        break;
+      }
+    }
+    if(pending < 0) {
+      Recording recording;
+      vk::CommandBufferAllocateInfo alloc_info{};
+      alloc_info.setCommandPool(command_pool);
+      alloc_info.setLevel(vk::CommandBufferLevel::ePrimary);
+      alloc_info.setCommandBufferCount(1);
+      if(device.allocateCommandBuffers(&alloc_info, &recording.cmd) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to allocate shadow command buffer!");
+      }
+      recordings.push_back(recording);
+      pending = static_cast<int>(recordings.size() - 1);
+    }
+    // Not reusable until submitted() says when it's done
+    recordings[pending].value = ~0ull;
+
+    vk::CommandBuffer cmd = recordings[pending].cmd;
+    vk::CommandBufferBeginInfo begin_info{};
+    begin_info.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    cmd.begin(&begin_info);
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    if(!initialized) {
+      for(Target* target: {&cascades, &atlas}) {
+        transition(cmd, target->cache.image, target->layers, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferSrcOptimal,
+            vk::PipelineStageFlagBits::eTopOfPipe, {}, vk::PipelineStageFlagBits::eTransfer, {});
+        transition(cmd, target->live.image, target->layers, vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal,
+            vk::PipelineStageFlagBits::eTopOfPipe, {}, vk::PipelineStageFlagBits::eFragmentShader, {});
+      }
+    }
+    record_target(cmd, cascades, 0, settings.cascade_count);
+    record_target(cmd, atlas, settings.cascade_count, settings.local_lights * 6);
+    cmd.end();
+    initialized = true;
+    stats.total_static_views += stats.static_views;
+    stats.total_dynamic_views += stats.dynamic_views;
+    return cmd;
+  }
+
+  void ShadowMaps::submitted(uint64_t value) {
+    if(pending >= 0) {
+      recordings[pending].value = value;
+      pending = -1;
+    }
+  }
+
+  const ShadowStats& ShadowMaps::get_stats() const {
+    return stats;
+  }
+
+  vk::DescriptorSet ShadowMaps::get_render_set(uint32_t slot) const {
+    return slots[slot].render_set;
+  }
+
+  vk::DescriptorSetLayout ShadowMaps::get_render_set_layout() const {
+    return render_set_layout;
+  }
+}
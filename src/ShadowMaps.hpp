@@ -0,0 +1,258 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Bvh.hpp"
+#include "ClusteredLighting.hpp"
+#include "MemoryBudget.hpp"
+#include "Resource.hpp"
+#include "Reflection.hpp"
+#include "ShaderManager.hpp"
+#include "Timeline.hpp"
+
+namespace jar {
+  struct ShadowSettings {
+    // Up to ShadowMaps::max_cascades
+    uint32_t cascade_count = 3;
+    uint32_t cascade_resolution = 1024;
+    // The cascades cover the view up to here, or the far plane if it's closer
+    float max_distance = 10.0f;
+    // 0 splits the distance evenly, 1 logarithmically
+    float split_lambda = 0.75f;
+    // How far towards the sun casters outside a cascade still throw into it
+    float caster_margin = 5.0f;
+    // The first lights of jar::ClusteredLighting get a cube in the atlas,
+    // they hold still so it can be cached
+    uint32_t local_lights = 4;
+    uint32_t atlas_resolution = 2048;
+    // Size of one cube face in the atlas
+    uint32_t tile_resolution = 256;
+    // Towards the sun, world space
+    glm::vec3 sun_direction = {-0.4f, -0.3f, 0.85f};
+    glm::vec3 sun_color = {1.0f, 0.95f, 0.85f};
+    float sun_intensity = 0.6f;
+  };
+
+  // Geometry drawn into the shadow maps, a position stream with 16 bit indices
+  struct ShadowCaster {
+    vk::Buffer vertex_buffer;
+    vk::DeviceSize position_offset = 0;
+    vk::Buffer index_buffer;
+    vk::DeviceSize index_offset = 0;
+    uint32_t index_count = 0;
+    glm::mat4 model{1.0f};
+    // World space
+    Aabb bounds;
+    // Static casters are drawn into the cache when it's rebuilt, dynamic
+    // ones on top of it every frame
+    bool is_static = true;
+  };
+
+  struct ShadowStats {
+    // Of the last frame, a view is a cascade or a cube face
+    uint32_t static_views = 0;
+    uint32_t dynamic_views = 0;
+    uint32_t copied_views = 0;
+    uint32_t draws = 0;
+    uint64_t total_static_views = 0;
+    uint64_t total_dynamic_views = 0;
+  };
+
+  /*
+   * Shadow maps for the sun, as cascades fitted to the camera, and for the
+   * first few local lights, as cube maps with the faces packed into an
+   * atlas. Every map exists twice: a cache with only the static casters
+   * and the live map the shaders sample.
+   *
+   * A view's cache is redrawn when its matrix changes (the sun turns, the
+   * camera moves past a texel or a light moves) or a static caster in it
+   * changes. The live map gets the cache copied in and the dynamic casters
+   * drawn on top, but only for views that have dynamic casters now or had
+   * them last frame. With nothing changed and nothing dynamic around there
+   * is nothing to record at all. Cascades are snapped to texels so turning
+   * the camera doesn't count as a change.
+   *
+   * The work is recorded each frame into its own command buffer, submitted
+   * ahead of the prerecorded frame on the graphics queue, whose barriers
+   * order it against the frames still reading the live maps. There is one
+   * live map for all frames in flight, so a frame that rewrites it waits
+   * for the previous frame's fragment shading to finish before the copy,
+   * its shadow work can't overlap that frame. A live map per frame in
+   * flight would lift this for another copy of both targets in memory;
+   * frames with nothing to rewrite don't wait at all.
+   */
+  class ShadowMaps {
+    public:
+    static constexpr uint32_t max_cascades = 4;
+    static constexpr uint32_t max_local_lights = 8;
+
+    private:
+    // Matches the Shadows block in shader.frag
+    struct Uniforms {
+      glm::mat4 view_to_world;
+      // World space to the cascade's uv and depth
+      glm::mat4 cascades[max_cascades];
+      // View depth each cascade ends at
+      glm::vec4 cascade_splits;
+      // Towards the sun, then its intensity
+      glm::vec4 sun_direction;
+      glm::vec4 sun_color;
+      // Cascades, shadowed local lights
+      glm::uvec4 counts;
+      // World position, then the far plane
+      glm::vec4 local_lights[max_local_lights];
+      // World space to the atlas uv and depth, six faces per light
+      glm::mat4 local_faces[max_local_lights * 6];
+    };
+
+    struct View {
+      // Clip space of the light with a 0..1 depth range, casters are drawn with it
+      glm::mat4 render{1.0f};
+      Frustum frustum{};
+      uint32_t layer = 0;
+      vk::Rect2D area;
+      bool active = false;
+      bool static_valid = false;
+      bool has_dynamic = false;
+      bool had_dynamic = false;
+      // The live map needs the cache copied in this frame
+      bool copy = false;
+    };
+
+    struct Image {
+      UniqueImage image;
+      UniqueMemory memory;
+      MemoryCharge charge;
+    };
+
+    // The cascades or the atlas, both as cache and live map
+    struct Target {
+      Image cache;
+      Image live;
+      uint32_t layers = 1;
+      vk::Extent2D extent;
+      // One per layer
+      std::vector<UniqueImageView> cache_views;
+      std::vector<UniqueImageView> live_views;
+      std::vector<Unique<vk::Framebuffer>> cache_framebuffers;
+      std::vector<Unique<vk::Framebuffer>> live_framebuffers;
+      UniqueImageView sampled_view;
+    };
+
+    struct Slot {
+      BufferAllocation uniforms;
+      void* mapped = nullptr;
+      vk::DescriptorSet render_set;
+    };
+
+    struct Recording {
+      vk::CommandBuffer cmd;
+      // Timeline value of the submission it went into
+      uint64_t value = 0;
+    };
+
+    vk::Device device;
+    vk::PhysicalDevice physical_device;
+    DeletionQueue* deletion_queue = nullptr;
+    MemoryBudget* memory_budget = nullptr;
+    LayoutCache* layouts = nullptr;
+    ShadowSettings settings{};
+    vk::Format format;
+    bool linear_filtering = false;
+
+    Target cascades;
+    Target atlas;
+    // Cascades first, then six faces per local light
+    std::vector<View> views;
+    std::vector<ShadowCaster> casters;
+    // Indices of the dynamic ones, checked every frame
+    std::vector<uint32_t> dynamic_casters;
+    std::array<glm::vec3, max_local_lights> local_positions{};
+    uint32_t local_count = 0;
+    float local_far = 1.0f;
+    // Until the first recording the images are in no particular layout,
+    // after it caches are kept as transfer sources and live maps as shader
+    // read only
+    bool initialized = false;
+    ShadowStats stats{};
+
+    // One per swapchain image, see set_slot_count
+    std::vector<Slot> slots;
+    Unique<vk::DescriptorPool> descriptor_pool;
+    vk::DescriptorSetLayout render_set_layout;
+    // Of set 2 in shader.frag
+    std::vector<vk::DescriptorSetLayoutBinding> render_bindings;
+    Unique<vk::Sampler> sampler;
+    Unique<vk::RenderPass> static_pass;
+    Unique<vk::RenderPass> dynamic_pass;
+    vk::PipelineLayout pipeline_layout;
+    UniquePipeline pipeline;
+    vk::CommandPool command_pool;
+    std::vector<Recording> recordings;
+    int pending = -1;
+
+    void create_image(Image& image, const Target& target, vk::ImageUsageFlags usage);
+    void create_target(Target& target, vk::Extent2D extent, uint32_t layers);
+    void create_render_passes();
+    void create_descriptor_sets();
+    void fit_cascades(const glm::mat4& view, const glm::mat4& projection, float z_near, float z_far, Uniforms& uniforms);
+    void place_local_lights(const ClusteredLighting& lighting, Uniforms& uniforms);
+    // Marks the cached views a caster is in as out of date
+    void invalidate(const Aabb& bounds);
+    void draw_casters(vk::CommandBuffer cmd, const View& view, bool static_casters);
+    void record_target(vk::CommandBuffer cmd, Target& target, uint32_t first_view, uint32_t view_count);
+
+    public:
+    // queue_family is the graphics queue the recordings are submitted to.
+    // fragment_reflection is the shader sampling the maps in set 2.
+    void create(vk::Device device,
+        vk::PhysicalDevice physical_device,
+        uint32_t queue_family,
+        DeletionQueue& deletion_queue,
+        MemoryBudget& memory_budget,
+        LayoutCache& layouts,
+        const ShaderReflection& fragment_reflection,
+        const ShadowSettings& settings);
+    // Again on a shader reload, replaces the caster pipeline
+    void create_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders);
+    // Same from any thread, the returned call swaps them in between frames
+    std::function<void()> build_pipelines(ShaderModuleRegistry& modules, const ShaderManager& shaders);
+    // Slots are indexed by swapchain image, again when the image count
+    // changes with nothing in flight
+    void set_slot_count(uint32_t count);
+    // Device idle
+    void destroy();
+
+    // Returns the caster's index for update_caster
+    uint32_t add_caster(const ShadowCaster& caster);
+    // Cheap for dynamic casters. A static one that changed has the views
+    // it was and is in redrawn.
+    void update_caster(uint32_t index, const ShadowCaster& caster);
+    // Towards the sun, redraws every cascade if it turned
+    void set_sun(const glm::vec3& direction, const glm::vec3& color, float intensity);
+    const ShadowSettings& get_settings() const;
+
+    // Each frame with its camera, before record(). Writes what the shaders
+    // need for the swapchain image the frame renders to.
+    void prepare(const glm::mat4& view,
+        const glm::mat4& projection,
+        float z_near,
+        float z_far,
+        const ClusteredLighting& lighting,
+        uint32_t slot);
+    // A command buffer to submit before the frame's, or nothing if the
+    // maps are up to date
+    vk::CommandBuffer record(const Timeline& timeline);
+    // Timeline value of the submission record() went into
+    void submitted(uint64_t value);
+    const ShadowStats& get_stats() const;
+
+    // Set 2 of the main pipeline for a swapchain image
+    vk::DescriptorSet get_render_set(uint32_t slot) const;
+    vk::DescriptorSetLayout get_render_set_layout() const;
+  };
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace jar {
+  /*
+   * Fixed size lock-free queue for one producer thread and one consumer
+   * thread. Never allocates, push fails when it's full. The two counters sit
+   * on their own cache lines so the sides don't false share.
+   */
+  template<typename T, size_t Capacity>
+  class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "ring capacity must be a power of two!");
+    static constexpr size_t mask = Capacity - 1;
+
+    std::array<T, Capacity> slots{};
+    // Free running, only masked for indexing. Head is written by the
+    // consumer, tail by the producer.
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+
+    public:
+    // Producer side
+    bool push(const T& value) {
+      size_t current_tail = tail.load(std::memory_order_relaxed);
+      if(current_tail - head.load(std::memory_order_acquire) == Capacity) {
+        return false;
+      }
+      slots[current_tail & mask] = value;
+      tail.store(current_tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Consumer side
+    bool pop(T& value) {
+      size_t current_head = head.load(std::memory_order_relaxed);
+      if(current_head == tail.load(std::memory_order_acquire)) {
+        return false;
+      }
+      value = slots[current_head & mask];
+      head.store(current_head + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Only a snapshot when called from the other side
+    size_t size() const {
+      return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() {
+      return Capacity;
+    }
+  };
+}
@@ -0,0 +1,102 @@
+#include "SteppedBenchmark.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+namespace jar {
+  SteppedBenchmark::SteppedBenchmark(std::string knob, uint32_t maximum, double settle_seconds, double measure_seconds):
+    knob(std::move(knob)), settle_time(settle_seconds), measure_time(measure_seconds) {
+    for(int shift = 4; shift >= 0; shift--) {
+      uint32_t value = maximum >> shift;
+      if(value > 0) {
+        steps.push_back({value});
+      }
+    }
+    step_start = Clock::now();
+    last_frame = step_start;
+  }
+
+  uint32_t SteppedBenchmark::get_value() const {
+    if(is_done()) {
+      return 0;
+    }
+    return steps[current].value;
+  }
+
+  bool SteppedBenchmark::on_frame(const OverlapStats& gpu) {
+    if(is_done()) {
+      return false;
+    }
+    auto now = Clock::now();
+    std::chrono::duration<double, std::milli> frame_time = now - last_frame;
+    last_frame = now;
+    auto elapsed = now - step_start;
+    if(elapsed < settle_time) {
+      return false;
+    }
+
+    Step& step = steps[current];
+    step.frames++;
+    step.frame_ms += frame_time.count();
+    // Already smoothed, averaging them again just evens out the tail
+    step.compute_ms += gpu.compute_ms;
+    step.graphics_ms += gpu.graphics_ms;
+    step.overlap_ms += gpu.overlap_ms;
+    step.has_overlap = gpu.has_overlap;
+    if(elapsed < settle_time + measure_time) {
+      return false;
+    }
+
+    step.frame_ms /= step.frames;
+    step.compute_ms /= step.frames;
+    step.graphics_ms /= step.frames;
+    step.overlap_ms /= step.frames;
+    std::cout << "Benchmark: " << step.value << " " << knob << ", "
+      << std::fixed << std::setprecision(2) << step.frame_ms << "ms per frame\n";
+    current++;
+    step_start = now;
+    return true;
+  }
+
+  bool SteppedBenchmark::is_done() const {
+    return current >= steps.size();
+  }
+
+  void SteppedBenchmark::print() const {
+    int width = static_cast<int>(std::max<size_t>(knob.size(), 8)) + 2;
+    std::cout << std::setw(width) << knob << std::setw(8) << "frames"
+      << std::setw(11) << "frame ms" << std::setw(12) << "compute ms"
+      << std::setw(13) << "graphics ms" << std::setw(12) << "overlap ms" << '\n';
+    for(size_t i = 0; i < current && i < steps.size(); i++) {
+      const auto& step = steps[i];
+      std::cout << std::setw(width) << step.value << std::setw(8) << step.frames
+        << std::fixed << std::setprecision(3)
+        << std::setw(11) << step.frame_ms << std::setw(12) << step.compute_ms
+        << std::setw(13) << step.graphics_ms << std::setw(12);
+      if(step.has_overlap) {
+        std::cout << step.overlap_ms << '\n';
+      } else {
+        std::cout << "-\n";
+      }
+    }
+  }
+
+  void SteppedBenchmark::write_csv(const std::string& path) const {
+    std::ofstream file(path);
+    if(!file.is_open()) {
+      throw std::runtime_error("failed to open " + path + "!");
+    }
+    file << knob << ",frames,frame_ms,compute_ms,graphics_ms,overlap_ms\n";
+    for(size_t i = 0; i < current && i < steps.size(); i++) {
+      const auto& step = steps[i];
+      file << step.value << ',' << step.frames << ',' << step.frame_ms << ','
+        << step.compute_ms << ',' << step.graphics_ms << ',';
+      if(step.has_overlap) {
+        file << step.overlap_ms;
+      }
+      file << '\n';
+    }
+  }
+}
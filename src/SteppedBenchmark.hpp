@@ -0,0 +1,52 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "AsyncCompute.hpp"
+
+namespace jar {
+  /*
+   * Frame time against one knob, like the particle or light count. Steps
+   * it through 1/16, 1/8, ... of its maximum, waits settle_seconds at each
+   * step for the change to take effect and the smoothed GPU timings to
+   * catch up, then averages the CPU frame interval and the GPU times of
+   * the compute batch and the graphics frame.
+   *
+   * Run uncapped (--throughput) or the numbers are just the refresh rate.
+   */
+  class SteppedBenchmark {
+    struct Step {
+      uint32_t value;
+      uint32_t frames = 0;
+      double frame_ms = 0.0;
+      double compute_ms = 0.0;
+      double graphics_ms = 0.0;
+      double overlap_ms = 0.0;
+      bool has_overlap = false;
+    };
+
+    using Clock = std::chrono::steady_clock;
+    // Plural, names the first column and the progress lines
+    std::string knob;
+    std::vector<Step> steps;
+    size_t current = 0;
+    Clock::time_point step_start;
+    Clock::time_point last_frame;
+    std::chrono::duration<double> settle_time;
+    std::chrono::duration<double> measure_time;
+
+    public:
+    SteppedBenchmark(std::string knob, uint32_t maximum, double settle_seconds, double measure_seconds = 3.0);
+
+    // Knob value to use for the coming frames, 0 once done
+    uint32_t get_value() const;
+    // Once per frame after draw_frame, returns true when the value changed
+    bool on_frame(const OverlapStats& gpu);
+    bool is_done() const;
+    void print() const;
+    // Columns: the knob, frames, frame_ms, compute_ms, graphics_ms, overlap_ms,
+    // the last left empty when the overlap couldn't be measured
+    void write_csv(const std::string& path) const;
+  };
+}
@@ -1,5 +1,6 @@
 #include <set>
 #include <vector>
+#include <algorithm>
 #include <vulkan/vulkan.hpp>
 #include "SwapChainSupportDetails.hpp"
 
@@ -42,11 +43,22 @@ namespace jar::swapchain {
     return available_formats[0];
   }
 
-  vk::PresentModeKHR choose_swap_present_mode(const std::vector<vk::PresentModeKHR> available_present_modes) {
-    for (const auto& available_present_modes : available_present_modes) {
-        if (available_present_modes == vk::PresentModeKHR::eMailbox) {
-            return available_present_modes;
+  vk::PresentModeKHR choose_swap_present_mode(const std::vector<vk::PresentModeKHR> available_present_modes, vk::PresentModeKHR preferred) {
+    auto is_available = [&available_present_modes](vk::PresentModeKHR mode) {
+      return std::find(available_present_modes.begin(), available_present_modes.end(), mode) != available_present_modes.end();
+    };
+    if (is_available(preferred)) {
+      return preferred;
+    }
+
+    // The vsync modes fall back to plain FIFO, the low latency ones to each
+    // other before giving up and using FIFO, which is always supported
+    if (preferred == vk::PresentModeKHR::eMailbox || preferred == vk::PresentModeKHR::eImmediate) {
+      for (const auto& fallback : {vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eImmediate}) {
+        if (is_available(fallback)) {
+          return fallback;
         }
+      }
     }
 
     return vk::PresentModeKHR::eFifo;
@@ -0,0 +1,125 @@
+#include "TaskGraph.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+
+namespace jar {
+  TaskId TaskGraph::add(const std::string& name, std::function<void()> run, const std::vector<TaskId>& dependencies) {
+    TaskId id = static_cast<TaskId>(tasks.size());
+    for(TaskId dependency: dependencies) {
+      // Only earlier tasks, so the graph can't have cycles
+      if(dependency >= id) {
+        throw std::runtime_error("task " + name + " depends on a task added after it!");
+      }
+      tasks[dependency].dependents.push_back(id);
+    }
+    Task task{};
+    task.name = name;
+    task.run = std::move(run);
+    task.dependency_count = static_cast<uint32_t>(dependencies.size());
+    tasks.push_back(std::move(task));
+    return id;
+  }
+
+  void TaskGraph::run(ThreadPool& pool) {
+    done_count = 0;
+    error = nullptr;
+    started = Clock::now();
+    std::vector<TaskId> ready;
+    for(TaskId id = 0; id < tasks.size(); id++) {
+      tasks[id].remaining = tasks[id].dependency_count;
+      tasks[id].skipped = false;
+      if(tasks[id].remaining == 0) {
+        ready.push_back(id);
+      }
+    }
+    for(TaskId id: ready) {
+      schedule(pool, id);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    all_done.wait(lock, [this]() { return done_count == tasks.size(); });
+    finished = Clock::now();
+    if(error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  void TaskGraph::schedule(ThreadPool& pool, TaskId id) {
+    pool.submit([this, &pool, id]() {
+      Task& task = tasks[id];
+      bool skip;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        skip = static_cast<bool>(error);
+      }
+      task.thread = std::this_thread::get_id();
+      task.start = Clock::now();
+      if(skip) {
+        task.skipped = true;
+      } else {
+        try {
+          task.run();
+        } catch(...) {
+          std::lock_guard<std::mutex> lock(mutex);
+          if(!error) {
+            error = std::current_exception();
+          }
+        }
+      }
+      task.end = Clock::now();
+      complete(pool, id);
+    });
+  }
+
+  void TaskGraph::complete(ThreadPool& pool, TaskId id) {
+    std::vector<TaskId> ready;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for(TaskId dependent: tasks[id].dependents) {
+        if(--tasks[dependent].remaining == 0) {
+          ready.push_back(dependent);
+        }
+      }
+      done_count++;
+      // Under the lock, run() may return and take the graph with it right after
+      if(done_count == tasks.size()) {
+        all_done.notify_all();
+      }
+    }
+    for(TaskId dependent: ready) {
+      schedule(pool, dependent);
+    }
+  }
+
+  void TaskGraph::print_timings() const {
+    using ms = std::chrono::duration<float, std::milli>;
+    std::vector<const Task*> order;
+    for(const auto& task: tasks) {
+      order.push_back(&task);
+    }
+    std::sort(order.begin(), order.end(), [](const Task* a, const Task* b) {
+      return a->start < b->start;
+    });
+
+    // Small numbers read better than thread ids
+    std::map<std::thread::id, int> threads;
+    float total = 0.0f;
+    std::cout << "Startup tasks:\n";
+    for(const Task* task: order) {
+      int thread = threads.emplace(task->thread, static_cast<int>(threads.size())).first->second;
+      float duration = ms(task->end - task->start).count();
+      total += duration;
+      std::cout << "\t" << std::left << std::setw(24) << task->name << std::right << std::fixed << std::setprecision(2)
+        << " start " << std::setw(8) << ms(task->start - started).count() << "ms"
+        << "  took " << std::setw(8) << duration << "ms"
+        << "  thread " << thread
+        << (task->skipped ? "  (skipped)" : "") << '\n';
+    }
+    float wall = ms(finished - started).count();
+    std::cout << "\t" << tasks.size() << " tasks in " << wall << "ms on " << threads.size() << " thread(s), "
+      << total << "ms if run in sequence\n";
+  }
+}
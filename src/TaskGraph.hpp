@@ -0,0 +1,58 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ThreadPool.hpp"
+
+namespace jar {
+  using TaskId = uint32_t;
+
+  /*
+   * Runs a set of tasks on a thread pool, each one as soon as everything it
+   * depends on is done. Used for startup, where most creation steps only
+   * need the device and can overlap.
+   *
+   * If a task throws, tasks depending on it are skipped and run() rethrows
+   * the first exception once everything in flight has finished.
+   */
+  class TaskGraph {
+    using Clock = std::chrono::steady_clock;
+
+    struct Task {
+      std::string name;
+      std::function<void()> run;
+      std::vector<TaskId> dependents;
+      uint32_t dependency_count = 0;
+      uint32_t remaining = 0;
+      Clock::time_point start;
+      Clock::time_point end;
+      std::thread::id thread;
+      bool skipped = false;
+    };
+
+    std::vector<Task> tasks;
+    std::mutex mutex;
+    std::condition_variable all_done;
+    size_t done_count = 0;
+    std::exception_ptr error;
+    Clock::time_point started;
+    Clock::time_point finished;
+
+    void schedule(ThreadPool& pool, TaskId id);
+    void complete(ThreadPool& pool, TaskId id);
+
+    public:
+    TaskId add(const std::string& name, std::function<void()> run, const std::vector<TaskId>& dependencies = {});
+    // Blocks until every task ran or was skipped
+    void run(ThreadPool& pool);
+
+    // Per task start and duration relative to the start of run(), and how
+    // much the overlap saved over running them back to back
+    void print_timings() const;
+  };
+}
@@ -0,0 +1,48 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+namespace jar {
+  ThreadPool::ThreadPool(unsigned int thread_count) {
+    if(thread_count == 0) {
+      thread_count = std::max(2u, std::thread::hardware_concurrency());
+    }
+    for(unsigned int i = 0; i < thread_count; i++) {
+      workers.emplace_back(&ThreadPool::work, this);
+    }
+  }
+
+  ThreadPool::~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    job_available.notify_all();
+    for(auto& worker: workers) {
+      worker.join();
+    }
+  }
+
+  void ThreadPool::submit(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(std::move(job));
+    }
+    job_available.notify_one();
+  }
+
+  void ThreadPool::work() {
+    while(true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        job_available.wait(lock, [this]() { return stopping || !jobs.empty(); });
+        if(jobs.empty()) {
+          return;
+        }
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      job();
+    }
+  }
+}
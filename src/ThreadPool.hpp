@@ -0,0 +1,31 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jar {
+  // Fixed set of workers pulling jobs off a single queue, in order
+  class ThreadPool {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable job_available;
+    bool stopping = false;
+
+    void work();
+
+    public:
+    // 0 picks one worker per hardware thread
+    explicit ThreadPool(unsigned int thread_count = 0);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    // Finishes the jobs already queued
+    ~ThreadPool();
+
+    void submit(std::function<void()> job);
+    size_t size() const { return workers.size(); }
+  };
+}
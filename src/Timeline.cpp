@@ -0,0 +1,65 @@
+#include "Timeline.hpp"
+#include <stdexcept>
+
+namespace jar {
+  void Timeline::create(vk::Device device, const vk::DispatchLoaderDynamic& dispatch) {
+    this->device = device;
+    this->dispatch = &dispatch;
+
+    vk::SemaphoreTypeCreateInfoKHR type_info{};
+    type_info.setSemaphoreType(vk::SemaphoreTypeKHR::eTimeline);
+    type_info.setInitialValue(0);
+    vk::SemaphoreCreateInfo semaphore_info{};
+    semaphore_info.setPNext(&type_info);
+    if(device.createSemaphore(&semaphore_info, nullptr, &semaphore) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create timeline semaphore!");
+    }
+    last_signaled.store(0);
+  }
+
+  void Timeline::destroy() {
+    device.destroySemaphore(semaphore);
+    semaphore = nullptr;
+  }
+
+  vk::Semaphore Timeline::get_semaphore() const {
+    return semaphore;
+  }
+
+  uint64_t Timeline::next_value() {
+    return last_signaled.fetch_add(1) + 1;
+  }
+
+  uint64_t Timeline::last_value() const {
+    return last_signaled.load();
+  }
+
+  uint64_t Timeline::completed_value() const {
+    uint64_t value = 0;
+    if(device.getSemaphoreCounterValueKHR(semaphore, &value, *dispatch) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to read timeline semaphore!");
+    }
+    return value;
+  }
+
+  bool Timeline::is_complete(uint64_t value) const {
+    return value == 0 || completed_value() >= value;
+  }
+
+  bool Timeline::wait(uint64_t value, uint64_t timeout) const {
+    if(value == 0) {
+      return true;
+    }
+    vk::SemaphoreWaitInfoKHR wait_info{};
+    wait_info.setSemaphoreCount(1);
+    wait_info.setPSemaphores(&semaphore);
+    wait_info.setPValues(&value);
+    const auto& result = device.waitSemaphoresKHR(&wait_info, timeout, *dispatch);
+    if(result == vk::Result::eTimeout) {
+      return false;
+    } else if(result != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to wait for timeline semaphore: " + vk::to_string(result));
+    }
+    return true;
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+namespace jar {
+  /*
+   * A VK_KHR_timeline_semaphore and the last value handed out for it, one
+   * per queue. Every submission signals the next value, so "is frame N done"
+   * or "is this upload done" is just a comparison against the counter.
+   */
+  class Timeline {
+    vk::Device device;
+    const vk::DispatchLoaderDynamic* dispatch = nullptr;
+    vk::Semaphore semaphore;
+    // Handed out on the render thread, read from startup workers and the
+    // deletion queue on other threads
+    std::atomic<uint64_t> last_signaled{0};
+
+    public:
+    void create(vk::Device device, const vk::DispatchLoaderDynamic& dispatch);
+    void destroy();
+
+    vk::Semaphore get_semaphore() const;
+    // Reserves the value the next submission on this queue signals
+    uint64_t next_value();
+    // Last value handed out, waiting on it waits for all work so far
+    uint64_t last_value() const;
+    // Latest value the GPU has reached
+    uint64_t completed_value() const;
+    bool is_complete(uint64_t value) const;
+    // Returns false if the timeout ran out first
+    bool wait(uint64_t value, uint64_t timeout = std::numeric_limits<uint64_t>::max()) const;
+  };
+}
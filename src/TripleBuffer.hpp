@@ -0,0 +1,43 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace jar {
+  /*
+   * Latest value handoff between one writer and one reader thread. The
+   * writer fills the back slot and swaps it with the middle one, the reader
+   * swaps the middle one into the front slot. Neither side ever waits, the
+   * reader just gets the newest value and anything written in between is
+   * overwritten.
+   */
+  template<typename T>
+  class TripleBuffer {
+    static constexpr uint32_t index_mask = 3;
+    // Set in middle when it holds a value the reader hasn't taken
+    static constexpr uint32_t fresh_bit = 4;
+
+    std::array<T, 3> slots{};
+    std::atomic<uint32_t> middle{1};
+    // Only touched by their own side
+    uint32_t back = 0;
+    uint32_t front = 2;
+
+    public:
+    // Writer side
+    void publish(const T& value) {
+      slots[back] = value;
+      back = middle.exchange(back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Reader side, returns false and leaves value alone if nothing new was published
+    bool consume(T& value) {
+      if(!(middle.load(std::memory_order_relaxed) & fresh_bit)) {
+        return false;
+      }
+      front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+      value = slots[front];
+      return true;
+    }
+  };
+}
@@ -1,5 +1,9 @@
 #pragma once
 #include <glm/glm.hpp>
 struct UniformBufferObject {
-  glm::mat4 mvp;
+  glm::mat4 view_projection;
+  // For lighting in view space, see shader.frag
+  glm::mat4 view;
+  // The animated model, particles are emitted in its space
+  glm::mat4 model;
 };
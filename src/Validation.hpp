@@ -72,6 +72,9 @@ namespace jar::validation {
       extensions.push_back(glfwExtensions[i]);
     }
 
+    // Needed by VK_KHR_timeline_semaphore on a 1.0 instance
+    extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
     if (enableValidationLayers) {
       extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
     }
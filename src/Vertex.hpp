@@ -1,34 +1,10 @@
 #pragma once
 #include <glm/glm.hpp>
-#include <vulkan/vulkan.hpp>
-#include <array>
-#include <cstddef>
 
 struct Vertex {
   glm::vec3 pos;
   glm::vec3 color;
-
-  static vk::VertexInputBindingDescription getBindingDescription() {
-    vk::VertexInputBindingDescription bindingDescription{};
-    bindingDescription.setBinding(0);
-    bindingDescription.setStride(sizeof(Vertex));
-    bindingDescription.setInputRate(vk::VertexInputRate::eVertex);
-    return bindingDescription;
-  }
-
-
-  static std::array<vk::VertexInputAttributeDescription, 2> getAttributeDescriptions() {
-    std::array<vk::VertexInputAttributeDescription, 2> attributeDescriptions = {};
-    attributeDescriptions[0].setBinding(0);
-    attributeDescriptions[0].setLocation(0);
-    attributeDescriptions[0].setFormat(vk::Format::eR32G32B32Sfloat);
-    attributeDescriptions[0].setOffset(offsetof(Vertex, pos));
-
-    attributeDescriptions[1].setBinding(0);
-    attributeDescriptions[1].setLocation(1);
-    attributeDescriptions[1].setFormat(vk::Format::eR32G32B32Sfloat);
-    attributeDescriptions[1].setOffset(offsetof(Vertex, color));
-
-    return attributeDescriptions;
-  }
+  // Attribute and binding descriptions are reflected from the vertex
+  // shaders, see jar::make_vertex_layout. Members are tightly packed in
+  // location order to match.
 };
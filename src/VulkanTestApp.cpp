@@ -6,8 +6,8 @@
 #include "Device.hpp"
 #include "SwapChain.hpp"
 #include "SwapChainSupportDetails.hpp"
-#include "Shader.hpp"
 #include "Memory.hpp"
+#include "Image.hpp"
 #include "UniformBufferObject.hpp"
 
 #define GLM_FORCE_RADIANS
@@ -15,6 +15,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <chrono>
+#include <algorithm>
+#include <cmath>
 
 void VulkanTestApp::create_instance() {
   vk::ApplicationInfo appInfo{
@@ -65,7 +67,99 @@ void VulkanTestApp::create_surface() {
 }
 
 void VulkanTestApp::select_physical_device() {
-  this->physical_device = jar::device::pickPhysicalDevice(instance, surface, device_extensions);
+  this->physical_device = jar::device::pickPhysicalDevice(instance, surface, device_extensions, device_selection);
+}
+
+void VulkanTestApp::set_device_selection(const jar::device::DeviceSelection& selection) {
+  device_selection = selection;
+}
+
+void VulkanTestApp::set_object_count(uint32_t count) {
+  scene_objects.resize(1);
+  if(count <= 1) {
+    return;
+  }
+  // A square grid over the model's 4x4 area, scaled to fit
+  uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(count - 1))));
+  float spacing = 4.0f / side;
+  scene.reserve(count);
+  for(uint32_t i = 0; i + 1 < count; i++) {
+    glm::vec3 position(
+        (i % side + 0.5f) * spacing - 2.0f,
+        (i / side + 0.5f) * spacing - 2.0f,
+        0.0f);
+    scene_objects.push_back(scene.add_node(jar::Scene::no_parent, position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(spacing * 0.8f)));
+  }
+}
+
+void VulkanTestApp::set_fixed_time_step(float seconds) {
+  fixed_time_step = seconds;
+}
+
+float VulkanTestApp::get_startup_ms() const {
+  return startup_ms;
+}
+
+uint32_t VulkanTestApp::get_object_count() const {
+  return static_cast<uint32_t>(scene_objects.size());
+}
+
+uint32_t VulkanTestApp::get_visible_count() const {
+  return last_visible_count;
+}
+
+uint32_t VulkanTestApp::get_draw_count() const {
+  return last_draw_count;
+}
+
+std::string VulkanTestApp::get_device_name() const {
+  vk::PhysicalDeviceProperties properties;
+  physical_device.getProperties(&properties);
+  return properties.deviceName;
+}
+
+void VulkanTestApp::set_particle_settings(const jar::ParticleSettings& settings) {
+  particle_settings = settings;
+}
+
+void VulkanTestApp::set_particle_emit_rate(float rate) {
+  particle_settings.emit_rate = rate;
+  if(particle_settings.capacity > 0) {
+    particles.set_emit_rate(rate);
+  }
+}
+
+const jar::ParticleSettings& VulkanTestApp::get_particle_settings() const {
+  return particle_settings;
+}
+
+void VulkanTestApp::set_light_settings(const jar::LightSettings& settings) {
+  light_settings = settings;
+}
+
+void VulkanTestApp::set_light_count(uint32_t count) {
+  light_settings.count = std::min(count, light_settings.capacity);
+  lighting.set_light_count(light_settings.count);
+}
+
+const jar::LightSettings& VulkanTestApp::get_light_settings() const {
+  return light_settings;
+}
+
+void VulkanTestApp::set_shadow_settings(const jar::ShadowSettings& settings) {
+  shadow_settings = settings;
+}
+
+const jar::ShadowStats& VulkanTestApp::get_shadow_stats() const {
+  return shadows.get_stats();
+}
+
+void VulkanTestApp::set_msaa_samples(uint32_t samples) {
+  requested_msaa_samples = samples;
+}
+
+vk::SampleCountFlagBits VulkanTestApp::get_msaa_samples() const {
+  return msaa_samples;
 }
 
 void VulkanTestApp::create_logical_device() {
@@ -73,17 +167,46 @@ void VulkanTestApp::create_logical_device() {
   float queuePriority = 1.0f;
   vk::DeviceQueueCreateInfo queueCreateInfo{{}, static_cast<uint32_t>(queueFamilyIndices.graphics_family), 1, &queuePriority};
 
+  vk::PhysicalDeviceFeatures supported_features = physical_device.getFeatures();
+  pipeline_statistics_supported = supported_features.pipelineStatisticsQuery;
+  multi_draw_supported = supported_features.multiDrawIndirect;
+  first_instance_supported = supported_features.drawIndirectFirstInstance;
+  max_draw_count = physical_device.getProperties().limits.maxDrawIndirectCount;
   vk::PhysicalDeviceFeatures deviceFeatures{};
+  deviceFeatures.setPipelineStatisticsQuery(pipeline_statistics_supported);
+  deviceFeatures.setMultiDrawIndirect(multi_draw_supported);
+  deviceFeatures.setDrawIndirectFirstInstance(first_instance_supported);
 
   vk::DeviceCreateInfo createInfo{};
   createInfo.setPQueueCreateInfos(&queueCreateInfo);
   createInfo.setQueueCreateInfoCount(1);
   createInfo.setPEnabledFeatures(&deviceFeatures);
-  createInfo.setEnabledExtensionCount(device_extensions.size());
-  createInfo.setPpEnabledExtensionNames(device_extensions.data());
+  // Guaranteed to be supported when the extension is
+  vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features{};
+  timeline_features.setTimelineSemaphore(true);
+  createInfo.setPNext(&timeline_features);
+  // Optional, memory_budget falls back to its own bookkeeping without it
+  std::vector<const char*> enabled_extensions = device_extensions;
+  bool has_memory_budget = jar::device::has_device_extension(physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  if(has_memory_budget) {
+    enabled_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  }
+  // Only needed when multiDrawIndirect is missing
+  draw_count_supported = !multi_draw_supported
+    && jar::device::has_device_extension(physical_device, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+  if(draw_count_supported) {
+    enabled_extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+  }
+  // Without it the queues' timestamps can't be compared, so no overlap
+  bool has_calibrated_timestamps = jar::device::has_device_extension(physical_device, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+  if(has_calibrated_timestamps) {
+    enabled_extensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+  }
+  createInfo.setEnabledExtensionCount(enabled_extensions.size());
+  createInfo.setPpEnabledExtensionNames(enabled_extensions.data());
 
-  std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
-  std::set<int> uniqueQueueFamilies = {queueFamilyIndices.graphics_family, queueFamilyIndices.present_family};
+  std::set<int> uniqueQueueFamilies = {queueFamilyIndices.graphics_family, queueFamilyIndices.present_family, queueFamilyIndices.compute_family};
+  auto queueCreateInfos = transient->vector<vk::DeviceQueueCreateInfo>(uniqueQueueFamilies.size());
   for (int queue_family : uniqueQueueFamilies) {
     vk::DeviceQueueCreateInfo queue_create_info{};
     queue_create_info.setQueueFamilyIndex(queue_family);
@@ -110,33 +233,93 @@ void VulkanTestApp::create_logical_device() {
   // And queue
   device.getQueue(queueFamilyIndices.graphics_family, 0, &graphics_queue);
   device.getQueue(queueFamilyIndices.present_family, 0, &present_queue);
+
+  // The timeline semaphore entry points aren't exported by the loader
+  dispatch.init(instance, vkGetInstanceProcAddr, device, vkGetDeviceProcAddr);
+  graphics_timeline.create(device, dispatch);
+  deletion_queue.init(device, graphics_timeline);
+  memory_budget.init(physical_device, dispatch, has_memory_budget);
+  shader_modules.init(device, deletion_queue);
+  async_compute.create(device, physical_device, dispatch,
+      queueFamilyIndices.compute_family, queueFamilyIndices.graphics_family,
+      frame_pacing.frames_in_flight, has_calibrated_timestamps);
+  std::cout << "Compute queue: family " << queueFamilyIndices.compute_family
+    << (async_compute.is_async() ? " (async)\n" : " (shared with graphics)\n");
 }
 
 void VulkanTestApp::create_semaphores() {
-  image_available_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  render_finished_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  in_flight_fences.resize(MAX_FRAMES_IN_FLIGHT);
-  for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+  const uint32_t frames_in_flight = frame_pacing.frames_in_flight;
+  image_available_semaphores.resize(frames_in_flight);
+  render_finished_semaphores.resize(frames_in_flight);
+  frame_timeline_values.assign(frames_in_flight, 0);
+  frame_image_indices.assign(frames_in_flight, -1);
+  frame_input_times.assign(frames_in_flight, {});
+  // Never shrunk, the arena in use may belong to a slot that is going away
+  while(frame_arenas.size() < frames_in_flight) {
+    frame_arenas.push_back(std::make_unique<jar::FrameArena>());
+  }
+  current_frame = 0;
+  // Binary semaphores are only left for the swapchain, which can't use
+  // timelines. Frame completion is tracked by graphics_timeline.
+  for(size_t i = 0; i < frames_in_flight; i++) {
     auto& image_available_semaphore = image_available_semaphores[i];
     auto& render_finished_semaphore = render_finished_semaphores[i];
     vk::SemaphoreCreateInfo semaphore_info{};
-    vk::FenceCreateInfo fence_info{};
-    fence_info.setFlags(vk::FenceCreateFlagBits::eSignaled);
     if(
         device.createSemaphore(&semaphore_info, nullptr, &image_available_semaphore) != vk::Result::eSuccess ||
-        device.createSemaphore(&semaphore_info, nullptr, &render_finished_semaphore) != vk::Result::eSuccess ||
-        device.createFence(&fence_info, nullptr, &in_flight_fences[i]) != vk::Result::eSuccess) {
+        device.createSemaphore(&semaphore_info, nullptr, &render_finished_semaphore) != vk::Result::eSuccess) {
       throw std::runtime_error("Failed to create semaphores!"); 
     }
   }
 }
 
+// The last presents may still be waiting on the render finished semaphores,
+// they were queued before the next frame's submit so they are done with
+// them once that frame is
+void VulkanTestApp::destroy_semaphores() {
+  for(size_t i = 0; i < image_available_semaphores.size(); i++) {
+    deletion_queue.destroy_later(render_finished_semaphores[i]);
+    deletion_queue.destroy_later(image_available_semaphores[i]);
+  }
+  image_available_semaphores.clear();
+  render_finished_semaphores.clear();
+  frame_timeline_values.clear();
+}
+
+void VulkanTestApp::create_shader_manager() {
+  // Produced by compile_shaders.sh next to the loose .spv files, optional
+  shader_modules.open_pack("shaders/shaders.pack");
+  shader_manager = std::make_unique<jar::ShaderManager>("shaders", shader_modules);
+  auto add = [this](const std::string& source, const std::string& spirv, uint32_t pipelines) {
+    shader_manager->add(source, spirv);
+    shader_pipelines[source] = pipelines;
+  };
+  add("shader.vert", "vert.spv", scene_pipelines);
+  add("shader.frag", "frag.spv", scene_pipelines);
+  add("depth.vert", "depth.spv", scene_pipelines);
+  add("particle.vert", "particle_vert.spv", scene_pipelines);
+  add("particle.frag", "particle_frag.spv", scene_pipelines);
+  add("particle_init.comp", "particle_init.spv", particle_pipelines);
+  add("particle_simulate.comp", "particle_simulate.spv", particle_pipelines);
+  add("particle_emit.comp", "particle_emit.spv", particle_pipelines);
+  add("particle_finish.comp", "particle_finish.spv", particle_pipelines);
+  add("light_cull.comp", "light_cull.spv", lighting_pipelines);
+  add("shadow.vert", "shadow.spv", shadow_pipelines);
+  shader_manager->start();
+}
+
 void VulkanTestApp::create_graphics_pipeline() {
-  auto vert_shader_code = jar::shader::readFile("shaders/vert.spv");
-  auto frag_shader_code = jar::shader::readFile("shaders/frag.spv");
+  build_graphics_pipeline()();
+}
 
-  vk::ShaderModule vert_shader_module = jar::shader::create_shader_module(vert_shader_code, device);
-  vk::ShaderModule frag_shader_module = jar::shader::create_shader_module(frag_shader_code, device);
+// Also runs on the reload worker, the returned call replaces the current
+// pipelines between frames. It reads the render graph's passes, so
+// recreate_swapchain waits for the worker before replacing them.
+std::function<void()> VulkanTestApp::build_graphics_pipeline() {
+  // Modules are shared and kept by the registry, unchanged shaders cost nothing on a reload
+  vk::ShaderModule vert_shader_module = shader_modules.get_module(shader_manager->get("shader.vert"));
+  vk::ShaderModule frag_shader_module = shader_modules.get_module(shader_manager->get("shader.frag"));
+  vk::ShaderModule depth_shader_module = shader_modules.get_module(shader_manager->get("depth.vert"));
 
   vk::PipelineShaderStageCreateInfo vert_shader_stage_create_info{};
   vert_shader_stage_create_info.setStage(vk::ShaderStageFlagBits::eVertex);
@@ -152,35 +335,50 @@ void VulkanTestApp::create_graphics_pipeline() {
 
   vk::PipelineShaderStageCreateInfo shader_stages[] = {frag_shader_stage_create_info, vert_shader_stage_create_info};
 
+  // No fragment stage at all for the pre-pass, only depth gets written
+  vk::PipelineShaderStageCreateInfo depth_shader_stage_create_info{};
+  depth_shader_stage_create_info.setStage(vk::ShaderStageFlagBits::eVertex);
+  depth_shader_stage_create_info.setModule(depth_shader_module);
+  depth_shader_stage_create_info.setPName("main");
+
+  // Vertex inputs and layouts come from the shaders themselves
+  jar::ShaderReflection vert_reflection = jar::reflect(shader_manager->get("shader.vert"));
+  jar::ShaderReflection frag_reflection = jar::reflect(shader_manager->get("shader.frag"));
+  jar::ShaderReflection depth_reflection = jar::reflect(shader_manager->get("depth.vert"));
+
+  // Inputs are laid out tightly packed in location order, which the buffers have to match
+  jar::VertexLayout vertex_layout = jar::make_vertex_layout(vert_reflection);
+  if(vertex_layout.binding.stride != sizeof(Vertex)) {
+    throw std::runtime_error("shader.vert inputs don't match the Vertex struct!");
+  }
   vk::PipelineVertexInputStateCreateInfo vertex_info{};
-  auto bindingDescription = Vertex::getBindingDescription();
   vertex_info.setVertexBindingDescriptionCount(1);
-  vertex_info.setPVertexBindingDescriptions(&bindingDescription);
-  auto attributeDescription = Vertex::getAttributeDescriptions();
-  vertex_info.setVertexAttributeDescriptionCount(attributeDescription.size());
-  vertex_info.setPVertexAttributeDescriptions(attributeDescription.data());
+  vertex_info.setPVertexBindingDescriptions(&vertex_layout.binding);
+  vertex_info.setVertexAttributeDescriptionCount(vertex_layout.attributes.size());
+  vertex_info.setPVertexAttributeDescriptions(vertex_layout.attributes.data());
+
+  // Position-only stream, tightly packed so it doesn't drag the rest of the
+  // vertex through the cache
+  jar::VertexLayout position_layout = jar::make_vertex_layout(depth_reflection);
+  if(position_layout.binding.stride != sizeof(glm::vec3)) {
+    throw std::runtime_error("depth.vert inputs don't match the position stream!");
+  }
+  vk::PipelineVertexInputStateCreateInfo position_vertex_info{};
+  position_vertex_info.setVertexBindingDescriptionCount(1);
+  position_vertex_info.setPVertexBindingDescriptions(&position_layout.binding);
+  position_vertex_info.setVertexAttributeDescriptionCount(position_layout.attributes.size());
+  position_vertex_info.setPVertexAttributeDescriptions(position_layout.attributes.data());
 
   vk::PipelineInputAssemblyStateCreateInfo input_assembly{};
   input_assembly.setTopology(vk::PrimitiveTopology::eTriangleList);
   input_assembly.setPrimitiveRestartEnable(false);
 
-  vk::Viewport viewport{};
-  viewport.setX(0.0f);
-  viewport.setY(0.0f);
-  viewport.setWidth((float) swapchain_extent.width);
-  viewport.setHeight((float) swapchain_extent.height);
-  viewport.setMinDepth(0.0f);
-  viewport.setMaxDepth(1.0f);
-
-  vk::Rect2D scissor = {};
-  scissor.setOffset({0, 0});
-  scissor.setExtent(swapchain_extent);
-
+  // Viewport and scissor are dynamic, so the pipeline survives a resize
   vk::PipelineViewportStateCreateInfo viewport_state = {};
   viewport_state.setViewportCount(1);
-  viewport_state.setPViewports(&viewport);
+  viewport_state.setPViewports(nullptr);
   viewport_state.setScissorCount(1);
-  viewport_state.setPScissors(&scissor);
+  viewport_state.setPScissors(nullptr);
 
   vk::PipelineRasterizationStateCreateInfo rasterizer{};
   rasterizer.setDepthClampEnable(false);
@@ -189,7 +387,7 @@ void VulkanTestApp::create_graphics_pipeline() {
   rasterizer.setLineWidth(1.0f);
   rasterizer.setCullMode(vk::CullModeFlagBits::eNone);
   rasterizer.setFrontFace(vk::FrontFace::eCounterClockwise);
-  //Changing these might be useful for shadow mapping
+  // Only the shadow pipeline biases depth, see jar::ShadowMaps
   rasterizer.setDepthBiasEnable(false);
   rasterizer.setDepthBiasConstantFactor(0.0f);
   rasterizer.setDepthBiasClamp(0.0f);
@@ -197,7 +395,8 @@ void VulkanTestApp::create_graphics_pipeline() {
 
   vk::PipelineMultisampleStateCreateInfo multisampling{};
   multisampling.setSampleShadingEnable(false);
-  multisampling.setRasterizationSamples(vk::SampleCountFlagBits::e1);
+  // The pre-pass and the main pass share the multisampled depth
+  multisampling.setRasterizationSamples(msaa_samples);
   multisampling.setMinSampleShading(1.0f);
   multisampling.setPSampleMask(nullptr);
   multisampling.setAlphaToCoverageEnable(false);
@@ -220,24 +419,40 @@ void VulkanTestApp::create_graphics_pipeline() {
   color_blending.setPAttachments(&color_blend_attachment);
   color_blending.setBlendConstants({0.0, 0.0, 0.0, 0.0});
 
+  vk::PipelineColorBlendStateCreateInfo depth_only_blending{};
+  depth_only_blending.setAttachmentCount(0);
+
+  // The pre-pass lays down the nearest depth, so the main pass can test for
+  // EQUAL without writing and only shade the visible fragment of each pixel
+  vk::PipelineDepthStencilStateCreateInfo prepass_depth_stencil{};
+  prepass_depth_stencil.setDepthTestEnable(true);
+  prepass_depth_stencil.setDepthWriteEnable(true);
+  prepass_depth_stencil.setDepthCompareOp(vk::CompareOp::eLess);
+  prepass_depth_stencil.setDepthBoundsTestEnable(false);
+  prepass_depth_stencil.setStencilTestEnable(false);
+
+  vk::PipelineDepthStencilStateCreateInfo depth_stencil = prepass_depth_stencil;
+  depth_stencil.setDepthWriteEnable(false);
+  depth_stencil.setDepthCompareOp(vk::CompareOp::eEqual);
+
   vk::DynamicState dynamic_states[] = {
     vk::DynamicState::eViewport,
-    vk::DynamicState::eLineWidth
+    vk::DynamicState::eScissor
   };
 
   vk::PipelineDynamicStateCreateInfo dynamic_state{};
   dynamic_state.setDynamicStateCount(2);
   dynamic_state.setPDynamicStates(dynamic_states);
 
-  vk::PipelineLayoutCreateInfo pipeline_layout_info{};
-  pipeline_layout_info.setSetLayoutCount(1);
-  pipeline_layout_info.setPSetLayouts(&descriptor_set_layout);
-  pipeline_layout_info.setPushConstantRangeCount(0);
-  pipeline_layout_info.setPPushConstantRanges(nullptr);
-
-  if (device.createPipelineLayout(&pipeline_layout_info, nullptr, &pipeline_layout) != vk::Result::eSuccess) {
-    throw std::runtime_error("failed to create pipeline layout!");
+  // Both pipelines bind the same descriptor sets, so they share one layout.
+  // The sets are allocated once, a reload can't change their layout.
+  auto description = jar::merge_layouts({vert_reflection, frag_reflection, depth_reflection});
+  auto set_layouts = layout_cache.get_set_layouts(description);
+  if(set_layouts.size() != 3 || set_layouts[0] != descriptor_set_layout || set_layouts[1] != lighting.get_render_set_layout() ||
+      set_layouts[2] != shadows.get_render_set_layout()) {
+    throw std::runtime_error("descriptor set layout changed, restart to pick it up!");
   }
+  vk::PipelineLayout layout = layout_cache.get_pipeline_layout(description);
 
   vk::GraphicsPipelineCreateInfo pipeline_info{};
   pipeline_info.setStageCount(2);
@@ -247,61 +462,284 @@ void VulkanTestApp::create_graphics_pipeline() {
   pipeline_info.setPViewportState(&viewport_state);
   pipeline_info.setPRasterizationState(&rasterizer);
   pipeline_info.setPMultisampleState(&multisampling);
-  pipeline_info.setPDepthStencilState(nullptr); // Optional
+  pipeline_info.setPDepthStencilState(&depth_stencil);
   pipeline_info.setPColorBlendState(&color_blending);
-  pipeline_info.setPDynamicState(nullptr); // Optional
-  pipeline_info.setLayout(pipeline_layout);
-  pipeline_info.setRenderPass(render_pass);
-  pipeline_info.setSubpass(0);
+  pipeline_info.setPDynamicState(&dynamic_state);
+  pipeline_info.setLayout(layout);
+  pipeline_info.setRenderPass(render_graph->get_render_pass(main_pass));
+  pipeline_info.setSubpass(render_graph->get_subpass(main_pass));
   pipeline_info.setBasePipelineHandle(nullptr);
   pipeline_info.setBasePipelineIndex(-1);
 
-  if(device.createGraphicsPipelines(nullptr, 1, &pipeline_info, nullptr, &graphics_pipeline) != vk::Result::eSuccess) {
+  vk::GraphicsPipelineCreateInfo prepass_pipeline_info = pipeline_info;
+  prepass_pipeline_info.setStageCount(1);
+  prepass_pipeline_info.setPStages(&depth_shader_stage_create_info);
+  prepass_pipeline_info.setPVertexInputState(&position_vertex_info);
+  prepass_pipeline_info.setPDepthStencilState(&prepass_depth_stencil);
+  prepass_pipeline_info.setPColorBlendState(&depth_only_blending);
+  prepass_pipeline_info.setRenderPass(render_graph->get_render_pass(depth_prepass));
+  prepass_pipeline_info.setSubpass(render_graph->get_subpass(depth_prepass));
+
+  vk::Pipeline prepass_pipeline;
+  if(device.createGraphicsPipelines(nullptr, 1, &prepass_pipeline_info, nullptr, &prepass_pipeline) != vk::Result::eSuccess) {
+    throw std::runtime_error("failed to create depth pre-pass pipeline!");
+  }
+  jar::UniquePipeline new_prepass_pipeline(deletion_queue, prepass_pipeline);
+  vk::Pipeline pipeline;
+  if(device.createGraphicsPipelines(nullptr, 1, &pipeline_info, nullptr, &pipeline) != vk::Result::eSuccess) {
     throw std::runtime_error("failed to create graphics pipeline!");
   }
-  device.destroyShaderModule(vert_shader_module);
-  device.destroyShaderModule(frag_shader_module);
+  jar::UniquePipeline new_graphics_pipeline(deletion_queue, pipeline);
+
+  // Particles: no vertex buffers, tested against the scene's depth without
+  // writing it and blended additively so they need no sorting
+  jar::UniquePipeline new_particle_pipeline;
+  vk::PipelineLayout new_particle_layout;
+  if(particle_settings.capacity > 0) {
+    jar::ShaderReflection particle_vert_reflection = jar::reflect(shader_manager->get("particle.vert"));
+    jar::ShaderReflection particle_frag_reflection = jar::reflect(shader_manager->get("particle.frag"));
+    auto particle_description = jar::merge_layouts({particle_vert_reflection, particle_frag_reflection});
+    auto particle_set_layouts = layout_cache.get_set_layouts(particle_description);
+    if(particle_set_layouts.size() != 2 || particle_set_layouts[0] != descriptor_set_layout ||
+        particle_set_layouts[1] != particles.get_render_set_layout()) {
+      throw std::runtime_error("particle descriptor set layouts changed, restart to pick them up!");
+    }
+    new_particle_layout = layout_cache.get_pipeline_layout(particle_description);
+
+    vk::PipelineShaderStageCreateInfo particle_stages[2] = {vert_shader_stage_create_info, frag_shader_stage_create_info};
+    particle_stages[0].setModule(shader_modules.get_module(shader_manager->get("particle.vert")));
+    particle_stages[1].setModule(shader_modules.get_module(shader_manager->get("particle.frag")));
+
+    vk::PipelineVertexInputStateCreateInfo no_vertex_info{};
+
+    vk::PipelineDepthStencilStateCreateInfo particle_depth_stencil = depth_stencil;
+    particle_depth_stencil.setDepthCompareOp(vk::CompareOp::eLessOrEqual);
+
+    vk::PipelineColorBlendAttachmentState additive_blend_attachment = color_blend_attachment;
+    additive_blend_attachment.setBlendEnable(true);
+    additive_blend_attachment.setDstColorBlendFactor(vk::BlendFactor::eOne);
+    additive_blend_attachment.setDstAlphaBlendFactor(vk::BlendFactor::eOne);
+    vk::PipelineColorBlendStateCreateInfo additive_blending = color_blending;
+    additive_blending.setPAttachments(&additive_blend_attachment);
+
+    vk::GraphicsPipelineCreateInfo particle_pipeline_info = pipeline_info;
+    particle_pipeline_info.setStageCount(2);
+    particle_pipeline_info.setPStages(particle_stages);
+    particle_pipeline_info.setPVertexInputState(&no_vertex_info);
+    particle_pipeline_info.setPDepthStencilState(&particle_depth_stencil);
+    particle_pipeline_info.setPColorBlendState(&additive_blending);
+    particle_pipeline_info.setLayout(new_particle_layout);
+
+    vk::Pipeline particle_pipeline_handle;
+    if(device.createGraphicsPipelines(nullptr, 1, &particle_pipeline_info, nullptr, &particle_pipeline_handle) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create particle pipeline!");
+    }
+    new_particle_pipeline = jar::UniquePipeline(deletion_queue, particle_pipeline_handle);
+  }
+
+  // Replacing these on a reload hands the old ones to the deletion queue
+  auto built = std::make_shared<std::array<jar::UniquePipeline, 3>>();
+  (*built)[0] = std::move(new_prepass_pipeline);
+  (*built)[1] = std::move(new_graphics_pipeline);
+  (*built)[2] = std::move(new_particle_pipeline);
+  return [this, layout, new_particle_layout, built]() {
+    pipeline_layout = layout;
+    depth_prepass_pipeline = std::move((*built)[0]);
+    graphics_pipeline = std::move((*built)[1]);
+    particle_pipeline_layout = new_particle_layout;
+    particle_pipeline = std::move((*built)[2]);
+  };
+}
+
+void VulkanTestApp::create_particles() {
+  if(particle_settings.capacity == 0) {
+    std::cout << "Particles disabled\n";
+    return;
+  }
+  particles.create(device, physical_device, deletion_queue, memory_budget, layout_cache, *shader_manager,
+      async_compute.get_sharing_families(), particle_settings);
+  particles.create_pipelines(shader_modules, *shader_manager);
+  // The draw reads the positions and draw records written by this frame's batch
+  async_compute.add_job("particles", [this](vk::CommandBuffer cmd, uint32_t) {
+      particles.record_simulation(cmd);
+    },
+    vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader);
+}
+
+void VulkanTestApp::create_lighting() {
+  lighting.create(device, physical_device, deletion_queue, memory_budget, layout_cache,
+      jar::reflect(shader_manager->get("shader.frag")), async_compute.get_sharing_families(), light_settings);
+  light_settings = lighting.get_settings();
+  lighting.create_pipelines(shader_modules, *shader_manager);
+  // Only shading reads the light grid, the vertex work can go ahead of it
+  async_compute.add_job("light_culling", [this](vk::CommandBuffer cmd, uint32_t) {
+      lighting.record_culling(cmd);
+    },
+    vk::PipelineStageFlagBits::eFragmentShader);
+}
+
+void VulkanTestApp::create_shadows() {
+  shadows.create(device, physical_device, static_cast<uint32_t>(queueFamilyIndices.graphics_family), deletion_queue, memory_budget,
+      layout_cache, jar::reflect(shader_manager->get("shader.frag")), shadow_settings);
+  shadow_settings = shadows.get_settings();
+  shadows.create_pipelines(shader_modules, *shader_manager);
+  // Their cube maps stay cached as long as they don't move
+  lighting.set_still_lights(shadow_settings.local_lights);
+  // Filled in every frame, it spins
+  jar::ShadowCaster caster;
+  caster.is_static = false;
+  model_caster = shadows.add_caster(caster);
+}
+
+// Everything but the model holds still, those only cost a draw when a
+// cached view is redrawn. set_mesh updates them again.
+void VulkanTestApp::create_shadow_casters() {
+  object_casters.clear();
+  for(jar::NodeHandle node: scene_objects) {
+    if(node != model_node) {
+      object_casters.push_back(shadows.add_caster(make_caster(scene.get_world(node), true)));
+    }
+  }
+}
+
+jar::ShadowCaster VulkanTestApp::make_caster(const glm::mat4& model, bool is_static) const {
+  jar::ShadowCaster caster;
+  caster.vertex_buffer = model_buffer.buffer;
+  caster.position_offset = position_offset;
+  caster.index_buffer = model_buffer.buffer;
+  caster.index_offset = index_offset;
+  caster.index_count = static_cast<uint32_t>(indices.size());
+  caster.model = model;
+  caster.bounds = mesh_bounds.transformed(model);
+  caster.is_static = is_static;
+  return caster;
+}
+
+void VulkanTestApp::create_image_slots() {
+  uint32_t image_count = static_cast<uint32_t>(swapchain_images.size());
+  if(particle_settings.capacity > 0) {
+    particles.set_slot_count(image_count);
+  }
+  lighting.set_slot_count(image_count);
+  shadows.set_slot_count(image_count);
+}
+
+// Compiles finish on the shader manager's thread, then only the pipelines
+// built from the changed shaders are rebuilt, on a worker so the frame
+// doesn't wait for the driver's compiler. They are swapped in here, between
+// frames, once the worker is done.
+void VulkanTestApp::reload_changed_shaders() {
+  if(pipeline_build.valid()) {
+    if(pipeline_build.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      return;
+    }
+    install_pipelines();
+  }
+  // The worker reads the SPIR-V, which only stays put until the next poll.
+  // Saves made during a build are picked up once it's done.
+  uint32_t groups = 0;
+  for(const auto& source: shader_manager->poll()) {
+    groups |= shader_pipelines.at(source);
+  }
+  if(groups == 0) {
+    return;
+  }
+  pipeline_build_start = std::chrono::steady_clock::now();
+  pipeline_build = std::async(std::launch::async, [this, groups]() {
+    return build_pipelines(groups);
+  });
+}
+
+// A group that fails keeps its old pipelines, the others still go in
+std::vector<std::function<void()>> VulkanTestApp::build_pipelines(uint32_t groups) {
+  std::vector<std::function<void()>> installs;
+  auto build = [&](uint32_t group, const char* name, const std::function<std::function<void()>()>& builder) {
+    if(!(groups & group)) {
+      return;
+    }
+    try {
+      installs.push_back(builder());
+    } catch(const std::runtime_error& e) {
+      std::cout << "Keeping the old " << name << " pipelines: " << e.what() << '\n';
+    }
+  };
+  build(scene_pipelines, "scene", [this]() { return build_graphics_pipeline(); });
+  build(lighting_pipelines, "light culling", [this]() { return lighting.build_pipelines(shader_modules, *shader_manager); });
+  build(shadow_pipelines, "shadow", [this]() { return shadows.build_pipelines(shader_modules, *shader_manager); });
+  if(particle_settings.capacity > 0) {
+    build(particle_pipelines, "particle", [this]() { return particles.build_pipelines(shader_modules, *shader_manager); });
+  }
+  return installs;
+}
+
+void VulkanTestApp::install_pipelines() {
+  auto installs = pipeline_build.get();
+  if(installs.empty()) {
+    return;
+  }
+  for(auto& install: installs) {
+    install();
+  }
+  rerecord_command_buffers();
+  std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - pipeline_build_start;
+  std::cout << "Pipelines rebuilt and swapped in " << elapsed.count() << "ms after the reload\n";
+}
+
+void VulkanTestApp::wait_for_pipeline_build() {
+  if(pipeline_build.valid()) {
+    pipeline_build.wait();
+  }
 }
 
 
 void VulkanTestApp::create_model_buffer() {
+  // Laid out as [interleaved vertices][positions][indices], the positions
+  // are a separate stream for the depth pre-pass
+  std::vector<glm::vec3> positions;
+  positions.reserve(vertices.size());
+  for(const auto& vertex: vertices) {
+    positions.push_back(vertex.pos);
+  }
   vk::DeviceSize vertex_size = sizeof(vertices[0]) * vertices.size();
+  vk::DeviceSize position_size = sizeof(positions[0]) * positions.size();
   vk::DeviceSize index_size = sizeof(indices[0]) * indices.size();
-  vk::DeviceSize buffer_size = vertex_size + index_size;
+  vk::DeviceSize buffer_size = vertex_size + position_size + index_size;
+  position_offset = vertex_size;
+  index_offset = vertex_size + position_size;
 
-  vk::Buffer staging_buffer;
-  vk::DeviceMemory staging_buffer_memory;
-  create_buffer(buffer_size,
+  jar::BufferAllocation staging = create_buffer(buffer_size,
       vk::BufferUsageFlagBits::eTransferSrc,
       vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-      staging_buffer,
-      staging_buffer_memory);
+      jar::MemoryCategory::staging);
 
-  void* data = device.mapMemory(staging_buffer_memory, 0, buffer_size);
+  void* data = device.mapMemory(staging.memory, 0, buffer_size);
   memcpy(static_cast<char*>(data), vertices.data(), vertex_size);
-  memcpy(static_cast<char*>(data) + vertex_size, indices.data(), index_size);
-  device.unmapMemory(staging_buffer_memory);
+  memcpy(static_cast<char*>(data) + position_offset, positions.data(), position_size);
+  memcpy(static_cast<char*>(data) + index_offset, indices.data(), index_size);
+  device.unmapMemory(staging.memory);
 
-  create_buffer(buffer_size,
+  // The previous model, if any, stays alive until the frames drawing it are done
+  model_buffer = create_buffer(buffer_size,
       vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer,
       vk::MemoryPropertyFlagBits::eDeviceLocal,
-      model_buffer,
-      model_buffer_memory);
+      jar::MemoryCategory::mesh);
 
-  copy_buffer(staging_buffer, model_buffer, buffer_size);
-  device.destroyBuffer(staging_buffer, nullptr);
-  device.freeMemory(staging_buffer_memory, nullptr);
+  copy_buffer(staging.buffer, model_buffer.buffer, buffer_size);
 }
 
-void VulkanTestApp::create_buffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer& buffer, vk::DeviceMemory& buffer_memory) {
+jar::BufferAllocation VulkanTestApp::create_buffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, jar::MemoryCategory category) {
   vk::BufferCreateInfo buffer_info{};
   buffer_info.setSize(size);
   buffer_info.setUsage(usage);
   buffer_info.setSharingMode(vk::SharingMode::eExclusive);
 
+  jar::BufferAllocation allocation;
+  allocation.size = size;
+  vk::Buffer buffer;
   if (device.createBuffer(&buffer_info, nullptr, &buffer) != vk::Result::eSuccess) {
     throw std::runtime_error("failed to create vertex buffer!");
   }
+  allocation.buffer = jar::UniqueBuffer(deletion_queue, buffer);
 
   vk::MemoryRequirements mem_requirements = device.getBufferMemoryRequirements(buffer);
 
@@ -313,11 +751,15 @@ void VulkanTestApp::create_buffer(vk::DeviceSize size, vk::BufferUsageFlags usag
   allocInfo.setAllocationSize(mem_requirements.size);
   allocInfo.setMemoryTypeIndex(memory_type_index);
 
+  vk::DeviceMemory buffer_memory;
   if (device.allocateMemory(&allocInfo, nullptr, &buffer_memory) != vk::Result::eSuccess) {
-    throw std::runtime_error("failed to allocate vertex buffer memory!");
+    throw std::runtime_error(std::string("failed to allocate ") + jar::to_string(category) + " buffer memory!");
   }
+  allocation.memory = jar::UniqueMemory(deletion_queue, buffer_memory);
+  allocation.charge = jar::MemoryCharge(memory_budget, deletion_queue, memory_type_index, category, mem_requirements.size);
 
   device.bindBufferMemory(buffer, buffer_memory, 0);
+  return allocation;
 }
 
 void VulkanTestApp::copy_buffer(vk::Buffer src_buffer, vk::Buffer dst_buffer, vk::DeviceSize size) {
@@ -338,38 +780,194 @@ void VulkanTestApp::copy_buffer(vk::Buffer src_buffer, vk::Buffer dst_buffer, vk
     command_buffer.copyBuffer(src_buffer, dst_buffer, 1, &copy_region);
 
     command_buffer.end();
+
+    // Wait for just this copy instead of idling the queue
+    uint64_t upload_value = graphics_timeline.next_value();
+    vk::Semaphore timeline_semaphore = graphics_timeline.get_semaphore();
+    vk::TimelineSemaphoreSubmitInfoKHR timeline_info{};
+    timeline_info.setSignalSemaphoreValueCount(1);
+    timeline_info.setPSignalSemaphoreValues(&upload_value);
+
     vk::SubmitInfo submit_info = {};
+    submit_info.setPNext(&timeline_info);
     submit_info.setCommandBufferCount(1);
     submit_info.setPCommandBuffers(&command_buffer);
+    submit_info.setSignalSemaphoreCount(1);
+    submit_info.setPSignalSemaphores(&timeline_semaphore);
 
-    graphics_queue.submit(1, &submit_info, nullptr);
-    graphics_queue.waitIdle();
+    if (graphics_queue.submit(1, &submit_info, nullptr) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to submit buffer copy!");
+    }
+    graphics_timeline.wait(upload_value);
     device.freeCommandBuffers(command_pool, 1, &command_buffer);
 }
 
+vk::ImageView VulkanTestApp::create_image_view(vk::Image image, vk::Format format, vk::ImageAspectFlags aspect_flags) {
+  vk::ImageViewCreateInfo create_info{};
+  create_info.setImage(image);
+  create_info.setViewType(vk::ImageViewType::e2D);
+  create_info.setFormat(format);
+  create_info.components.setR(vk::ComponentSwizzle::eIdentity);
+  create_info.components.setG(vk::ComponentSwizzle::eIdentity);
+  create_info.components.setB(vk::ComponentSwizzle::eIdentity);
+  create_info.components.setA(vk::ComponentSwizzle::eIdentity);
+
+  create_info.subresourceRange.setAspectMask(aspect_flags);
+  create_info.subresourceRange.setBaseMipLevel(0);
+  create_info.subresourceRange.setLevelCount(1);
+  create_info.subresourceRange.setBaseArrayLayer(0);
+  create_info.subresourceRange.setLayerCount(1);
+
+  vk::ImageView image_view;
+  if(device.createImageView(&create_info, nullptr, &image_view) != vk::Result::eSuccess) {
+    throw std::runtime_error("failed to create image views!");
+  }
+  return image_view;
+}
+
+void VulkanTestApp::create_query_pool() {
+  std::fill(frame_image_indices.begin(), frame_image_indices.end(), -1);
+  auto families = physical_device.getQueueFamilyProperties();
+  graphics_timestamps_supported = families[queueFamilyIndices.graphics_family].timestampValidBits > 0;
+  if(graphics_timestamps_supported) {
+    // Begin and end of each image's frame, for the async compute overlap
+    vk::QueryPoolCreateInfo timestamp_info{};
+    timestamp_info.setQueryType(vk::QueryType::eTimestamp);
+    timestamp_info.setQueryCount(static_cast<uint32_t>(swapchain_images.size()) * 2);
+    if(device.createQueryPool(&timestamp_info, nullptr, &graphics_timestamp_pool) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to create timestamp query pool!");
+    }
+  }
+  if(!pipeline_statistics_supported) {
+    std::cout << "Pipeline statistics queries not supported, overdraw won't be reported\n";
+    return;
+  }
+  vk::QueryPoolCreateInfo pool_info{};
+  pool_info.setQueryType(vk::QueryType::ePipelineStatistics);
+  pool_info.setQueryCount(static_cast<uint32_t>(swapchain_images.size()));
+  pool_info.setPipelineStatistics(PipelineStatistics::flags());
+  if(device.createQueryPool(&pool_info, nullptr, &statistics_query_pool) != vk::Result::eSuccess) {
+    throw std::runtime_error("failed to create query pool!");
+  }
+}
+
+void VulkanTestApp::read_pipeline_statistics(uint32_t image_index) {
+  if(!pipeline_statistics_supported) {
+    return;
+  }
+  std::array<uint64_t, PipelineStatistics::COUNTER_COUNT> results{};
+  // No wait flag, if the command buffer was resubmitted in the meantime we just skip this sample
+  const auto& result = device.getQueryPoolResults(statistics_query_pool, image_index, 1,
+      sizeof(results), results.data(), sizeof(results),
+      vk::QueryResultFlagBits::e64);
+  if(result != vk::Result::eSuccess) {
+    return;
+  }
+  pipeline_statistics.input_primitives = results[0];
+  pipeline_statistics.clipped_primitives = results[1];
+  pipeline_statistics.fragment_invocations = results[2];
+  pipeline_statistics.pixel_count = static_cast<uint64_t>(swapchain_extent.width) * swapchain_extent.height;
+}
+
+const PipelineStatistics& VulkanTestApp::get_pipeline_statistics() const {
+  return pipeline_statistics;
+}
+
+void VulkanTestApp::read_compute_overlap(uint32_t image_index) {
+  if(!graphics_timestamps_supported || !async_compute.has_jobs()) {
+    return;
+  }
+  std::array<uint64_t, 2> results{};
+  const auto& result = device.getQueryPoolResults(graphics_timestamp_pool, image_index * 2, 2,
+      sizeof(results), results.data(), sizeof(uint64_t),
+      vk::QueryResultFlagBits::e64);
+  if(result != vk::Result::eSuccess) {
+    return;
+  }
+  async_compute.record_overlap(current_frame, results[0], results[1]);
+}
+
+jar::AsyncCompute& VulkanTestApp::get_async_compute() {
+  return async_compute;
+}
+
+const jar::AsyncCompute& VulkanTestApp::get_async_compute() const {
+  return async_compute;
+}
+
+jar::FrameCapture& VulkanTestApp::get_frame_capture() {
+  return frame_capture;
+}
+
+bool VulkanTestApp::is_readback_supported() const {
+  return readback_supported;
+}
+
+vk::Extent2D VulkanTestApp::get_swapchain_extent() const {
+  return swapchain_extent;
+}
+
+jar::MemoryBudget& VulkanTestApp::get_memory_budget() {
+  return memory_budget;
+}
+
+const jar::MemoryBudget& VulkanTestApp::get_memory_budget() const {
+  return memory_budget;
+}
+
 void VulkanTestApp::create_uniform_buffers() {
   vk::DeviceSize buffer_size = sizeof(UniformBufferObject);
 
-  uniform_buffers.resize(swapchain_images.size());
-  uniform_buffers_memory.resize(swapchain_images.size());
-
+  uniform_buffers.clear();
   for (size_t i = 0; i < swapchain_images.size(); i++) {
-    create_buffer(buffer_size,
+    uniform_buffers.push_back(create_buffer(buffer_size,
         vk::BufferUsageFlagBits::eUniformBuffer,
         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-        uniform_buffers[i],
-        uniform_buffers_memory[i]);
+        jar::MemoryCategory::uniform));
   }
 }
 
+void VulkanTestApp::create_draw_buffers() {
+  // The visible draws first, then the count of them, see update_draw_list
+  vk::DeviceSize buffer_size = sizeof(vk::DrawIndexedIndirectCommand) * scene_objects.size() + sizeof(uint32_t);
+
+  draw_buffers.clear();
+  object_buffers.clear();
+  for (size_t i = 0; i < swapchain_images.size(); i++) {
+    draw_buffers.push_back(create_buffer(buffer_size,
+        vk::BufferUsageFlagBits::eIndirectBuffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        jar::MemoryCategory::indirect));
+    object_buffers.push_back(create_buffer(sizeof(glm::mat4) * scene_objects.size(),
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        jar::MemoryCategory::uniform));
+  }
+}
+
+void VulkanTestApp::build_bvh() {
+  mesh_bounds = jar::Aabb{};
+  for(const auto& vertex: vertices) {
+    mesh_bounds.expand(vertex.pos);
+  }
+  scene.update();
+  std::vector<jar::Aabb> bounds;
+  bounds.reserve(scene_objects.size());
+  for(jar::NodeHandle node: scene_objects) {
+    bounds.push_back(mesh_bounds.transformed(scene.get_world(node)));
+  }
+  bvh.build(bounds);
+}
+
 void VulkanTestApp::create_descriptor_pool() {
-  vk::DescriptorPoolSize pool_size = {};
-  pool_size.setType(vk::DescriptorType::eUniformBuffer);
-  pool_size.setDescriptorCount(static_cast<uint32_t>(swapchain_images.size()));
+  vk::DescriptorPoolSize pool_sizes[] = {
+    {vk::DescriptorType::eUniformBuffer, static_cast<uint32_t>(swapchain_images.size())},
+    {vk::DescriptorType::eStorageBuffer, static_cast<uint32_t>(swapchain_images.size())}
+  };
 
   vk::DescriptorPoolCreateInfo pool_info = {};
-  pool_info.setPoolSizeCount(1);
-  pool_info.setPPoolSizes(&pool_size);
+  pool_info.setPoolSizeCount(2);
+  pool_info.setPPoolSizes(pool_sizes);
   pool_info.setMaxSets(static_cast<uint32_t>(swapchain_images.size()));
 
   if(device.createDescriptorPool(&pool_info, nullptr, &descriptor_pool) != vk::Result::eSuccess) {
@@ -378,7 +976,8 @@ void VulkanTestApp::create_descriptor_pool() {
 }
 
 void VulkanTestApp::create_descriptor_sets() {
-  std::vector<vk::DescriptorSetLayout> layouts(swapchain_images.size(), descriptor_set_layout);
+  auto layouts = transient->vector<vk::DescriptorSetLayout>(swapchain_images.size());
+  layouts.assign(swapchain_images.size(), descriptor_set_layout);
   vk::DescriptorSetAllocateInfo alloc_info = {};
   alloc_info.setDescriptorPool(descriptor_pool);
   alloc_info.setDescriptorSetCount(static_cast<uint32_t>(swapchain_images.size()));
@@ -389,13 +988,16 @@ void VulkanTestApp::create_descriptor_sets() {
     throw std::runtime_error("failed to allocate descriptor sets!");
   }
 
+  // Written in one go, the infos have to stay put until then
+  auto buffer_infos = transient->vector<vk::DescriptorBufferInfo>(swapchain_images.size() * 2);
+  auto descriptor_writes = transient->vector<vk::WriteDescriptorSet>(swapchain_images.size() * 2);
   for(size_t i = 0; i < swapchain_images.size(); i++) {
-    vk::DescriptorBufferInfo bufferInfo = {};
-    bufferInfo.setBuffer(uniform_buffers[i]);
+    vk::DescriptorBufferInfo& bufferInfo = buffer_infos.emplace_back();
+    bufferInfo.setBuffer(uniform_buffers[i].buffer);
     bufferInfo.setOffset(0);
     bufferInfo.setRange(sizeof(UniformBufferObject));
 
-    vk::WriteDescriptorSet descriptor_write = {};
+    vk::WriteDescriptorSet& descriptor_write = descriptor_writes.emplace_back();
     descriptor_write.setDstSet(descriptor_sets[i]);
     descriptor_write.setDstBinding(0);
     descriptor_write.setDstArrayElement(0);
@@ -407,12 +1009,59 @@ void VulkanTestApp::create_descriptor_sets() {
     descriptor_write.setPImageInfo(nullptr); // Optional
     descriptor_write.setPTexelBufferView(nullptr); // Optional
 
-    device.updateDescriptorSets(1, &descriptor_write, 0, nullptr);
+    vk::DescriptorBufferInfo& object_info = buffer_infos.emplace_back();
+    object_info.setBuffer(object_buffers[i].buffer);
+    object_info.setOffset(0);
+    object_info.setRange(VK_WHOLE_SIZE);
+
+    vk::WriteDescriptorSet& object_write = descriptor_writes.emplace_back();
+    object_write.setDstSet(descriptor_sets[i]);
+    object_write.setDstBinding(1);
+    object_write.setDescriptorType(vk::DescriptorType::eStorageBuffer);
+    object_write.setDescriptorCount(1);
+    object_write.setPBufferInfo(&object_info);
+  }
+  device.updateDescriptorSets(descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
+}
+
+void VulkanTestApp::record_viewport(vk::CommandBuffer cmd_buf) {
+  vk::Viewport viewport{};
+  viewport.setX(0.0f);
+  viewport.setY(0.0f);
+  viewport.setWidth((float) swapchain_extent.width);
+  viewport.setHeight((float) swapchain_extent.height);
+  viewport.setMinDepth(0.0f);
+  viewport.setMaxDepth(1.0f);
+  cmd_buf.setViewport(0, 1, &viewport);
+
+  vk::Rect2D scissor = {};
+  scissor.setOffset({0, 0});
+  scissor.setExtent(swapchain_extent);
+  cmd_buf.setScissor(0, 1, &scissor);
+}
+
+void VulkanTestApp::record_draw_list(vk::CommandBuffer cmd_buf, uint32_t image_index) {
+  vk::Buffer buffer = draw_buffers[image_index].buffer;
+  uint32_t object_count = static_cast<uint32_t>(scene_objects.size());
+  uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+  if(multi_draw_supported) {
+    // The culled draws at the end have no instances. Only a few devices
+    // limit the count.
+    for(uint32_t first = 0; first < object_count; first += max_draw_count) {
+      uint32_t count = std::min(object_count - first, max_draw_count);
+      cmd_buf.drawIndexedIndirect(buffer, vk::DeviceSize(first) * stride, count, stride);
+    }
+  } else if(draw_count_supported) {
+    cmd_buf.drawIndexedIndirectCountKHR(buffer, 0, buffer, vk::DeviceSize(stride) * object_count, object_count, stride, dispatch);
+  } else {
+    for(uint32_t i = 0; i < object_count; i++) {
+      cmd_buf.drawIndexedIndirect(buffer, vk::DeviceSize(i) * stride, 1, stride);
+    }
   }
 }
 
 void VulkanTestApp::create_command_buffers() {
-  command_buffers.resize(swapchain_framebuffers.size());
+  command_buffers.resize(swapchain_images.size());
   vk::CommandBufferAllocateInfo alloc_info{};
   alloc_info.setCommandPool(command_pool);
   alloc_info.setLevel(vk::CommandBufferLevel::ePrimary);
@@ -421,8 +1070,6 @@ void VulkanTestApp::create_command_buffers() {
   if(device.allocateCommandBuffers(&alloc_info, command_buffers.data()) != vk::Result::eSuccess) {
     throw std::runtime_error("failed to create command buffers!");
   }
-  vk::FenceCreateInfo fence_create_info{};
-
   for(size_t i = 0; i < command_buffers.size(); i++) {
     vk::CommandBufferBeginInfo begin_info{};
     auto& cmd_buf = command_buffers[i];
@@ -431,27 +1078,18 @@ void VulkanTestApp::create_command_buffers() {
     if(cmd_buf.begin(&begin_info) != vk::Result::eSuccess) {
       throw std::runtime_error("failed to begin recording command buffer!");
     }
-    vk::RenderPassBeginInfo render_pass_info{};
-    render_pass_info.setRenderPass(render_pass);
-    render_pass_info.setFramebuffer(swapchain_framebuffers[i]);
-    render_pass_info.renderArea.setOffset({0, 0});
-    render_pass_info.renderArea.setExtent(swapchain_extent);
-    vk::ClearValue clear_color{std::array<float, 4>{0.5, 0.7f, 0.2f, 1.0f}};
-    render_pass_info.setClearValueCount(1);
-    render_pass_info.setPClearValues(&clear_color);
-    cmd_buf.beginRenderPass(&render_pass_info, vk::SubpassContents::eInline);
-
-    cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, graphics_pipeline);
-    vk::Buffer model_buffers[] = {model_buffer};
-    vk::DeviceSize offsets[] = {0};
-    cmd_buf.bindVertexBuffers(0, 1, model_buffers, offsets);
-
-    vk::DeviceSize vertex_size = sizeof(vertices[0]) * vertices.size();
-    cmd_buf.bindIndexBuffer(model_buffer, vertex_size, vk::IndexType::eUint16);
-    cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, 1, &descriptor_sets[i], 0, nullptr);
-    cmd_buf.drawIndexed(static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
-
-    cmd_buf.endRenderPass();
+    // Queries can't be reset inside a render pass, so do it before the graph
+    if(pipeline_statistics_supported) {
+      cmd_buf.resetQueryPool(statistics_query_pool, i, 1);
+    }
+    if(graphics_timestamps_supported) {
+      cmd_buf.resetQueryPool(graphics_timestamp_pool, i * 2, 2);
+      cmd_buf.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, graphics_timestamp_pool, i * 2);
+    }
+    render_graph->execute(cmd_buf, i);
+    if(graphics_timestamps_supported) {
+      cmd_buf.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, graphics_timestamp_pool, i * 2 + 1);
+    }
     cmd_buf.end();
   }
 }
@@ -460,7 +1098,7 @@ void VulkanTestApp::create_swapchain() {
   SwapChainSupportDetails details = jar::swapchain::query_swapchain_support(physical_device, surface);
 
   vk::SurfaceFormatKHR surface_format = jar::swapchain::choose_swap_surface_format(details.formats);
-  vk::PresentModeKHR present_mode = jar::swapchain::choose_swap_present_mode(details.present_modes);
+  vk::PresentModeKHR present_mode = jar::swapchain::choose_swap_present_mode(details.present_modes, frame_pacing.present_mode);
   vk::Extent2D extent = jar::swapchain::choose_swap_extent(details.capabilities, width, height);
 
   uint32_t image_count = details.capabilities.minImageCount + 1;
@@ -476,7 +1114,13 @@ void VulkanTestApp::create_swapchain() {
   create_info.setImageColorSpace(surface_format.colorSpace);
   create_info.setImageExtent(extent);
   create_info.setImageArrayLayers(1);
-  create_info.setImageUsage(vk::ImageUsageFlagBits::eColorAttachment);
+  // Captures copy straight out of the swapchain images
+  vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eColorAttachment;
+  readback_supported = static_cast<bool>(details.capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferSrc);
+  if(readback_supported) {
+    usage |= vk::ImageUsageFlagBits::eTransferSrc;
+  }
+  create_info.setImageUsage(usage);
 
   QueueFamilyIndices indices = jar::device::find_queue_families(physical_device, surface);
 
@@ -495,16 +1139,25 @@ void VulkanTestApp::create_swapchain() {
   create_info.setPreTransform(vk::SurfaceTransformFlagBitsKHR::eIdentity);
   create_info.setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque);
   create_info.setPresentMode(present_mode);
+  this->present_mode = present_mode;
   create_info.setClipped(true);
-  create_info.setOldSwapchain(nullptr);
+  // Handing over the old swapchain lets the driver reuse its resources and
+  // keep presenting from it while the new one is being set up
+  vk::SwapchainKHR old_swapchain = swapchain;
+  create_info.setOldSwapchain(old_swapchain);
 
   if (device.createSwapchainKHR(&create_info, nullptr, &(this->swapchain)) != vk::Result::eSuccess) {
     throw std::runtime_error("failed to create swap chain!");
   }
+  if (old_swapchain) {
+    device.destroySwapchainKHR(old_swapchain);
+  }
 
   device.getSwapchainImagesKHR(swapchain, &image_count, nullptr);
   swapchain_images.resize(image_count);
   device.getSwapchainImagesKHR(swapchain, &image_count, this->swapchain_images.data());
+  // Recreating waits for every submitted frame first
+  image_timeline_values.assign(image_count, 0);
 
   swapchain_image_format = surface_format.format;
   swapchain_extent = extent;
@@ -514,92 +1167,84 @@ void VulkanTestApp::create_swapchain() {
 void VulkanTestApp::create_image_views() {
   swapchain_image_views.resize(swapchain_images.size());
   for(size_t i = 0; i < swapchain_images.size(); i++) {
-    vk::ImageViewCreateInfo create_info{};
-    create_info.setImage(swapchain_images[i]);
-    create_info.setViewType(vk::ImageViewType::e2D);
-    create_info.setFormat(swapchain_image_format);
-    create_info.components.setR(vk::ComponentSwizzle::eIdentity);
-    create_info.components.setG(vk::ComponentSwizzle::eIdentity);
-    create_info.components.setB(vk::ComponentSwizzle::eIdentity);
-    create_info.components.setA(vk::ComponentSwizzle::eIdentity);
-
-    create_info.subresourceRange.setAspectMask(vk::ImageAspectFlagBits::eColor);
-    create_info.subresourceRange.setBaseMipLevel(0);
-    create_info.subresourceRange.setLevelCount(1);
-    create_info.subresourceRange.setBaseArrayLayer(0);
-    create_info.subresourceRange.setLayerCount(1);
-
-    if(device.createImageView(&create_info, nullptr, &swapchain_image_views[i]) != vk::Result::eSuccess) {
-      throw std::runtime_error("failed to create image views!");
-    }
+    swapchain_image_views[i] = create_image_view(swapchain_images[i], swapchain_image_format, vk::ImageAspectFlagBits::eColor);
   }
 }
 
-void VulkanTestApp::create_render_pass() {
-  vk::AttachmentDescription color_attachment{};
-  color_attachment.setFormat(swapchain_image_format);
-  color_attachment.setSamples(vk::SampleCountFlagBits::e1);
-  color_attachment.setLoadOp(vk::AttachmentLoadOp::eClear);
-  color_attachment.setStoreOp(vk::AttachmentStoreOp::eStore);
-  color_attachment.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare);
-  color_attachment.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare);
-  color_attachment.setInitialLayout(vk::ImageLayout::eUndefined);
-  color_attachment.setFinalLayout(vk::ImageLayout::ePresentSrcKHR);
-
-  vk::AttachmentReference color_attachment_ref{};
-  color_attachment_ref.setAttachment(0);
-  color_attachment_ref.setLayout(vk::ImageLayout::eColorAttachmentOptimal);
-
-  vk::SubpassDescription subpass{};
-  subpass.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics);
-  subpass.setColorAttachmentCount(1);
-  subpass.setPColorAttachments(&color_attachment_ref);
-
-  vk::RenderPassCreateInfo render_pass_info{};
-  render_pass_info.setAttachmentCount(1);
-  render_pass_info.setPAttachments(&color_attachment);
-  render_pass_info.setSubpassCount(1);
-  render_pass_info.setPSubpasses(&subpass);
-
-  // TODO: try to render without this
-  vk::SubpassDependency dependency{};
-  dependency.setSrcSubpass(VK_SUBPASS_EXTERNAL);
-  dependency.setDstSubpass(0);
-
-  dependency.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput);
-  // ??
-  dependency.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentRead);
-
-  dependency.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput);
-  dependency.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite);
-
-  render_pass_info.setDependencyCount(1);
-  render_pass_info.setPDependencies(&dependency);
-
-  if(device.createRenderPass(&render_pass_info, nullptr, &render_pass) != vk::Result::eSuccess) {
-    throw std::runtime_error("failed to create render pass!");
+void VulkanTestApp::create_render_graph() {
+  depth_format = jar::image::find_depth_format(physical_device);
+  msaa_samples = jar::image::find_sample_count(physical_device, requested_msaa_samples);
+  render_graph = std::make_unique<jar::RenderGraph>(device, physical_device, &memory_budget);
+
+  // The presentation engine is done with the image once the acquire
+  // semaphore, waited on at color attachment output, has signaled
+  jar::ResourceHandle backbuffer = render_graph->import_image("backbuffer",
+      swapchain_image_format,
+      swapchain_extent,
+      vk::ImageAspectFlagBits::eColor,
+      swapchain_images,
+      swapchain_image_views,
+      vk::ImageLayout::eUndefined,
+      vk::PipelineStageFlagBits::eColorAttachmentOutput,
+      vk::ImageLayout::ePresentSrcKHR);
+  render_graph->set_output(backbuffer);
+  // The pre-pass and main pass end up as subpasses of one render pass, so
+  // depth and the multisampled color never have to leave the tile
+  jar::ResourceHandle depth = render_graph->create_image("depth", depth_format, swapchain_extent, vk::ImageAspectFlagBits::eDepth,
+      msaa_samples);
+  jar::ResourceHandle color = backbuffer;
+  if(msaa_samples != vk::SampleCountFlagBits::e1) {
+    color = render_graph->create_image("color", swapchain_image_format, swapchain_extent, vk::ImageAspectFlagBits::eColor,
+        msaa_samples);
   }
-}
-
-void VulkanTestApp::create_frame_buffers() {
-  swapchain_framebuffers.resize(swapchain_image_views.size());
-  for(size_t i = 0; i < swapchain_image_views.size(); i++) {
-    vk::ImageView attachments[] = {
-      swapchain_image_views[i]
-    };
 
-    vk::FramebufferCreateInfo framebuffer_info{};
-    framebuffer_info.setRenderPass(render_pass);
-    framebuffer_info.setAttachmentCount(1);
-    framebuffer_info.setPAttachments(attachments);
-    framebuffer_info.setWidth(swapchain_extent.width);
-    framebuffer_info.setHeight(swapchain_extent.height);
-    framebuffer_info.setLayers(1);
-
-    if (device.createFramebuffer(&framebuffer_info, nullptr, &swapchain_framebuffers[i]) != vk::Result::eSuccess) {
-      throw std::runtime_error("failed to create framebuffer!");
-    }
+  depth_prepass = render_graph->add_pass("depth_prepass")
+    .write_depth(depth, 1.0f)
+    .on_record([this](vk::CommandBuffer cmd_buf, uint32_t image_index) {
+      record_viewport(cmd_buf);
+      // Positions only
+      cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, depth_prepass_pipeline);
+      cmd_buf.bindVertexBuffers(0, 1, model_buffer.buffer.address(), &position_offset);
+      cmd_buf.bindIndexBuffer(model_buffer.buffer, index_offset, vk::IndexType::eUint16);
+      cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, 1, &descriptor_sets[image_index], 0, nullptr);
+      record_draw_list(cmd_buf, image_index);
+    })
+    .handle();
+
+  auto main_builder = render_graph->add_pass("main");
+  main_builder.read_depth(depth);
+  main_builder.write_color(color, std::array<float, 4>{0.5, 0.7f, 0.2f, 1.0f});
+  if(color != backbuffer) {
+    main_builder.resolve(color, backbuffer);
   }
+  main_pass = main_builder
+    .on_record([this](vk::CommandBuffer cmd_buf, uint32_t image_index) {
+      if(pipeline_statistics_supported) {
+        cmd_buf.beginQuery(statistics_query_pool, image_index, {});
+      }
+      record_viewport(cmd_buf);
+      cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, graphics_pipeline);
+      vk::Buffer model_buffers[] = {model_buffer.buffer};
+      vk::DeviceSize offsets[] = {0};
+      cmd_buf.bindVertexBuffers(0, 1, model_buffers, offsets);
+      cmd_buf.bindIndexBuffer(model_buffer.buffer, index_offset, vk::IndexType::eUint16);
+      // Set 1 is the light grid culled for this image, set 2 the shadow maps
+      vk::DescriptorSet sets[] = {descriptor_sets[image_index], lighting.get_render_set(image_index), shadows.get_render_set(image_index)};
+      cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, 3, sets, 0, nullptr);
+      record_draw_list(cmd_buf, image_index);
+      if(pipeline_statistics_supported) {
+        cmd_buf.endQuery(statistics_query_pool, image_index);
+      }
+      // After the query, particles would swamp the overdraw numbers
+      if(particle_pipeline) {
+        cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, particle_pipeline);
+        cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, particle_pipeline_layout, 0, 1, &descriptor_sets[image_index], 0, nullptr);
+        particles.record_draw(cmd_buf, particle_pipeline_layout, image_index);
+      }
+    })
+    .handle();
+
+  render_graph->compile();
 }
 
 void VulkanTestApp::create_command_pool() {
@@ -614,138 +1259,591 @@ void VulkanTestApp::create_command_pool() {
   }
 }
 
+// Derived from the shaders, every stage of both pipelines has to agree on
+// set 0. Set 1 holds the lights, see jar::ClusteredLighting, and set 2 the
+// shadow maps, see jar::ShadowMaps.
 void VulkanTestApp::create_descriptor_set_layout() {
-  vk::DescriptorSetLayoutBinding ubo_layout_binding = {};
-  ubo_layout_binding.setBinding(0);
-  ubo_layout_binding.setDescriptorType(vk::DescriptorType::eUniformBuffer);
-  ubo_layout_binding.setDescriptorCount(1);
-  ubo_layout_binding.setStageFlags(vk::ShaderStageFlagBits::eVertex);
-  ubo_layout_binding.setPImmutableSamplers(nullptr);
-
-  vk::DescriptorSetLayoutCreateInfo layout_info = {};
-  layout_info.setBindingCount(1);
-  layout_info.setPBindings(&ubo_layout_binding);
-  if(device.createDescriptorSetLayout(&layout_info, nullptr, &descriptor_set_layout) != vk::Result::eSuccess) {
-    throw std::runtime_error("failed to create descriptor set layout!");
+  layout_cache.init(device);
+  auto description = jar::merge_layouts({
+    jar::reflect(shader_manager->get("shader.vert")),
+    jar::reflect(shader_manager->get("shader.frag")),
+    jar::reflect(shader_manager->get("depth.vert"))
+  });
+  auto set_layouts = layout_cache.get_set_layouts(description);
+  if(set_layouts.size() != 3) {
+    throw std::runtime_error("shaders are expected to use descriptor sets 0 to 2!");
   }
+  descriptor_set_layout = set_layouts[0];
 }
 
 void VulkanTestApp::init_vulkan(GLFWwindow* window) {
+  startup_start = std::chrono::steady_clock::now();
   this->window = window;
-  glfwGetWindowSize(window, &this->width, &this->height);
+  glfwGetFramebufferSize(window, &this->width, &this->height);
   if (enableValidationLayers && !jar::validation::checkValidationLayerSupport(validationLayers)) {
     throw std::runtime_error("validation layers requested, but not available!");
   }
 
-  create_instance();
-  create_surface();
-  select_physical_device();
-  create_logical_device();
-  create_swapchain();
-  create_image_views();
-  create_render_pass();
-  create_descriptor_set_layout();
-  create_graphics_pipeline();
-  create_frame_buffers();
-  create_command_pool();
-  create_texture_image();
-  create_uniform_buffers();
-  create_descriptor_pool();
-  create_descriptor_sets();
-  create_command_buffers();
-  create_semaphores();
+  // Each step only waits for what it reads. Shader loading doesn't need a
+  // device at all, the model upload and the per image resources overlap
+  // with the render graph and pipeline creation.
+  jar::TaskGraph startup;
+  auto instance_task = startup.add("instance", [this]() { create_instance(); });
+  auto surface_task = startup.add("surface", [this]() { create_surface(); }, {instance_task});
+  auto physical_device_task = startup.add("physical_device", [this]() { select_physical_device(); }, {surface_task});
+  auto device_task = startup.add("logical_device", [this]() { create_logical_device(); }, {physical_device_task});
+  auto shaders_task = startup.add("shaders", [this]() { create_shader_manager(); });
+  auto swapchain_task = startup.add("swapchain", [this]() { create_swapchain(); }, {device_task});
+  auto image_views_task = startup.add("image_views", [this]() { create_image_views(); }, {swapchain_task});
+  auto render_graph_task = startup.add("render_graph", [this]() { create_render_graph(); }, {image_views_task});
+  auto set_layout_task = startup.add("descriptor_set_layout", [this]() { create_descriptor_set_layout(); }, {device_task, shaders_task});
+  // The pipelines need the particles', lights' and shadows' set layouts, and the compute jobs go in in this order
+  auto particles_task = startup.add("particles", [this]() { create_particles(); }, {set_layout_task});
+  auto lighting_task = startup.add("lighting", [this]() { create_lighting(); }, {particles_task});
+  auto shadows_task = startup.add("shadows", [this]() { create_shadows(); }, {lighting_task});
+  auto pipelines_task = startup.add("pipelines", [this]() { create_graphics_pipeline(); }, {render_graph_task, shadows_task});
+  auto command_pool_task = startup.add("command_pool", [this]() { create_command_pool(); }, {device_task});
+  startup.add("frame_capture", [this]() {
+      frame_capture.create(device, physical_device, static_cast<uint32_t>(queueFamilyIndices.graphics_family), deletion_queue, memory_budget);
+    }, {device_task});
+  auto model_task = startup.add("model_upload", [this]() { create_model_buffer(); }, {command_pool_task});
+  auto uniform_buffers_task = startup.add("uniform_buffers", [this]() { create_uniform_buffers(); }, {swapchain_task});
+  auto draw_buffers_task = startup.add("draw_buffers", [this]() { create_draw_buffers(); }, {swapchain_task});
+  // CPU only, the scene isn't touched by anything else during startup
+  auto bvh_task = startup.add("bvh", [this]() { build_bvh(); });
+  auto descriptor_pool_task = startup.add("descriptor_pool", [this]() { create_descriptor_pool(); }, {swapchain_task});
+  auto descriptor_sets_task = startup.add("descriptor_sets", [this]() { create_descriptor_sets(); },
+      {descriptor_pool_task, set_layout_task, uniform_buffers_task, draw_buffers_task});
+  auto query_pool_task = startup.add("query_pool", [this]() { create_query_pool(); }, {swapchain_task});
+  startup.add("shadow_casters", [this]() { create_shadow_casters(); }, {shadows_task, model_task, bvh_task});
+  auto image_slots_task = startup.add("image_slots", [this]() { create_image_slots(); }, {swapchain_task, shadows_task});
+  startup.add("command_buffers", [this]() { create_command_buffers(); },
+      {render_graph_task, pipelines_task, model_task, descriptor_sets_task, query_pool_task, command_pool_task, draw_buffers_task,
+        image_slots_task});
+  // Both reset the per frame bookkeeping
+  startup.add("semaphores", [this]() { create_semaphores(); }, {device_task, query_pool_task});
+  {
+    jar::ThreadPool pool;
+    startup.run(pool);
+  }
+  startup.print_timings();
+  std::cout << "Startup scratch memory: " << startup_arena.get_stats().high_water_mark << " bytes from "
+    << startup_arena.thread_count() << " thread(s)\n";
 }
 
-void VulkanTestApp::draw_frame() {
-  device.waitForFences(1, &in_flight_fences[current_frame], true, std::numeric_limits<uint64_t>::max());
-  device.resetFences(1, &in_flight_fences[current_frame]);
+void VulkanTestApp::draw_frame(std::chrono::steady_clock::time_point input_time) {
+  if(pacing_dirty) {
+    apply_frame_pacing();
+  }
+  if(swapchain_dirty && !recreate_swapchain()) {
+    return;
+  }
+  reload_changed_shaders();
+  // Waits for the submission that last used this frame slot, nothing else
+  graphics_timeline.wait(frame_timeline_values[current_frame]);
+  deletion_queue.collect();
+  // Right after the frees, so warnings see as much headroom as there is
+  memory_budget.update();
+  transient = frame_arenas[current_frame].get();
+  transient->reset();
+  frame_capture.poll(graphics_timeline);
+  if(frame_image_indices[current_frame] >= 0) {
+    read_pipeline_statistics(frame_image_indices[current_frame]);
+    read_compute_overlap(frame_image_indices[current_frame]);
+    // Only an upper bound, the timeline may have passed the value a while before we looked
+    std::chrono::duration<double, std::milli> gpu_latency = std::chrono::steady_clock::now() - frame_input_times[current_frame];
+    latency_stats.input_to_gpu_done_ms = LatencyStats::smooth(latency_stats.input_to_gpu_done_ms, gpu_latency.count());
+  }
 
   uint32_t image_index;
   const auto& image_available_semaphore = image_available_semaphores[current_frame];
   const auto& render_finished_semaphore = render_finished_semaphores[current_frame];
-  device.acquireNextImageKHR(swapchain, std::numeric_limits<uint64_t>::max(), image_available_semaphore, nullptr, &image_index);
+  const auto& acquire_result = device.acquireNextImageKHR(swapchain, std::numeric_limits<uint64_t>::max(), image_available_semaphore, nullptr, &image_index);
+  if(acquire_result == vk::Result::eErrorOutOfDateKHR) {
+    // Nothing was submitted, the frame slot is still free for the next try
+    recreate_swapchain();
+    return;
+  } else if(acquire_result != vk::Result::eSuccess && acquire_result != vk::Result::eSuboptimalKHR) {
+    throw std::runtime_error("failed to acquire swapchain image: " + vk::to_string(acquire_result));
+  }
+  // Everything written below is per image and may still be read by the
+  // image's last frame
+  graphics_timeline.wait(image_timeline_values[image_index]);
+  frame_image_indices[current_frame] = image_index;
+  frame_input_times[current_frame] = input_time;
+  float dt = fixed_time_step;
+  if(fixed_time_step == 0.0f && last_input_time != std::chrono::steady_clock::time_point{}) {
+    dt = std::chrono::duration<float>(input_time - last_input_time).count();
+  }
+  last_input_time = input_time;
+  if(replayed_frame) {
+    dt = replayed_frame->dt;
+    if(replayed_frame->particle_emit_rate != particle_settings.emit_rate) {
+      set_particle_emit_rate(replayed_frame->particle_emit_rate);
+    }
+    if(replayed_frame->light_count != light_settings.count) {
+      set_light_count(replayed_frame->light_count);
+    }
+  }
 
   update_uniform_buffer(image_index);
+  if(command_capture) {
+    captured_frame.index = command_capture->get_frame_count();
+    captured_frame.dt = dt;
+    captured_frame.width = swapchain_extent.width;
+    captured_frame.height = swapchain_extent.height;
+    captured_frame.particle_emit_rate = particle_settings.emit_rate;
+    captured_frame.light_count = light_settings.count;
+    command_capture->write_frame(captured_frame);
+  }
+
+  // Compute goes first so it can overlap with this frame's rasterization,
+  // graphics only waits for it at the stages that read the results
+  if(particle_settings.capacity > 0) {
+    particles.prepare(dt, image_index);
+  }
+  lighting.prepare(dt, view_matrix, projection, z_near, z_far, swapchain_extent, image_index);
+  shadows.prepare(view_matrix, projection, z_near, z_far, lighting, image_index);
+  // The batch rebuilds the particle set the frame before last drew from
+  uint64_t compute_value = async_compute.submit(current_frame, graphics_timeline.get_semaphore(), previous_frame_value);
 
   vk::SubmitInfo submit_info{};
-  vk::Semaphore wait_semaphores[] = {image_available_semaphore};
-  vk::PipelineStageFlags wait_stages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
-  submit_info.setWaitSemaphoreCount(1);
+  vk::Semaphore wait_semaphores[] = {image_available_semaphore, async_compute.get_timeline().get_semaphore()};
+  vk::PipelineStageFlags wait_stages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput, async_compute.get_consumer_stages()};
+  uint64_t wait_values[] = {0, compute_value};
+  uint32_t wait_count = compute_value != 0 ? 2 : 1;
+  submit_info.setWaitSemaphoreCount(wait_count);
   submit_info.setPWaitSemaphores(wait_semaphores);
   submit_info.setPWaitDstStageMask(wait_stages);
 
-  submit_info.setCommandBufferCount(1);
-  submit_info.setPCommandBuffers(&command_buffers[image_index]);
-  vk::Semaphore signal_semaphores[] = {render_finished_semaphore};
-  submit_info.setSignalSemaphoreCount(1);
+  // A capture copies the image after the frame's own commands, before present
+  vk::CommandBuffer capture_cmd = readback_supported ?
+    frame_capture.record(swapchain_images[image_index], swapchain_image_format, swapchain_extent) : nullptr;
+  // Shadow map updates go first, only when something changed
+  vk::CommandBuffer shadow_cmd = shadows.record(graphics_timeline);
+  vk::CommandBuffer submit_command_buffers[3];
+  uint32_t command_buffer_count = 0;
+  if(shadow_cmd) {
+    submit_command_buffers[command_buffer_count++] = shadow_cmd;
+  }
+  submit_command_buffers[command_buffer_count++] = command_buffers[image_index];
+  if(capture_cmd) {
+    submit_command_buffers[command_buffer_count++] = capture_cmd;
+  }
+  submit_info.setCommandBufferCount(command_buffer_count);
+  submit_info.setPCommandBuffers(submit_command_buffers);
+  // The binary semaphore is for present, the timeline value marks the frame done
+  uint64_t frame_value = graphics_timeline.next_value();
+  vk::Semaphore signal_semaphores[] = {render_finished_semaphore, graphics_timeline.get_semaphore()};
+  uint64_t signal_values[] = {0, frame_value};
+  vk::TimelineSemaphoreSubmitInfoKHR timeline_info{};
+  timeline_info.setWaitSemaphoreValueCount(wait_count);
+  timeline_info.setPWaitSemaphoreValues(wait_values);
+  timeline_info.setSignalSemaphoreValueCount(2);
+  timeline_info.setPSignalSemaphoreValues(signal_values);
+  submit_info.setPNext(&timeline_info);
+  submit_info.setSignalSemaphoreCount(2);
   submit_info.setPSignalSemaphores(signal_semaphores);
-  if (graphics_queue.submit(1, &submit_info, in_flight_fences[current_frame]) != vk::Result::eSuccess) {
+  if (graphics_queue.submit(1, &submit_info, nullptr) != vk::Result::eSuccess) {
     throw std::runtime_error("failed to submit draw command buffer!");
   }
+  frame_timeline_values[current_frame] = frame_value;
+  image_timeline_values[image_index] = frame_value;
+  if(capture_cmd) {
+    frame_capture.submitted(frame_value);
+  }
+  if(shadow_cmd) {
+    shadows.submitted(frame_value);
+  }
+  previous_frame_value = last_frame_value;
+  last_frame_value = frame_value;
 
   vk::PresentInfoKHR present_info{};
   present_info.setWaitSemaphoreCount(1);
-  present_info.setPWaitSemaphores(signal_semaphores);
+  present_info.setPWaitSemaphores(&render_finished_semaphore);
   vk::SwapchainKHR swapchains[] = {swapchain};
   present_info.setSwapchainCount(1);
   present_info.setPSwapchains(swapchains);
   present_info.setPImageIndices(&image_index);
   present_info.setPResults(nullptr);
-  present_queue.presentKHR(&present_info);
-  current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+  const auto& present_result = present_queue.presentKHR(&present_info);
+  std::chrono::duration<double, std::milli> present_latency = std::chrono::steady_clock::now() - input_time;
+  latency_stats.input_to_present_ms = LatencyStats::smooth(latency_stats.input_to_present_ms, present_latency.count());
+  if(!first_frame_presented) {
+    first_frame_presented = true;
+    std::chrono::duration<float, std::milli> startup_time = std::chrono::steady_clock::now() - startup_start;
+    startup_ms = startup_time.count();
+    std::cout << "First frame presented " << startup_ms << "ms after init_vulkan\n";
+  }
+  current_frame = (current_frame + 1) % frame_timeline_values.size();
+
+  if(present_result == vk::Result::eErrorOutOfDateKHR || present_result == vk::Result::eSuboptimalKHR || framebuffer_resized) {
+    framebuffer_resized = false;
+    recreate_swapchain();
+  } else if(present_result != vk::Result::eSuccess) {
+    throw std::runtime_error("failed to present swapchain image: " + vk::to_string(present_result));
+  }
 }
 
-void VulkanTestApp::update_uniform_buffer(uint32_t current_image) {
-  static auto startTime = std::chrono::high_resolution_clock::now();
+void VulkanTestApp::set_mesh(std::vector<Vertex> vertices, std::vector<uint16_t> indices) {
+  this->vertices = std::move(vertices);
+  this->indices = std::move(indices);
+  if(command_capture) {
+    command_capture->write_mesh(this->vertices, this->indices);
+  }
+  create_model_buffer();
+  build_bvh();
+  // The old buffer is on its way out, the cached views they're in get redrawn
+  size_t caster = 0;
+  for(jar::NodeHandle node: scene_objects) {
+    if(node != model_node) {
+      shadows.update_caster(object_casters[caster++], make_caster(scene.get_world(node), true));
+    }
+  }
+  rerecord_command_buffers();
+}
+
+void VulkanTestApp::reload_pipelines() {
+  wait_for_pipeline_build();
+  if(pipeline_build.valid()) {
+    install_pipelines();
+  }
+  for(auto& install: build_pipelines(all_pipelines)) {
+    install();
+  }
+  rerecord_command_buffers();
+}
+
+// The command buffers are prerecorded and may still be pending, so record a
+// new set instead of resetting them and free the old one once it's done
+void VulkanTestApp::rerecord_command_buffers() {
+  std::vector<vk::CommandBuffer> old_command_buffers;
+  old_command_buffers.swap(command_buffers);
+  vk::Device device = this->device;
+  vk::CommandPool command_pool = this->command_pool;
+  deletion_queue.defer([device, command_pool, old_command_buffers]() {
+    device.freeCommandBuffers(command_pool, old_command_buffers.size(), old_command_buffers.data());
+  });
+  create_command_buffers();
+}
+
+void VulkanTestApp::set_framebuffer_size(int width, int height) {
+  if(width != this->width || height != this->height) {
+    this->width = width;
+    this->height = height;
+    framebuffer_resized = true;
+  }
+}
+
+void VulkanTestApp::set_frame_pacing(const FramePacing& pacing) {
+  frame_pacing = pacing;
+  frame_pacing.frames_in_flight = std::clamp(pacing.frames_in_flight, 1u, FramePacing::max_frames_in_flight);
+  // Before init_vulkan there is nothing to rebuild yet
+  pacing_dirty = static_cast<bool>(device);
+}
+
+const FramePacing& VulkanTestApp::get_frame_pacing() const {
+  return frame_pacing;
+}
+
+const LatencyStats& VulkanTestApp::get_latency_stats() const {
+  return latency_stats;
+}
+
+jar::ArenaStats VulkanTestApp::get_frame_arena_stats() const {
+  jar::ArenaStats total;
+  for(const auto& arena: frame_arenas) {
+    jar::ArenaStats stats = arena->get_stats();
+    total.used += stats.used;
+    total.high_water_mark += stats.high_water_mark;
+    total.capacity += stats.capacity;
+    total.block_count += stats.block_count;
+  }
+  return total;
+}
+
+vk::PresentModeKHR VulkanTestApp::get_present_mode() const {
+  return present_mode;
+}
+
+void VulkanTestApp::apply_frame_pacing() {
+  pacing_dirty = false;
+  // Frame slots are renumbered, everything in flight has to be done with them
+  graphics_timeline.wait(graphics_timeline.last_value());
+  destroy_semaphores();
+  create_semaphores();
+  async_compute.set_slot_count(frame_pacing.frames_in_flight);
+  latency_stats = {};
+  // Picks up the new present mode
+  swapchain_dirty = true;
+  std::cout << "Frame pacing: " << frame_pacing.frames_in_flight << " frame(s) in flight, "
+    << vk::to_string(frame_pacing.present_mode) << " requested\n";
+}
+
+void VulkanTestApp::cleanup_swapchain() {
+  device.freeCommandBuffers(command_pool, command_buffers.size(), command_buffers.data());
+  command_buffers.clear();
+  render_graph->destroy();
+  for (auto& image_view: swapchain_image_views) {
+    device.destroyImageView(image_view);
+  }
+  swapchain_image_views.clear();
+}
+
+bool VulkanTestApp::recreate_swapchain() {
+  // The size comes from set_framebuffer_size, only the main thread may ask
+  // GLFW. Minimized, try again once there is something to render to.
+  swapchain_dirty = width == 0 || height == 0;
+  if(swapchain_dirty) {
+    return false;
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  // A reload may be building against the render passes that are about to
+  // go. Its pipelines are still swapped in later, the new passes are
+  // compatible with the old ones.
+  wait_for_pipeline_build();
+  // Only submitted frames can still reference the swapchain objects,
+  // waiting for those is enough, no need to idle the whole device or the
+  // present queue. Pending presents are handled by the old swapchain being
+  // retired through oldSwapchain.
+  graphics_timeline.wait(graphics_timeline.last_value());
+
+  size_t old_image_count = swapchain_images.size();
+  cleanup_swapchain();
+  create_swapchain();
+  create_image_views();
+  create_render_graph();
+
+  // Per image resources only need rebuilding if the image count changed
+  if(swapchain_images.size() != old_image_count) {
+    device.destroyDescriptorPool(descriptor_pool);
+    if(pipeline_statistics_supported) {
+      device.destroyQueryPool(statistics_query_pool);
+    }
+    if(graphics_timestamps_supported) {
+      device.destroyQueryPool(graphics_timestamp_pool);
+    }
+    create_uniform_buffers();
+    create_draw_buffers();
+    create_descriptor_pool();
+    create_descriptor_sets();
+    create_query_pool();
+    create_image_slots();
+  } else {
+    std::fill(frame_image_indices.begin(), frame_image_indices.end(), -1);
+  }
+  create_command_buffers();
+
+  auto end = std::chrono::high_resolution_clock::now();
+  std::cout << "Swapchain recreated at " << swapchain_extent.width << "x" << swapchain_extent.height
+    << " in " << std::chrono::duration<float, std::milli>(end - start).count() << "ms\n";
+  return true;
+}
 
-  auto currentTime = std::chrono::high_resolution_clock::now();
-  float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+void VulkanTestApp::update_uniform_buffer(uint32_t current_image) {
+  glm::mat4 model;
+  if(replayed_frame) {
+    model = replayed_frame->model;
+    view_matrix = replayed_frame->view;
+    projection = replayed_frame->projection;
+    view_projection = projection * view_matrix;
+  } else {
+    animate_scene();
+    model = scene.get_world(model_node);
+  }
+  captured_frame.model = model;
+  captured_frame.view = view_matrix;
+  captured_frame.projection = projection;
 
-  glm::mat4 model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-  glm::mat4 proj = glm::perspective<float>(glm::radians(45.0f), swapchain_extent.width / (float) swapchain_extent.height, 0.1f, 10.0f);
-  glm::mat4 view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-  proj[1][1] *= -1;
+  shadows.update_caster(model_caster, make_caster(model, false));
 
   UniformBufferObject ubo = {};
-  ubo.mvp = proj * view * model;
+  ubo.view_projection = view_projection;
+  ubo.view = view_matrix;
+  ubo.model = model;
 
-  void* data = device.mapMemory(uniform_buffers_memory[current_image], 0, sizeof(ubo));
+  const auto& memory = uniform_buffers[current_image].memory;
+  void* data = device.mapMemory(memory, 0, sizeof(ubo));
   memcpy(data, &ubo, sizeof(ubo));
-  device.unmapMemory(uniform_buffers_memory[current_image]);
+  device.unmapMemory(memory);
+  update_draw_list(current_image, model);
 }
 
-//TODO: RAII this
-void VulkanTestApp::cleanup() {
-  std::cout << "Cleanup\n";
-  device.waitIdle();
-  for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    device.destroySemaphore(render_finished_semaphores[i]);
-    device.destroySemaphore(image_available_semaphores[i]);
-    device.destroyFence(in_flight_fences[i]);
+void VulkanTestApp::animate_scene() {
+  float time = animation_time;
+  if(fixed_time_step > 0.0f) {
+    animation_time += fixed_time_step;
+  } else {
+    auto now = std::chrono::steady_clock::now();
+    if(animation_start == std::chrono::steady_clock::time_point{}) {
+      animation_start = now;
+    }
+    time = std::chrono::duration<float>(now - animation_start).count();
   }
-  for(const auto& framebuffer: swapchain_framebuffers) {
-    device.destroyFramebuffer(framebuffer);
+
+  // Only the model node moves, the update skips everything before it
+  scene.set_rotation(model_node, glm::angleAxis(time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+  scene.update();
+  // Likewise only the moved objects are refitted in the tree
+  for(uint32_t i = 0; i < scene_objects.size(); i++) {
+    if(scene.world_changed(scene_objects[i])) {
+      bvh.update(i, mesh_bounds.transformed(scene.get_world(scene_objects[i])));
+    }
   }
+  bvh.refit();
+  projection = glm::perspective<float>(glm::radians(45.0f), swapchain_extent.width / (float) swapchain_extent.height, z_near, z_far);
+  view_matrix = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+  projection[1][1] *= -1;
+  view_projection = projection * view_matrix;
+}
 
-  device.destroyDescriptorSetLayout(descriptor_set_layout);
-  for(size_t i = 0; i < swapchain_images.size(); i++) {
-    device.destroyBuffer(uniform_buffers[i]);
-    device.freeMemory(uniform_buffers_memory[i]);
+void VulkanTestApp::update_draw_list(uint32_t current_image, const glm::mat4& model) {
+  auto visible_objects = transient->vector<uint32_t>(scene_objects.size());
+  if(replayed_frame) {
+    replayed_frame->for_each_visible([&](uint32_t object) {
+      if(object < scene_objects.size()) {
+        visible_objects.push_back(object);
+      }
+    });
+  } else {
+    bvh.cull(jar::Frustum::from_matrix(view_projection), visible_objects);
+  }
+  last_visible_count = static_cast<uint32_t>(visible_objects.size());
+
+  // Only the model moves, a replayed frame brings its matrix along
+  const auto& object_memory = object_buffers[current_image].memory;
+  auto* worlds = static_cast<glm::mat4*>(device.mapMemory(object_memory, 0, sizeof(glm::mat4) * scene_objects.size()));
+  for(size_t i = 0; i < visible_objects.size(); i++) {
+    jar::NodeHandle node = scene_objects[visible_objects[i]];
+    worlds[i] = node == model_node ? model : scene.get_world(node);
   }
+  device.unmapMemory(object_memory);
+
+  // Visible draws are packed at the front, so the rest can be skipped by the
+  // count or cost nothing as draws without instances. Every object is the
+  // same mesh, without firstInstance they all go into the first draw.
+  const auto& memory = draw_buffers[current_image].memory;
+  vk::DeviceSize size = sizeof(vk::DrawIndexedIndirectCommand) * scene_objects.size() + sizeof(uint32_t);
+  auto* draws = static_cast<vk::DrawIndexedIndirectCommand*>(device.mapMemory(memory, 0, size));
+  uint32_t index_count = static_cast<uint32_t>(indices.size());
+  uint32_t draw_count = last_visible_count;
+  if(first_instance_supported) {
+    for(uint32_t i = 0; i < scene_objects.size(); i++) {
+      uint32_t instance_count = i < last_visible_count ? 1 : 0;
+      draws[i] = vk::DrawIndexedIndirectCommand(index_count, instance_count, 0, 0, i);
+    }
+  } else {
+    for(size_t i = 0; i < scene_objects.size(); i++) {
+      draws[i] = vk::DrawIndexedIndirectCommand(index_count, 0, 0, 0, 0);
+    }
+    draws[0].setInstanceCount(last_visible_count);
+    draw_count = std::min(last_visible_count, 1u);
+  }
+  *reinterpret_cast<uint32_t*>(draws + scene_objects.size()) = draw_count;
+  last_draw_count = draw_count;
+  device.unmapMemory(memory);
+  if(command_capture) {
+    captured_frame.set_visible(visible_objects);
+  }
+}
 
-  device.destroyDescriptorPool(descriptor_pool);
-  device.destroySwapchainKHR(swapchain);
-  device.destroyBuffer(model_buffer);
-  device.freeMemory(model_buffer_memory);
-  device.destroyRenderPass(render_pass);
-  device.destroyPipelineLayout(pipeline_layout);
-  device.destroyPipeline(graphics_pipeline);
-  device.destroyCommandPool(command_pool);
+void VulkanTestApp::start_command_capture(const std::string& path) {
+  stop_command_capture();
+  jar::StreamSetup setup;
+  setup.object_count = static_cast<uint32_t>(scene_objects.size());
+  setup.width = swapchain_extent.width;
+  setup.height = swapchain_extent.height;
+  setup.particles = particle_settings;
+  setup.lights = light_settings;
+  setup.msaa_samples = static_cast<uint32_t>(msaa_samples);
+  setup.shadows = shadow_settings;
+  command_capture = std::make_unique<jar::CommandStreamWriter>();
+  command_capture->open(path, setup);
+  command_capture->write_mesh(vertices, indices);
+  std::cout << "Capturing commands to " << path << '\n';
+}
 
+void VulkanTestApp::stop_command_capture() {
+  if(!command_capture) {
+    return;
+  }
+  std::cout << "Command capture stopped, " << command_capture->get_frame_count() << " frame(s) in "
+    << command_capture->get_byte_count() / 1024 << " KiB\n";
+  command_capture->close();
+  command_capture.reset();
+}
 
-  for (auto& image_view: swapchain_image_views) {
-    device.destroyImageView(image_view);
+bool VulkanTestApp::is_capturing_commands() const {
+  return static_cast<bool>(command_capture);
+}
+
+void VulkanTestApp::replay_frame(const jar::FramePacket& frame) {
+  replayed_frame = &frame;
+  draw_frame();
+  replayed_frame = nullptr;
+}
+
+std::optional<uint32_t> VulkanTestApp::pick(double x, double y) const {
+  // The projection's y flip already matches the window's y pointing down
+  glm::vec2 ndc(2.0f * x - 1.0f, 2.0f * y - 1.0f);
+  glm::mat4 inverse = glm::inverse(view_projection);
+  glm::vec4 near_point = inverse * glm::vec4(ndc, 0.0f, 1.0f);
+  glm::vec4 far_point = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+  near_point /= near_point.w;
+  far_point /= far_point.w;
+
+  // Distances are fractions of the way to the far plane
+  jar::Ray ray{glm::vec3(near_point), glm::vec3(far_point - near_point), 1.0f};
+  auto hit = bvh.raycast(ray);
+  if(!hit) {
+    return std::nullopt;
   }
+  return hit->object;
+}
+
+void VulkanTestApp::cleanup() {
+  std::cout << "Cleanup\n";
+  stop_command_capture();
+  shader_manager->stop();
+  // Dropping the result queues its pipelines for deletion
+  wait_for_pipeline_build();
+  pipeline_build = {};
+  device.waitIdle();
+  destroy_semaphores();
+  cleanup_swapchain();
+
+  // The owning handles only queue their destruction, the device is idle so
+  // the queue can be flushed straight away. Must happen before the device
+  // and command pool go.
+  uniform_buffers.clear();
+  draw_buffers.clear();
+  object_buffers.clear();
+  model_buffer.reset();
+  graphics_pipeline.reset();
+  depth_prepass_pipeline.reset();
+  particle_pipeline.reset();
+  particles.destroy();
+  lighting.destroy();
+  shadows.destroy();
+  // Encodes whatever was still waiting
+  frame_capture.destroy();
+  deletion_queue.flush();
+  layout_cache.destroy();
+  shader_modules.print_summary();
+  shader_modules.destroy();
+  async_compute.destroy();
+  graphics_timeline.destroy();
+
+  device.destroyDescriptorPool(descriptor_pool);
+  device.destroySwapchainKHR(swapchain);
+  if(pipeline_statistics_supported) {
+    device.destroyQueryPool(statistics_query_pool);
+  }
+  if(graphics_timestamps_supported) {
+    device.destroyQueryPool(graphics_timestamp_pool);
+  }
+  device.destroyCommandPool(command_pool);
 
   jar::validation::DestroyDebugReportCallbackEXT(instance, callback, nullptr);
   device.destroy();
@@ -4,21 +4,60 @@
 #include <vulkan/vulkan.hpp>
 #include <string>
 #include <array>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
 #include "QueueFamilyIndices.hpp"
 #include "Vertex.hpp"
+#include "PipelineStatistics.hpp"
+#include "RenderGraph.hpp"
+#include "FramePacing.hpp"
+#include "Timeline.hpp"
+#include "Resource.hpp"
+#include "ShaderManager.hpp"
+#include "Reflection.hpp"
+#include "TaskGraph.hpp"
+#include "DeviceSelection.hpp"
+#include "AsyncCompute.hpp"
+#include "ParticleSystem.hpp"
+#include "ClusteredLighting.hpp"
+#include "ShadowMaps.hpp"
+#include "Scene.hpp"
+#include "Bvh.hpp"
+#include "FrameArena.hpp"
+#include "FrameCapture.hpp"
+#include "CommandStream.hpp"
+#include <optional>
 
 class VulkanTestApp {
   private:
-  static const int MAX_FRAMES_IN_FLIGHT = 2;
   VkDebugReportCallbackEXT callback;
   const bool enableValidationLayers = true;
   const std::vector<const char*> validationLayers = {
     "VK_LAYER_LUNARG_standard_validation"
   };
   const std::vector<const char*> device_extensions = {
-    VK_KHR_SWAPCHAIN_EXTENSION_NAME
+    VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+    VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME
   };
-  int current_frame = 0;
+  std::chrono::steady_clock::time_point startup_start;
+  bool first_frame_presented = false;
+  // From init_vulkan to the first present
+  float startup_ms = 0.0f;
+  // 0 animates with the clock, otherwise every frame advances this much
+  float fixed_time_step = 0.0f;
+  float animation_time = 0.0f;
+  std::chrono::steady_clock::time_point animation_start{};
+  jar::device::DeviceSelection device_selection{};
+  FramePacing frame_pacing{};
+  bool pacing_dirty = false;
+  LatencyStats latency_stats{};
+  size_t current_frame = 0;
+  bool framebuffer_resized = false;
+  // Set while the window has no area and the swapchain couldn't be rebuilt
+  bool swapchain_dirty = false;
   int width, height;
   GLFWwindow* window;
   QueueFamilyIndices queueFamilyIndices{};
@@ -31,25 +70,128 @@ class VulkanTestApp {
   vk::SwapchainKHR swapchain;
   std::vector<vk::Image> swapchain_images;
   vk::Format swapchain_image_format;
+  vk::PresentModeKHR present_mode;
   vk::Extent2D swapchain_extent;
   std::vector<vk::ImageView> swapchain_image_views;
+  // Everything released at runtime goes through here, see jar::Unique
+  jar::DeletionQueue deletion_queue;
+  jar::MemoryBudget memory_budget;
+  jar::FrameCapture frame_capture;
+  // Whether the surface lets swapchain images be copied from
+  bool readback_supported = false;
+  // Owns the descriptor set and pipeline layouts, shared by every pipeline
+  jar::LayoutCache layout_cache;
   vk::DescriptorSetLayout descriptor_set_layout;
   vk::PipelineLayout pipeline_layout;
-  vk::RenderPass render_pass;
-  vk::Pipeline graphics_pipeline;
-  std::vector<vk::Framebuffer> swapchain_framebuffers;
+  std::unique_ptr<jar::RenderGraph> render_graph;
+  jar::PassHandle depth_prepass;
+  jar::PassHandle main_pass;
+  jar::UniquePipeline depth_prepass_pipeline;
+  jar::UniquePipeline graphics_pipeline;
+  jar::ParticleSettings particle_settings{};
+  jar::ParticleSystem particles;
+  jar::UniquePipeline particle_pipeline;
+  vk::PipelineLayout particle_pipeline_layout;
+  jar::LightSettings light_settings{};
+  jar::ClusteredLighting lighting;
+  jar::ShadowSettings shadow_settings{};
+  jar::ShadowMaps shadows;
+  // The model, the only dynamic caster
+  uint32_t model_caster = 0;
+  // The other scene objects' static casters, see create_shadow_casters
+  std::vector<uint32_t> object_casters;
+  // Declared before the manager, which loads through it
+  jar::ShaderModuleRegistry shader_modules;
+  std::unique_ptr<jar::ShaderManager> shader_manager;
+  // What a reload has to rebuild when a shader changes
+  enum PipelineGroup : uint32_t {
+    scene_pipelines = 1 << 0,
+    lighting_pipelines = 1 << 1,
+    shadow_pipelines = 1 << 2,
+    particle_pipelines = 1 << 3,
+    all_pipelines = scene_pipelines | lighting_pipelines | shadow_pipelines | particle_pipelines
+  };
+  std::map<std::string, uint32_t> shader_pipelines;
+  // Reloads build on a worker, each finished group comes back as the call
+  // that swaps it in
+  std::future<std::vector<std::function<void()>>> pipeline_build;
+  std::chrono::steady_clock::time_point pipeline_build_start;
+  vk::Format depth_format;
+  uint32_t requested_msaa_samples = 1;
+  // What the device could do of the requested count
+  vk::SampleCountFlagBits msaa_samples = vk::SampleCountFlagBits::e1;
+  // How record_draw_list gets the draw list into one command, without
+  // either it's a command per object
+  bool multi_draw_supported = false;
+  bool draw_count_supported = false;
+  // Without it the visible objects are drawn as instances of one draw
+  bool first_instance_supported = false;
+  uint32_t max_draw_count = 1;
+  bool pipeline_statistics_supported = false;
+  vk::QueryPool statistics_query_pool;
+  bool graphics_timestamps_supported = false;
+  // Two per swapchain image, around the whole frame
+  vk::QueryPool graphics_timestamp_pool;
+  // Swapchain image rendered by each frame in flight, -1 until it has been used
+  std::vector<int> frame_image_indices;
+  // When input was polled for the frame each frame in flight is rendering
+  std::vector<std::chrono::steady_clock::time_point> frame_input_times;
+  PipelineStatistics pipeline_statistics{};
   vk::CommandPool command_pool;
   std::vector<vk::CommandBuffer> command_buffers;
   std::vector<vk::Semaphore> image_available_semaphores;
   std::vector<vk::Semaphore> render_finished_semaphores;
-  std::vector<vk::Fence> in_flight_fences;
-  vk::Buffer model_buffer;
-  vk::DeviceMemory model_buffer_memory;
-  std::vector<vk::Buffer> uniform_buffers;
-  std::vector<vk::DeviceMemory> uniform_buffers_memory;
+  vk::DispatchLoaderDynamic dispatch;
+  jar::Timeline graphics_timeline;
+  jar::AsyncCompute async_compute;
+  // Timeline value signaled by the last submission of each frame in flight
+  std::vector<uint64_t> frame_timeline_values;
+  // And of each swapchain image, with more frames in flight than images an
+  // image comes back before its frame slot does
+  std::vector<uint64_t> image_timeline_values;
+  // Scratch memory for the startup tasks and for each frame in flight. Only
+  // grows, a slot's arena is reset once the slot's last frame is done.
+  jar::FrameArena startup_arena;
+  std::vector<std::unique_ptr<jar::FrameArena>> frame_arenas;
+  // Whichever of those the code running now should allocate from
+  jar::FrameArena* transient = &startup_arena;
+  // Values of the two most recent frames, whatever their slot
+  uint64_t last_frame_value = 0;
+  uint64_t previous_frame_value = 0;
+  std::chrono::steady_clock::time_point last_input_time{};
+  jar::BufferAllocation model_buffer;
+  vk::DeviceSize position_offset;
+  vk::DeviceSize index_offset;
+  std::vector<jar::BufferAllocation> uniform_buffers;
   vk::DescriptorPool descriptor_pool;
   std::vector<vk::DescriptorSet> descriptor_sets;
 
+  jar::Scene scene;
+  jar::NodeHandle model_node = scene.add_node();
+  // Everything drawn with the mesh, object i is scene node scene_objects[i]
+  std::vector<jar::NodeHandle> scene_objects = {model_node};
+  jar::Aabb mesh_bounds;
+  jar::Bvh bvh;
+  uint32_t last_visible_count = 0;
+  uint32_t last_draw_count = 0;
+  // Camera of the last updated frame, for picking and the light grid
+  static constexpr float z_near = 0.1f;
+  static constexpr float z_far = 10.0f;
+  glm::mat4 view_matrix{1.0f};
+  glm::mat4 projection{1.0f};
+  glm::mat4 view_projection{1.0f};
+  // One indexed indirect command per object and swapchain image, culling
+  // packs the visible ones at the front so the recorded draws never change
+  std::vector<jar::BufferAllocation> draw_buffers;
+  // World matrices of the visible objects in the same order, the shaders
+  // find theirs through the draw's first instance
+  std::vector<jar::BufferAllocation> object_buffers;
+  // Set while replaying a captured frame, stands in for animation and culling
+  const jar::FramePacket* replayed_frame = nullptr;
+  std::unique_ptr<jar::CommandStreamWriter> command_capture;
+  // Filled in while a frame is built, written out if capturing
+  jar::FramePacket captured_frame;
+
   std::vector<Vertex> vertices = {{
     {{-0.5f, -0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}},
     {{ 0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}},
@@ -65,24 +207,121 @@ class VulkanTestApp {
   void select_physical_device();
   void create_model_buffer();
   void create_command_buffers();
+  void rerecord_command_buffers();
   void create_semaphores();
+  void destroy_semaphores();
+  void apply_frame_pacing();
   void create_swapchain();
   void create_image_views();
-  void create_render_pass();
+  void create_render_graph();
+  void create_shader_manager();
   void create_graphics_pipeline();
-  void create_frame_buffers();
+  std::function<void()> build_graphics_pipeline();
+  void create_particles();
+  void create_lighting();
+  void create_shadows();
+  // The scene objects, after the model buffer and the scene are ready
+  void create_shadow_casters();
+  // The model's mesh in its current buffer, placed by model
+  jar::ShadowCaster make_caster(const glm::mat4& model, bool is_static) const;
+  // Sizes the per swapchain image slots of the above
+  void create_image_slots();
+  void reload_changed_shaders();
+  std::vector<std::function<void()>> build_pipelines(uint32_t groups);
+  void install_pipelines();
+  void wait_for_pipeline_build();
   void create_command_pool();
   void create_descriptor_set_layout();
   void create_uniform_buffers();
+  void create_draw_buffers();
+  void build_bvh();
   void create_descriptor_pool();
   void create_descriptor_sets();
+  void create_query_pool();
+
+  void cleanup_swapchain();
+  bool recreate_swapchain();
+  void record_viewport(vk::CommandBuffer cmd_buf);
+  void record_draw_list(vk::CommandBuffer cmd_buf, uint32_t image_index);
 
   void update_uniform_buffer(uint32_t current_image);
-  void create_buffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer& buffer, vk::DeviceMemory& buffer_memory);
+  // Moves the model and sets the camera, unless a captured frame is replayed
+  void animate_scene();
+  // model is the animated model's world matrix this frame
+  void update_draw_list(uint32_t current_image, const glm::mat4& model);
+  jar::BufferAllocation create_buffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, jar::MemoryCategory category);
   void copy_buffer(vk::Buffer src_buffer, vk::Buffer dst_buffer, vk::DeviceSize size);
+  vk::ImageView create_image_view(vk::Image image, vk::Format format, vk::ImageAspectFlags aspect_flags);
+  void read_pipeline_statistics(uint32_t image_index);
+  void read_compute_overlap(uint32_t image_index);
 
   public:
-    void draw_frame();
+    // input_time is when the input this frame reacts to was polled
+    void draw_frame(std::chrono::steady_clock::time_point input_time = std::chrono::steady_clock::now());
+    // Can be changed at runtime, takes effect at the start of the next frame
+    void set_frame_pacing(const FramePacing& pacing);
+    const FramePacing& get_frame_pacing() const;
+    const LatencyStats& get_latency_stats() const;
+    // Summed over the frames in flight, between frames only
+    jar::ArenaStats get_frame_arena_stats() const;
+    vk::PresentModeKHR get_present_mode() const;
+    // Framebuffer size as the window thread last saw it, rebuilds the swapchain if it changed
+    void set_framebuffer_size(int width, int height);
+    // Hot swaps, the old resources are destroyed once frames using them are done
+    void set_mesh(std::vector<Vertex> vertices, std::vector<uint16_t> indices);
+    void reload_pipelines();
+    // Object under a window position, tested against its bounds. The
+    // position is a fraction of the window size, 0 to 1 from the top left.
+    std::optional<uint32_t> pick(double x, double y) const;
+    // Before init_vulkan
+    void set_device_selection(const jar::device::DeviceSelection& selection);
+    // Before init_vulkan, adds smaller copies of the model in a grid
+    // around it. They hold still and cast static shadows.
+    void set_object_count(uint32_t count);
+    // Makes animation independent of frame rate, for repeatable runs
+    void set_fixed_time_step(float seconds);
+    float get_startup_ms() const;
+    uint32_t get_object_count() const;
+    // Objects that passed culling in the last frame
+    uint32_t get_visible_count() const;
+    // Indirect draws with instances in the last frame
+    uint32_t get_draw_count() const;
+    std::string get_device_name() const;
+    // Before init_vulkan, the capacity is fixed after that
+    void set_particle_settings(const jar::ParticleSettings& settings);
+    void set_particle_emit_rate(float rate);
+    const jar::ParticleSettings& get_particle_settings() const;
+    // Before init_vulkan, the capacity is fixed after that
+    void set_light_settings(const jar::LightSettings& settings);
+    // Up to the capacity, at runtime
+    void set_light_count(uint32_t count);
+    const jar::LightSettings& get_light_settings() const;
+    // Before init_vulkan
+    void set_shadow_settings(const jar::ShadowSettings& settings);
+    // Before init_vulkan, 1 for none. Lowered to what the device supports.
+    void set_msaa_samples(uint32_t samples);
+    vk::SampleCountFlagBits get_msaa_samples() const;
+    const jar::ShadowStats& get_shadow_stats() const;
     void init_vulkan(GLFWwindow* window);
     void cleanup();
+    const PipelineStatistics& get_pipeline_statistics() const;
+    // Register compute jobs here, they are submitted every frame before graphics
+    jar::AsyncCompute& get_async_compute();
+    // Warning callbacks go here, they run on the thread calling draw_frame
+    jar::MemoryBudget& get_memory_budget();
+    const jar::MemoryBudget& get_memory_budget() const;
+    // Only does anything if readback is supported
+    jar::FrameCapture& get_frame_capture();
+    bool is_readback_supported() const;
+    vk::Extent2D get_swapchain_extent() const;
+    // Writes what every frame from now on draws to a command stream, see
+    // jar::CommandStreamWriter
+    void start_command_capture(const std::string& path);
+    void stop_command_capture();
+    bool is_capturing_commands() const;
+    // Draws a captured frame, its camera and visible objects instead of
+    // animating and culling the scene. Set up the object count, particles
+    // and mesh like the stream's before.
+    void replay_frame(const jar::FramePacket& frame);
+    const jar::AsyncCompute& get_async_compute() const;
 };
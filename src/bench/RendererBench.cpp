@@ -0,0 +1,227 @@
+#include "RendererBench.hpp"
+#include "../Json.hpp"
+#include "../VulkanTestApp.hpp"
+#include "GitCommit.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+  // Nearest rank, sorted has to be sorted
+  double percentile(const std::vector<double>& sorted, double fraction) {
+    if(sorted.empty()) {
+      return 0.0;
+    }
+    size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+  }
+
+  double percent_change(double before, double after) {
+    return before > 0.0 ? (after - before) / before * 100.0 : 0.0;
+  }
+}
+
+namespace jar {
+  const std::vector<BenchScene>& get_bench_scenes() {
+    static const std::vector<BenchScene> scenes = {
+      {"single", 1, 0},
+      {"objects_1k", 1000, 0},
+      {"objects_10k", 10000, 0},
+      {"objects_100k", 100000, 0},
+      {"particles_256k", 1, 1 << 18},
+      {"mixed", 10000, 1 << 18},
+      {"lights_4k", 1000, 0, 4096},
+      {"msaa_4x", 1000, 0, LightSettings{}.count, 4},
+    };
+    return scenes;
+  }
+
+  BenchResult run_bench_scene(const BenchScene& scene, const BenchOptions& options) {
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(options.width, options.height, ("renderer_bench: " + scene.name).c_str(), nullptr, nullptr);
+    if(!window) {
+      throw std::runtime_error("failed to create benchmark window!");
+    }
+
+    BenchResult result;
+    result.scene = scene;
+    {
+      VulkanTestApp app;
+      ParticleSettings particles{};
+      particles.capacity = scene.particles;
+      particles.emit_rate = scene.particles / ParticleSettings::mean_lifetime;
+      app.set_device_selection(options.selection);
+      app.set_particle_settings(particles);
+      LightSettings lights{};
+      lights.count = scene.lights;
+      lights.capacity = std::max(lights.capacity, scene.lights);
+      app.set_light_settings(lights);
+      app.set_msaa_samples(scene.msaa);
+      app.set_object_count(scene.objects);
+      // Uncapped, and the same animation whatever the frame rate
+      app.set_frame_pacing(FramePacing::throughput());
+      app.set_fixed_time_step(1.0f / 60.0f);
+      app.init_vulkan(window);
+
+      std::vector<double> frame_ms;
+      frame_ms.reserve(options.frames);
+      double visible_sum = 0.0;
+      double draw_sum = 0.0;
+      auto last_frame = std::chrono::steady_clock::now();
+      for(uint32_t frame = 0; frame < options.warmup_frames + options.frames && !glfwWindowShouldClose(window); frame++) {
+        glfwPollEvents();
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        app.set_framebuffer_size(width, height);
+        app.draw_frame();
+        // The interval between frames, with the queue kept full that is the
+        // slower of the CPU and the GPU
+        auto now = std::chrono::steady_clock::now();
+        if(frame >= options.warmup_frames) {
+          frame_ms.push_back(std::chrono::duration<double, std::milli>(now - last_frame).count());
+          visible_sum += app.get_visible_count();
+          draw_sum += app.get_draw_count();
+        }
+        last_frame = now;
+      }
+
+      result.device = app.get_device_name();
+      result.frames = static_cast<uint32_t>(frame_ms.size());
+      result.startup_ms = app.get_startup_ms();
+
+      result.memory = app.get_memory_budget().get_report();
+      if(!frame_ms.empty()) {
+        result.visible_objects = visible_sum / frame_ms.size();
+        result.draws = draw_sum / frame_ms.size();
+        for(double ms: frame_ms) {
+          result.mean_ms += ms;
+        }
+        result.mean_ms /= frame_ms.size();
+        std::sort(frame_ms.begin(), frame_ms.end());
+        result.p50_ms = percentile(frame_ms, 0.5);
+        result.p90_ms = percentile(frame_ms, 0.9);
+        result.p99_ms = percentile(frame_ms, 0.99);
+        result.max_ms = frame_ms.back();
+      }
+      app.cleanup();
+    }
+    glfwDestroyWindow(window);
+
+    std::cout << std::fixed << std::setprecision(3) << scene.name << ": " << result.frames << " frames, "
+      << result.mean_ms << "ms mean, " << result.p50_ms << "ms p50, " << result.p99_ms << "ms p99, "
+      << std::setprecision(1) << result.visible_objects << "/" << result.scene.objects << " objects visible in "
+      << result.draws << " draws, startup "
+      << result.startup_ms << "ms\n";
+    return result;
+  }
+
+  void write_bench_json(const std::string& path, const std::vector<BenchResult>& results, const BenchOptions& options) {
+    std::ofstream out(path);
+    if(!out.is_open()) {
+      throw std::runtime_error("failed to open " + path + "!");
+    }
+    out << std::fixed << std::setprecision(4);
+    out << "{\n"
+      << "  \"commit\": " << json::quote(JAR_GIT_COMMIT) << ",\n"
+      << "  \"device\": " << json::quote(results.empty() ? "" : results[0].device) << ",\n"
+      << "  \"warmup_frames\": " << options.warmup_frames << ",\n"
+      << "  \"frames\": " << options.frames << ",\n"
+      << "  \"width\": " << options.width << ",\n"
+      << "  \"height\": " << options.height << ",\n"
+      << "  \"scenes\": [";
+    for(size_t s = 0; s < results.size(); s++) {
+      const auto& result = results[s];
+      vk::DeviceSize device_local_usage = 0;
+      vk::DeviceSize tracked = 0;
+      for(const auto& heap: result.memory.heaps) {
+        tracked += heap.tracked;
+        if(heap.device_local) {
+          device_local_usage += heap.usage;
+        }
+      }
+      out << (s ? "," : "") << "\n    {\n"
+        << "      \"name\": " << json::quote(result.scene.name) << ",\n"
+        << "      \"objects\": " << result.scene.objects << ",\n"
+        << "      \"particles\": " << result.scene.particles << ",\n"
+        << "      \"lights\": " << result.scene.lights << ",\n"
+        << "      \"msaa\": " << result.scene.msaa << ",\n"
+        << "      \"frames\": " << result.frames << ",\n"
+        << "      \"startup_ms\": " << result.startup_ms << ",\n"
+        << "      \"frame_ms\": {\"mean\": " << result.mean_ms << ", \"p50\": " << result.p50_ms
+          << ", \"p90\": " << result.p90_ms << ", \"p99\": " << result.p99_ms << ", \"max\": " << result.max_ms << "},\n"
+        << "      \"draws\": " << result.draws << ",\n"
+        << "      \"visible_objects\": " << result.visible_objects << ",\n"
+        << "      \"memory\": {\"device_local_usage\": " << device_local_usage << ", \"tracked\": " << tracked
+          << ", \"allocations\": " << result.memory.allocation_count << ", \"categories\": {";
+      bool first = true;
+      for(size_t i = 0; i < memory_category_count; i++) {
+        if(result.memory.categories[i] == 0) {
+          continue;
+        }
+        out << (first ? "" : ", ") << json::quote(to_string(static_cast<MemoryCategory>(i))) << ": " << result.memory.categories[i];
+        first = false;
+      }
+      out << "}}\n    }";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+  std::map<std::string, BaselineTimes> read_bench_baseline(const std::string& path) {
+    std::ifstream in(path);
+    if(!in.is_open()) {
+      throw std::runtime_error("failed to open " + path + "!");
+    }
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    std::map<std::string, BaselineTimes> baseline;
+    json::Value root = json::parse(text);
+    const json::Value* scenes = root.find("scenes");
+    if(!scenes || scenes->type != json::Value::Type::array) {
+      throw std::runtime_error(path + " has no scenes!");
+    }
+    auto number = [&](const json::Value* times, const char* key) {
+      const json::Value* value = times ? times->find(key) : nullptr;
+      if(!value || value->type != json::Value::Type::number) {
+        throw std::runtime_error(path + " is missing a " + key + " frame time!");
+      }
+      return value->number;
+    };
+    for(const auto& scene: scenes->items) {
+      const json::Value* name = scene.find("name");
+      if(!name || name->type != json::Value::Type::string) {
+        throw std::runtime_error(path + " has a scene without a name!");
+      }
+      const json::Value* times = scene.find("frame_ms");
+      BaselineTimes& entry = baseline[name->string];
+      entry.mean_ms = number(times, "mean");
+      entry.p50_ms = number(times, "p50");
+      entry.p99_ms = number(times, "p99");
+    }
+    return baseline;
+  }
+
+  uint32_t compare_to_baseline(const std::vector<BenchResult>& results, const std::map<std::string, BaselineTimes>& baseline, double threshold_percent) {
+    uint32_t regressions = 0;
+    std::cout << std::fixed << std::setprecision(1);
+    for(const auto& result: results) {
+      auto found = baseline.find(result.scene.name);
+      if(found == baseline.end()) {
+        std::cout << result.scene.name << ": not in the baseline\n";
+        continue;
+      }
+      double p50_change = percent_change(found->second.p50_ms, result.p50_ms);
+      double p99_change = percent_change(found->second.p99_ms, result.p99_ms);
+      bool regressed = p50_change > threshold_percent || p99_change > threshold_percent;
+      regressions += regressed;
+      std::cout << result.scene.name << ": p50 " << std::showpos << p50_change << "%, p99 " << p99_change
+        << "%, mean " << percent_change(found->second.mean_ms, result.mean_ms) << std::noshowpos << "%"
+        << (regressed ? " REGRESSED\n" : "\n");
+    }
+    return regressions;
+  }
+}
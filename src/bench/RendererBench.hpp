@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "../DeviceSelection.hpp"
+#include "../ClusteredLighting.hpp"
+#include "../MemoryBudget.hpp"
+
+namespace jar {
+  // What a benchmark scene puts on screen. Materials and textures aren't
+  // knobs yet, the renderer has neither.
+  struct BenchScene {
+    std::string name;
+    uint32_t objects = 1;
+    uint32_t particles = 0;
+    // Dynamic lights through the clustered pass
+    uint32_t lights = LightSettings{}.count;
+    // Samples per pixel, lowered to what the device supports
+    uint32_t msaa = 1;
+  };
+
+  // The fixed set runs compare across commits, add to the end
+  const std::vector<BenchScene>& get_bench_scenes();
+
+  struct BenchOptions {
+    // Names from get_bench_scenes, empty for all of them
+    std::vector<std::string> scenes;
+    uint32_t warmup_frames = 60;
+    uint32_t frames = 600;
+    uint32_t width = 1280;
+    uint32_t height = 720;
+    device::DeviceSelection selection;
+    std::string output = "renderer_bench.json";
+    std::string baseline;
+    // A scene whose median or 99th percentile frame time grows by more
+    // than this counts as a regression
+    double threshold_percent = 5.0;
+  };
+
+  struct BenchResult {
+    BenchScene scene;
+    std::string device;
+    uint32_t frames = 0;
+    double startup_ms = 0.0;
+    double mean_ms = 0.0;
+    double p50_ms = 0.0;
+    double p90_ms = 0.0;
+    double p99_ms = 0.0;
+    double max_ms = 0.0;
+    // Indirect draws with instances per frame, averaged
+    double draws = 0.0;
+    double visible_objects = 0.0;
+    MemoryReport memory;
+  };
+
+  // Frame times of one scene from the baseline file
+  struct BaselineTimes {
+    double mean_ms = 0.0;
+    double p50_ms = 0.0;
+    double p99_ms = 0.0;
+  };
+
+  // Opens its own window, glfwInit has to have been called
+  BenchResult run_bench_scene(const BenchScene& scene, const BenchOptions& options);
+  void write_bench_json(const std::string& path, const std::vector<BenchResult>& results, const BenchOptions& options);
+  // Reads the frame times back from what write_bench_json wrote
+  std::map<std::string, BaselineTimes> read_bench_baseline(const std::string& path);
+  // Prints the changes, returns how many scenes regressed
+  uint32_t compare_to_baseline(const std::vector<BenchResult>& results, const std::map<std::string, BaselineTimes>& baseline, double threshold_percent);
+}
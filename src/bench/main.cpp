@@ -0,0 +1,108 @@
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "RendererBench.hpp"
+#include "../Arguments.hpp"
+
+// renderer_bench [--scene name]... [--frames N] [--warmup N] [--size WxH]
+//                [--gpu index|name] [--output path] [--baseline path] [--threshold percent]
+// Exits with 1 if a scene regressed against the baseline.
+// Returns false if the tool should exit right away with exit_code, throws
+// on values that don't parse
+bool parse_arguments(int argc, char** argv, jar::BenchOptions& options, int& exit_code) {
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if(arg == "--scene" && has_value) {
+      options.scenes.push_back(argv[++i]);
+    } else if(arg == "--frames" && has_value) {
+      options.frames = jar::args::parse_uint(arg, argv[++i], 1);
+    } else if(arg == "--warmup" && has_value) {
+      options.warmup_frames = jar::args::parse_uint(arg, argv[++i]);
+    } else if(arg == "--size" && has_value) {
+      std::string size = argv[++i];
+      size_t x = size.find('x');
+      if(x == std::string::npos) {
+        throw std::runtime_error("invalid value '" + size + "' for --size, expected WxH");
+      }
+      options.width = jar::args::parse_uint(arg, size.substr(0, x), 1, 16384);
+      options.height = jar::args::parse_uint(arg, size.substr(x + 1), 1, 16384);
+    } else if(arg == "--gpu" && has_value) {
+      options.selection.parse(arg, argv[++i]);
+    } else if(arg == "--output" && has_value) {
+      options.output = argv[++i];
+    } else if(arg == "--baseline" && has_value) {
+      options.baseline = argv[++i];
+    } else if(arg == "--threshold" && has_value) {
+      options.threshold_percent = jar::args::parse_double(arg, argv[++i], 0.0, 1000.0);
+    } else if(arg == "--list") {
+      for(const auto& scene: jar::get_bench_scenes()) {
+        std::cout << scene.name << ": " << scene.objects << " objects, " << scene.particles << " particles, " << scene.lights << " lights, "
+          << scene.msaa << "x MSAA\n";
+      }
+      exit_code = 0;
+      return false;
+    } else {
+      std::cout << "Unknown argument " << arg << '\n';
+      exit_code = 2;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  jar::BenchOptions options;
+  int exit_code = 0;
+  try {
+    if(!parse_arguments(argc, argv, options, exit_code)) {
+      return exit_code;
+    }
+  } catch(const std::exception& e) {
+    std::cout << e.what() << '\n';
+    return 2;
+  }
+
+  std::vector<jar::BenchScene> scenes;
+  for(const auto& scene: jar::get_bench_scenes()) {
+    if(options.scenes.empty() || std::find(options.scenes.begin(), options.scenes.end(), scene.name) != options.scenes.end()) {
+      scenes.push_back(scene);
+    }
+  }
+  if(scenes.size() < std::max<size_t>(options.scenes.size(), 1)) {
+    std::cout << "Unknown scene, --list shows them\n";
+    return 2;
+  }
+
+  glfwInit();
+  if(!glfwVulkanSupported()) {
+    std::cout << "This machine does not support vulkan\n";
+    return 2;
+  }
+  std::vector<jar::BenchResult> results;
+  try {
+    for(const auto& scene: scenes) {
+      results.push_back(jar::run_bench_scene(scene, options));
+    }
+  } catch(const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    glfwTerminate();
+    return 2;
+  }
+  glfwTerminate();
+
+  jar::write_bench_json(options.output, results, options);
+  std::cout << "Results written to " << options.output << '\n';
+  if(!options.baseline.empty()) {
+    uint32_t regressions = jar::compare_to_baseline(results, jar::read_bench_baseline(options.baseline), options.threshold_percent);
+    if(regressions > 0) {
+      std::cout << regressions << " scene(s) regressed by more than " << options.threshold_percent << "%\n";
+      return 1;
+    }
+  }
+  return 0;
+}
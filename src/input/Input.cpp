@@ -1,12 +1,27 @@
 #include "Input.hpp"
+#include "../SpscRing.hpp"
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <vector>
 
 namespace Input {
   namespace {
+    // Key state bits
+    constexpr uint8_t downBit = 1;
+    // Held and handled every handle_input
+    constexpr uint8_t repeatingBit = 2;
+
     std::vector<std::function<void(double, double)>> scroll_handlers;
 
-    std::map<int, ActionHandler> handlers;
-    std::set<int> currentKeys;
+    // Indexed by key code, no lookups or allocations per event
+    std::array<ActionHandler, GLFW_KEY_LAST + 1> handlers;
+    std::array<uint8_t, GLFW_KEY_LAST + 1> keyStates{};
+    // GLFW callbacks push, process_events pops. Enough for a few seconds
+    // of a high rate mouse between two frames, and a dropped cursor event
+    // loses no motion since the deltas come from positions.
+    jar::SpscRing<Event, 4096> events;
+    uint64_t droppedEvents;
     double mouseX;
     double mouseY;
     double deltaX;
@@ -14,31 +29,95 @@ namespace Input {
     int mods;
     bool mouseLocked;
     GLFWwindow* window;
+
+    bool is_valid_key(int key) {
+      return key >= 0 && key <= GLFW_KEY_LAST;
+    }
+
     void handle_key(int key) {
-      if(handlers.count(key) > 0) {
+      if(handlers[key]) {
 	handlers[key]();
       }
     }
+
+    void push(const Event& event) {
+      if(!events.push(event)) {
+	droppedEvents++;
+      }
+    }
+
+    void process_key(const Event& event) {
+      Input::mods = event.mods;
+      if(!is_valid_key(event.key)) {
+	return;
+      }
+      if(event.action == GLFW_PRESS) {
+	if (event.key == GLFW_KEY_ESCAPE) {
+	  glfwSetWindowShouldClose(Input::window, GL_TRUE);
+	}
+	keyStates[event.key] = downBit;
+	handle_key(event.key);
+	if(handlers[event.key] && Actions::is_repeatable(event.key)) {
+	  keyStates[event.key] |= repeatingBit;
+	}
+      } else if(event.action == GLFW_RELEASE) {
+	keyStates[event.key] = 0;
+      }
+    }
   }
 
   void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
-    Input::mods = mods;
-    if(action == GLFW_PRESS) {
-      if (key == GLFW_KEY_ESCAPE) {
-	glfwSetWindowShouldClose(window, GL_TRUE);
-      }
-      handle_key(key);
-      if(handlers.count(key) > 0 && Actions::is_repeatable(key)) {
-	currentKeys.insert(key);
+    push({Event::Type::key, key, action, mods, 0.0, 0.0, std::chrono::steady_clock::now()});
+  }
+
+  void cursor_pos_callback(GLFWwindow* window, double x, double y) {
+    push({Event::Type::cursor, 0, 0, 0, x, y, std::chrono::steady_clock::now()});
+  }
+
+  void scroll_callback(GLFWwindow* window, double x_offset, double y_offset) {
+    push({Event::Type::scroll, 0, 0, 0, x_offset, y_offset, std::chrono::steady_clock::now()});
+  }
+
+  std::optional<std::chrono::steady_clock::time_point> process_events() {
+    Input::deltaX = 0;
+    Input::deltaY = 0;
+    auto oldest = std::chrono::steady_clock::time_point::max();
+    Event event;
+    while(events.pop(event)) {
+      oldest = std::min(oldest, event.time);
+      switch(event.type) {
+	case Event::Type::key:
+	  process_key(event);
+	  break;
+	case Event::Type::cursor:
+	  // Summed, a frame can see many cursor events
+	  Input::deltaX += mouseX - event.x;
+	  Input::deltaY += mouseY - event.y;
+	  Input::mouseX = event.x;
+	  Input::mouseY = event.y;
+	  break;
+	case Event::Type::scroll:
+	  for(const auto& handler: scroll_handlers) {
+	    handler(event.x, event.y);
+	  }
+	  break;
       }
-    } else if(action == GLFW_RELEASE) {
-      currentKeys.erase(key);
     }
+    if(oldest == std::chrono::steady_clock::time_point::max()) {
+      return std::nullopt;
+    }
+    return oldest;
+  }
+
+  uint64_t get_dropped_events() {
+    return droppedEvents;
   }
 
   void handle_input() {
-    for(int key: currentKeys) {
-      handle_key(key);
+    for(int key = 0; key <= GLFW_KEY_LAST; key++) {
+      if(keyStates[key] & repeatingBit) {
+	handle_key(key);
+      }
     }
   }
 
@@ -47,29 +126,20 @@ namespace Input {
   }
 
   void on(int key, const std::function<void()>& handler, bool repeat) {
-    handlers[key] = handler; 
+    if(!is_valid_key(key)) {
+      std::cout << "Can't bind unknown key " << key << '\n';
+      return;
+    }
+    handlers[key] = handler;
     if(repeat) {
       Actions::set_repeatable(key);
     }
   }
-  
+
   void on_scroll(std::function<void(double, double)> handler) {
     scroll_handlers.push_back(handler);
   }
 
-  void scroll_callback(GLFWwindow* window, double x_offset, double y_offset) {
-    for(const auto& handler: scroll_handlers) {
-      handler(x_offset, y_offset);
-    }
-  }
-
-  void cursor_pos_callback(GLFWwindow* window, double x, double y) {
-    Input::deltaX = mouseX - x;
-    Input::deltaY = mouseY - y;
-    Input::mouseX = x;
-    Input::mouseY = y;
-  }
-
   double get_mouse_x() {
     return Input::mouseX;
   }
@@ -89,7 +159,7 @@ namespace Input {
   }
 
   bool is_key_down(int key) {
-      return currentKeys.count(key) != 0;
+      return is_valid_key(key) && (keyStates[key] & downBit) != 0;
   }
 
   bool is_mouse_locked() {
@@ -1,16 +1,37 @@
 #ifndef HONDO_INPUT_HPP
 #define HONDO_INPUT_HPP
 #include <GLFW/glfw3.h>
+#include <chrono>
+#include <cstdint>
 #include <functional>
-#include <map>
-#include <set>
-#include <vector>
+#include <optional>
 #include "Actions.hpp"
 namespace Input {
   typedef std::function<void()> ActionHandler;
+
+  // What the GLFW callbacks queue, stamped when the callback ran
+  struct Event {
+    enum class Type : uint8_t { key, cursor, scroll };
+    Type type;
+    int key;
+    int action;
+    int mods;
+    double x;
+    double y;
+    std::chrono::steady_clock::time_point time;
+  };
+
+  // The callbacks only queue events, nothing is handled until process_events
   void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
   void cursor_pos_callback(GLFWwindow* window, double x, double y);
   void scroll_callback(GLFWwindow* window, double x_offset, double y_offset);
+  // After each glfwPollEvents/glfwWaitEvents, on the window's thread. Updates
+  // the key states, runs the handlers and sums the mouse motion into the
+  // deltas, all in event order.
+  // Returns when the oldest event happened, nothing if there were none.
+  std::optional<std::chrono::steady_clock::time_point> process_events();
+  // Events lost because the queue was full
+  uint64_t get_dropped_events();
   void reset_delta();
   void handle_input();
   void on(int key, const std::function<void()>& handler);
@@ -18,6 +39,7 @@ namespace Input {
   void on_scroll(std::function<void(double, double)> handler);
   double get_mouse_x();
   double get_mouse_y();
+  // Summed over every cursor event of the last process_events
   double get_mouse_dx();
   double get_mouse_dy();
   bool is_key_down(int key);
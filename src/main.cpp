@@ -6,10 +6,39 @@
 
 #include <iostream>
 #include "VulkanTestApp.hpp"
+#include "SteppedBenchmark.hpp"
+#include "BvhBenchmark.hpp"
+#include "SceneBenchmark.hpp"
+#include "RenderThread.hpp"
+#include "ImageIO.hpp"
+#include "Arguments.hpp"
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <iomanip>
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <string>
 
-inline double calcFPS(double theTimeInterval = 1.0) {
+void print_memory_report(const jar::MemoryReport& report) {
+  std::cout << "Device memory (" << (report.driver_budget ? "VK_EXT_memory_budget" : "estimated budget")
+    << ", " << report.allocation_count << " allocations):\n";
+  for(size_t i = 0; i < report.heaps.size(); i++) {
+    const auto& heap = report.heaps[i];
+    std::cout << "  heap " << i << (heap.device_local ? " (device local): " : ": ")
+      << heap.usage / (1024 * 1024) << " / " << heap.budget / (1024 * 1024) << " MiB used, "
+      << heap.tracked / (1024 * 1024) << " MiB ours, " << heap.size / (1024 * 1024) << " MiB total\n";
+  }
+  for(size_t i = 0; i < jar::memory_category_count; i++) {
+    if(report.categories[i] > 0) {
+      std::cout << "  " << jar::to_string(static_cast<jar::MemoryCategory>(i)) << ": "
+        << report.categories[i] / 1024 << " KiB\n";
+    }
+  }
+}
+
+inline double calcFPS(const VulkanTestApp& app, double theTimeInterval = 1.0) {
   static double t0Value       = glfwGetTime(); // Set the initial time to now
   static int    fpsFrameCount = 0;             // Set the initial FPS frame count to 0
   static double fps           = 0.0;           // Set the initial FPS value to 0.0
@@ -34,6 +63,46 @@ inline double calcFPS(double theTimeInterval = 1.0) {
     std::stringstream str;
     str << std::fixed << std::setprecision(1) << fps;
     std::cout << "FPS: " << str.str() << '\n';
+
+    const auto& stats = app.get_pipeline_statistics();
+    std::cout << "Fragments shaded: " << stats.fragment_invocations
+      << ", overdraw: " << std::fixed << std::setprecision(2) << stats.overdraw()
+      << ", primitives: " << stats.input_primitives << " in, " << stats.clipped_primitives << " after clipping\n";
+
+    const auto& latency = app.get_latency_stats();
+    std::cout << "Latency: " << std::setprecision(1) << latency.input_to_present_ms << "ms input to present, "
+      << latency.input_to_gpu_done_ms << "ms input to GPU done ("
+      << app.get_frame_pacing().frames_in_flight << " in flight, " << vk::to_string(app.get_present_mode()) << ")\n";
+
+    auto memory = app.get_memory_budget().get_report();
+    for(size_t i = 0; i < memory.heaps.size(); i++) {
+      if(memory.heaps[i].device_local) {
+        std::cout << "VRAM heap " << i << ": " << memory.heaps[i].usage / (1024 * 1024) << " / "
+          << memory.heaps[i].budget / (1024 * 1024) << " MiB\n";
+      }
+    }
+
+    auto arena = app.get_frame_arena_stats();
+    std::cout << "Frame arenas: " << arena.high_water_mark / 1024 << " KiB high water, "
+      << arena.capacity / 1024 << " KiB in " << arena.block_count << " block(s)\n";
+
+    const auto& compute = app.get_async_compute();
+    if(compute.has_jobs()) {
+      const auto& overlap = compute.get_overlap_stats();
+      std::cout << "Async compute: " << std::setprecision(2) << overlap.compute_ms << "ms compute, "
+        << overlap.graphics_ms << "ms graphics";
+      if(overlap.has_overlap) {
+        std::cout << ", " << overlap.overlap_ms << "ms overlapped ("
+          << std::setprecision(0) << overlap.overlap_ratio() * 100.0 << "%"
+          << (compute.is_async() ? ")\n" : ", same queue)\n");
+      } else {
+        std::cout << " (no calibrated timestamps for the overlap)\n";
+      }
+    }
+
+    const auto& shadows = app.get_shadow_stats();
+    std::cout << "Shadows: " << shadows.static_views << " cached, " << shadows.dynamic_views << " dynamic, "
+      << shadows.copied_views << " copied view(s), " << shadows.draws << " draw(s) last frame\n";
     // Reset the FPS frame counter and set the initial time to be now
     fpsFrameCount = 0;
     t0Value = glfwGetTime();
@@ -47,7 +116,189 @@ inline double calcFPS(double theTimeInterval = 1.0) {
   return fps;
 }
 
-int main() {
+// --latency, --throughput and --vsync pick a preset, --frames-in-flight N,
+// --present-mode immediate|mailbox|fifo|fifo-relaxed and --max-fps N tweak it.
+// --gpu picks a device by index or name, --gpu-report FILE dumps all of them.
+// --particles N sets the particle capacity (0 for none), --particle-rate N the
+// particles spawned per second, --particle-benchmark [--benchmark-csv FILE]
+// measures frame time against particle count and exits. --lights N sets how
+// many lights are lit, --light-benchmark does the same for light count
+// (one benchmark per run, they'd skew each other). --shadow-lights N sets how many of the lights
+// cast shadows (0 for only the sun). --msaa N sets the samples per pixel, as
+// many as the device has up to N. --bvh-benchmark [N]
+// times the scene BVH on N random objects (a million by default) and exits
+// without opening a window, --scene-benchmark [N] does the same for the
+// transform update on N nodes (100k by default) and checks it, exiting with
+// 1 on a mismatch. --capture-commands FILE writes what every frame
+// draws to a command stream for renderer_replay, C toggles that at runtime.
+// --capture-frame N FILE saves frame N as a PNG, --record FILE writes a Y4M
+// video. --compare FILE [TOLERANCE] checks a frame (the 60th unless
+// --capture-frame says otherwise) against a reference PNG and exits with 1
+// if they differ. The frames are read back from the swapchain, so comparing
+// isn't headless: the window is hidden, but a display is still needed, run
+// it under a virtual X server such as Xvfb on CI machines.
+struct BenchmarkOptions {
+  bool particles = false;
+  bool lights = false;
+  std::string csv_path;
+  uint32_t bvh_objects = 0;
+  uint32_t scene_nodes = 0;
+};
+
+struct CaptureOptions {
+  // Frame to grab, counted from the first one drawn, 0 for none
+  uint64_t frame = 0;
+  std::string path;
+  // Reference image to compare the grabbed frame against, exits with 1 if they differ
+  std::string baseline;
+  uint32_t tolerance = 0;
+  std::string video_path;
+  std::string command_path;
+};
+
+// Saves and/or compares a grabbed frame, then closes the window. Runs on
+// the capture worker.
+void check_capture(const jar::RgbImage& image, const CaptureOptions& options, std::atomic<int>& exit_code, GLFWwindow* window) {
+  try {
+    if(!options.path.empty()) {
+      jar::write_png(options.path, image);
+      std::cout << "Frame " << options.frame << " saved to " << options.path << '\n';
+    }
+    if(!options.baseline.empty()) {
+      auto difference = jar::compare_images(image, jar::read_png(options.baseline), options.tolerance);
+      if(!difference.same_size) {
+        std::cout << "Frame " << options.frame << " isn't the size of " << options.baseline << '\n';
+      } else {
+        std::cout << "Frame " << options.frame << " against " << options.baseline << ": "
+          << difference.differing_pixels << " pixel(s) off by more than " << options.tolerance
+          << ", max difference " << difference.max_difference << ", rmse " << difference.rmse << '\n';
+      }
+      exit_code = difference.matches() ? 0 : 1;
+    }
+  } catch(const std::exception& e) {
+    std::cout << "Capture check failed: " << e.what() << '\n';
+    exit_code = 2;
+  }
+  glfwSetWindowShouldClose(window, GLFW_TRUE);
+  glfwPostEmptyEvent();
+}
+
+// Throws on values that don't parse or are out of range
+void parse_arguments(int argc, char** argv,
+    FramePacing& pacing,
+    jar::device::DeviceSelection& selection,
+    jar::ParticleSettings& particles,
+    jar::LightSettings& lights,
+    jar::ShadowSettings& shadows,
+    uint32_t& msaa_samples,
+    BenchmarkOptions& benchmark,
+    CaptureOptions& capture) {
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if(arg == "--latency") {
+      pacing = FramePacing::low_latency();
+    } else if(arg == "--throughput") {
+      pacing = FramePacing::throughput();
+    } else if(arg == "--vsync") {
+      pacing = FramePacing::vsync();
+    } else if(arg == "--frames-in-flight" && has_value) {
+      pacing.frames_in_flight = jar::args::parse_uint(arg, argv[++i], 1, FramePacing::max_frames_in_flight);
+    } else if(arg == "--max-fps" && has_value) {
+      pacing.max_fps = jar::args::parse_double(arg, argv[++i], 0.0, 10000.0);
+    } else if(arg == "--present-mode" && has_value) {
+      std::string mode = argv[++i];
+      if(mode == "immediate") {
+        pacing.present_mode = vk::PresentModeKHR::eImmediate;
+      } else if(mode == "mailbox") {
+        pacing.present_mode = vk::PresentModeKHR::eMailbox;
+      } else if(mode == "fifo") {
+        pacing.present_mode = vk::PresentModeKHR::eFifo;
+      } else if(mode == "fifo-relaxed") {
+        pacing.present_mode = vk::PresentModeKHR::eFifoRelaxed;
+      } else {
+        std::cout << "Unknown present mode " << mode << '\n';
+      }
+    } else if(arg == "--gpu" && has_value) {
+      selection.parse(arg, argv[++i]);
+    } else if(arg == "--gpu-report" && has_value) {
+      selection.report_path = argv[++i];
+    } else if(arg == "--particles" && has_value) {
+      particles.capacity = jar::args::parse_uint(arg, argv[++i]);
+    } else if(arg == "--particle-rate" && has_value) {
+      particles.emit_rate = jar::args::parse_double(arg, argv[++i], 0.0, 1e9);
+    } else if(arg == "--particle-benchmark") {
+      benchmark.particles = true;
+    } else if(arg == "--lights" && has_value) {
+      lights.count = jar::args::parse_uint(arg, argv[++i]);
+      lights.capacity = std::max(lights.capacity, lights.count);
+    } else if(arg == "--light-benchmark") {
+      benchmark.lights = true;
+    } else if(arg == "--shadow-lights" && has_value) {
+      shadows.local_lights = jar::args::parse_uint(arg, argv[++i], 0, jar::ShadowMaps::max_local_lights);
+    } else if(arg == "--msaa" && has_value) {
+      msaa_samples = jar::args::parse_uint(arg, argv[++i], 1, 64);
+    } else if(arg == "--bvh-benchmark") {
+      benchmark.bvh_objects = 1000000;
+      if(has_value && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+        benchmark.bvh_objects = jar::args::parse_uint(arg, argv[++i], 1);
+      }
+    } else if(arg == "--scene-benchmark") {
+      benchmark.scene_nodes = 100000;
+      if(has_value && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+        benchmark.scene_nodes = jar::args::parse_uint(arg, argv[++i], 1);
+      }
+    } else if(arg == "--benchmark-csv" && has_value) {
+      benchmark.csv_path = argv[++i];
+    } else if(arg == "--capture-frame" && i + 2 < argc) {
+      capture.frame = jar::args::parse_uint64(arg, argv[++i]);
+      capture.path = argv[++i];
+    } else if(arg == "--compare" && has_value) {
+      capture.baseline = argv[++i];
+      if(i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+        capture.tolerance = jar::args::parse_uint(arg, argv[++i], 0, 255);
+      }
+    } else if(arg == "--record" && has_value) {
+      capture.video_path = argv[++i];
+    } else if(arg == "--capture-commands" && has_value) {
+      capture.command_path = argv[++i];
+    } else {
+      std::cout << "Unknown argument " << arg << '\n';
+    }
+  }
+  if(benchmark.particles && benchmark.lights) {
+    throw std::runtime_error("--particle-benchmark and --light-benchmark step their counts at the same time and "
+      "share --benchmark-csv, run them one at a time");
+  }
+}
+
+int main(int argc, char** argv) {
+  FramePacing pacing{};
+  jar::device::DeviceSelection selection{};
+  jar::ParticleSettings particles{};
+  jar::LightSettings lights{};
+  jar::ShadowSettings shadows{};
+  uint32_t msaa_samples = 1;
+  BenchmarkOptions benchmark_options{};
+  CaptureOptions capture_options{};
+  try {
+    parse_arguments(argc, argv, pacing, selection, particles, lights, shadows, msaa_samples, benchmark_options, capture_options);
+  } catch(const std::exception& e) {
+    std::cout << e.what() << '\n';
+    return 2;
+  }
+  if(!capture_options.baseline.empty() && capture_options.frame == 0) {
+    // Comparing on its own still needs a frame to compare
+    capture_options.frame = 60;
+  }
+  if(benchmark_options.bvh_objects > 0) {
+    jar::run_bvh_benchmark(benchmark_options.bvh_objects);
+    return 0;
+  }
+  if(benchmark_options.scene_nodes > 0) {
+    return jar::run_scene_benchmark(benchmark_options.scene_nodes) ? 0 : 1;
+  }
+
   glfwInit();
 
   if (!glfwVulkanSupported()) {
@@ -56,7 +307,9 @@ int main() {
   }
 
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+  // Nobody looks at a comparison run, it only needs the swapchain
+  glfwWindowHint(GLFW_VISIBLE, capture_options.baseline.empty() ? GLFW_TRUE : GLFW_FALSE);
   GLFWwindow* window = glfwCreateWindow(800, 600, "Vulkan window", nullptr, nullptr);
 
   uint32_t extensionCount = 0;
@@ -70,19 +323,173 @@ int main() {
       });
 
   VulkanTestApp vkApp;
+  FrameLimiter limiter;
+  std::unique_ptr<jar::SteppedBenchmark> benchmark;
+  // Applies the benchmark's current value
+  std::function<void()> apply_benchmark;
+  if(benchmark_options.particles && particles.capacity > 0) {
+    // Waits out the longest lifetime so the live count has settled
+    benchmark = std::make_unique<jar::SteppedBenchmark>("particles", particles.capacity, 4.0);
+    // The live count is the expected steady state, it's never read back
+    particles.emit_rate = benchmark->get_value() / jar::ParticleSettings::mean_lifetime;
+    apply_benchmark = [&]() { vkApp.set_particle_emit_rate(benchmark->get_value() / jar::ParticleSettings::mean_lifetime); };
+  } else if(benchmark_options.lights && lights.capacity > 0) {
+    benchmark = std::make_unique<jar::SteppedBenchmark>("lights", lights.capacity, 1.0);
+    lights.count = benchmark->get_value();
+    apply_benchmark = [&]() { vkApp.set_light_count(benchmark->get_value()); };
+  }
+  vkApp.set_device_selection(selection);
+  vkApp.set_particle_settings(particles);
+  vkApp.set_light_settings(lights);
+  vkApp.set_shadow_settings(shadows);
+  vkApp.set_msaa_samples(msaa_samples);
+  vkApp.set_frame_pacing(pacing);
+  limiter.set_max_fps(pacing.max_fps);
   vkApp.init_vulkan(window);
-  while(!glfwWindowShouldClose(window)) {
-    glfwPollEvents();
+  vkApp.get_memory_budget().add_warning_callback([](uint32_t heap, const jar::HeapBudget& budget) {
+    std::cout << "Warning: memory heap " << heap << " is at " << std::fixed << std::setprecision(0)
+      << budget.fraction_used() * 100.0f << "% of its budget (" << budget.usage / (1024 * 1024) << " / "
+      << budget.budget / (1024 * 1024) << " MiB)\n";
+  });
+
+  // Only windowing and input stay on this thread, anything touching the
+  // app from a handler is posted to the render thread
+  jar::RenderThread render_thread;
+  // Switch pacing at runtime, the frame cap from the command line is kept
+  auto switch_pacing = [&render_thread](FramePacing pacing) {
+    render_thread.post([pacing](VulkanTestApp& app) mutable {
+      pacing.max_fps = app.get_frame_pacing().max_fps;
+      app.set_frame_pacing(pacing);
+    });
+  };
+  Input::on(GLFW_KEY_F1, [switch_pacing]() { switch_pacing(FramePacing::low_latency()); });
+  Input::on(GLFW_KEY_F2, [switch_pacing]() { switch_pacing(FramePacing::throughput()); });
+  Input::on(GLFW_KEY_F3, [switch_pacing]() { switch_pacing(FramePacing::vsync()); });
+  Input::on(GLFW_KEY_M, [&render_thread]() {
+    render_thread.post([](VulkanTestApp& app) {
+      print_memory_report(app.get_memory_budget().get_report());
+    });
+  });
+  Input::on(GLFW_KEY_P, [&render_thread, window]() {
+    int width, height;
+    glfwGetWindowSize(window, &width, &height);
+    if(width == 0 || height == 0) {
+      return;
+    }
+    double x = Input::get_mouse_x() / width;
+    double y = Input::get_mouse_y() / height;
+    render_thread.post([x, y](VulkanTestApp& app) {
+      auto object = app.pick(x, y);
+      if(object) {
+        std::cout << "Picked object " << *object << '\n';
+      } else {
+        std::cout << "Nothing under the cursor\n";
+      }
+    });
+  });
 
-    vkApp.draw_frame();
-    calcFPS();
+  Input::on(GLFW_KEY_F12, [&render_thread]() {
+    render_thread.post([](VulkanTestApp& app) {
+      static int screenshot_count = 0;
+      std::string path = "screenshot_" + std::to_string(screenshot_count++) + ".png";
+      app.get_frame_capture().capture_next([path](const jar::RgbImage& image) {
+        jar::write_png(path, image);
+        std::cout << "Saved " << path << '\n';
+      });
+    });
+  });
+  Input::on(GLFW_KEY_V, [&render_thread]() {
+    render_thread.post([](VulkanTestApp& app) {
+      static int recording_count = 0;
+      auto& capture = app.get_frame_capture();
+      if(capture.is_recording()) {
+        capture.stop_recording();
+      } else {
+        auto extent = app.get_swapchain_extent();
+        capture.start_recording("recording_" + std::to_string(recording_count++) + ".y4m", extent.width, extent.height);
+      }
+    });
+  });
+
+  Input::on(GLFW_KEY_C, [&render_thread]() {
+    render_thread.post([](VulkanTestApp& app) {
+      static int stream_count = 0;
+      if(app.is_capturing_commands()) {
+        app.stop_command_capture();
+      } else {
+        app.start_command_capture("commands_" + std::to_string(stream_count++) + ".jcs");
+      }
+    });
+  });
 
-    glfwSwapBuffers(window);
+  auto current_state = [window]() {
+    jar::FrameState state;
+    state.input_time = Input::process_events();
+    glfwGetFramebufferSize(window, &state.framebuffer_width, &state.framebuffer_height);
+    state.minimized = glfwGetWindowAttrib(window, GLFW_ICONIFIED);
+    return state;
+  };
+  render_thread.publish(current_state());
+  std::atomic<int> capture_exit_code{0};
+  auto request_capture = [&]() {
+    vkApp.get_frame_capture().capture_next([&](const jar::RgbImage& image) {
+      check_capture(image, capture_options, capture_exit_code, window);
+    });
+  };
+  if(!vkApp.is_readback_supported() && (capture_options.frame > 0 || !capture_options.video_path.empty())) {
+    std::cout << "The surface doesn't allow reading back swapchain images, nothing can be captured\n";
+    if(!capture_options.baseline.empty()) {
+      // Nothing to compare, no point running
+      capture_exit_code = 2;
+      glfwSetWindowShouldClose(window, GLFW_TRUE);
+    }
+    capture_options = {};
+  }
+  // The render thread isn't running yet, the rest is requested from there
+  if(capture_options.frame == 1) {
+    request_capture();
+  }
+  if(!capture_options.video_path.empty()) {
+    auto extent = vkApp.get_swapchain_extent();
+    vkApp.get_frame_capture().start_recording(capture_options.video_path, extent.width, extent.height);
+  }
+  if(!capture_options.command_path.empty()) {
+    vkApp.start_command_capture(capture_options.command_path);
+  }
+  uint64_t frames_drawn = 0;
+  render_thread.start(vkApp, window, limiter, [&](const jar::FrameState& state) {
+    frames_drawn++;
+    // Goes into the next frame's submission
+    if(frames_drawn + 1 == capture_options.frame) {
+      request_capture();
+    }
+    calcFPS(vkApp);
+    if(benchmark && benchmark->on_frame(vkApp.get_async_compute().get_overlap_stats())) {
+      if(benchmark->is_done()) {
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+        glfwPostEmptyEvent();
+      } else {
+        apply_benchmark();
+      }
+    }
+  });
+  // Blocks until there are events, the render thread doesn't need a fresh
+  // state every frame
+  while(!glfwWindowShouldClose(window)) {
+    glfwWaitEvents();
+    render_thread.publish(current_state());
+  }
+  render_thread.stop();
+  if(benchmark) {
+    benchmark->print();
+    if(!benchmark_options.csv_path.empty()) {
+      benchmark->write_csv(benchmark_options.csv_path);
+    }
   }
   vkApp.cleanup();
   glfwDestroyWindow(window);
 
   glfwTerminate();
 
-  return 0;
+  return capture_exit_code;
 }
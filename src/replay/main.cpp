@@ -0,0 +1,194 @@
+#include "../VulkanTestApp.hpp"
+#include "../CommandStream.hpp"
+#include "../Arguments.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// renderer_replay FILE [--loops N] [--frame K [--repeat N]] [--gpu index|name] [--msaa N] [--show]
+// Redraws a stream written with --capture-commands as fast as it goes and
+// prints the frame times. --frame draws only the Kth frame, --repeat times.
+// --msaa overrides the samples per pixel the stream was drawn with.
+// The window stays hidden unless --show is given, the renderer still needs
+// one for its swapchain.
+struct ReplayOptions {
+  std::string path;
+  uint32_t loops = 1;
+  // 0 for all frames, otherwise the one to repeat
+  uint64_t frame = 0;
+  uint32_t repeat = 600;
+  jar::device::DeviceSelection selection{};
+  // 0 keeps the stream's
+  uint32_t msaa_samples = 0;
+  bool show = false;
+};
+
+// Throws on values that don't parse or are out of range
+bool parse_arguments(int argc, char** argv, ReplayOptions& options) {
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if(arg == "--loops" && has_value) {
+      options.loops = jar::args::parse_uint(arg, argv[++i], 1);
+    } else if(arg == "--frame" && has_value) {
+      options.frame = jar::args::parse_uint64(arg, argv[++i]);
+    } else if(arg == "--repeat" && has_value) {
+      options.repeat = jar::args::parse_uint(arg, argv[++i], 1);
+    } else if(arg == "--gpu" && has_value) {
+      options.selection.parse(arg, argv[++i]);
+    } else if(arg == "--msaa" && has_value) {
+      options.msaa_samples = jar::args::parse_uint(arg, argv[++i], 1, 64);
+    } else if(arg == "--show") {
+      options.show = true;
+    } else if(options.path.empty() && arg[0] != '-') {
+      options.path = arg;
+    } else {
+      std::cout << "Unknown argument " << arg << '\n';
+      return false;
+    }
+  }
+  return !options.path.empty();
+}
+
+void print_frame_times(std::vector<double> frame_ms) {
+  if(frame_ms.empty()) {
+    std::cout << "No frames drawn\n";
+    return;
+  }
+  double total = 0.0;
+  for(double ms: frame_ms) {
+    total += ms;
+  }
+  std::sort(frame_ms.begin(), frame_ms.end());
+  auto percentile = [&](double fraction) {
+    size_t rank = static_cast<size_t>(fraction * (frame_ms.size() - 1) + 0.5);
+    return frame_ms[rank];
+  };
+  std::cout << std::fixed << std::setprecision(3) << frame_ms.size() << " frames in " << total / 1000.0 << "s, "
+    << total / frame_ms.size() << "ms mean, " << percentile(0.5) << "ms p50, " << percentile(0.99) << "ms p99, "
+    << frame_ms.back() << "ms max\n";
+}
+
+int main(int argc, char** argv) {
+  ReplayOptions options;
+  bool parsed = false;
+  try {
+    parsed = parse_arguments(argc, argv, options);
+  } catch(const std::exception& e) {
+    std::cout << e.what() << '\n';
+  }
+  if(!parsed) {
+    std::cout << "Usage: renderer_replay FILE [--loops N] [--frame K [--repeat N]] [--gpu index|name] [--msaa N] [--show]\n";
+    return 2;
+  }
+  jar::CommandStream stream;
+  try {
+    stream = jar::read_command_stream(options.path);
+  } catch(const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 2;
+  }
+  std::cout << options.path << ": " << stream.frame_count << " frame(s), " << stream.setup.object_count
+    << " object(s), " << stream.setup.particles.capacity << " particle(s), " << stream.setup.lights.capacity << " light(s), "
+    << stream.setup.shadows.local_lights << " shadowed light(s), " << stream.setup.msaa_samples << "x MSAA\n";
+
+  // The frames to draw, meshes uploaded in between come along
+  std::vector<const jar::StreamPacket*> packets;
+  std::vector<const jar::MeshPacket*> setup_meshes;
+  const jar::MeshPacket* current_mesh = nullptr;
+  for(const auto& packet: stream.packets) {
+    if(const auto* mesh = std::get_if<jar::MeshPacket>(&packet)) {
+      current_mesh = mesh;
+      // Meshes before the first frame are set up front, later ones are replayed
+      if(options.frame == 0 && packets.empty()) {
+        setup_meshes.push_back(mesh);
+      } else if(options.frame == 0) {
+        packets.push_back(&packet);
+      }
+    } else if(options.frame == 0) {
+      packets.push_back(&packet);
+    } else if(std::get<jar::FramePacket>(packet).index + 1 == options.frame) {
+      // Drawn with whatever mesh was current at the time
+      if(current_mesh) {
+        setup_meshes.push_back(current_mesh);
+      }
+      packets.assign(options.repeat, &packet);
+      break;
+    }
+  }
+  if(packets.empty()) {
+    std::cout << "Nothing to replay\n";
+    return 2;
+  }
+
+  glfwInit();
+  if(!glfwVulkanSupported()) {
+    std::cout << "This machine does not support vulkan\n";
+    return 2;
+  }
+  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_VISIBLE, options.show ? GLFW_TRUE : GLFW_FALSE);
+  int width = stream.setup.width > 0 ? stream.setup.width : 1280;
+  int height = stream.setup.height > 0 ? stream.setup.height : 720;
+  GLFWwindow* window = glfwCreateWindow(width, height, "renderer_replay", nullptr, nullptr);
+  // The framebuffer can be bigger than the window on high DPI screens
+  uint32_t window_width = width, window_height = height;
+
+  int exit_code = 0;
+  try {
+    VulkanTestApp app;
+    app.set_device_selection(options.selection);
+    app.set_object_count(stream.setup.object_count);
+    app.set_particle_settings(stream.setup.particles);
+    app.set_light_settings(stream.setup.lights);
+    app.set_shadow_settings(stream.setup.shadows);
+    app.set_msaa_samples(options.msaa_samples > 0 ? options.msaa_samples : stream.setup.msaa_samples);
+    app.set_frame_pacing(FramePacing::throughput());
+    app.init_vulkan(window);
+    for(const auto* mesh: setup_meshes) {
+      app.set_mesh(mesh->vertices, mesh->indices);
+    }
+
+    std::vector<double> frame_ms;
+    frame_ms.reserve(packets.size() * options.loops);
+    auto last_frame = std::chrono::steady_clock::now();
+    for(uint32_t loop = 0; loop < options.loops && !glfwWindowShouldClose(window); loop++) {
+      for(const auto* packet: packets) {
+        if(const auto* mesh = std::get_if<jar::MeshPacket>(packet)) {
+          app.set_mesh(mesh->vertices, mesh->indices);
+          continue;
+        }
+        const auto& frame = std::get<jar::FramePacket>(*packet);
+        glfwPollEvents();
+        if(frame.width > 0 && frame.height > 0 && (frame.width != window_width || frame.height != window_height)) {
+          window_width = frame.width;
+          window_height = frame.height;
+          glfwSetWindowSize(window, window_width, window_height);
+          glfwGetFramebufferSize(window, &width, &height);
+          app.set_framebuffer_size(width, height);
+        }
+        app.replay_frame(frame);
+        auto now = std::chrono::steady_clock::now();
+        frame_ms.push_back(std::chrono::duration<double, std::milli>(now - last_frame).count());
+        last_frame = now;
+      }
+    }
+    // The first interval includes getting the pipeline going
+    if(frame_ms.size() > 1) {
+      frame_ms.erase(frame_ms.begin());
+    }
+    print_frame_times(std::move(frame_ms));
+    app.cleanup();
+  } catch(const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    exit_code = 2;
+  }
+  glfwDestroyWindow(window);
+  glfwTerminate();
+  return exit_code;
+}